@@ -5,6 +5,14 @@
 #include <dxgi1_4.h>
 #include <d3d12.h>
 #include "d3dx12.h"
+#include "ProceduralMesh.h"
+#include "MeshOptimizer.h"
+#include "PackedVertex.h"
+#include "Meshlet.h"
+#include "MeshSimplifier.h"
+#include "HeapAllocator.h"
+#include "BindlessDescriptors.h"
+#include "StagingUploader.h"
 #include <DirectXMath.h>
 #include <vector>
 #include <iterator>
@@ -23,7 +31,7 @@ namespace
 	const int WINDOW_WIDTH = 640;
 	const int WINDOW_HEIGHT = 360;
 	const int BUFFER_COUNT = 3;
-	const int MAX_BINDLESS_RESOURCE = 100;
+	const uint32_t BINDLESS_CAPACITY = 1000000; // Largest shader-visible heap of any resource binding tier
 	const int MAX_DEFINED_RESOURCE = 8;
 	HWND g_mainWindowHandle = 0;
 };
@@ -39,6 +47,11 @@ class D3D
 {
 	ComPtr<IDXGIFactory2> mDxgiFactory;
 	ComPtr<ID3D12Device> mDevice;
+	// Textures and buffers placed in shared heaps, declared first so they outlive the resources
+	HeapAllocator::Allocator mMemory;
+	const uint64_t kPlacedHeapSize = 4 * 1024 * 1024; // Per pool heap, a larger resource gets a dedicated heap
+	// Every placed resource and its allocation, freed together in ~D3D
+	vector<pair<ComPtr<ID3D12Resource>*, HeapAllocator::Allocation>> mPlaced;
 	uint32_t mRTVStride;
 	uint32_t mDSVStride;
 	uint32_t mResourceStride;
@@ -52,10 +65,9 @@ class D3D
 	ComPtr<ID3D12Resource> mSwapChainTex[BUFFER_COUNT];
 	ComPtr<ID3D12DescriptorHeap> mSwapChainRTVs;
 
-	ComPtr<ID3D12CommandAllocator> mCmdAllocCopy;
 	ComPtr<ID3D12CommandQueue> mCmdQueueCopy;
-	ComPtr<ID3D12GraphicsCommandList> mCmdListCopy;
-	ComPtr<ID3D12Resource> mCopyBuffer;
+	StagingUploader::Uploader mUploader;
+	const uint64_t kUploadRingSize = 64 * 1024; // The 1x1 textures take 512 bytes each
 
 	enum class Constants {
 		SceneMatrix,
@@ -75,13 +87,11 @@ class D3D
 	};
 	ComPtr<ID3D12DescriptorHeap> mDSV;
 
-	enum class ShaderViews {
-		// Base pass
-		SceneCBVMatrix,
-		SceneBindlessResource,
-		Max = SceneBindlessResource + MAX_BINDLESS_RESOURCE,
-	};
-	ComPtr<ID3D12DescriptorHeap> mShaderView[BUFFER_COUNT];
+	// Every view of the sample lives in one shader-visible heap, indexed by handle
+	BindlessDescriptors::Heap mDescriptors;
+	BindlessDescriptors::Handle mSceneCBV[BUFFER_COUNT];
+	BindlessDescriptors::Handle mBindlessSRV[MAX_DEFINED_RESOURCE];
+	uint32_t mBindlessSlots[MAX_DEFINED_RESOURCE] = {};
 
 	enum class Samplers {
 		Default,
@@ -94,7 +104,7 @@ class D3D
 	ComPtr<ID3D12Resource> mSceneTex;
 	ComPtr<ID3D12Resource> mSceneZ;
 
-	ComPtr<ID3D12Resource> mBindlessResource[MAX_BINDLESS_RESOURCE];
+	ComPtr<ID3D12Resource> mBindlessResource[MAX_DEFINED_RESOURCE];
 
 	struct VertexElement
 	{
@@ -108,6 +118,20 @@ class D3D
 	D3D12_INDEX_BUFFER_VIEW mIBView = {};
 	const int SphereSlices = 12;
 	const int SphereStacks = 12;
+	ProceduralMesh::IndexedMesh mSphereMesh;
+	MeshSimplifier::LodChain mSphereLods;
+	const bool UsePackedVertex = true; // 12-byte PackedVertex::Vertex in the vertex buffers
+
+	// Sphere meshlets drawn by amplification and mesh shaders, where the device supports them
+	const bool UseMeshShader = true;
+	bool mMeshShaderEnabled = false;
+	ComPtr<ID3D12RootSignature> mMeshletRootSig;
+	ComPtr<ID3D12PipelineState> mMeshletPSO;
+	ComPtr<ID3D12Resource> mMeshlets;
+	ComPtr<ID3D12Resource> mMeshletVertices;
+	ComPtr<ID3D12Resource> mMeshletPrimitives;
+	ComPtr<ID3D12Resource> mMeshletBounds;
+	uint32_t mMeshletCount = 0;
 
 	ComPtr<ID3D12Resource> mVBPlane;
 	ComPtr<ID3D12Resource> mIBPlane;
@@ -122,6 +146,11 @@ class D3D
 		return ((val + align - 1) & ~(align - 1));
 	}
 
+	void CreatePlaced(D3D12_HEAP_TYPE type, const D3D12_RESOURCE_DESC& desc, D3D12_RESOURCE_STATES state, ComPtr<ID3D12Resource>& resource)
+	{
+		mPlaced.push_back({ &resource, mMemory.CreateResource(type, desc, state, nullptr, &resource) });
+	}
+
 public:
 	~D3D()
 	{
@@ -133,6 +162,12 @@ public:
 		{
 			SwitchToThread();
 		}
+
+		for (auto& placed : mPlaced)
+		{
+			placed.first->Reset();
+			mMemory.Free(placed.second);
+		}
 	}
 
 	D3D(int width, int height, HWND hWnd)
@@ -157,18 +192,19 @@ public:
 		mRTVStride = mDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
 		mResourceStride = mDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 		mSamplerStride = mDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER);
+		mMemory.Create(mDevice.Get(), kPlacedHeapSize);
 
 		for (int i = 0; i < BUFFER_COUNT; i++)
 		{
 			CHK(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&mCmdAlloc[i])));
 		}
-		CHK(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&mCmdAllocCopy)));
 
 		D3D12_COMMAND_QUEUE_DESC queueDesc = {};
 		queueDesc.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
 		CHK(mDevice->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&mCmdQueue)));
 		queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
 		CHK(mDevice->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&mCmdQueueCopy)));
+		mUploader.Create(mDevice.Get(), mCmdQueueCopy.Get(), kUploadRingSize);
 
 		DXGI_SWAP_CHAIN_DESC1 sc = {};
 		sc.Width = WINDOW_WIDTH;
@@ -188,8 +224,6 @@ public:
 
 		CHK(mDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence)));
 
-		CHK(mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, mCmdAllocCopy.Get(), nullptr, IID_PPV_ARGS(&mCmdListCopy)));
-
 		D3D12_DESCRIPTOR_HEAP_DESC descHeapDesc = {};
 		descHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
 		descHeapDesc.NumDescriptors = 10;
@@ -216,11 +250,11 @@ public:
 
 		descRange[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0); // VS
 		//descRange[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0, 0); // PS
-		descRange[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, MAX_BINDLESS_RESOURCE, 0, 1); // PS
+		descRange[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, MAX_DEFINED_RESOURCE, 0, 1); // PS, within the 128 SRVs of tier 1
 		rootParam[0].InitAsDescriptorTable(1, descRange + 0, D3D12_SHADER_VISIBILITY_VERTEX); // CBV_SRV_UAV
 		//rootParam[1].InitAsDescriptorTable(1, descRange + 1, D3D12_SHADER_VISIBILITY_PIXEL); // CBV_SRV_UAV
 		rootParam[1].InitAsDescriptorTable(1, descRange + 1, D3D12_SHADER_VISIBILITY_PIXEL); // CBV_SRV_UAV
-		rootParam[2].InitAsConstants(1, 0, 0, D3D12_SHADER_VISIBILITY_PIXEL);
+		rootParam[2].InitAsConstants(MAX_DEFINED_RESOURCE + 1, 0, 0, D3D12_SHADER_VISIBILITY_PIXEL);
 		rootSigDesc.Init(3, rootParam, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
 		CHK(D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1, &rootSigBlob, &rootSigError));
@@ -239,13 +273,23 @@ Output main(float3 position : Position, float3 normal : Normal) {
 	Output output;
 	output.position = mul(float4(position, 1), ViewProj);
 	output.world = position;
+#if PACKED_VERTEX
+	// Octahedral normal in xy
+	float3 n = float3(normal.xy, 1 - abs(normal.x) - abs(normal.y));
+	float t = saturate(-n.z);
+	n.x += n.x >= 0 ? -t : t;
+	n.y += n.y >= 0 ? -t : t;
+	output.normal = normalize(n);
+#else
 	output.normal = normalize(normal);
+#endif
 	return output;
 }
 )#";
 
 		static const char shaderCodeScenePS[] = R"#(
 cbuffer CRootParam : register(b0) {
+	uint4 TextureSlots[2];
 	uint RootParamOffset;
 };
 Texture2D<float4> ColorMap[] : register(t0, space1);
@@ -257,10 +301,10 @@ struct Input {
 float4 main(Input input) : SV_Target {
 	float4 color;
 	if (RootParamOffset < 8) {
-		color = ColorMap[RootParamOffset].Load(int3(0, 0, 0));
+		color = ColorMap[TextureSlots[RootParamOffset / 4][RootParamOffset % 4]].Load(int3(0, 0, 0));
 	} else {
 		uint index = ((uint)(input.position.x) + (uint)(input.position.y)) % 8;
-		color = ColorMap[ NonUniformResourceIndex(index) ].Load(int3(0, 0, 0));
+		color = ColorMap[ NonUniformResourceIndex(TextureSlots[index / 4][index % 4]) ].Load(int3(0, 0, 0));
 	}
 	float intensity = input.normal.y * 0.5 + 0.5;
 	color.xyz *= intensity;
@@ -283,8 +327,9 @@ float4 main(Input input) : SV_Target {
 		ComPtr<IDxcBlobEncoding> dxcError;
 		ComPtr<IDxcOperationResult> dxcRes;
 		const wchar_t* shaderArgs[] = { L"-Zi", L"-all_resources_bound", L"-Qembed_debug" };
+		const DxcDefine packedVertexDefines[] = { { L"PACKED_VERTEX", L"1" } };
 
-		dxc->Compile(dxcTxtSceneVS.Get(), nullptr, L"main", L"vs_6_0", shaderArgs, _countof(shaderArgs), nullptr, 0, nullptr, &dxcRes);
+		dxc->Compile(dxcTxtSceneVS.Get(), nullptr, L"main", L"vs_6_0", shaderArgs, _countof(shaderArgs), packedVertexDefines, UsePackedVertex ? 1 : 0, nullptr, &dxcRes);
 		dxcRes->GetErrorBuffer(&dxcError);
 		if (dxcError->GetBufferSize()) {
 			OutputDebugStringA(reinterpret_cast<char*>(dxcError->GetBufferPointer()));
@@ -313,7 +358,7 @@ float4 main(Input input) : SV_Target {
 		psoDesc.pRootSignature = mSceneRootSig.Get();
 		psoDesc.VS = CD3DX12_SHADER_BYTECODE(dxcBlobSceneVS->GetBufferPointer(), dxcBlobSceneVS->GetBufferSize());
 		psoDesc.PS = CD3DX12_SHADER_BYTECODE(dxcBlobScenePS->GetBufferPointer(), dxcBlobScenePS->GetBufferSize());
-		psoDesc.InputLayout = { ieDesc, _countof(ieDesc) };
+		psoDesc.InputLayout = UsePackedVertex ? PackedVertex::InputLayout() : D3D12_INPUT_LAYOUT_DESC{ ieDesc, _countof(ieDesc) };
 		psoDesc.IBStripCutValue = D3D12_INDEX_BUFFER_STRIP_CUT_VALUE_DISABLED;
 		psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
 		psoDesc.RasterizerState = rsDesc;
@@ -326,15 +371,174 @@ float4 main(Input input) : SV_Target {
 		psoDesc.SampleDesc.Count = 1;
 		CHK(mDevice->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&mScenePSO)));
 
+		// Mesh shader path, the amplification shader culls whole meshlets by frustum and normal cone
+
+		D3D12_FEATURE_DATA_SHADER_MODEL shaderModel = { D3D_SHADER_MODEL_6_5 };
+		D3D12_FEATURE_DATA_D3D12_OPTIONS7 options7 = {};
+		mMeshShaderEnabled = UseMeshShader &&
+			SUCCEEDED(mDevice->CheckFeatureSupport(D3D12_FEATURE_SHADER_MODEL, &shaderModel, sizeof(shaderModel))) &&
+			shaderModel.HighestShaderModel >= D3D_SHADER_MODEL_6_5 &&
+			SUCCEEDED(mDevice->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS7, &options7, sizeof(options7))) &&
+			options7.MeshShaderTier != D3D12_MESH_SHADER_TIER_NOT_SUPPORTED;
+		if (mMeshShaderEnabled)
+		{
+			// Same bindings as the scene root signature, plus the scene constants for the amplification shader and the meshlet buffers
+			rootParam[0].InitAsDescriptorTable(1, descRange + 0, D3D12_SHADER_VISIBILITY_MESH); // CBV_SRV_UAV
+			rootParam[3].InitAsDescriptorTable(1, descRange + 0, D3D12_SHADER_VISIBILITY_AMPLIFICATION); // CBV_SRV_UAV
+			rootParam[4].InitAsShaderResourceView(0); // Meshlets
+			rootParam[5].InitAsShaderResourceView(1); // Meshlet vertex indices
+			rootParam[6].InitAsShaderResourceView(2); // Meshlet primitives
+			rootParam[7].InitAsShaderResourceView(3); // Meshlet bounds
+			rootParam[8].InitAsShaderResourceView(4); // Vertices
+			rootSigDesc.Init(9, rootParam, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+			CHK(D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1, &rootSigBlob, &rootSigError));
+			CHK(mDevice->CreateRootSignature(0, rootSigBlob->GetBufferPointer(), rootSigBlob->GetBufferSize(), IID_PPV_ARGS(&mMeshletRootSig)));
+
+			static const char shaderCodeMeshletAS[] = R"#(
+cbuffer CScene {
+	float4x4 ViewProj;
+	float4 CameraPosition;
+	float4 FrustumPlanes[6];
+	uint MeshletCount;
+};
+struct Bounds {
+	float3 center;
+	float radius;
+	float3 coneApex;
+	float coneCutoff;
+	float3 coneAxis;
+	float padding;
+};
+struct Payload {
+	uint meshletIndices[32];
+};
+StructuredBuffer<Bounds> MeshletBounds : register(t3);
+groupshared Payload payload;
+bool IsVisible(Bounds bounds) {
+	for (int i = 0; i < 6; ++i) {
+		if (dot(FrustumPlanes[i].xyz, bounds.center) + FrustumPlanes[i].w < -bounds.radius)
+			return false;
+	}
+	// Every triangle faces away inside the cone
+	float3 view = normalize(bounds.coneApex - CameraPosition.xyz);
+	return bounds.coneCutoff >= 1 || dot(view, bounds.coneAxis) < bounds.coneCutoff;
+}
+[numthreads(32, 1, 1)]
+void main(uint meshletIndex : SV_DispatchThreadID) {
+	bool visible = meshletIndex < MeshletCount && IsVisible(MeshletBounds[meshletIndex]);
+	if (visible)
+		payload.meshletIndices[WavePrefixCountBits(visible)] = meshletIndex;
+	DispatchMesh(WaveActiveCountBits(visible), 1, 1, payload);
+}
+)#";
+
+			static const char shaderCodeMeshletMS[] = R"#(
+cbuffer CScene {
+	float4x4 ViewProj;
+};
+struct Meshlet {
+	uint vertexOffset;
+	uint vertexCount;
+	uint primitiveOffset;
+	uint primitiveCount;
+};
+struct Payload {
+	uint meshletIndices[32];
+};
+struct Output {
+	float4 position : SV_Position;
+	float3 world : WorldPosition;
+	float3 normal : Normal;
+};
+StructuredBuffer<Meshlet> Meshlets : register(t0);
+StructuredBuffer<uint> MeshletVertices : register(t1);
+StructuredBuffer<uint> MeshletPrimitives : register(t2);
+ByteAddressBuffer Vertices : register(t4);
+Output LoadVertex(uint index) {
+#if PACKED_VERTEX
+	// Half position and octahedral snorm normal
+	uint3 raw = Vertices.Load3(index * 12);
+	float3 position = float3(f16tof32(raw.x), f16tof32(raw.x >> 16), f16tof32(raw.y));
+	int2 snorm = int2(int(raw.z << 16) >> 16, int(raw.z) >> 16);
+	float2 e = max(float2(snorm) / 32767.0, -1.0);
+	float3 n = float3(e, 1 - abs(e.x) - abs(e.y));
+	float t = saturate(-n.z);
+	n.x += n.x >= 0 ? -t : t;
+	n.y += n.y >= 0 ? -t : t;
+#else
+	float3 position = asfloat(Vertices.Load3(index * 24));
+	float3 n = asfloat(Vertices.Load3(index * 24 + 12));
+#endif
+	Output output;
+	output.position = mul(float4(position, 1), ViewProj);
+	output.world = position;
+	output.normal = normalize(n);
+	return output;
+}
+[outputtopology("triangle")]
+[numthreads(128, 1, 1)]
+void main(uint thread : SV_GroupThreadID, uint group : SV_GroupID, in payload Payload payload,
+	out vertices Output verts[64], out indices uint3 tris[124]) {
+	Meshlet meshlet = Meshlets[payload.meshletIndices[group]];
+	SetMeshOutputCounts(meshlet.vertexCount, meshlet.primitiveCount);
+	if (thread < meshlet.vertexCount)
+		verts[thread] = LoadVertex(MeshletVertices[meshlet.vertexOffset + thread]);
+	if (thread < meshlet.primitiveCount) {
+		uint packed = MeshletPrimitives[meshlet.primitiveOffset + thread];
+		tris[thread] = uint3(packed & 0x3FF, (packed >> 10) & 0x3FF, (packed >> 20) & 0x3FF);
+	}
+}
+)#";
+			static_assert(MeshletBuilder::MaxVertices == 64 && MeshletBuilder::MaxPrimitives == 124, "Mesh shader output sizes");
+
+			ComPtr<IDxcBlobEncoding> dxcTxtMeshletAS, dxcTxtMeshletMS;
+			CHK(dxcLib->CreateBlobWithEncodingFromPinned(shaderCodeMeshletAS, _countof(shaderCodeMeshletAS) - 1, CP_UTF8, &dxcTxtMeshletAS));
+			CHK(dxcLib->CreateBlobWithEncodingFromPinned(shaderCodeMeshletMS, _countof(shaderCodeMeshletMS) - 1, CP_UTF8, &dxcTxtMeshletMS));
+
+			ComPtr<IDxcBlob> dxcBlobMeshletAS, dxcBlobMeshletMS;
+			dxc->Compile(dxcTxtMeshletAS.Get(), nullptr, L"main", L"as_6_5", shaderArgs, _countof(shaderArgs), nullptr, 0, nullptr, &dxcRes);
+			dxcRes->GetErrorBuffer(&dxcError);
+			if (dxcError->GetBufferSize()) {
+				OutputDebugStringA(reinterpret_cast<char*>(dxcError->GetBufferPointer()));
+				throw runtime_error("Shader compile error.");
+			}
+			dxcRes->GetResult(&dxcBlobMeshletAS);
+			dxc->Compile(dxcTxtMeshletMS.Get(), nullptr, L"main", L"ms_6_5", shaderArgs, _countof(shaderArgs), packedVertexDefines, UsePackedVertex ? 1 : 0, nullptr, &dxcRes);
+			dxcRes->GetErrorBuffer(&dxcError);
+			if (dxcError->GetBufferSize()) {
+				OutputDebugStringA(reinterpret_cast<char*>(dxcError->GetBufferPointer()));
+				throw runtime_error("Shader compile error.");
+			}
+			dxcRes->GetResult(&dxcBlobMeshletMS);
+
+			D3DX12_MESH_SHADER_PIPELINE_STATE_DESC meshletDesc = {};
+			meshletDesc.pRootSignature = mMeshletRootSig.Get();
+			meshletDesc.AS = CD3DX12_SHADER_BYTECODE(dxcBlobMeshletAS->GetBufferPointer(), dxcBlobMeshletAS->GetBufferSize());
+			meshletDesc.MS = CD3DX12_SHADER_BYTECODE(dxcBlobMeshletMS->GetBufferPointer(), dxcBlobMeshletMS->GetBufferSize());
+			meshletDesc.PS = psoDesc.PS;
+			meshletDesc.BlendState = psoDesc.BlendState;
+			meshletDesc.SampleMask = psoDesc.SampleMask;
+			meshletDesc.RasterizerState = psoDesc.RasterizerState;
+			meshletDesc.DepthStencilState = psoDesc.DepthStencilState;
+			meshletDesc.PrimitiveTopologyType = psoDesc.PrimitiveTopologyType;
+			meshletDesc.NumRenderTargets = psoDesc.NumRenderTargets;
+			meshletDesc.RTVFormats[0] = psoDesc.RTVFormats[0];
+			meshletDesc.DSVFormat = psoDesc.DSVFormat;
+			meshletDesc.SampleDesc = psoDesc.SampleDesc;
+			auto meshletStream = CD3DX12_PIPELINE_MESH_STATE_STREAM(meshletDesc);
+			D3D12_PIPELINE_STATE_STREAM_DESC streamDesc = { sizeof(meshletStream), &meshletStream };
+			ComPtr<ID3D12Device2> device2;
+			CHK(mDevice.As(&device2));
+			CHK(device2->CreatePipelineState(&streamDesc, IID_PPV_ARGS(&mMeshletPSO)));
+		}
+
 		// Resources
 
 		for (auto& cb : mConstantBuffer)
 		{
-			auto heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
 			auto resDesc = CD3DX12_RESOURCE_DESC::Buffer(256 * (int)Constants::Max);
-			CHK(mDevice->CreateCommittedResource(
-				&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-				D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&cb)));
+			CreatePlaced(D3D12_HEAP_TYPE_UPLOAD, resDesc, D3D12_RESOURCE_STATE_GENERIC_READ, cb);
 		}
 
 		auto heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
@@ -352,22 +556,13 @@ float4 main(Input input) : SV_Target {
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_DEPTH_WRITE, &clearValue, IID_PPV_ARGS(&mSceneZ)));
 
-		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-		resDesc = CD3DX12_RESOURCE_DESC::Buffer(4 * 1024 * 1024);
-		resDesc.Flags = D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE;
-		CHK(mDevice->CreateCommittedResource(
-			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mCopyBuffer)));
-		vector<char> copyBuffer;
-		copyBuffer.reserve(resDesc.Width);
-
+		// Packed into one batch on the copy queue, which leaves the textures in COMMON
+		StagingUploader::Ticket uploaded = 0;
 		for (int i = 0; i < MAX_DEFINED_RESOURCE; ++i)
 		{
-			heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+			// 4KB each instead of the 64KB of a committed texture
 			resDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 1, 1, 1);
-			CHK(mDevice->CreateCommittedResource(
-				&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-				D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&mBindlessResource[i])));
+			CreatePlaced(D3D12_HEAP_TYPE_DEFAULT, resDesc, D3D12_RESOURCE_STATE_COMMON, mBindlessResource[i]);
 
 			static const float colors[MAX_DEFINED_RESOURCE][4] = {
 				{1.0f, 0.0f, 0.0f, 1.0f},
@@ -380,18 +575,8 @@ float4 main(Input input) : SV_Target {
 				{1.0f, 1.0f, 1.0f, 1.0f},
 			};
 			D3D12_SUBRESOURCE_DATA sub = { colors[i], sizeof(colors[0]), sizeof(colors[0]) };
-			UpdateSubresources(
-				mCmdListCopy.Get(), mBindlessResource[i].Get(), mCopyBuffer.Get(),
-				D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT * i,
-				0, 1, &sub);
-		}
-		D3D12_RESOURCE_BARRIER transitions[MAX_DEFINED_RESOURCE];
-		for (int i = 0; i < MAX_DEFINED_RESOURCE; ++i)
-		{
-			transitions[i] = CD3DX12_RESOURCE_BARRIER::Transition(
-				mBindlessResource[i].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+			uploaded = mUploader.UploadTexture(mBindlessResource[i].Get(), 0, 1, &sub);
 		}
-		mCmdListCopy->ResourceBarrier(MAX_DEFINED_RESOURCE, transitions);
 
 		descHeapDesc = {};
 		descHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
@@ -409,34 +594,26 @@ float4 main(Input input) : SV_Target {
 		CD3DX12_CPU_DESCRIPTOR_HANDLE dsvHandle(mDSV->GetCPUDescriptorHandleForHeapStart());
 		mDevice->CreateDepthStencilView(mSceneZ.Get(), nullptr, dsvHandle);
 
+		// One view per resource instead of a copy of every view per frame
+		mDescriptors.Create(mDevice.Get(), BINDLESS_CAPACITY);
+		// Scene CBVs first, so the SRV table starts past them
 		for (int i = 0; i < BUFFER_COUNT; i++)
 		{
-			descHeapDesc = {};
-			descHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-			descHeapDesc.NumDescriptors = (int)ShaderViews::Max;
-			descHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-			CHK(mDevice->CreateDescriptorHeap(&descHeapDesc, IID_PPV_ARGS(&mShaderView[i])));
-
-			CD3DX12_CPU_DESCRIPTOR_HANDLE shaderViewHandle(mShaderView[i]->GetCPUDescriptorHandleForHeapStart());
-			auto addrCB = mConstantBuffer[i]->GetGPUVirtualAddress();
-
-			for (int i = 0; i < MAX_BINDLESS_RESOURCE; ++i) {
-				D3D12_SHADER_RESOURCE_VIEW_DESC srv = {};
-				srv.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-				srv.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-				srv.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-				srv.Texture2D.MipLevels = 1;
-				srv.Texture2D.PlaneSlice = 0; // Depth
-				auto sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)ShaderViews::SceneBindlessResource + i, mResourceStride);
-				mDevice->CreateShaderResourceView(mBindlessResource[i].Get(), &srv, sv);
-			}
-
 			D3D12_CONSTANT_BUFFER_VIEW_DESC cbv = {};
-			cbv.BufferLocation = addrCB + 256 * (int)Constants::SceneMatrix;
+			cbv.BufferLocation = mConstantBuffer[i]->GetGPUVirtualAddress() + 256 * (int)Constants::SceneMatrix;
 			cbv.SizeInBytes = 256;
-			auto sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)ShaderViews::SceneCBVMatrix, mResourceStride);
-			mDevice->CreateConstantBufferView(&cbv, sv);
+			mSceneCBV[i] = mDescriptors.CreateConstantBufferView(cbv);
+		}
+		for (int i = 0; i < MAX_DEFINED_RESOURCE; ++i) {
+			D3D12_SHADER_RESOURCE_VIEW_DESC srv = {};
+			srv.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+			srv.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+			srv.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+			srv.Texture2D.MipLevels = 1;
+			mBindlessSRV[i] = mDescriptors.CreateShaderResourceView(mBindlessResource[i].Get(), &srv);
+			mBindlessSlots[i] = mBindlessSRV[i].index - mBindlessSRV[0].index;
 		}
+		mDescriptors.Flush();
 
 		descHeapDesc = {};
 		descHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER;
@@ -453,111 +630,89 @@ float4 main(Input input) : SV_Target {
 		CD3DX12_CPU_DESCRIPTOR_HANDLE samplerHandle(mSampler->GetCPUDescriptorHandleForHeapStart());
 		mDevice->CreateSampler(&samplerDesc, samplerHandle);
 
-		// Generate sphere triangles
-
-		struct IndexList
-		{
-			short a[6];
+		// Generate sphere triangles, reordered in place for the vertex cache, overdraw and vertex fetch
+		// The packed vertex buffer is encoded from these
+		mSphereMesh = ProceduralMesh::PlanSphere(SphereSlices, SphereStacks);
+		vector<VertexElement> sphereVertices(mSphereMesh.vertexCount);
+		vector<uint8_t> sphereIndices(mSphereMesh.IndexBufferSize());
+		ProceduralMesh::WriteSphereVertices(sphereVertices.data(), ProceduralMesh::LayoutOf<VertexElement>(), SphereSlices, SphereStacks);
+		ProceduralMesh::WriteSphereIndices(sphereIndices.data(), mSphereMesh);
+		MeshOptimizer::OptimizeInPlace(mSphereMesh, sphereVertices.data(), sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
+		mSphereLods = MeshSimplifier::BuildLodChain(mSphereMesh, sphereVertices.data(), sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
+
+		const UINT vertexStride = UsePackedVertex ? sizeof(PackedVertex::Vertex) : sizeof(VertexElement);
+		auto uploadVertices = [&](void* dst, const void* src, uint32_t count) {
+			if (UsePackedVertex)
+				PackedVertex::Encode(static_cast<PackedVertex::Vertex*>(dst), src, ProceduralMesh::LayoutOf<VertexElement>(), count);
+			else
+				memcpy(dst, src, sizeof(VertexElement) * count);
 		};
-		vector<VertexElement> vertices;
-		vector<IndexList> indices;
-		vertices.reserve((SphereStacks + 1) * (SphereSlices + 1));
-		for (int y = 0; y < SphereStacks + 1; ++y)
-		{
-			for (int x = 0; x < SphereSlices + 1; ++x)
-			{
-				// Generate a evenly tesselated plane
-				float v[3] = { (float)x / (float)(SphereSlices), (float)y / (float)(SphereStacks), 0.0f };
-				// Convert to spherical coordinate system
-				float theta = 2 * 3.14159265f * v[0];
-				float phi = 2 * 3.14159265f * v[1] / 2.0f;
-				VertexElement ve = { sinf(phi) * sinf(theta), cosf(phi), sinf(phi) * cosf(theta), 0, 0, 0 };
-				// Setup normal
-				float r = 1.0f;
-				ve.normal[0] = ve.position[0] / r;
-				ve.normal[1] = ve.position[1] / r;
-				ve.normal[2] = ve.position[2] / r;
-				vertices.push_back(ve);
-			}
-		}
-		indices.reserve(SphereStacks * SphereSlices);
-		for (int y = 0; y < SphereStacks; ++y)
-		{
-			for (int x = 0; x < SphereSlices; ++x)
-			{
-				short b = static_cast<short>(y * (SphereSlices + 1) + x);
-				short s = SphereSlices + 1;
-				IndexList il = { b, b + s, b + 1, b + s, b + s + 1, b + 1 };
-				indices.push_back(il);
-			}
-		}
 
-		auto sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
-		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
-		CHK(mDevice->CreateCommittedResource(
-			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVB)));
+		// The mesh shader reads the sphere vertices as a raw buffer
+		auto sizeVB = static_cast<uint32_t>(vertexStride * mSphereMesh.vertexCount);
+		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, mMeshShaderEnabled ? D3D12_RESOURCE_FLAG_NONE : D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
+		CreatePlaced(D3D12_HEAP_TYPE_UPLOAD, resDesc, D3D12_RESOURCE_STATE_GENERIC_READ, mVB);
 		void* gpuMem;
 		CHK(mVB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		uploadVertices(gpuMem, sphereVertices.data(), mSphereMesh.vertexCount);
 
-		auto sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		auto sizeIB = static_cast<uint32_t>(mSphereLods.indices.size());
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeIB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
-		CHK(mDevice->CreateCommittedResource(
-			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIB)));
+		CreatePlaced(D3D12_HEAP_TYPE_UPLOAD, resDesc, D3D12_RESOURCE_STATE_GENERIC_READ, mIB);
 		CHK(mIB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		memcpy(gpuMem, mSphereLods.indices.data(), mSphereLods.indices.size());
 
 		mVBView.BufferLocation = mVB->GetGPUVirtualAddress();
-		mVBView.StrideInBytes = sizeof(VertexElement);
+		mVBView.StrideInBytes = vertexStride;
 		mVBView.SizeInBytes = sizeVB;
 		mIBView.BufferLocation = mIB->GetGPUVirtualAddress();
-		mIBView.Format = DXGI_FORMAT_R16_UINT;
+		mIBView.Format = ProceduralMesh::IndexFormat(mSphereMesh);
 		mIBView.SizeInBytes = sizeIB;
 
+		if (mMeshShaderEnabled)
+		{
+			// Meshlets over the optimized sphere, their vertex indices address mVB directly
+			const auto meshlets = MeshletBuilder::Build(mSphereMesh, sphereVertices.data(), sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
+			mMeshletCount = static_cast<uint32_t>(meshlets.meshlets.size());
+			auto createBuffer = [&](ComPtr<ID3D12Resource>& buffer, const void* data, size_t size) {
+				resDesc = CD3DX12_RESOURCE_DESC::Buffer(size);
+				CreatePlaced(D3D12_HEAP_TYPE_UPLOAD, resDesc, D3D12_RESOURCE_STATE_GENERIC_READ, buffer);
+				CHK(buffer->Map(0, nullptr, &gpuMem));
+				memcpy(gpuMem, data, size);
+			};
+			createBuffer(mMeshlets, meshlets.meshlets.data(), sizeof(MeshletBuilder::Meshlet) * meshlets.meshlets.size());
+			createBuffer(mMeshletVertices, meshlets.vertexIndices.data(), sizeof(uint32_t) * meshlets.vertexIndices.size());
+			createBuffer(mMeshletPrimitives, meshlets.primitives.data(), sizeof(uint32_t) * meshlets.primitives.size());
+			createBuffer(mMeshletBounds, meshlets.bounds.data(), sizeof(MeshletBuilder::Bounds) * meshlets.bounds.size());
+		}
+
 		// Generate plane triangles
-		vertices.clear();
-		indices.clear();
-		vertices.push_back({ -1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ -1, -1, -1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, -1,  0, +1,  0 });
-		for (auto& v : vertices) { v.position[0] *= 3; v.position[1] *= 3; v.position[2] *= 3; }
-		indices.push_back({ 0, 1, 2, 2, 1, 3 });
-
-		sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		const auto planeSize = ProceduralMesh::PlaneSize();
+
+		sizeVB = static_cast<uint32_t>(vertexStride * planeSize.vertexCount);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
-		CHK(mDevice->CreateCommittedResource(
-			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVBPlane)));
+		CreatePlaced(D3D12_HEAP_TYPE_UPLOAD, resDesc, D3D12_RESOURCE_STATE_GENERIC_READ, mVBPlane);
 		CHK(mVBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		VertexElement planeVertices[4];
+		ProceduralMesh::WritePlaneVertices(planeVertices, ProceduralMesh::LayoutOf<VertexElement>(), 3.0f, -3.0f);
+		uploadVertices(gpuMem, planeVertices, planeSize.vertexCount);
 
-		sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		sizeIB = static_cast<uint32_t>(sizeof(uint16_t) * planeSize.indexCount);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeIB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
-		CHK(mDevice->CreateCommittedResource(
-			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIBPlane)));
+		CreatePlaced(D3D12_HEAP_TYPE_UPLOAD, resDesc, D3D12_RESOURCE_STATE_GENERIC_READ, mIBPlane);
 		CHK(mIBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		ProceduralMesh::WritePlaneIndices(static_cast<uint16_t*>(gpuMem));
 
 		mVBPlaneView.BufferLocation = mVBPlane->GetGPUVirtualAddress();
-		mVBPlaneView.StrideInBytes = sizeof(VertexElement);
+		mVBPlaneView.StrideInBytes = vertexStride;
 		mVBPlaneView.SizeInBytes = sizeVB;
 		mIBPlaneView.BufferLocation = mIBPlane->GetGPUVirtualAddress();
 		mIBPlaneView.Format = DXGI_FORMAT_R16_UINT;
 		mIBPlaneView.SizeInBytes = sizeIB;
 
-		// DMA
+		// DMA, the first frame waits for the uploads on the GPU
 
-		CHK(mCmdListCopy->Close());
-		ID3D12GraphicsCommandList* cmdLists[] = { mCmdListCopy.Get() };
-		mCmdQueueCopy->ExecuteCommandLists(1, CommandListCast(cmdLists));
-		CHK(mCmdQueueCopy->Signal(mFence.Get(), 10));
-		while (mFence->GetCompletedValue() < 10);
-		CHK(mCmdAllocCopy->Reset());
+		mUploader.QueueWait(mCmdQueue.Get(), uploaded);
 	}
 
 	void Draw()
@@ -576,10 +731,11 @@ float4 main(Input input) : SV_Target {
 		auto dsvScene = CD3DX12_CPU_DESCRIPTOR_HANDLE(mDSV->GetCPUDescriptorHandleForHeapStart());
 		auto dsvShadow = CD3DX12_CPU_DESCRIPTOR_HANDLE(dsvScene, mDSVStride);
 
-		CD3DX12_GPU_DESCRIPTOR_HANDLE svBase(mShaderView[mFrameCount % BUFFER_COUNT]->GetGPUDescriptorHandleForHeapStart());
-		auto svShadow = svBase;
-		auto svSceneVS = CD3DX12_GPU_DESCRIPTOR_HANDLE(svBase, (int)ShaderViews::SceneCBVMatrix, mResourceStride);
-		auto svScenePS = CD3DX12_GPU_DESCRIPTOR_HANDLE(svBase, (int)ShaderViews::SceneBindlessResource, mResourceStride);
+		// Slots freed by retired frames return to the heap, views written since the last frame become visible
+		mDescriptors.Retire(mFence->GetCompletedValue());
+		mDescriptors.Flush();
+		auto svSceneVS = mDescriptors.Gpu(mSceneCBV[mFrameCount % BUFFER_COUNT]);
+		auto svScenePS = mDescriptors.Gpu(mBindlessSRV[0]);
 
 		auto samplerDefault = CD3DX12_GPU_DESCRIPTOR_HANDLE(mSampler->GetGPUDescriptorHandleForHeapStart());
 
@@ -593,6 +749,7 @@ float4 main(Input input) : SV_Target {
 		auto worldMat = DirectX::XMMatrixIdentity();
 		auto viewMat = DirectX::XMMatrixLookAtLH(mCameraPos, mCameraTarget, mCameraUp);
 		auto projMat = DirectX::XMMatrixPerspectiveFovLH(fov, aspect, nearClip, farClip);
+		const auto& sphereLod = mSphereLods.Select(DirectX::XMVectorGetX(DirectX::XMVector3Length(mCameraPos)) - 1.0f, MeshSimplifier::ProjectionScale(fov, (float)WINDOW_HEIGHT));
 
 		auto shadowDir = DirectX::XMVectorSet(0.0f, -1.0f, 0.0f, 0);
 		auto shadowPos = DirectX::XMVectorSet(0.0f, 5.0f, 0.0f, 0);
@@ -603,14 +760,30 @@ float4 main(Input input) : SV_Target {
 		auto shadowViewMat = DirectX::XMMatrixLookAtLH(shadowPos, DirectX::XMVectorAdd(shadowPos, shadowDir), shadowUp);
 		auto shadowProjMat = DirectX::XMMatrixOrthographicLH(shadowRange * 2, shadowRange * 2, 0, shadowDistance);
 
-		*reinterpret_cast<DirectX::XMMATRIX*>(pCBSceneMatrix) = DirectX::XMMatrixTranspose(worldMat * viewMat * projMat);
+		auto viewProjMat = worldMat * viewMat * projMat;
+		*reinterpret_cast<DirectX::XMMATRIX*>(pCBSceneMatrix) = DirectX::XMMatrixTranspose(viewProjMat);
+
+		// Camera and frustum planes for the meshlet culling, the world matrix is identity
+		auto clipRows = DirectX::XMMatrixTranspose(viewProjMat);
+		DirectX::XMVECTOR frustumPlanes[6] = {
+			DirectX::XMVectorAdd(clipRows.r[3], clipRows.r[0]),
+			DirectX::XMVectorSubtract(clipRows.r[3], clipRows.r[0]),
+			DirectX::XMVectorAdd(clipRows.r[3], clipRows.r[1]),
+			DirectX::XMVectorSubtract(clipRows.r[3], clipRows.r[1]),
+			clipRows.r[2],
+			DirectX::XMVectorSubtract(clipRows.r[3], clipRows.r[2]),
+		};
+		DirectX::XMStoreFloat4(reinterpret_cast<DirectX::XMFLOAT4*>(pCBSceneMatrix + 16), mCameraPos);
+		for (int i = 0; i < 6; ++i)
+			DirectX::XMStoreFloat4(reinterpret_cast<DirectX::XMFLOAT4*>(pCBSceneMatrix + 20 + 4 * i), DirectX::XMPlaneNormalize(frustumPlanes[i]));
+		*reinterpret_cast<uint32_t*>(pCBSceneMatrix + 44) = mMeshletCount;
 
 		// Start recording commands
 
 		CHK(mCmdAlloc[mFrameCount % BUFFER_COUNT]->Reset());
 		CHK(mCmdList->Reset(mCmdAlloc[mFrameCount % BUFFER_COUNT].Get(), nullptr));
 
-		ID3D12DescriptorHeap* descHeap[] = { mShaderView[mFrameCount % BUFFER_COUNT].Get(), mSampler.Get() };
+		ID3D12DescriptorHeap* descHeap[] = { mDescriptors.ShaderVisible(), mSampler.Get() };
 		mCmdList->SetDescriptorHeaps(_countof(descHeap), descHeap);
 
 		// Draw scene
@@ -627,7 +800,8 @@ float4 main(Input input) : SV_Target {
 		mCmdList->SetPipelineState(mScenePSO.Get());
 		mCmdList->SetGraphicsRootDescriptorTable(0, svSceneVS); // VS, CBV_SRV_UAV
 		mCmdList->SetGraphicsRootDescriptorTable(1, svScenePS); // PS, CBV_SRV_UAV
-		mCmdList->SetGraphicsRoot32BitConstant(2, static_cast<UINT>(mBindlessTextureIndex), 0); // PS, RootConstant
+		mCmdList->SetGraphicsRoot32BitConstants(2, MAX_DEFINED_RESOURCE, mBindlessSlots, 0); // PS, RootConstant
+		mCmdList->SetGraphicsRoot32BitConstant(2, static_cast<UINT>(mBindlessTextureIndex), MAX_DEFINED_RESOURCE); // PS, RootConstant
 		//mCmdList->SetGraphicsRootDescriptorTable(2, samplerDefault); // PS, Sampler
 		mCmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 		mCmdList->IASetVertexBuffers(0, 1, &mVBView);
@@ -637,7 +811,36 @@ float4 main(Input input) : SV_Target {
 		auto scissor = CD3DX12_RECT(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 		mCmdList->RSSetScissorRects(1, &scissor);
 		mCmdList->OMSetRenderTargets(1, &rtvScene, TRUE, &dsvScene);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		if (mMeshShaderEnabled)
+		{
+			ComPtr<ID3D12GraphicsCommandList6> cmdList6;
+			CHK(mCmdList.As(&cmdList6));
+			mCmdList->SetGraphicsRootSignature(mMeshletRootSig.Get());
+			mCmdList->SetPipelineState(mMeshletPSO.Get());
+			mCmdList->SetGraphicsRootDescriptorTable(0, svSceneVS); // MS, CBV_SRV_UAV
+			mCmdList->SetGraphicsRootDescriptorTable(1, svScenePS); // PS, CBV_SRV_UAV
+			mCmdList->SetGraphicsRoot32BitConstants(2, MAX_DEFINED_RESOURCE, mBindlessSlots, 0); // PS, RootConstant
+			mCmdList->SetGraphicsRoot32BitConstant(2, static_cast<UINT>(mBindlessTextureIndex), MAX_DEFINED_RESOURCE); // PS, RootConstant
+			mCmdList->SetGraphicsRootDescriptorTable(3, svSceneVS); // AS, CBV_SRV_UAV
+			mCmdList->SetGraphicsRootShaderResourceView(4, mMeshlets->GetGPUVirtualAddress());
+			mCmdList->SetGraphicsRootShaderResourceView(5, mMeshletVertices->GetGPUVirtualAddress());
+			mCmdList->SetGraphicsRootShaderResourceView(6, mMeshletPrimitives->GetGPUVirtualAddress());
+			mCmdList->SetGraphicsRootShaderResourceView(7, mMeshletBounds->GetGPUVirtualAddress());
+			mCmdList->SetGraphicsRootShaderResourceView(8, mVB->GetGPUVirtualAddress());
+			cmdList6->DispatchMesh((mMeshletCount + 31) / 32, 1, 1);
+
+			// Back to the input assembler for the plane
+			mCmdList->SetGraphicsRootSignature(mSceneRootSig.Get());
+			mCmdList->SetPipelineState(mScenePSO.Get());
+			mCmdList->SetGraphicsRootDescriptorTable(0, svSceneVS); // VS, CBV_SRV_UAV
+			mCmdList->SetGraphicsRootDescriptorTable(1, svScenePS); // PS, CBV_SRV_UAV
+			mCmdList->SetGraphicsRoot32BitConstants(2, MAX_DEFINED_RESOURCE, mBindlessSlots, 0); // PS, RootConstant
+			mCmdList->SetGraphicsRoot32BitConstant(2, static_cast<UINT>(mBindlessTextureIndex), MAX_DEFINED_RESOURCE); // PS, RootConstant
+		}
+		else
+		{
+			ProceduralMesh::DrawIndexed(mCmdList.Get(), sphereLod);
+		}
 
 		mCmdList->IASetVertexBuffers(0, 1, &mVBPlaneView);
 		mCmdList->IASetIndexBuffer(&mIBPlaneView);
@@ -724,7 +927,7 @@ public:
 	void ChangeTexture(bool forward)
 	{
 		float newIndex = forward ? (mBindlessTextureIndex + 0.1f) : (mBindlessTextureIndex - 0.1f);
-		mBindlessTextureIndex = max(0.0f, min((float)MAX_BINDLESS_RESOURCE + 1.0f, newIndex));
+		mBindlessTextureIndex = max(0.0f, min((float)MAX_DEFINED_RESOURCE + 1.0f, newIndex));
 	}
 };
 
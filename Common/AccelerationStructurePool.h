@@ -0,0 +1,166 @@
+#pragma once
+
+// Shared memory for acceleration structures
+// Every BLAS as its own committed resource costs a 64KB-aligned allocation sized for the worst case. The pool
+// keeps one large buffer in the acceleration structure state and hands out 256-byte aligned ranges of it,
+// so compacted structures of thousands of meshes pack tightly. Ranges are first fit, freed neighbours merge.
+
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+
+namespace AccelerationStructurePool
+{
+	// D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT
+	constexpr uint64_t Alignment = 256;
+
+	inline uint64_t AlignUp(uint64_t size, uint64_t alignment = Alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	// Offsets into a range of capacity bytes, sizes rounded up to the granularity
+	class RangeAllocator
+	{
+	public:
+		static constexpr uint64_t Invalid = ~0ull;
+
+		explicit RangeAllocator(uint64_t capacity = 0, uint64_t granularity = Alignment)
+		{
+			Reset(capacity, granularity);
+		}
+
+		void Reset(uint64_t capacity, uint64_t granularity = Alignment)
+		{
+			mGranularity = granularity;
+			mCapacity = capacity / granularity * granularity;
+			mUsed = 0;
+			mFree.clear();
+			mAllocations.clear();
+			if (mCapacity)
+				mFree[0] = mCapacity;
+		}
+
+		uint64_t Allocate(uint64_t size)
+		{
+			size = RoundUp(size ? size : 1);
+			for (auto it = mFree.begin(); it != mFree.end(); ++it)
+			{
+				if (it->second < size)
+					continue;
+				const uint64_t offset = it->first;
+				const uint64_t rest = it->second - size;
+				mFree.erase(it);
+				if (rest)
+					mFree[offset + size] = rest;
+				mAllocations[offset] = size;
+				mUsed += size;
+				return offset;
+			}
+			return Invalid;
+		}
+
+		void Free(uint64_t offset)
+		{
+			auto found = mAllocations.find(offset);
+			if (found == mAllocations.end())
+				throw std::runtime_error("Freeing an unknown acceleration structure range.");
+			uint64_t size = found->second;
+			mAllocations.erase(found);
+			mUsed -= size;
+			// Merge with the free ranges on both sides
+			auto next = mFree.lower_bound(offset);
+			if (next != mFree.end() && offset + size == next->first)
+			{
+				size += next->second;
+				next = mFree.erase(next);
+			}
+			if (next != mFree.begin())
+			{
+				auto prev = std::prev(next);
+				if (prev->first + prev->second == offset)
+				{
+					prev->second += size;
+					return;
+				}
+			}
+			mFree[offset] = size;
+		}
+
+		uint64_t SizeOf(uint64_t offset) const
+		{
+			auto found = mAllocations.find(offset);
+			return found == mAllocations.end() ? 0 : found->second;
+		}
+
+		uint64_t RoundUp(uint64_t size) const { return AlignUp(size, mGranularity); }
+		uint64_t Capacity() const { return mCapacity; }
+		uint64_t Used() const { return mUsed; }
+		size_t AllocationCount() const { return mAllocations.size(); }
+		size_t FreeRangeCount() const { return mFree.size(); }
+		uint64_t LargestFree() const
+		{
+			uint64_t largest = 0;
+			for (const auto& f : mFree)
+				largest = f.second > largest ? f.second : largest;
+			return largest;
+		}
+		const std::map<uint64_t, uint64_t>& FreeRanges() const { return mFree; }
+
+	private:
+		uint64_t mGranularity = Alignment;
+		uint64_t mCapacity = 0;
+		uint64_t mUsed = 0;
+		std::map<uint64_t, uint64_t> mFree;        // Offset, size
+		std::map<uint64_t, uint64_t> mAllocations; // Offset, size
+	};
+
+#if defined(__d3d12_h__)
+	// One buffer holding many acceleration structures. Builds and copies into it need UAV barriers on Resource().
+	class Pool
+	{
+	public:
+		void Create(ID3D12Device* device, uint64_t capacity)
+		{
+			D3D12_HEAP_PROPERTIES heapProp = {};
+			heapProp.Type = D3D12_HEAP_TYPE_DEFAULT;
+			D3D12_RESOURCE_DESC resDesc = {};
+			resDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+			resDesc.Width = capacity;
+			resDesc.Height = 1;
+			resDesc.DepthOrArraySize = 1;
+			resDesc.MipLevels = 1;
+			resDesc.SampleDesc.Count = 1;
+			resDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+			resDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+			if (FAILED(device->CreateCommittedResource(&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+				D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nullptr, IID_PPV_ARGS(&mBuffer))))
+				throw std::runtime_error("Cannot create the acceleration structure pool.");
+			mRanges.Reset(capacity);
+			mBase = mBuffer->GetGPUVirtualAddress();
+		}
+
+		D3D12_GPU_VIRTUAL_ADDRESS Allocate(uint64_t size)
+		{
+			const uint64_t offset = mRanges.Allocate(size);
+			if (offset == RangeAllocator::Invalid)
+				throw std::runtime_error("Acceleration structure pool is full.");
+			return mBase + offset;
+		}
+
+		void Free(D3D12_GPU_VIRTUAL_ADDRESS address)
+		{
+			mRanges.Free(address - mBase);
+		}
+
+		ID3D12Resource* Resource() const { return mBuffer.Get(); }
+		const RangeAllocator& Ranges() const { return mRanges; }
+
+	private:
+		Microsoft::WRL::ComPtr<ID3D12Resource> mBuffer;
+		D3D12_GPU_VIRTUAL_ADDRESS mBase = 0;
+		RangeAllocator mRanges;
+	};
+#endif
+}
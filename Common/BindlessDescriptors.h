@@ -0,0 +1,210 @@
+#pragma once
+
+// Bindless descriptors in one shader-visible heap
+// Slots come from a free list and are named by generational handles: freeing a handle bumps the generation of its
+// slot, so a stale copy of the handle is caught, and the slot is only reused once the fence value passed to Free()
+// has completed. Views are written to a CPU staging heap, and Flush() copies the slots written since the previous
+// flush to the shader-visible heap in contiguous runs. A slot is written once per handle, never while the GPU may
+// read it; changing a view means a new handle and a deferred free of the old one.
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace BindlessDescriptors
+{
+	struct Handle
+	{
+		uint32_t index = ~0u; // Into the heap, what the shader indexes
+		uint32_t generation = 0;
+
+		bool Valid() const { return index != ~0u; }
+	};
+
+	// Slots of the heap
+	class Table
+	{
+	public:
+		explicit Table(uint32_t capacity = 0)
+		{
+			Reset(capacity);
+		}
+
+		void Reset(uint32_t capacity)
+		{
+			mGenerations.assign(capacity, 1);
+			// Popped from the back, so the lowest slots go first
+			mFree.resize(capacity);
+			for (uint32_t i = 0; i < capacity; i++)
+				mFree[i] = capacity - 1 - i;
+			mPending.clear();
+			mDirty.clear();
+			mLive = 0;
+		}
+
+		Handle Allocate()
+		{
+			if (mFree.empty())
+				throw std::runtime_error("Bindless descriptor heap is full.");
+			Handle handle;
+			handle.index = mFree.back();
+			handle.generation = mGenerations[handle.index];
+			mFree.pop_back();
+			mDirty.push_back(handle.index);
+			mLive++;
+			return handle;
+		}
+
+		// The slot is reused after fenceValue completes
+		void Free(Handle handle, uint64_t fenceValue)
+		{
+			if (!IsValid(handle))
+				throw std::runtime_error("Freeing a stale bindless descriptor handle.");
+			mGenerations[handle.index]++;
+			mPending.push_back({ fenceValue, handle.index });
+			mLive--;
+		}
+
+		void Retire(uint64_t completedValue)
+		{
+			while (!mPending.empty() && mPending.front().first <= completedValue)
+			{
+				mFree.push_back(mPending.front().second);
+				mPending.pop_front();
+			}
+		}
+
+		bool IsValid(Handle handle) const
+		{
+			return handle.index < mGenerations.size() && mGenerations[handle.index] == handle.generation;
+		}
+
+		// Slots allocated since the previous call, as sorted runs of first and count
+		std::vector<std::pair<uint32_t, uint32_t>> TakeDirtyRuns()
+		{
+			std::vector<std::pair<uint32_t, uint32_t>> runs;
+			std::sort(mDirty.begin(), mDirty.end());
+			for (uint32_t index : mDirty)
+			{
+				if (!runs.empty() && runs.back().first + runs.back().second == index)
+					runs.back().second++;
+				else if (runs.empty() || runs.back().first + runs.back().second < index)
+					runs.push_back({ index, 1 });
+			}
+			mDirty.clear();
+			return runs;
+		}
+
+		uint32_t Capacity() const { return static_cast<uint32_t>(mGenerations.size()); }
+		uint32_t Live() const { return mLive; }
+		uint32_t Pending() const { return static_cast<uint32_t>(mPending.size()); }
+		uint32_t Available() const { return static_cast<uint32_t>(mFree.size()); }
+
+	private:
+		std::vector<uint32_t> mGenerations;
+		std::vector<uint32_t> mFree;
+		std::deque<std::pair<uint64_t, uint32_t>> mPending; // Fence value and slot, in fence order
+		std::vector<uint32_t> mDirty;
+		uint32_t mLive = 0;
+	};
+
+#if defined(__d3d12_h__)
+	class Heap
+	{
+	public:
+		// Every slot starts as a null SRV, so a bound table never reads an uninitialized descriptor
+		void Create(ID3D12Device* device, uint32_t capacity)
+		{
+			mDevice = device;
+			mTable.Reset(capacity);
+			D3D12_DESCRIPTOR_HEAP_DESC heapDesc = {};
+			heapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+			heapDesc.NumDescriptors = capacity;
+			if (FAILED(device->CreateDescriptorHeap(&heapDesc, IID_PPV_ARGS(&mStaging))))
+				throw std::runtime_error("Cannot create the bindless staging heap.");
+			heapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+			if (FAILED(device->CreateDescriptorHeap(&heapDesc, IID_PPV_ARGS(&mShaderVisible))))
+				throw std::runtime_error("Cannot create the bindless descriptor heap.");
+			mStride = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+			mCpuStart = mStaging->GetCPUDescriptorHandleForHeapStart();
+			mVisibleStart = mShaderVisible->GetCPUDescriptorHandleForHeapStart();
+			mGpuStart = mShaderVisible->GetGPUDescriptorHandleForHeapStart();
+
+			D3D12_SHADER_RESOURCE_VIEW_DESC nullDesc = {};
+			nullDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+			nullDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+			nullDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+			nullDesc.Texture2D.MipLevels = 1;
+			device->CreateShaderResourceView(nullptr, &nullDesc, mCpuStart);
+			// Doubling copies fill the staging heap in log2(capacity) calls
+			for (uint32_t filled = 1; filled < capacity; filled *= 2)
+				device->CopyDescriptorsSimple((std::min)(filled, capacity - filled), Cpu(filled), mCpuStart, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+			device->CopyDescriptorsSimple(capacity, mVisibleStart, mCpuStart, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+			mTable.TakeDirtyRuns();
+		}
+
+		Handle CreateShaderResourceView(ID3D12Resource* resource, const D3D12_SHADER_RESOURCE_VIEW_DESC* desc)
+		{
+			const auto handle = mTable.Allocate();
+			mDevice->CreateShaderResourceView(resource, desc, Cpu(handle.index));
+			return handle;
+		}
+
+		Handle CreateUnorderedAccessView(ID3D12Resource* resource, const D3D12_UNORDERED_ACCESS_VIEW_DESC* desc)
+		{
+			const auto handle = mTable.Allocate();
+			mDevice->CreateUnorderedAccessView(resource, nullptr, desc, Cpu(handle.index));
+			return handle;
+		}
+
+		Handle CreateConstantBufferView(const D3D12_CONSTANT_BUFFER_VIEW_DESC& desc)
+		{
+			const auto handle = mTable.Allocate();
+			mDevice->CreateConstantBufferView(&desc, Cpu(handle.index));
+			return handle;
+		}
+
+		void Free(Handle handle, uint64_t fenceValue) { mTable.Free(handle, fenceValue); }
+		void Retire(uint64_t completedValue) { mTable.Retire(completedValue); }
+
+		// Copies the views written since the previous flush, before the lists that read them execute
+		uint32_t Flush()
+		{
+			uint32_t copied = 0;
+			for (const auto& run : mTable.TakeDirtyRuns())
+			{
+				mDevice->CopyDescriptorsSimple(run.second, Visible(run.first), Cpu(run.first), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+				copied += run.second;
+			}
+			return copied;
+		}
+
+		D3D12_GPU_DESCRIPTOR_HANDLE Gpu(Handle handle) const
+		{
+			if (!mTable.IsValid(handle))
+				throw std::runtime_error("Stale bindless descriptor handle.");
+			return { mGpuStart.ptr + uint64_t(handle.index) * mStride };
+		}
+
+		D3D12_GPU_DESCRIPTOR_HANDLE GpuStart() const { return mGpuStart; }
+		ID3D12DescriptorHeap* ShaderVisible() const { return mShaderVisible.Get(); }
+		const Table& Slots() const { return mTable; }
+
+	private:
+		D3D12_CPU_DESCRIPTOR_HANDLE Cpu(uint32_t index) const { return { mCpuStart.ptr + SIZE_T(index) * mStride }; }
+		D3D12_CPU_DESCRIPTOR_HANDLE Visible(uint32_t index) const { return { mVisibleStart.ptr + SIZE_T(index) * mStride }; }
+
+		ID3D12Device* mDevice = nullptr;
+		Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mStaging;
+		Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mShaderVisible;
+		D3D12_CPU_DESCRIPTOR_HANDLE mCpuStart = {};
+		D3D12_CPU_DESCRIPTOR_HANDLE mVisibleStart = {};
+		D3D12_GPU_DESCRIPTOR_HANDLE mGpuStart = {};
+		uint32_t mStride = 0;
+		Table mTable;
+	};
+#endif
+}
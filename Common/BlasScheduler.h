@@ -0,0 +1,192 @@
+#pragma once
+
+// Batched BLAS builds over a shared scratch arena
+// Builds in one batch get disjoint scratch ranges, so they run back to back without barriers. The next batch
+// reuses the arena from offset 0 behind a single UAV barrier. Batches are packed first fit decreasing under a
+// scratch budget; a build larger than the budget gets a batch of its own and the arena grows to fit it.
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include "AccelerationStructurePool.h"
+
+namespace BlasScheduler
+{
+	struct Placement
+	{
+		uint32_t batch;
+		uint64_t offset; // Into the scratch arena
+	};
+
+	struct Plan
+	{
+		std::vector<Placement> placements;        // Per build
+		std::vector<std::vector<uint32_t>> batches; // Build indices, in recording order
+		std::vector<uint64_t> batchScratch;       // Arena bytes used per batch
+		uint64_t arenaSize = 0;
+
+		size_t Barriers() const { return batches.empty() ? 0 : batches.size() - 1; }
+	};
+
+	// Packs builds into batches within the scratch budget
+	inline Plan PlanBatches(const std::vector<uint64_t>& scratchSizes, uint64_t budget, uint64_t alignment = AccelerationStructurePool::Alignment)
+	{
+		Plan plan;
+		plan.placements.resize(scratchSizes.size());
+		std::vector<uint32_t> order(scratchSizes.size());
+		std::iota(order.begin(), order.end(), 0u);
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return scratchSizes[a] > scratchSizes[b]; });
+		for (uint32_t build : order)
+		{
+			const uint64_t size = AccelerationStructurePool::AlignUp(scratchSizes[build], alignment);
+			uint32_t batch = 0;
+			while (batch < plan.batches.size() && plan.batchScratch[batch] + size > budget)
+				batch++;
+			if (batch == plan.batches.size())
+			{
+				plan.batches.emplace_back();
+				plan.batchScratch.push_back(0);
+			}
+			plan.placements[build] = { batch, plan.batchScratch[batch] };
+			plan.batches[batch].push_back(build);
+			plan.batchScratch[batch] += size;
+			plan.arenaSize = (std::max)(plan.arenaSize, plan.batchScratch[batch]);
+		}
+		return plan;
+	}
+
+#if defined(__d3d12_h__)
+	struct Build
+	{
+		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs;
+		D3D12_GPU_VIRTUAL_ADDRESS dest;
+		uint64_t scratchSize;                   // ScratchDataSizeInBytes of the prebuild info
+		D3D12_GPU_VIRTUAL_ADDRESS compactedSize; // UINT64 written by the build, 0 for none
+	};
+
+	// Owns a compute queue with its list and fence for the lifetime of the app, and the scratch arena.
+	// Begin() waits for the previous submission, so the arena and allocator are never in flight when reused.
+	class Scheduler
+	{
+	public:
+		void Create(ID3D12Device5* device, uint64_t scratchBudget)
+		{
+			mDevice = device;
+			mBudget = scratchBudget;
+			D3D12_COMMAND_QUEUE_DESC queueDesc = { D3D12_COMMAND_LIST_TYPE_COMPUTE };
+			if (FAILED(device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&mQueue)))
+				|| FAILED(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COMPUTE, IID_PPV_ARGS(&mAlloc)))
+				|| FAILED(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COMPUTE, mAlloc.Get(), nullptr, IID_PPV_ARGS(&mList)))
+				|| FAILED(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence))))
+				throw std::runtime_error("Cannot create the BLAS build queue.");
+			mList->Close();
+		}
+
+		ID3D12GraphicsCommandList4* Begin()
+		{
+			Wait(mFenceValue);
+			mRetired.clear();
+			mRecorded = false;
+			if (FAILED(mAlloc->Reset()) || FAILED(mList->Reset(mAlloc.Get(), nullptr)))
+				throw std::runtime_error("Cannot reset the BLAS build list.");
+			return mList.Get();
+		}
+
+		// Destinations and compacted sizes need a barrier from the caller before they are read
+		void Record(const std::vector<Build>& builds)
+		{
+			std::vector<uint64_t> sizes(builds.size());
+			for (size_t i = 0; i < builds.size(); i++)
+				sizes[i] = builds[i].scratchSize;
+			mPlan = PlanBatches(sizes, mBudget);
+			Reserve(mPlan.arenaSize);
+			for (size_t batch = 0; batch < mPlan.batches.size(); batch++)
+			{
+				// Scratch of the previous batch, or of an earlier Record() on this list
+				if (batch || mRecorded)
+				{
+					D3D12_RESOURCE_BARRIER barrier = {};
+					barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+					barrier.UAV.pResource = mArena.Get();
+					mList->ResourceBarrier(1, &barrier);
+				}
+				for (uint32_t i : mPlan.batches[batch])
+				{
+					const auto& build = builds[i];
+					D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = {};
+					desc.Inputs = build.inputs;
+					desc.DestAccelerationStructureData = build.dest;
+					desc.ScratchAccelerationStructureData = mArena->GetGPUVirtualAddress() + mPlan.placements[i].offset;
+					D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_DESC postbuild = {};
+					postbuild.InfoType = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_POSTBUILD_INFO_COMPACTED_SIZE;
+					postbuild.DestBuffer = build.compactedSize;
+					mList->BuildRaytracingAccelerationStructure(&desc, build.compactedSize ? 1 : 0, build.compactedSize ? &postbuild : nullptr);
+				}
+			}
+			mRecorded = mRecorded || !builds.empty();
+		}
+
+		uint64_t Submit()
+		{
+			if (FAILED(mList->Close()))
+				throw std::runtime_error("Cannot close the BLAS build list.");
+			ID3D12CommandList* lists[] = { mList.Get() };
+			mQueue->ExecuteCommandLists(1, lists);
+			mQueue->Signal(mFence.Get(), ++mFenceValue);
+			return mFenceValue;
+		}
+
+		void Wait(uint64_t value)
+		{
+			if (mFence->GetCompletedValue() < value)
+				mFence->SetEventOnCompletion(value, nullptr);
+		}
+
+		ID3D12CommandQueue* Queue() const { return mQueue.Get(); }
+		ID3D12Fence* Fence() const { return mFence.Get(); }
+		const Plan& LastPlan() const { return mPlan; }
+		uint64_t ArenaSize() const { return mArenaSize; }
+
+	private:
+		// Grows only, a replaced arena may still be referenced by this list until the next Begin()
+		void Reserve(uint64_t size)
+		{
+			if (size <= mArenaSize)
+				return;
+			D3D12_HEAP_PROPERTIES heapProp = {};
+			heapProp.Type = D3D12_HEAP_TYPE_DEFAULT;
+			D3D12_RESOURCE_DESC resDesc = {};
+			resDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+			resDesc.Width = size;
+			resDesc.Height = 1;
+			resDesc.DepthOrArraySize = 1;
+			resDesc.MipLevels = 1;
+			resDesc.SampleDesc.Count = 1;
+			resDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+			resDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+			if (mArena)
+				mRetired.push_back(mArena);
+			mArena.Reset();
+			if (FAILED(mDevice->CreateCommittedResource(&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+				D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(&mArena))))
+				throw std::runtime_error("Cannot create the BLAS scratch arena.");
+			mArenaSize = size;
+		}
+
+		Microsoft::WRL::ComPtr<ID3D12Device5> mDevice;
+		Microsoft::WRL::ComPtr<ID3D12CommandQueue> mQueue;
+		Microsoft::WRL::ComPtr<ID3D12CommandAllocator> mAlloc;
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList4> mList;
+		Microsoft::WRL::ComPtr<ID3D12Fence> mFence;
+		uint64_t mFenceValue = 0;
+		Microsoft::WRL::ComPtr<ID3D12Resource> mArena;
+		uint64_t mArenaSize = 0;
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> mRetired;
+		uint64_t mBudget = 0;
+		bool mRecorded = false;
+		Plan mPlan;
+	};
+#endif
+}
@@ -0,0 +1,945 @@
+#pragma once
+
+// CPU bounding volume hierarchies and a reference ray tracer for the DXR samples
+// Trees are built with binned SAH (Wald 2007) over any set of boxes, large subtrees are split across threads.
+// The binary tree is then collapsed into nodes of Width children stored as structure-of-arrays, so one SIMD
+// slab test covers all children of a node (4-wide SSE2 and NEON, 8-wide AVX2).
+// Bottom levels hold the triangles of an IndexedMesh with one geometry per chunk like AppendGeometryDescs,
+// the top level holds instances with 3x4 transforms. Hits follow DXR: no face culling, t along the world ray,
+// barycentrics of vertices 1 and 2, PrimitiveIndex counted per geometry, InstanceIndex in TLAS order.
+
+#include "MeshOptimizer.h"
+#include <array>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#include <immintrin.h>
+#define BVH_SSE2 1
+#if defined(__AVX2__)
+#define BVH_AVX2 1
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#include <arm_neon.h>
+#define BVH_NEON 1
+#endif
+
+namespace Bvh
+{
+	using ProceduralMesh::VertexLayout;
+	using ProceduralMesh::IndexedMesh;
+
+	struct Box
+	{
+		float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		void Grow(const float p[3])
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				lo[i] = (std::min)(lo[i], p[i]);
+				hi[i] = (std::max)(hi[i], p[i]);
+			}
+		}
+		void Grow(const Box& b)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				lo[i] = (std::min)(lo[i], b.lo[i]);
+				hi[i] = (std::max)(hi[i], b.hi[i]);
+			}
+		}
+		float HalfArea() const
+		{
+			const float d[3] = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] };
+			return d[0] < 0.0f ? 0.0f : d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+		}
+	};
+
+	struct Ray
+	{
+		float origin[3];
+		float direction[3];
+		float tmin = 0.0f;
+		float tmax = FLT_MAX;
+	};
+
+	struct Hit
+	{
+		float t = FLT_MAX;
+		float u = 0.0f; // Weight of vertex 1, attr.barycentrics.x
+		float v = 0.0f; // Weight of vertex 2, attr.barycentrics.y
+		uint32_t primitiveIndex = ~0u;
+		uint32_t geometryIndex = ~0u;
+		uint32_t instanceIndex = ~0u;
+
+		bool Valid() const { return primitiveIndex != ~0u; }
+	};
+
+	// Binary SAH tree, internal nodes have children first and first + 1
+	struct BinaryNode
+	{
+		Box box;
+		uint32_t first = 0;
+		uint32_t count = 0; // Primitives of a leaf, 0 for internal nodes
+	};
+
+	struct BuildStats
+	{
+		uint32_t binaryNodes = 0;
+		uint32_t wideNodes = 0;
+		uint32_t leaves = 0;
+		uint32_t maxDepth = 0;
+		double sahCost = 0.0; // Expected node and primitive tests per ray relative to the root box
+	};
+
+	namespace Detail
+	{
+		struct ScalarOps
+		{
+			using F = float;
+			using M = bool;
+			static constexpr size_t Width = 1;
+			static F Load(const float* p) { return *p; }
+			static F Set(float a) { return a; }
+			static F Sub(F a, F b) { return a - b; }
+			static F Mul(F a, F b) { return a * b; }
+			// Operand order as minps/maxps
+			static F Min(F a, F b) { return a < b ? a : b; }
+			static F Max(F a, F b) { return a > b ? a : b; }
+			static M LessEqual(F a, F b) { return a <= b; }
+			static void Store(float* p, F a) { *p = a; }
+			static uint32_t Bits(M a) { return a ? 1u : 0u; }
+		};
+
+#ifdef BVH_SSE2
+		struct Sse2Ops
+		{
+			using F = __m128;
+			using M = __m128;
+			static constexpr size_t Width = 4;
+			static F Load(const float* p) { return _mm_loadu_ps(p); }
+			static F Set(float a) { return _mm_set1_ps(a); }
+			static F Sub(F a, F b) { return _mm_sub_ps(a, b); }
+			static F Mul(F a, F b) { return _mm_mul_ps(a, b); }
+			static F Min(F a, F b) { return _mm_min_ps(a, b); }
+			static F Max(F a, F b) { return _mm_max_ps(a, b); }
+			static M LessEqual(F a, F b) { return _mm_cmple_ps(a, b); }
+			static void Store(float* p, F a) { _mm_storeu_ps(p, a); }
+			static uint32_t Bits(M a) { return static_cast<uint32_t>(_mm_movemask_ps(a)); }
+		};
+#endif
+
+#ifdef BVH_AVX2
+		struct Avx2Ops
+		{
+			using F = __m256;
+			using M = __m256;
+			static constexpr size_t Width = 8;
+			static F Load(const float* p) { return _mm256_loadu_ps(p); }
+			static F Set(float a) { return _mm256_set1_ps(a); }
+			static F Sub(F a, F b) { return _mm256_sub_ps(a, b); }
+			static F Mul(F a, F b) { return _mm256_mul_ps(a, b); }
+			static F Min(F a, F b) { return _mm256_min_ps(a, b); }
+			static F Max(F a, F b) { return _mm256_max_ps(a, b); }
+			static M LessEqual(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+			static void Store(float* p, F a) { _mm256_storeu_ps(p, a); }
+			static uint32_t Bits(M a) { return static_cast<uint32_t>(_mm256_movemask_ps(a)); }
+		};
+#endif
+
+#ifdef BVH_NEON
+		struct NeonOps
+		{
+			using F = float32x4_t;
+			using M = uint32x4_t;
+			static constexpr size_t Width = 4;
+			static F Load(const float* p) { return vld1q_f32(p); }
+			static F Set(float a) { return vdupq_n_f32(a); }
+			static F Sub(F a, F b) { return vsubq_f32(a, b); }
+			static F Mul(F a, F b) { return vmulq_f32(a, b); }
+			static F Min(F a, F b) { return vbslq_f32(vcltq_f32(a, b), a, b); }
+			static F Max(F a, F b) { return vbslq_f32(vcgtq_f32(a, b), a, b); }
+			static M LessEqual(F a, F b) { return vcleq_f32(a, b); }
+			static void Store(float* p, F a) { vst1q_f32(p, a); }
+			static uint32_t Bits(M a)
+			{
+				const uint32_t lanes[4] = { 1, 2, 4, 8 };
+				return vaddvq_u32(vandq_u32(a, vld1q_u32(lanes)));
+			}
+		};
+#endif
+
+#if defined(BVH_AVX2)
+		using BestOps = Avx2Ops;
+#elif defined(BVH_SSE2)
+		using BestOps = Sse2Ops;
+#elif defined(BVH_NEON)
+		using BestOps = NeonOps;
+#else
+		using BestOps = ScalarOps;
+#endif
+
+		constexpr uint32_t BinCount = 16;
+		constexpr uint32_t MaxLeafSize = 4;
+		constexpr uint32_t ParallelBuildSize = 16384;
+		constexpr float TraversalCost = 1.0f;
+		constexpr float IntersectionCost = 1.0f;
+
+		struct BuildContext
+		{
+			const Box* boxes;
+			const std::array<float, 3>* centroids;
+			uint32_t* order;
+			BinaryNode* nodes;
+			std::atomic<uint32_t> nodeCount;
+		};
+
+		inline void BuildNode(BuildContext& ctx, uint32_t nodeIndex, uint32_t begin, uint32_t end, uint32_t threads)
+		{
+			auto& node = ctx.nodes[nodeIndex];
+			Box box, centroidBox;
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				box.Grow(ctx.boxes[ctx.order[i]]);
+				centroidBox.Grow(ctx.centroids[ctx.order[i]].data());
+			}
+			node.box = box;
+			node.first = begin;
+			node.count = end - begin;
+			if (node.count == 1)
+				return;
+
+			// Sweep the bins of every axis for the cheapest split
+			float bestCost = FLT_MAX;
+			int bestAxis = -1;
+			uint32_t bestSplit = 0;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				const float extent = centroidBox.hi[axis] - centroidBox.lo[axis];
+				if (!(extent > 0.0f))
+					continue;
+				const float scale = BinCount / extent;
+				Box bins[BinCount];
+				uint32_t counts[BinCount] = {};
+				for (uint32_t i = begin; i < end; ++i)
+				{
+					const uint32_t p = ctx.order[i];
+					const uint32_t b = (std::min)(BinCount - 1, static_cast<uint32_t>((ctx.centroids[p][axis] - centroidBox.lo[axis]) * scale));
+					bins[b].Grow(ctx.boxes[p]);
+					counts[b]++;
+				}
+				float rightArea[BinCount];
+				uint32_t rightCount[BinCount];
+				Box right;
+				uint32_t count = 0;
+				for (uint32_t b = BinCount - 1; b > 0; --b)
+				{
+					right.Grow(bins[b]);
+					count += counts[b];
+					rightArea[b] = right.HalfArea();
+					rightCount[b] = count;
+				}
+				Box left;
+				count = 0;
+				for (uint32_t b = 1; b < BinCount; ++b)
+				{
+					left.Grow(bins[b - 1]);
+					count += counts[b - 1];
+					if (count == 0 || rightCount[b] == 0)
+						continue;
+					const float cost = left.HalfArea() * count + rightArea[b] * rightCount[b];
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = b;
+					}
+				}
+			}
+
+			const float leafCost = IntersectionCost * node.count;
+			const float splitCost = TraversalCost + IntersectionCost * bestCost / (std::max)(box.HalfArea(), FLT_MIN);
+			uint32_t middle;
+			if (bestAxis >= 0)
+			{
+				if (node.count <= MaxLeafSize && leafCost <= splitCost)
+					return;
+				const float scale = BinCount / (centroidBox.hi[bestAxis] - centroidBox.lo[bestAxis]);
+				middle = static_cast<uint32_t>(std::partition(ctx.order + begin, ctx.order + end, [&](uint32_t p)
+				{
+					return (std::min)(BinCount - 1, static_cast<uint32_t>((ctx.centroids[p][bestAxis] - centroidBox.lo[bestAxis]) * scale)) < bestSplit;
+				}) - ctx.order);
+			}
+			else
+			{
+				// Every centroid is the same point, only the leaf size matters
+				if (node.count <= MaxLeafSize)
+					return;
+				middle = begin + node.count / 2;
+			}
+
+			const uint32_t children = ctx.nodeCount.fetch_add(2);
+			node.first = children;
+			node.count = 0;
+			if (threads > 1 && end - begin >= ParallelBuildSize)
+			{
+				std::thread worker([&ctx, children, begin, middle, threads]() { BuildNode(ctx, children, begin, middle, threads / 2); });
+				BuildNode(ctx, children + 1, middle, end, threads - threads / 2);
+				worker.join();
+			}
+			else
+			{
+				BuildNode(ctx, children, begin, middle, 1);
+				BuildNode(ctx, children + 1, middle, end, 1);
+			}
+		}
+	}
+
+	constexpr size_t Width = Detail::BestOps::Width < 4 ? 4 : Detail::BestOps::Width;
+	constexpr uint32_t EmptyChild = ~0u;
+
+	// Children as structure-of-arrays, count > 0 marks a leaf of count primitives starting at child
+	struct WideNode
+	{
+		float lo[3][Width];
+		float hi[3][Width];
+		uint32_t child[Width];
+		uint32_t count[Width];
+	};
+
+	struct Tree
+	{
+		std::vector<WideNode> nodes; // Root first
+		std::vector<uint32_t> order; // Primitive of every leaf slot
+		Box bounds;
+		BuildStats stats;
+
+		// threads = 0 uses every hardware thread for the top of the tree
+		void Build(const std::vector<Box>& boxes, uint32_t threads = 0)
+		{
+			nodes.clear();
+			stats = {};
+			const auto count = static_cast<uint32_t>(boxes.size());
+			order.resize(count);
+			for (uint32_t i = 0; i < count; ++i)
+				order[i] = i;
+			bounds = Box();
+			if (count == 0)
+				return;
+			std::vector<std::array<float, 3>> centroids(count);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				for (int a = 0; a < 3; ++a)
+					centroids[i][a] = (boxes[i].lo[a] + boxes[i].hi[a]) * 0.5f;
+			}
+			std::vector<BinaryNode> binary(2 * size_t(count));
+			Detail::BuildContext ctx = { boxes.data(), centroids.data(), order.data(), binary.data(), { 1 } };
+			Detail::BuildNode(ctx, 0, 0, count, threads ? threads : (std::max)(std::thread::hardware_concurrency(), 1u));
+			binary.resize(ctx.nodeCount);
+			bounds = binary[0].box;
+			stats.binaryNodes = static_cast<uint32_t>(binary.size());
+			Collapse(binary, 0, 1);
+			stats.wideNodes = static_cast<uint32_t>(nodes.size());
+			stats.sahCost = Sah();
+		}
+
+		// Keeps the topology and recomputes every box like a PERFORM_UPDATE build, boxes in the order given to Build.
+		// The cost only grows when primitives drift away from the clusters the tree was built for.
+		void Refit(const std::vector<Box>& boxes)
+		{
+			// Children always follow their parent
+			for (size_t n = nodes.size(); n-- > 0;)
+			{
+				auto& node = nodes[n];
+				for (size_t l = 0; l < Width; ++l)
+				{
+					if (node.child[l] == EmptyChild)
+						continue;
+					Box box;
+					if (node.count[l])
+					{
+						for (uint32_t i = node.child[l]; i < node.child[l] + node.count[l]; ++i)
+							box.Grow(boxes[order[i]]);
+					}
+					else
+						box = Bounds(nodes[node.child[l]]);
+					for (int a = 0; a < 3; ++a)
+					{
+						node.lo[a][l] = box.lo[a];
+						node.hi[a][l] = box.hi[a];
+					}
+				}
+			}
+			if (!nodes.empty())
+				bounds = Bounds(nodes[0]);
+			stats.sahCost = Sah();
+		}
+
+		static Box Bounds(const WideNode& node)
+		{
+			Box box;
+			for (size_t l = 0; l < Width; ++l)
+			{
+				if (node.child[l] == EmptyChild)
+					continue;
+				const float lo[3] = { node.lo[0][l], node.lo[1][l], node.lo[2][l] };
+				const float hi[3] = { node.hi[0][l], node.hi[1][l], node.hi[2][l] };
+				box.Grow(lo);
+				box.Grow(hi);
+			}
+			return box;
+		}
+
+		// Expected node and primitive tests of a random ray through the root box
+		double Sah() const
+		{
+			double cost = 0.0;
+			for (const auto& node : nodes)
+			{
+				cost += Detail::TraversalCost * Bounds(node).HalfArea();
+				for (size_t l = 0; l < Width; ++l)
+				{
+					if (node.child[l] != EmptyChild && node.count[l])
+					{
+						Box leaf;
+						const float lo[3] = { node.lo[0][l], node.lo[1][l], node.lo[2][l] };
+						const float hi[3] = { node.hi[0][l], node.hi[1][l], node.hi[2][l] };
+						leaf.Grow(lo);
+						leaf.Grow(hi);
+						cost += Detail::IntersectionCost * node.count[l] * leaf.HalfArea();
+					}
+				}
+			}
+			return nodes.empty() ? 0.0 : cost / (std::max)(bounds.HalfArea(), FLT_MIN);
+		}
+
+	private:
+		// Opens the largest internal children until Width slots are used, so wide nodes follow the SAH tree
+		uint32_t Collapse(const std::vector<BinaryNode>& binary, uint32_t root, uint32_t depth)
+		{
+			uint32_t slots[Width];
+			size_t used = 0;
+			if (binary[root].count)
+				slots[used++] = root;
+			else
+			{
+				slots[used++] = binary[root].first;
+				slots[used++] = binary[root].first + 1;
+			}
+			while (used < Width)
+			{
+				size_t open = Width;
+				float area = -1.0f;
+				for (size_t i = 0; i < used; ++i)
+				{
+					const auto& n = binary[slots[i]];
+					if (n.count == 0 && n.box.HalfArea() > area)
+					{
+						open = i;
+						area = n.box.HalfArea();
+					}
+				}
+				if (open == Width)
+					break;
+				const uint32_t first = binary[slots[open]].first;
+				slots[open] = first;
+				// Keep the children next to each other so lanes stay in tree order
+				for (size_t i = used; i > open + 1; --i)
+					slots[i] = slots[i - 1];
+				slots[open + 1] = first + 1;
+				used++;
+			}
+
+			const auto index = static_cast<uint32_t>(nodes.size());
+			nodes.emplace_back();
+			stats.maxDepth = (std::max)(stats.maxDepth, depth);
+			for (size_t i = 0; i < Width; ++i)
+			{
+				auto& node = nodes[index];
+				if (i >= used)
+				{
+					for (int a = 0; a < 3; ++a)
+					{
+						node.lo[a][i] = FLT_MAX;
+						node.hi[a][i] = -FLT_MAX;
+					}
+					node.child[i] = EmptyChild;
+					node.count[i] = 0;
+					continue;
+				}
+				const auto& n = binary[slots[i]];
+				for (int a = 0; a < 3; ++a)
+				{
+					node.lo[a][i] = n.box.lo[a];
+					node.hi[a][i] = n.box.hi[a];
+				}
+				node.count[i] = n.count;
+				if (n.count)
+				{
+					node.child[i] = n.first;
+					stats.leaves++;
+				}
+				else
+				{
+					const uint32_t child = Collapse(binary, slots[i], depth + 1);
+					nodes[index].child[i] = child;
+				}
+			}
+			return index;
+		}
+	};
+
+	// Precomputed edges for Moller-Trumbore
+	struct Triangle
+	{
+		float v0[3];
+		float e1[3];
+		float e2[3];
+		uint32_t primitiveIndex;
+		uint32_t geometryIndex;
+	};
+
+	class BottomLevel
+	{
+	public:
+		Tree tree;
+		std::vector<Triangle> triangles; // In leaf order
+
+		// One geometry per chunk, the index buffer in the layout of mesh.indexSize
+		void Build(const IndexedMesh& mesh, const void* vertices, const void* indices, const VertexLayout& layout, uint32_t threads = 0)
+		{
+			Extract(mesh, vertices, indices, layout);
+			tree.Build(mBoxes, threads);
+			Reorder();
+		}
+
+		// Moved vertices of the same mesh, the tree keeps its topology
+		void Refit(const IndexedMesh& mesh, const void* vertices, const void* indices, const VertexLayout& layout)
+		{
+			Extract(mesh, vertices, indices, layout);
+			tree.Refit(mBoxes);
+			Reorder();
+		}
+
+	private:
+		std::vector<Triangle> mSource;
+		std::vector<Box> mBoxes;
+
+		void Extract(const IndexedMesh& mesh, const void* vertices, const void* indices, const VertexLayout& layout)
+		{
+			mSource.clear();
+			mBoxes.clear();
+			mSource.reserve(mesh.indexCount / 3);
+			mBoxes.reserve(mesh.indexCount / 3);
+			for (uint32_t g = 0; g < mesh.chunks.size(); ++g)
+			{
+				const auto& c = mesh.chunks[g];
+				for (uint32_t i = 0; i < c.indexCount / 3; ++i)
+				{
+					MeshOptimizer::Detail::Float3 p[3];
+					Box box;
+					for (int k = 0; k < 3; ++k)
+					{
+						p[k] = MeshOptimizer::Detail::Position(vertices, layout, c.baseVertex + MeshOptimizer::Detail::ReadIndex(indices, mesh.indexSize, c.firstIndex + 3 * size_t(i) + k));
+						const float q[3] = { p[k].x, p[k].y, p[k].z };
+						box.Grow(q);
+					}
+					mSource.push_back({ { p[0].x, p[0].y, p[0].z },
+						{ p[1].x - p[0].x, p[1].y - p[0].y, p[1].z - p[0].z },
+						{ p[2].x - p[0].x, p[2].y - p[0].y, p[2].z - p[0].z }, i, g });
+					mBoxes.push_back(box);
+				}
+			}
+		}
+
+		void Reorder()
+		{
+			triangles.resize(mSource.size());
+			for (size_t i = 0; i < mSource.size(); ++i)
+				triangles[i] = mSource[tree.order[i]];
+		}
+	};
+
+	// D3D12_RAYTRACING_INSTANCE_DESC without the GPU addresses
+	struct Instance
+	{
+		float transform[3][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } };
+		uint32_t instanceMask = 0xFF;
+		const BottomLevel* blas = nullptr;
+	};
+
+	namespace Detail
+	{
+		struct LocalRay
+		{
+			float origin[3];
+			float direction[3];
+			float invDirection[3];
+		};
+
+		inline LocalRay MakeLocalRay(const float origin[3], const float direction[3])
+		{
+			LocalRay r;
+			for (int a = 0; a < 3; ++a)
+			{
+				r.origin[a] = origin[a];
+				r.direction[a] = direction[a];
+				// No 0 * inf in the slab test
+				const float d = std::fabs(direction[a]) < 1e-30f ? std::copysign(1e-30f, direction[a]) : direction[a];
+				r.invDirection[a] = 1.0f / d;
+			}
+			return r;
+		}
+
+		inline bool IntersectTriangle(const Triangle& tri, const LocalRay& ray, float tmin, Hit& hit)
+		{
+			const float* d = ray.direction;
+			const float p[3] = { d[1] * tri.e2[2] - d[2] * tri.e2[1], d[2] * tri.e2[0] - d[0] * tri.e2[2], d[0] * tri.e2[1] - d[1] * tri.e2[0] };
+			const float det = tri.e1[0] * p[0] + tri.e1[1] * p[1] + tri.e1[2] * p[2];
+			if (std::fabs(det) < 1e-20f)
+				return false;
+			const float inv = 1.0f / det;
+			const float s[3] = { ray.origin[0] - tri.v0[0], ray.origin[1] - tri.v0[1], ray.origin[2] - tri.v0[2] };
+			const float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+			if (u < 0.0f || u > 1.0f)
+				return false;
+			const float q[3] = { s[1] * tri.e1[2] - s[2] * tri.e1[1], s[2] * tri.e1[0] - s[0] * tri.e1[2], s[0] * tri.e1[1] - s[1] * tri.e1[0] };
+			const float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+			if (v < 0.0f || u + v > 1.0f)
+				return false;
+			const float t = (tri.e2[0] * q[0] + tri.e2[1] * q[1] + tri.e2[2] * q[2]) * inv;
+			if (t < tmin || t >= hit.t)
+				return false;
+			hit.t = t;
+			hit.u = u;
+			hit.v = v;
+			hit.primitiveIndex = tri.primitiveIndex;
+			hit.geometryIndex = tri.geometryIndex;
+			return true;
+		}
+
+		// Lanes whose box overlaps [tmin, tmax], entry distances in tnear
+		template<class V>
+		inline uint32_t NodeHits(const WideNode& node, const LocalRay& ray, float tmin, float tmax, float tnear[Width])
+		{
+			uint32_t bits = 0;
+			for (size_t l = 0; l < Width; l += V::Width)
+			{
+				typename V::F lo[3], hi[3];
+				for (int a = 0; a < 3; ++a)
+				{
+					const auto o = V::Set(ray.origin[a]), inv = V::Set(ray.invDirection[a]);
+					const auto t0 = V::Mul(V::Sub(V::Load(node.lo[a] + l), o), inv);
+					const auto t1 = V::Mul(V::Sub(V::Load(node.hi[a] + l), o), inv);
+					lo[a] = V::Min(t0, t1);
+					hi[a] = V::Max(t0, t1);
+				}
+				const auto enter = V::Max(V::Max(lo[0], lo[1]), V::Max(lo[2], V::Set(tmin)));
+				const auto exit = V::Min(V::Min(hi[0], hi[1]), V::Min(hi[2], V::Set(tmax)));
+				V::Store(tnear + l, enter);
+				bits |= V::Bits(V::LessEqual(enter, exit)) << l;
+			}
+			return bits;
+		}
+
+		struct StackEntry
+		{
+			uint32_t child;
+			uint32_t count;
+			float tnear;
+		};
+		constexpr size_t StackSize = 64 * Width;
+
+		// Nearest children are visited first, equal distances in lane order. onLeaf(first, count) returns true to stop.
+		template<class V, class OnLeaf>
+		inline void Traverse(const Tree& tree, const LocalRay& ray, float tmin, const float& tmax, OnLeaf&& onLeaf)
+		{
+			if (tree.nodes.empty())
+				return;
+			StackEntry stack[StackSize];
+			size_t top = 0;
+			stack[top++] = { 0, 0, tmin };
+			while (top)
+			{
+				const auto entry = stack[--top];
+				if (entry.tnear > tmax)
+					continue;
+				if (entry.count)
+				{
+					if (onLeaf(entry.child, entry.count))
+						return;
+					continue;
+				}
+				const auto& node = tree.nodes[entry.child];
+				float tnear[Width];
+				uint32_t bits = NodeHits<V>(node, ray, tmin, tmax, tnear);
+				StackEntry hits[Width];
+				size_t hitCount = 0;
+				for (; bits; bits &= bits - 1)
+				{
+					uint32_t lane = 0;
+					while (!(bits & (1u << lane)))
+						++lane;
+					if (node.child[lane] == EmptyChild)
+						continue;
+					// Sorted far to near so the nearest is popped first
+					StackEntry e = { node.child[lane], node.count[lane], tnear[lane] };
+					size_t k = hitCount++;
+					while (k > 0 && hits[k - 1].tnear < e.tnear)
+					{
+						hits[k] = hits[k - 1];
+						--k;
+					}
+					hits[k] = e;
+				}
+				if (top + hitCount > StackSize)
+					throw std::runtime_error("BVH traversal stack overflow.");
+				for (size_t i = 0; i < hitCount; ++i)
+					stack[top++] = hits[i];
+			}
+		}
+
+		template<class V>
+		inline bool TraceBottom(const BottomLevel& blas, const LocalRay& ray, float tmin, Hit& hit, bool anyHit)
+		{
+			bool found = false;
+			Traverse<V>(blas.tree, ray, tmin, hit.t, [&](uint32_t first, uint32_t count)
+			{
+				for (uint32_t i = first; i < first + count; ++i)
+				{
+					if (IntersectTriangle(blas.triangles[i], ray, tmin, hit))
+					{
+						found = true;
+						if (anyHit)
+							return true;
+					}
+				}
+				return false;
+			});
+			return found;
+		}
+
+		inline void Invert(const float m[3][4], float inv[3][4])
+		{
+			const float det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+				- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+				+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+			const float s = 1.0f / det;
+			inv[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * s;
+			inv[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * s;
+			inv[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * s;
+			inv[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * s;
+			inv[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * s;
+			inv[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * s;
+			inv[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * s;
+			inv[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * s;
+			inv[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * s;
+			for (int r = 0; r < 3; ++r)
+				inv[r][3] = -(inv[r][0] * m[0][3] + inv[r][1] * m[1][3] + inv[r][2] * m[2][3]);
+		}
+	}
+
+	inline const char* SimdName()
+	{
+#if defined(BVH_AVX2)
+		return "avx2";
+#elif defined(BVH_SSE2)
+		return "sse2";
+#elif defined(BVH_NEON)
+		return "neon";
+#else
+		return "scalar";
+#endif
+	}
+
+	class TopLevel
+	{
+	public:
+		Tree tree;
+		std::vector<Instance> instances;
+
+		void Build(const std::vector<Instance>& source)
+		{
+			tree.Build(Prepare(source), 1);
+		}
+
+		// Same instances with new transforms or refitted bottom levels
+		void Refit(const std::vector<Instance>& source)
+		{
+			tree.Refit(Prepare(source));
+		}
+
+		// TraceRay / RayQuery with RAY_FLAG_CULL_NON_OPAQUE, everything is opaque. anyHit ends at the first hit
+		// like RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH.
+		bool Trace(const Ray& ray, Hit& hit, uint32_t mask = 0xFF, bool anyHit = false, bool simd = true) const
+		{
+			hit = Hit();
+			hit.t = ray.tmax;
+			return simd ? TraceWith<Detail::BestOps>(ray, hit, mask, anyHit) : TraceWith<Detail::ScalarOps>(ray, hit, mask, anyHit);
+		}
+
+	private:
+		struct Inverse
+		{
+			float m[3][4];
+		};
+		std::vector<Inverse> mInverse;
+
+		std::vector<Box> Prepare(const std::vector<Instance>& source)
+		{
+			instances = source;
+			mInverse.resize(instances.size());
+			std::vector<Box> boxes(instances.size());
+			for (size_t i = 0; i < instances.size(); ++i)
+			{
+				const auto& inst = instances[i];
+				Detail::Invert(inst.transform, mInverse[i].m);
+				// Corners of the bottom level box in world space
+				const auto& b = inst.blas->tree.bounds;
+				for (int c = 0; c < 8; ++c)
+				{
+					const float p[3] = { (c & 1) ? b.hi[0] : b.lo[0], (c & 2) ? b.hi[1] : b.lo[1], (c & 4) ? b.hi[2] : b.lo[2] };
+					float w[3];
+					for (int r = 0; r < 3; ++r)
+						w[r] = inst.transform[r][0] * p[0] + inst.transform[r][1] * p[1] + inst.transform[r][2] * p[2] + inst.transform[r][3];
+					boxes[i].Grow(w);
+				}
+			}
+			return boxes;
+		}
+		template<class V>
+		bool TraceWith(const Ray& ray, Hit& hit, uint32_t mask, bool anyHit) const
+		{
+			const auto world = Detail::MakeLocalRay(ray.origin, ray.direction);
+			bool found = false;
+			Detail::Traverse<V>(tree, world, ray.tmin, hit.t, [&](uint32_t first, uint32_t count)
+			{
+				for (uint32_t slot = first; slot < first + count; ++slot)
+				{
+					const uint32_t i = tree.order[slot];
+					if (!(instances[i].instanceMask & mask))
+						continue;
+					// Direction stays unnormalized so t keeps its world meaning
+					const auto& m = mInverse[i].m;
+					float o[3], d[3];
+					for (int r = 0; r < 3; ++r)
+					{
+						o[r] = m[r][0] * ray.origin[0] + m[r][1] * ray.origin[1] + m[r][2] * ray.origin[2] + m[r][3];
+						d[r] = m[r][0] * ray.direction[0] + m[r][1] * ray.direction[1] + m[r][2] * ray.direction[2];
+					}
+					if (Detail::TraceBottom<V>(*instances[i].blas, Detail::MakeLocalRay(o, d), ray.tmin, hit, anyHit))
+					{
+						hit.instanceIndex = i;
+						found = true;
+						if (anyHit)
+							return true;
+					}
+				}
+				return false;
+			});
+			return found;
+		}
+	};
+
+	// Refit or rebuild for structures whose primitives move every frame. A refit keeps the topology, so its SAH cost
+	// drifts up from the cost of the last build. Rebuild once it has grown by tolerance, or after maxUpdates refits.
+	struct RefitPolicy
+	{
+		double tolerance = 0.25;
+		uint32_t maxUpdates = 0; // 0 never forces a rebuild
+
+		double builtCost = 0.0;
+		uint32_t updates = 0;
+		uint32_t rebuilds = 0;
+
+		bool ShouldRebuild(double refitCost) const
+		{
+			return builtCost <= 0.0 || refitCost > builtCost * (1.0 + tolerance) || (maxUpdates && updates >= maxUpdates);
+		}
+		void OnBuild(double cost)
+		{
+			builtCost = cost;
+			updates = 0;
+			rebuilds++;
+		}
+		void OnRefit()
+		{
+			updates++;
+		}
+	};
+
+	// The closest hit shader modes of the DXR sample
+	enum class RayGenMode : uint32_t
+	{
+		White,
+		Barycentrics,
+		PrimitiveIndex, // palette[PrimitiveIndex() % 8]
+		InstanceIndex,  // palette[InstanceIndex() % 8]
+	};
+
+	// Same rays as shaderCodeSceneRayGen: through the pixel center to the far plane of invViewProj (row-major,
+	// row vectors as DirectXMath), from cameraPos with TMin 0.01 and TMax 100. Writes R8G8B8A8_UNORM pixels.
+	inline void RenderRayGen(const TopLevel& scene, const float invViewProj[16], const float cameraPos[3], uint32_t width, uint32_t height,
+		RayGenMode mode, const float palette[8][4], uint8_t* rgba, uint32_t threads = 0, bool simd = true)
+	{
+		threads = threads ? threads : (std::max)(std::thread::hardware_concurrency(), 1u);
+		auto renderRows = [&](uint32_t y0, uint32_t y1)
+		{
+			for (uint32_t y = y0; y < y1; ++y)
+			{
+				for (uint32_t x = 0; x < width; ++x)
+				{
+					const float ndc[4] = { (0.5f + x) / width * 2 - 1, (0.5f + y) / height * -2 + 1, 1, 1 };
+					float farPos[4];
+					for (int c = 0; c < 4; ++c)
+						farPos[c] = ndc[0] * invViewProj[c] + ndc[1] * invViewProj[4 + c] + ndc[2] * invViewProj[8 + c] + ndc[3] * invViewProj[12 + c];
+					Ray ray;
+					float length = 0.0f;
+					for (int a = 0; a < 3; ++a)
+					{
+						ray.origin[a] = cameraPos[a];
+						ray.direction[a] = farPos[a] / farPos[3] - cameraPos[a];
+						length += ray.direction[a] * ray.direction[a];
+					}
+					length = std::sqrt(length);
+					for (auto& d : ray.direction)
+						d /= length;
+					ray.tmin = 0.01f;
+					ray.tmax = 100.0f;
+
+					float color[4] = { 0.3f, 0.3f, 0.3f, 1.0f };
+					Hit hit;
+					if (scene.Trace(ray, hit, 0x1, false, simd))
+					{
+						const float* c = nullptr;
+						const float bary[4] = { 1 - hit.u - hit.v, hit.u, hit.v, 1 };
+						const float white[4] = { 1, 1, 1, 1 };
+						switch (mode)
+						{
+						case RayGenMode::White: c = white; break;
+						case RayGenMode::Barycentrics: c = bary; break;
+						case RayGenMode::PrimitiveIndex: c = palette[hit.primitiveIndex % 8]; break;
+						case RayGenMode::InstanceIndex: c = palette[hit.instanceIndex % 8]; break;
+						}
+						memcpy(color, c, sizeof(color));
+					}
+					auto* out = rgba + 4 * (size_t(y) * width + x);
+					for (int c = 0; c < 4; ++c)
+						out[c] = static_cast<uint8_t>((std::min)((std::max)(color[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+				}
+			}
+		};
+		const uint32_t bands = (std::min)(threads, (std::max)(height, 1u));
+		std::vector<std::thread> workers;
+		for (uint32_t b = 1; b < bands; ++b)
+			workers.emplace_back(renderRows, height * b / bands, height * (b + 1) / bands);
+		renderRows(0, height / bands);
+		for (auto& t : workers)
+			t.join();
+	}
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+// Constants for many draws from one persistently mapped upload buffer
+// Allocations advance a head through the buffer, 256-byte aligned for constant buffer views, and wrap to the start
+// when they do not fit before its end. Close() tags everything allocated since the previous Close() with the fence
+// value that retires it, and Retire() moves the tail past frames whose fence has completed. Positions only grow,
+// the buffer offset is the position modulo the capacity, so a full ring and an empty one never look alike.
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+
+namespace ConstantRing
+{
+	// D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT
+	constexpr uint64_t Alignment = 256;
+
+	inline uint64_t AlignUp(uint64_t size, uint64_t alignment = Alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	// Offsets into a ring of capacity bytes
+	class Ring
+	{
+	public:
+		static constexpr uint64_t Invalid = ~0ull;
+
+		explicit Ring(uint64_t capacity = 0)
+		{
+			Reset(capacity);
+		}
+
+		void Reset(uint64_t capacity)
+		{
+			mCapacity = capacity / Alignment * Alignment;
+			mHead = mTail = 0;
+			mFrames.clear();
+			mFrameBytes = mFrameAllocations = 0;
+		}
+
+		// Invalid while the space is still in flight. The capacity must be a multiple of alignment.
+		uint64_t Allocate(uint64_t size, uint64_t alignment = Alignment)
+		{
+			if (size == 0 || size > mCapacity)
+				return Invalid;
+			const uint64_t offset = mHead % mCapacity;
+			uint64_t start = mHead - offset + AlignUp(offset, alignment);
+			// Skip the end of the buffer rather than split an allocation across it
+			if (start - (mHead - offset) + size > mCapacity)
+				start = mHead - offset + mCapacity;
+			const uint64_t end = start + size;
+			if (end - mTail > mCapacity)
+				return Invalid;
+			mFrameBytes += end - mHead;
+			mFrameAllocations++;
+			mHead = end;
+			return start % mCapacity;
+		}
+
+		// Allocations since the previous Close() are free once fenceValue completes
+		void Close(uint64_t fenceValue)
+		{
+			mFrames.push_back({ fenceValue, mHead });
+			mLastFrameBytes = mFrameBytes;
+			mLastFrameAllocations = mFrameAllocations;
+			mFrameBytes = mFrameAllocations = 0;
+		}
+
+		void Retire(uint64_t completedValue)
+		{
+			while (!mFrames.empty() && mFrames.front().fenceValue <= completedValue)
+			{
+				mTail = mFrames.front().head;
+				mFrames.pop_front();
+			}
+		}
+
+		uint64_t Capacity() const { return mCapacity; }
+		uint64_t Used() const { return mHead - mTail; } // Including padding and the open frame
+		size_t FramesInFlight() const { return mFrames.size(); }
+		uint64_t LastFrameBytes() const { return mLastFrameBytes; }
+		uint64_t LastFrameAllocations() const { return mLastFrameAllocations; }
+
+	private:
+		struct Frame
+		{
+			uint64_t fenceValue;
+			uint64_t head; // Position after the frame's last allocation
+		};
+
+		uint64_t mCapacity = 0;
+		uint64_t mHead = 0;
+		uint64_t mTail = 0;
+		std::deque<Frame> mFrames;
+		uint64_t mFrameBytes = 0;
+		uint64_t mFrameAllocations = 0;
+		uint64_t mLastFrameBytes = 0;
+		uint64_t mLastFrameAllocations = 0;
+	};
+
+#if defined(__d3d12_h__)
+	struct Allocation
+	{
+		void* cpu;
+		D3D12_GPU_VIRTUAL_ADDRESS gpu; // For SetGraphicsRootConstantBufferView() or a CBV
+	};
+
+	// Upload buffer mapped once for its lifetime
+	class Allocator
+	{
+	public:
+		void Create(ID3D12Device* device, uint64_t capacity)
+		{
+			D3D12_HEAP_PROPERTIES heapProp = {};
+			heapProp.Type = D3D12_HEAP_TYPE_UPLOAD;
+			D3D12_RESOURCE_DESC resDesc = {};
+			resDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+			resDesc.Width = AlignUp(capacity);
+			resDesc.Height = 1;
+			resDesc.DepthOrArraySize = 1;
+			resDesc.MipLevels = 1;
+			resDesc.SampleDesc.Count = 1;
+			resDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+			if (FAILED(device->CreateCommittedResource(&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+				D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mBuffer))))
+				throw std::runtime_error("Cannot create the constant ring.");
+			const D3D12_RANGE noRead = {};
+			if (FAILED(mBuffer->Map(0, &noRead, reinterpret_cast<void**>(&mCpu))))
+				throw std::runtime_error("Cannot map the constant ring.");
+			mGpu = mBuffer->GetGPUVirtualAddress();
+			mRing.Reset(resDesc.Width);
+		}
+
+		Allocation Allocate(uint64_t size)
+		{
+			const uint64_t offset = mRing.Allocate(size);
+			if (offset == Ring::Invalid)
+				throw std::runtime_error("Constant ring is full.");
+			return { mCpu + offset, mGpu + offset };
+		}
+
+		template<class T>
+		D3D12_GPU_VIRTUAL_ADDRESS Push(const T& constants)
+		{
+			const auto allocation = Allocate(sizeof(T));
+			memcpy(allocation.cpu, &constants, sizeof(T));
+			return allocation.gpu;
+		}
+
+		void Close(uint64_t fenceValue) { mRing.Close(fenceValue); }
+		void Retire(uint64_t completedValue) { mRing.Retire(completedValue); }
+
+		ID3D12Resource* Resource() const { return mBuffer.Get(); }
+		const Ring& Ranges() const { return mRing; }
+
+	private:
+		Microsoft::WRL::ComPtr<ID3D12Resource> mBuffer;
+		uint8_t* mCpu = nullptr;
+		D3D12_GPU_VIRTUAL_ADDRESS mGpu = 0;
+		Ring mRing;
+	};
+#endif
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+// Transient descriptor tables in a shader-visible ring
+// A table is a contiguous range of the ring, copied from views kept in non-visible staging heaps. Ranges come
+// from the same fence-retired ring as the constants, counted in descriptors instead of bytes, so a table never
+// wraps around the end of the heap. Sources that follow each other in a staging heap are copied with one
+// CopyDescriptorsSimple() call. A table with the same sources as one already pushed this frame reuses it without
+// copying; the cache is dropped at Close(), as an older table is retired with its own frame.
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include "ConstantRing.h"
+
+namespace DescriptorRing
+{
+	// Calls copy(first, count) for each run of sources that are stride apart, first being the index in the table
+	template<class Copy>
+	void ForEachRun(const uint64_t* sources, uint32_t count, uint64_t stride, Copy&& copy)
+	{
+		uint32_t first = 0;
+		for (uint32_t i = 1; i <= count; i++)
+		{
+			if (i == count || sources[i] != sources[i - 1] + stride)
+			{
+				copy(first, i - first);
+				first = i;
+			}
+		}
+	}
+
+	// Ranges and the per-frame table cache
+	class Tables
+	{
+	public:
+		explicit Tables(uint32_t capacity = 0)
+		{
+			Reset(capacity);
+		}
+
+		// The capacity is rounded down to a multiple of 256 descriptors
+		void Reset(uint32_t capacity)
+		{
+			mRing.Reset(capacity);
+			mCache.clear();
+			mSources.clear();
+			mCopied = mTables = mHits = 0;
+			mLastCopied = mLastTables = mLastHits = 0;
+		}
+
+		// First slot of the table, hit is set when this frame already holds the same sources there
+		uint32_t Allocate(const uint64_t* sources, uint32_t count, bool& hit)
+		{
+			const uint64_t hash = Hash(sources, count);
+			mTables++;
+			auto& entries = mCache[hash];
+			for (const auto& entry : entries)
+			{
+				if (entry.count == count && std::equal(sources, sources + count, mSources.begin() + entry.source))
+				{
+					hit = true;
+					mHits++;
+					return entry.first;
+				}
+			}
+			const uint64_t first = mRing.Allocate(count, 1);
+			if (first == ConstantRing::Ring::Invalid)
+				throw std::runtime_error("Descriptor ring is full.");
+			entries.push_back({ static_cast<uint32_t>(first), count, mSources.size() });
+			mSources.insert(mSources.end(), sources, sources + count);
+			mCopied += count;
+			hit = false;
+			return static_cast<uint32_t>(first);
+		}
+
+		void Close(uint64_t fenceValue)
+		{
+			mRing.Close(fenceValue);
+			mCache.clear();
+			mSources.clear();
+			mLastCopied = mCopied;
+			mLastTables = mTables;
+			mLastHits = mHits;
+			mCopied = mTables = mHits = 0;
+		}
+
+		void Retire(uint64_t completedValue) { mRing.Retire(completedValue); }
+
+		uint32_t Capacity() const { return static_cast<uint32_t>(mRing.Capacity()); }
+		uint64_t Used() const { return mRing.Used(); }
+		uint32_t LastFrameCopied() const { return mLastCopied; }
+		uint32_t LastFrameTables() const { return mLastTables; }
+		uint32_t LastFrameHits() const { return mLastHits; }
+
+	private:
+		struct Entry
+		{
+			uint32_t first;
+			uint32_t count;
+			size_t source; // Into mSources
+		};
+
+		static uint64_t Hash(const uint64_t* sources, uint32_t count)
+		{
+			uint64_t hash = 14695981039346656037ull; // FNV-1a over the handles
+			for (uint32_t i = 0; i < count; i++)
+			{
+				hash ^= sources[i];
+				hash *= 1099511628211ull;
+			}
+			return hash;
+		}
+
+		ConstantRing::Ring mRing;
+		std::unordered_map<uint64_t, std::vector<Entry>> mCache;
+		std::vector<uint64_t> mSources;
+		uint32_t mCopied = 0;
+		uint32_t mTables = 0;
+		uint32_t mHits = 0;
+		uint32_t mLastCopied = 0;
+		uint32_t mLastTables = 0;
+		uint32_t mLastHits = 0;
+	};
+
+#if defined(__d3d12_h__)
+	class Allocator
+	{
+	public:
+		void Create(ID3D12Device* device, uint32_t capacity)
+		{
+			mDevice = device;
+			mTables.Reset(capacity);
+			D3D12_DESCRIPTOR_HEAP_DESC heapDesc = {};
+			heapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+			heapDesc.NumDescriptors = mTables.Capacity();
+			heapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+			if (FAILED(device->CreateDescriptorHeap(&heapDesc, IID_PPV_ARGS(&mHeap))))
+				throw std::runtime_error("Cannot create the descriptor ring.");
+			mStride = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+			mCpuStart = mHeap->GetCPUDescriptorHandleForHeapStart();
+			mGpuStart = mHeap->GetGPUDescriptorHandleForHeapStart();
+		}
+
+		// Sources live in non-visible heaps and must not change until the frame is closed
+		D3D12_GPU_DESCRIPTOR_HANDLE Push(const D3D12_CPU_DESCRIPTOR_HANDLE* sources, uint32_t count)
+		{
+			mScratch.resize(count);
+			for (uint32_t i = 0; i < count; i++)
+				mScratch[i] = sources[i].ptr;
+			bool hit;
+			const uint32_t first = mTables.Allocate(mScratch.data(), count, hit);
+			if (!hit)
+			{
+				ForEachRun(mScratch.data(), count, mStride, [&](uint32_t run, uint32_t length) {
+					const D3D12_CPU_DESCRIPTOR_HANDLE dst = { mCpuStart.ptr + SIZE_T(first + run) * mStride };
+					mDevice->CopyDescriptorsSimple(length, dst, sources[run], D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+				});
+			}
+			return { mGpuStart.ptr + uint64_t(first) * mStride };
+		}
+
+		void Close(uint64_t fenceValue) { mTables.Close(fenceValue); }
+		void Retire(uint64_t completedValue) { mTables.Retire(completedValue); }
+
+		ID3D12DescriptorHeap* Heap() const { return mHeap.Get(); }
+		const Tables& Ranges() const { return mTables; }
+
+	private:
+		ID3D12Device* mDevice = nullptr;
+		Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mHeap;
+		D3D12_CPU_DESCRIPTOR_HANDLE mCpuStart = {};
+		D3D12_GPU_DESCRIPTOR_HANDLE mGpuStart = {};
+		uint32_t mStride = 0;
+		Tables mTables;
+		std::vector<uint64_t> mScratch;
+	};
+#endif
+}
@@ -0,0 +1,416 @@
+#pragma once
+
+// Asset files streamed to the GPU without a staging copy
+// The file is mapped in windows, 64KB-aligned as both MapViewOfFile() and placed resources need, and each mapped
+// window is opened as a heap with OpenExistingHeapFromAddress(). A cross-adapter buffer placed on that heap is the
+// source of CopyBufferRegion()/CopyTextureRegion() straight into default-heap resources, so the bytes go from the
+// page cache to the GPU with no memcpy into an upload buffer. Windows are mapped when a copy first reads them and
+// unmapped once the fence of the last batch reading them completes, which bounds the resident file pages. The tail
+// after the last 64KB boundary cannot be a heap; it goes through a small upload buffer, so assets meant for
+// streaming are padded with PaddedSize().
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace FileStreaming
+{
+	// Allocation granularity of Windows and D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT
+	constexpr uint64_t Granularity = 64 * 1024;
+	constexpr uint64_t DefaultWindowSize = 4 * 1024 * 1024;
+	constexpr uint32_t Invalid = ~0u;
+
+	inline uint64_t AlignUp(uint64_t size, uint64_t alignment = Granularity)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	// Size an asset should be written with, so no byte of it goes through the tail
+	inline uint64_t PaddedSize(uint64_t size) { return AlignUp(size); }
+
+	// Read-only file mapped in copy-on-write views, which the device can open as heaps
+	// It may be deleted while open, the data lives until Close()
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		~MappedFile() { Close(); }
+
+		void Open(const char* path)
+		{
+			Close();
+#if defined(_WIN32)
+			mFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			LARGE_INTEGER size = {};
+			if (mFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(mFile, &size))
+				throw std::runtime_error(std::string("Cannot open ") + path + ".");
+			mSize = size.QuadPart;
+			mMapping = mSize ? CreateFileMappingA(mFile, nullptr, PAGE_WRITECOPY, 0, 0, nullptr) : nullptr;
+			if (mSize && !mMapping)
+				throw std::runtime_error(std::string("Cannot map ") + path + ".");
+#else
+			mFile = open(path, O_RDONLY);
+			struct stat st = {};
+			if (mFile < 0 || fstat(mFile, &st) != 0)
+				throw std::runtime_error(std::string("Cannot open ") + path + ".");
+			mSize = st.st_size;
+#endif
+		}
+
+		void Close()
+		{
+#if defined(_WIN32)
+			if (mMapping)
+				CloseHandle(mMapping);
+			if (mFile != INVALID_HANDLE_VALUE)
+				CloseHandle(mFile);
+			mMapping = nullptr;
+			mFile = INVALID_HANDLE_VALUE;
+#else
+			if (mFile >= 0)
+				close(mFile);
+			mFile = -1;
+#endif
+			mSize = 0;
+		}
+
+		// offset is a multiple of the granularity and the view ends within the file
+		uint8_t* Map(uint64_t offset, uint64_t size) const
+		{
+			if (offset % Granularity || size == 0 || offset + size > mSize)
+				throw std::runtime_error("File view is unaligned or past the end.");
+#if defined(_WIN32)
+			void* data = MapViewOfFile(mMapping, FILE_MAP_COPY, DWORD(offset >> 32), DWORD(offset), SIZE_T(size));
+			if (!data)
+				throw std::runtime_error("Cannot map a file view.");
+#else
+			void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, mFile, off_t(offset));
+			if (data == MAP_FAILED)
+				throw std::runtime_error("Cannot map a file view.");
+			madvise(data, size, MADV_SEQUENTIAL);
+#endif
+			return static_cast<uint8_t*>(data);
+		}
+
+		static void Unmap(uint8_t* data, uint64_t size)
+		{
+#if defined(_WIN32)
+			(void)size;
+			UnmapViewOfFile(data);
+#else
+			munmap(data, size);
+#endif
+		}
+
+		uint64_t Size() const { return mSize; }
+
+	private:
+#if defined(_WIN32)
+		HANDLE mFile = INVALID_HANDLE_VALUE;
+		HANDLE mMapping = nullptr;
+#else
+		int mFile = -1;
+#endif
+		uint64_t mSize = 0;
+	};
+
+	// Mapped windows and the last batch reading each
+	class WindowTable
+	{
+	public:
+		struct Window
+		{
+			uint64_t offset;
+			uint64_t size;
+		};
+
+		// windowSize is rounded up to the granularity
+		void Reset(uint64_t fileSize, uint64_t windowSize = DefaultWindowSize)
+		{
+			mFileSize = fileSize;
+			mWindowSize = AlignUp((std::max)(windowSize, uint64_t(1)));
+			mBulk = fileSize / Granularity * Granularity;
+			mStates.assign(static_cast<size_t>(AlignUp(mBulk, mWindowSize) / mWindowSize), State());
+			mPending.clear();
+			mMapped = mPeakMapped = 0;
+			mMappedBytes = mPeakMappedBytes = 0;
+		}
+
+		uint32_t Count() const { return static_cast<uint32_t>(mStates.size()); }
+		uint64_t Bulk() const { return mBulk; } // Bytes covered by windows, the rest is the tail
+
+		Window Get(uint32_t index) const
+		{
+			const uint64_t offset = uint64_t(index) * mWindowSize;
+			return { offset, (std::min)(mWindowSize, mBulk - offset) };
+		}
+
+		// Window holding the byte at offset, Invalid in the tail
+		uint32_t Find(uint64_t offset) const
+		{
+			return offset < mBulk ? static_cast<uint32_t>(offset / mWindowSize) : Invalid;
+		}
+
+		// The open batch reads the window, true when it has to be mapped first
+		bool Use(uint32_t index)
+		{
+			auto& state = mStates.at(index);
+			state.open = true;
+			if (state.mapped)
+				return false;
+			state.mapped = true;
+			mMapped++;
+			mMappedBytes += Get(index).size;
+			mPeakMapped = (std::max)(mPeakMapped, mMapped);
+			mPeakMappedBytes = (std::max)(mPeakMappedBytes, mMappedBytes);
+			return true;
+		}
+
+		// Windows read since the previous Close() stay mapped until fenceValue completes
+		void Close(uint64_t fenceValue)
+		{
+			for (uint32_t i = 0; i < mStates.size(); i++)
+			{
+				if (!mStates[i].open)
+					continue;
+				mStates[i].open = false;
+				mStates[i].fenceValue = fenceValue;
+				mPending.push_back({ fenceValue, i });
+			}
+		}
+
+		// Windows to unmap, no batch in flight or open reads them any more
+		std::vector<uint32_t> Retire(uint64_t completedValue)
+		{
+			std::vector<uint32_t> unmapped;
+			while (!mPending.empty() && mPending.front().fenceValue <= completedValue)
+			{
+				auto& state = mStates[mPending.front().index];
+				if (state.mapped && !state.open && state.fenceValue == mPending.front().fenceValue)
+				{
+					state.mapped = false;
+					mMapped--;
+					mMappedBytes -= Get(mPending.front().index).size;
+					unmapped.push_back(mPending.front().index);
+				}
+				mPending.pop_front();
+			}
+			return unmapped;
+		}
+
+		// Calls copy(window, offset in the window, size, offset in the range) for each window the range crosses,
+		// window being Invalid for the part in the tail
+		template<class Copy>
+		void ForEachWindow(uint64_t offset, uint64_t size, Copy&& copy) const
+		{
+			if (offset + size > mFileSize)
+				throw std::runtime_error("Streamed range is past the end of the file.");
+			for (uint64_t done = 0; done < size;)
+			{
+				const uint64_t at = offset + done;
+				const uint32_t index = Find(at);
+				const uint64_t start = index == Invalid ? mBulk : Get(index).offset;
+				const uint64_t end = index == Invalid ? mFileSize : start + Get(index).size;
+				const uint64_t length = (std::min)(size - done, end - at);
+				copy(index, at - start, length, done);
+				done += length;
+			}
+		}
+
+		bool Mapped(uint32_t index) const { return mStates.at(index).mapped; }
+		uint32_t MappedCount() const { return mMapped; }
+		uint32_t PeakMapped() const { return mPeakMapped; }
+		uint64_t PeakMappedBytes() const { return mPeakMappedBytes; }
+
+	private:
+		struct State
+		{
+			bool mapped = false;
+			bool open = false; // Read by the batch not closed yet
+			uint64_t fenceValue = 0;
+		};
+
+		struct Pending
+		{
+			uint64_t fenceValue;
+			uint32_t index;
+		};
+
+		uint64_t mFileSize = 0;
+		uint64_t mWindowSize = DefaultWindowSize;
+		uint64_t mBulk = 0;
+		std::vector<State> mStates;
+		std::deque<Pending> mPending;
+		uint32_t mMapped = 0;
+		uint32_t mPeakMapped = 0;
+		uint64_t mMappedBytes = 0;
+		uint64_t mPeakMappedBytes = 0;
+	};
+
+#if defined(__d3d12_h__)
+	// Copies from a mapped file on the queue of the command lists passed in, which may be a copy queue
+	class Reader
+	{
+	public:
+		void Open(ID3D12Device3* device, const char* path, uint64_t windowSize = DefaultWindowSize)
+		{
+			mDevice = device;
+			mFile.Open(path);
+			mTable.Reset(mFile.Size(), windowSize);
+			mViews.assign(mTable.Count(), View());
+			mTail.Reset();
+			const uint64_t tailSize = mFile.Size() - mTable.Bulk();
+			if (tailSize == 0)
+				return;
+			// The only bytes copied on the CPU, less than one granule
+			D3D12_HEAP_PROPERTIES heapProp = {};
+			heapProp.Type = D3D12_HEAP_TYPE_UPLOAD;
+			auto resDesc = BufferDesc(Granularity, D3D12_RESOURCE_FLAG_NONE);
+			if (FAILED(device->CreateCommittedResource(&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+				D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mTail))))
+				throw std::runtime_error("Cannot create the file tail buffer.");
+			void* tail;
+			const D3D12_RANGE noRead = {};
+			if (FAILED(mTail->Map(0, &noRead, &tail)))
+				throw std::runtime_error("Cannot map the file tail buffer.");
+			uint8_t* view = mFile.Map(mTable.Bulk(), tailSize);
+			memcpy(tail, view, static_cast<size_t>(tailSize));
+			MappedFile::Unmap(view, tailSize);
+			mTail->Unmap(0, nullptr);
+		}
+
+		// Unmaps every window, once no batch reading them is in flight
+		void Release()
+		{
+			for (uint32_t i = 0; i < mViews.size(); i++)
+				Unmap(i);
+			mTail.Reset();
+			mFile.Close();
+		}
+
+		~Reader() { Release(); }
+
+		void CopyBuffer(ID3D12GraphicsCommandList* cmdList, ID3D12Resource* dst, uint64_t dstOffset, uint64_t fileOffset, uint64_t size)
+		{
+			mTable.ForEachWindow(fileOffset, size, [&](uint32_t window, uint64_t offset, uint64_t length, uint64_t done) {
+				cmdList->CopyBufferRegion(dst, dstOffset + done, Source(window), offset, length);
+			});
+		}
+
+		// The file holds the subresource in the layout of footprint, from fileOffset + footprint.Offset, within one
+		// window and 512-byte aligned in it as any placed footprint
+		void CopyTexture(ID3D12GraphicsCommandList* cmdList, ID3D12Resource* dst, UINT subresource,
+			const D3D12_PLACED_SUBRESOURCE_FOOTPRINT& footprint, uint64_t fileOffset)
+		{
+			const uint64_t start = fileOffset + footprint.Offset;
+			const uint64_t size = uint64_t(footprint.Footprint.RowPitch) * footprint.Footprint.Height * footprint.Footprint.Depth;
+			uint32_t calls = 0;
+			D3D12_TEXTURE_COPY_LOCATION src = {};
+			src.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+			src.PlacedFootprint = footprint;
+			mTable.ForEachWindow(start, size, [&](uint32_t window, uint64_t offset, uint64_t, uint64_t) {
+				src.pResource = Source(window);
+				src.PlacedFootprint.Offset = offset;
+				calls++;
+			});
+			if (calls != 1 || src.PlacedFootprint.Offset % D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT)
+				throw std::runtime_error("Streamed texture crosses a window or is unaligned.");
+			D3D12_TEXTURE_COPY_LOCATION dstLocation = {};
+			dstLocation.pResource = dst;
+			dstLocation.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+			dstLocation.SubresourceIndex = subresource;
+			cmdList->CopyTextureRegion(&dstLocation, 0, 0, 0, &src, nullptr);
+		}
+
+		// Copies recorded since the previous Close() read the file until fenceValue completes
+		void Close(uint64_t fenceValue) { mTable.Close(fenceValue); }
+
+		void Retire(uint64_t completedValue)
+		{
+			for (uint32_t window : mTable.Retire(completedValue))
+				Unmap(window);
+		}
+
+		uint64_t Size() const { return mFile.Size(); }
+		const WindowTable& Windows() const { return mTable; }
+
+	private:
+		struct View
+		{
+			uint8_t* data = nullptr;
+			Microsoft::WRL::ComPtr<ID3D12Heap> heap;
+			Microsoft::WRL::ComPtr<ID3D12Resource> buffer;
+		};
+
+		static D3D12_RESOURCE_DESC BufferDesc(uint64_t size, D3D12_RESOURCE_FLAGS flags)
+		{
+			D3D12_RESOURCE_DESC resDesc = {};
+			resDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+			resDesc.Width = size;
+			resDesc.Height = 1;
+			resDesc.DepthOrArraySize = 1;
+			resDesc.MipLevels = 1;
+			resDesc.SampleDesc.Count = 1;
+			resDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+			resDesc.Flags = flags;
+			return resDesc;
+		}
+
+		ID3D12Resource* Source(uint32_t window)
+		{
+			if (window == Invalid)
+				return mTail.Get();
+			auto& view = mViews[window];
+			if (mTable.Mapped(window))
+			{
+				mTable.Use(window);
+				return view.buffer.Get();
+			}
+			// The table marks the window mapped only once the view opened, a throw leaves it untouched
+			const auto range = mTable.Get(window);
+			view.data = mFile.Map(range.offset, range.size);
+			// The heap comes out SHARED_CROSS_ADAPTER, which only takes ALLOW_CROSS_ADAPTER row-major buffers
+			auto resDesc = BufferDesc(range.size, D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER | D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
+			if (FAILED(mDevice->OpenExistingHeapFromAddress(view.data, IID_PPV_ARGS(&view.heap))) ||
+				FAILED(mDevice->CreatePlacedResource(view.heap.Get(), 0, &resDesc,
+					D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&view.buffer))))
+			{
+				Unmap(window);
+				throw std::runtime_error("Cannot open a file view as a heap.");
+			}
+			mTable.Use(window);
+			return view.buffer.Get();
+		}
+
+		void Unmap(uint32_t window)
+		{
+			auto& view = mViews[window];
+			view.buffer.Reset();
+			view.heap.Reset();
+			if (view.data)
+				MappedFile::Unmap(view.data, mTable.Get(window).size);
+			view.data = nullptr;
+		}
+
+		ID3D12Device3* mDevice = nullptr;
+		MappedFile mFile;
+		WindowTable mTable;
+		std::vector<View> mViews;
+		Microsoft::WRL::ComPtr<ID3D12Resource> mTail;
+	};
+#endif
+}
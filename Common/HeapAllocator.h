@@ -0,0 +1,698 @@
+#pragma once
+
+// Placed resources sub-allocated from large heaps
+// Each heap type and flags class (buffers, render target and depth textures, other textures, as tier 1 hardware
+// requires) gets a pool of heaps. A heap is carved by a two level segregated fit: free blocks are binned by the
+// power of two of their size and 16 linear steps within it, two bitmaps find a bin that is large enough in
+// constant time, and freed blocks merge with free neighbors at once. Offsets and sizes are multiples of 4KB, so
+// small textures keep their small placement alignment while buffers and larger textures take 64KB. Resources
+// larger than a heap get a dedicated heap, released with them. Defragment() moves allocations out of the emptiest
+// heaps; the old ranges stay reserved until the caller has copied the data and calls FinishMoves().
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace HeapAllocator
+{
+	constexpr uint64_t SmallAlignment = 4 * 1024;     // D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT
+	constexpr uint64_t DefaultAlignment = 64 * 1024;  // D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT
+	constexpr uint64_t DefaultHeapSize = 64ull << 20;
+	constexpr uint32_t Invalid = ~0u;
+
+	inline uint64_t AlignUp(uint64_t size, uint64_t alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	// Two level segregated fit over one heap
+	class Tlsf
+	{
+	public:
+		explicit Tlsf(uint64_t capacity)
+		{
+			mCapacity = capacity / SmallAlignment * SmallAlignment;
+			for (auto& heads : mHeads)
+			{
+				for (auto& head : heads)
+					head = Invalid;
+			}
+			if (mCapacity)
+				InsertFree(NewBlock({ 0, mCapacity, Invalid, Invalid, Invalid, Invalid, true }));
+		}
+
+		// Block index, Invalid when no free block fits. Alignment is a power of two.
+		uint32_t Allocate(uint64_t size, uint64_t alignment = SmallAlignment)
+		{
+			size = AlignUp(size ? size : 1, SmallAlignment);
+			alignment = alignment < SmallAlignment ? SmallAlignment : alignment;
+			if (size > mCapacity)
+				return Invalid;
+			uint32_t block = FindFree(size, alignment);
+			if (block == Invalid)
+				return Invalid;
+			RemoveFree(block);
+			const uint64_t aligned = AlignUp(mBlocks[block].offset, alignment);
+			if (aligned > mBlocks[block].offset)
+			{
+				const uint32_t front = block;
+				block = Split(front, aligned - mBlocks[front].offset);
+				InsertFree(front);
+			}
+			if (mBlocks[block].size > size)
+				InsertFree(Split(block, size));
+			mBlocks[block].free = false;
+			mUsed += mBlocks[block].size;
+			mAllocations++;
+			return block;
+		}
+
+		void Free(uint32_t block)
+		{
+			if (block >= mBlocks.size() || mBlocks[block].free)
+				throw std::runtime_error("Freeing a heap block that is not allocated.");
+			mUsed -= mBlocks[block].size;
+			mAllocations--;
+			mBlocks[block].free = true;
+			const uint32_t next = mBlocks[block].nextPhys;
+			if (next != Invalid && mBlocks[next].free)
+			{
+				RemoveFree(next);
+				Merge(block, next);
+			}
+			const uint32_t prev = mBlocks[block].prevPhys;
+			if (prev != Invalid && mBlocks[prev].free)
+			{
+				RemoveFree(prev);
+				Merge(prev, block);
+				block = prev;
+			}
+			InsertFree(block);
+		}
+
+		uint64_t Offset(uint32_t block) const { return mBlocks[block].offset; }
+		uint64_t Size(uint32_t block) const { return mBlocks[block].size; }
+		uint64_t Capacity() const { return mCapacity; }
+		uint64_t Used() const { return mUsed; }
+		uint32_t Allocations() const { return mAllocations; }
+		uint32_t FreeBlocks() const { return mFreeBlocks; }
+
+		uint64_t LargestFree() const
+		{
+			if (!mFlBitmap)
+				return 0;
+			const uint32_t fl = HighestBit(mFlBitmap);
+			uint64_t largest = 0;
+			for (uint32_t block = mHeads[fl][HighestBit(mSlBitmap[fl])]; block != Invalid; block = mBlocks[block].nextFree)
+				largest = largest < mBlocks[block].size ? mBlocks[block].size : largest;
+			return largest;
+		}
+
+	private:
+		static constexpr uint32_t SlLog2 = 4;
+		static constexpr uint32_t SlCount = 1 << SlLog2;
+		static constexpr uint32_t FlCount = 32;
+
+		struct Block
+		{
+			uint64_t offset;
+			uint64_t size;
+			uint32_t prevPhys; // Neighbors in the heap
+			uint32_t nextPhys;
+			uint32_t prevFree; // Neighbors in the bin
+			uint32_t nextFree;
+			bool free;
+		};
+
+		static uint32_t HighestBit(uint64_t bits)
+		{
+			uint32_t bit = 0;
+			while (bits >>= 1)
+				bit++;
+			return bit;
+		}
+
+		static uint32_t LowestBit(uint32_t bits)
+		{
+			uint32_t bit = 0;
+			while (!(bits & 1))
+			{
+				bits >>= 1;
+				bit++;
+			}
+			return bit;
+		}
+
+		// Bin of a size in 4KB pages: linear below SlCount pages, then SlCount steps per power of two
+		static void Mapping(uint64_t size, uint32_t& fl, uint32_t& sl)
+		{
+			const uint64_t pages = size / SmallAlignment;
+			if (pages < SlCount)
+			{
+				fl = 0;
+				sl = static_cast<uint32_t>(pages);
+				return;
+			}
+			const uint32_t log = HighestBit(pages);
+			fl = log - SlLog2 + 1;
+			sl = static_cast<uint32_t>(pages >> (log - SlLog2)) - SlCount;
+		}
+
+		uint32_t FindFree(uint64_t size, uint64_t alignment) const
+		{
+			// Padded for the alignment and rounded up to the next bin, any block there fits
+			const uint64_t padded = size + alignment - SmallAlignment;
+			uint64_t rounded = padded;
+			const uint64_t pages = padded / SmallAlignment;
+			if (pages >= SlCount)
+				rounded += ((uint64_t(1) << (HighestBit(pages) - SlLog2)) - 1) * SmallAlignment;
+			uint32_t fl, sl;
+			Mapping(rounded, fl, sl);
+			const uint32_t bin = fl * SlCount + sl;
+			uint32_t slMap = fl < FlCount ? mSlBitmap[fl] & (~0u << sl) : 0;
+			if (!slMap && fl + 1 < FlCount)
+			{
+				const uint32_t flMap = mFlBitmap & (~0u << (fl + 1));
+				if (flMap)
+				{
+					fl = LowestBit(flMap);
+					slMap = mSlBitmap[fl];
+				}
+			}
+			if (slMap)
+				return mHeads[fl][LowestBit(slMap)];
+			// Bins below may still hold a block that fits, when it is large enough or happens to be aligned
+			Mapping(size, fl, sl);
+			for (uint32_t b = fl * SlCount + sl; b < bin && b < FlCount * SlCount; b++)
+			{
+				for (uint32_t block = mHeads[b / SlCount][b % SlCount]; block != Invalid; block = mBlocks[block].nextFree)
+				{
+					if (AlignUp(mBlocks[block].offset, alignment) + size <= mBlocks[block].offset + mBlocks[block].size)
+						return block;
+				}
+			}
+			return Invalid;
+		}
+
+		void InsertFree(uint32_t block)
+		{
+			uint32_t fl, sl;
+			Mapping(mBlocks[block].size, fl, sl);
+			auto& b = mBlocks[block];
+			b.free = true;
+			b.prevFree = Invalid;
+			b.nextFree = mHeads[fl][sl];
+			if (b.nextFree != Invalid)
+				mBlocks[b.nextFree].prevFree = block;
+			mHeads[fl][sl] = block;
+			mFlBitmap |= 1u << fl;
+			mSlBitmap[fl] |= 1u << sl;
+			mFreeBlocks++;
+		}
+
+		void RemoveFree(uint32_t block)
+		{
+			uint32_t fl, sl;
+			Mapping(mBlocks[block].size, fl, sl);
+			const auto& b = mBlocks[block];
+			if (b.prevFree != Invalid)
+				mBlocks[b.prevFree].nextFree = b.nextFree;
+			else
+				mHeads[fl][sl] = b.nextFree;
+			if (b.nextFree != Invalid)
+				mBlocks[b.nextFree].prevFree = b.prevFree;
+			if (mHeads[fl][sl] == Invalid)
+			{
+				mSlBitmap[fl] &= ~(1u << sl);
+				if (!mSlBitmap[fl])
+					mFlBitmap &= ~(1u << fl);
+			}
+			mFreeBlocks--;
+		}
+
+		// Keeps size bytes in block, returns the block of the rest
+		uint32_t Split(uint32_t block, uint64_t size)
+		{
+			const uint32_t rest = NewBlock({ mBlocks[block].offset + size, mBlocks[block].size - size, block, mBlocks[block].nextPhys, Invalid, Invalid, false });
+			if (mBlocks[rest].nextPhys != Invalid)
+				mBlocks[mBlocks[rest].nextPhys].prevPhys = rest;
+			mBlocks[block].nextPhys = rest;
+			mBlocks[block].size = size;
+			return rest;
+		}
+
+		// Appends next to block and recycles it
+		void Merge(uint32_t block, uint32_t next)
+		{
+			mBlocks[block].size += mBlocks[next].size;
+			mBlocks[block].nextPhys = mBlocks[next].nextPhys;
+			if (mBlocks[next].nextPhys != Invalid)
+				mBlocks[mBlocks[next].nextPhys].prevPhys = block;
+			mUnusedBlocks.push_back(next);
+		}
+
+		uint32_t NewBlock(const Block& b)
+		{
+			if (mUnusedBlocks.empty())
+			{
+				mBlocks.push_back(b);
+				return static_cast<uint32_t>(mBlocks.size() - 1);
+			}
+			const uint32_t block = mUnusedBlocks.back();
+			mUnusedBlocks.pop_back();
+			mBlocks[block] = b;
+			return block;
+		}
+
+		std::vector<Block> mBlocks;
+		std::vector<uint32_t> mUnusedBlocks;
+		uint32_t mHeads[FlCount][SlCount];
+		uint32_t mFlBitmap = 0;
+		uint32_t mSlBitmap[FlCount] = {};
+		uint64_t mCapacity = 0;
+		uint64_t mUsed = 0;
+		uint32_t mAllocations = 0;
+		uint32_t mFreeBlocks = 0;
+	};
+
+	// Creates and destroys the memory behind the heaps of a pool, a device or a fake for tests
+	class Backend
+	{
+	public:
+		virtual ~Backend() = default;
+		virtual bool CreateHeap(uint32_t heap, uint64_t size, uint64_t alignment) = 0;
+		virtual void DestroyHeap(uint32_t heap) = 0;
+	};
+
+	struct Placement
+	{
+		uint32_t heap;
+		uint64_t offset;
+		uint64_t size; // Rounded to 4KB
+	};
+
+	struct Move
+	{
+		uint32_t allocation;
+		Placement from;
+		Placement to;
+	};
+
+	struct Stats
+	{
+		uint32_t heaps = 0;
+		uint32_t allocations = 0;
+		uint32_t freeBlocks = 0;
+		uint64_t heapBytes = 0;
+		uint64_t usedBytes = 0;
+		uint64_t largestFree = 0;
+
+		uint64_t FreeBytes() const { return heapBytes - usedBytes; }
+		// 0 when all free memory is one block, towards 1 as it scatters
+		double Fragmentation() const { return FreeBytes() ? 1.0 - double(largestFree) / FreeBytes() : 0.0; }
+
+		void Add(const Stats& other)
+		{
+			heaps += other.heaps;
+			allocations += other.allocations;
+			freeBlocks += other.freeBlocks;
+			heapBytes += other.heapBytes;
+			usedBytes += other.usedBytes;
+			largestFree = largestFree < other.largestFree ? other.largestFree : largestFree;
+		}
+	};
+
+	// Heaps of one type and flags class
+	class Pool
+	{
+	public:
+		explicit Pool(Backend& backend, uint64_t heapSize = DefaultHeapSize)
+			: mBackend(backend), mHeapSize(AlignUp(heapSize, DefaultAlignment))
+		{
+		}
+
+		~Pool()
+		{
+			for (uint32_t heap = 0; heap < mHeaps.size(); heap++)
+			{
+				if (mHeaps[heap].tlsf)
+					mBackend.DestroyHeap(heap);
+			}
+		}
+
+		Pool(const Pool&) = delete;
+		Pool& operator=(const Pool&) = delete;
+
+		// Allocation index, stable until Free()
+		uint32_t Allocate(uint64_t size, uint64_t alignment)
+		{
+			size = AlignUp(size ? size : 1, SmallAlignment);
+			alignment = alignment < SmallAlignment ? SmallAlignment : alignment;
+			uint32_t heap = Invalid, block = Invalid;
+			if (size + alignment - SmallAlignment > mHeapSize)
+			{
+				heap = CreateHeap(AlignUp(size, DefaultAlignment), alignment, true);
+				block = mHeaps[heap].tlsf->Allocate(size, alignment);
+			}
+			else
+			{
+				for (uint32_t h = 0; h < mHeaps.size() && block == Invalid; h++)
+				{
+					if (mHeaps[h].tlsf && !mHeaps[h].dedicated)
+					{
+						heap = h;
+						block = mHeaps[h].tlsf->Allocate(size, alignment);
+					}
+				}
+				if (block == Invalid)
+				{
+					heap = CreateHeap(mHeapSize, DefaultAlignment, false);
+					block = mHeaps[heap].tlsf->Allocate(size, alignment);
+				}
+			}
+			if (block == Invalid)
+				throw std::runtime_error("Placed resource does not fit a fresh heap.");
+			uint32_t allocation;
+			if (mUnusedAllocations.empty())
+			{
+				allocation = static_cast<uint32_t>(mAllocations.size());
+				mAllocations.emplace_back();
+			}
+			else
+			{
+				allocation = mUnusedAllocations.back();
+				mUnusedAllocations.pop_back();
+			}
+			mAllocations[allocation] = { heap, block, alignment, true };
+			return allocation;
+		}
+
+		// The caller makes sure the GPU no longer uses the memory
+		void Free(uint32_t allocation)
+		{
+			if (allocation >= mAllocations.size() || !mAllocations[allocation].live)
+				throw std::runtime_error("Freeing a heap allocation that is not live.");
+			auto& a = mAllocations[allocation];
+			FreeBlock(a.heap, a.block);
+			a.live = false;
+			mUnusedAllocations.push_back(allocation);
+		}
+
+		Placement Get(uint32_t allocation) const
+		{
+			const auto& a = mAllocations[allocation];
+			const auto& tlsf = *mHeaps[a.heap].tlsf;
+			return { a.heap, tlsf.Offset(a.block), tlsf.Size(a.block) };
+		}
+
+		// Moves allocations of the emptiest heaps into fuller ones, or lower in their own heap, up to maxBytes.
+		// Get() returns the new placements at once; the old ones stay reserved until FinishMoves().
+		std::vector<Move> Defragment(uint64_t maxBytes)
+		{
+			std::vector<uint32_t> heaps;
+			for (uint32_t h = 0; h < mHeaps.size(); h++)
+			{
+				if (mHeaps[h].tlsf && !mHeaps[h].dedicated && mHeaps[h].tlsf->Allocations())
+					heaps.push_back(h);
+			}
+			std::vector<double> occupancy(mHeaps.size(), 0.0);
+			for (uint32_t h : heaps)
+				occupancy[h] = double(mHeaps[h].tlsf->Used()) / mHeaps[h].tlsf->Capacity();
+			std::stable_sort(heaps.begin(), heaps.end(), [&](uint32_t a, uint32_t b) { return occupancy[a] < occupancy[b]; });
+
+			std::vector<std::vector<uint32_t>> heapAllocations(mHeaps.size());
+			for (uint32_t a = 0; a < mAllocations.size(); a++)
+			{
+				if (mAllocations[a].live)
+					heapAllocations[mAllocations[a].heap].push_back(a);
+			}
+
+			std::vector<Move> moves;
+			uint64_t moved = 0;
+			for (size_t source = 0; source < heaps.size() && moved < maxBytes; source++)
+			{
+				const uint32_t heap = heaps[source];
+				// Allocations moved here from an earlier source stay put
+				auto& candidates = heapAllocations[heap];
+				// Highest first, so the heap empties from its end
+				std::stable_sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+					return mHeaps[heap].tlsf->Offset(mAllocations[a].block) > mHeaps[heap].tlsf->Offset(mAllocations[b].block);
+				});
+				for (uint32_t a : candidates)
+				{
+					const Placement from = Get(a);
+					if (moved + from.size > maxBytes)
+						break;
+					const uint64_t alignment = mAllocations[a].alignment;
+					uint32_t target = Invalid, block = Invalid;
+					// Fullest heaps first, the source heap itself last
+					for (size_t t = heaps.size(); t-- > source && block == Invalid;)
+					{
+						target = heaps[t];
+						block = mHeaps[target].tlsf->Allocate(from.size, alignment);
+						if (block != Invalid && target == heap && mHeaps[heap].tlsf->Offset(block) > from.offset)
+						{
+							mHeaps[heap].tlsf->Free(block);
+							block = Invalid;
+						}
+					}
+					if (block == Invalid)
+						continue;
+					mPendingFrees.push_back({ heap, mAllocations[a].block });
+					mAllocations[a].heap = target;
+					mAllocations[a].block = block;
+					moves.push_back({ a, from, Get(a) });
+					moved += from.size;
+				}
+			}
+			return moves;
+		}
+
+		// The data of the last Defragment() has been copied and the GPU no longer reads the old placements
+		void FinishMoves()
+		{
+			for (const auto& pending : mPendingFrees)
+				FreeBlock(pending.first, pending.second);
+			mPendingFrees.clear();
+		}
+
+		// Releases heaps left empty, a fresh heap is created when needed again
+		void Trim()
+		{
+			for (uint32_t heap = 0; heap < mHeaps.size(); heap++)
+			{
+				if (mHeaps[heap].tlsf && !mHeaps[heap].tlsf->Allocations())
+					DestroyHeap(heap);
+			}
+		}
+
+		Stats GetStats() const
+		{
+			Stats stats;
+			for (const auto& heap : mHeaps)
+			{
+				if (!heap.tlsf)
+					continue;
+				stats.heaps++;
+				stats.allocations += heap.tlsf->Allocations();
+				stats.freeBlocks += heap.tlsf->FreeBlocks();
+				stats.heapBytes += heap.tlsf->Capacity();
+				stats.usedBytes += heap.tlsf->Used();
+				stats.largestFree = (std::max)(stats.largestFree, heap.tlsf->LargestFree());
+			}
+			stats.allocations -= static_cast<uint32_t>(mPendingFrees.size());
+			return stats;
+		}
+
+		uint32_t HeapCount() const { return static_cast<uint32_t>(mHeaps.size()); } // Including released slots
+		bool HeapLive(uint32_t heap) const { return mHeaps[heap].tlsf != nullptr; }
+		uint64_t HeapSize(uint32_t heap) const { return mHeaps[heap].tlsf->Capacity(); }
+
+	private:
+		struct Heap
+		{
+			std::unique_ptr<Tlsf> tlsf; // Null once released
+			bool dedicated;
+		};
+
+		struct Allocation
+		{
+			uint32_t heap;
+			uint32_t block;
+			uint64_t alignment;
+			bool live;
+		};
+
+		uint32_t CreateHeap(uint64_t size, uint64_t alignment, bool dedicated)
+		{
+			uint32_t heap = 0;
+			while (heap < mHeaps.size() && mHeaps[heap].tlsf)
+				heap++;
+			if (heap == mHeaps.size())
+				mHeaps.emplace_back();
+			if (!mBackend.CreateHeap(heap, size, alignment))
+				throw std::runtime_error("Cannot create a heap for placed resources.");
+			mHeaps[heap].tlsf.reset(new Tlsf(size));
+			mHeaps[heap].dedicated = dedicated;
+			return heap;
+		}
+
+		void DestroyHeap(uint32_t heap)
+		{
+			mBackend.DestroyHeap(heap);
+			mHeaps[heap].tlsf.reset();
+		}
+
+		void FreeBlock(uint32_t heap, uint32_t block)
+		{
+			mHeaps[heap].tlsf->Free(block);
+			if (mHeaps[heap].dedicated && !mHeaps[heap].tlsf->Allocations())
+				DestroyHeap(heap);
+		}
+
+		Backend& mBackend;
+		uint64_t mHeapSize;
+		std::vector<Heap> mHeaps;
+		std::vector<Allocation> mAllocations;
+		std::vector<uint32_t> mUnusedAllocations;
+		std::vector<std::pair<uint32_t, uint32_t>> mPendingFrees; // Heap and block
+	};
+
+#if defined(__d3d12_h__)
+	// Heap flags classes of tier 1 resource heaps
+	enum class HeapClass
+	{
+		Buffers,
+		RtDsTextures,
+		OtherTextures,
+		Count,
+	};
+
+	inline HeapClass ClassOf(const D3D12_RESOURCE_DESC& desc)
+	{
+		if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+			return HeapClass::Buffers;
+		if (desc.Flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL))
+			return HeapClass::RtDsTextures;
+		return HeapClass::OtherTextures;
+	}
+
+	struct Allocation
+	{
+		uint32_t pool = Invalid;
+		uint32_t index = Invalid;
+	};
+
+	// Pools per heap type and class over ID3D12Heaps. Placed resources must be released before the allocator.
+	class Allocator
+	{
+	public:
+		void Create(ID3D12Device* device, uint64_t heapSize = DefaultHeapSize)
+		{
+			mDevice = device;
+			const D3D12_HEAP_TYPE types[] = { D3D12_HEAP_TYPE_DEFAULT, D3D12_HEAP_TYPE_UPLOAD, D3D12_HEAP_TYPE_READBACK };
+			const D3D12_HEAP_FLAGS flags[] = { D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS, D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES, D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES };
+			for (auto type : types)
+			{
+				for (auto flag : flags)
+				{
+					mHeaps.emplace_back(new DeviceHeaps(device, type, flag));
+					mPools.emplace_back(new Pool(*mHeaps.back(), heapSize));
+				}
+			}
+		}
+
+		// Small textures get the 4KB placement alignment where the device allows it
+		Allocation CreateResource(D3D12_HEAP_TYPE type, const D3D12_RESOURCE_DESC& desc, D3D12_RESOURCE_STATES state,
+			const D3D12_CLEAR_VALUE* clearValue, ID3D12Resource** resource)
+		{
+			auto placedDesc = desc;
+			D3D12_RESOURCE_ALLOCATION_INFO info = {};
+			if (ClassOf(desc) == HeapClass::OtherTextures && desc.SampleDesc.Count <= 1 && !desc.Alignment)
+			{
+				placedDesc.Alignment = SmallAlignment;
+				info = mDevice->GetResourceAllocationInfo(0, 1, &placedDesc);
+			}
+			if (info.Alignment != SmallAlignment)
+			{
+				placedDesc.Alignment = desc.Alignment;
+				info = mDevice->GetResourceAllocationInfo(0, 1, &placedDesc);
+			}
+			if (info.SizeInBytes == UINT64_MAX)
+				throw std::runtime_error("Invalid placed resource description.");
+			Allocation allocation;
+			allocation.pool = PoolIndex(type, ClassOf(desc));
+			allocation.index = mPools[allocation.pool]->Allocate(info.SizeInBytes, info.Alignment);
+			const auto placement = mPools[allocation.pool]->Get(allocation.index);
+			if (FAILED(mDevice->CreatePlacedResource(mHeaps[allocation.pool]->heaps[placement.heap].Get(), placement.offset,
+				&placedDesc, state, clearValue, IID_PPV_ARGS(resource))))
+			{
+				mPools[allocation.pool]->Free(allocation.index);
+				throw std::runtime_error("Cannot create a placed resource.");
+			}
+			return allocation;
+		}
+
+		void Free(Allocation allocation)
+		{
+			mPools[allocation.pool]->Free(allocation.index);
+		}
+
+		Pool& GetPool(D3D12_HEAP_TYPE type, HeapClass heapClass) { return *mPools[PoolIndex(type, heapClass)]; }
+		ID3D12Heap* Heap(Allocation allocation) const
+		{
+			return mHeaps[allocation.pool]->heaps[mPools[allocation.pool]->Get(allocation.index).heap].Get();
+		}
+
+		Stats GetStats() const
+		{
+			Stats stats;
+			for (const auto& pool : mPools)
+				stats.Add(pool->GetStats());
+			return stats;
+		}
+
+	private:
+		struct DeviceHeaps : Backend
+		{
+			DeviceHeaps(ID3D12Device* device, D3D12_HEAP_TYPE type, D3D12_HEAP_FLAGS flags) : device(device), type(type), flags(flags) {}
+
+			bool CreateHeap(uint32_t heap, uint64_t size, uint64_t alignment) override
+			{
+				if (heap >= heaps.size())
+					heaps.resize(heap + 1);
+				D3D12_HEAP_DESC heapDesc = {};
+				heapDesc.SizeInBytes = size;
+				heapDesc.Properties.Type = type;
+				heapDesc.Alignment = alignment > DefaultAlignment ? alignment : DefaultAlignment;
+				heapDesc.Flags = flags;
+				return SUCCEEDED(device->CreateHeap(&heapDesc, IID_PPV_ARGS(&heaps[heap])));
+			}
+
+			void DestroyHeap(uint32_t heap) override
+			{
+				heaps[heap].Reset();
+			}
+
+			ID3D12Device* device;
+			D3D12_HEAP_TYPE type;
+			D3D12_HEAP_FLAGS flags;
+			std::vector<Microsoft::WRL::ComPtr<ID3D12Heap>> heaps;
+		};
+
+		static uint32_t PoolIndex(D3D12_HEAP_TYPE type, HeapClass heapClass)
+		{
+			if (type < D3D12_HEAP_TYPE_DEFAULT || type > D3D12_HEAP_TYPE_READBACK)
+				throw std::runtime_error("Heap type cannot be sub-allocated.");
+			return (type - D3D12_HEAP_TYPE_DEFAULT) * uint32_t(HeapClass::Count) + uint32_t(heapClass);
+		}
+
+		ID3D12Device* mDevice = nullptr;
+		// Pools are destroyed first, they release their heaps through the backends
+		std::vector<std::unique_ptr<DeviceHeaps>> mHeaps;
+		std::vector<std::unique_ptr<Pool>> mPools;
+	};
+#endif
+}
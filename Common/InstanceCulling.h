@@ -0,0 +1,442 @@
+#pragma once
+
+// Many-instance scenes with CPU frustum culling
+// Instance bounds are kept as structure-of-arrays so one SIMD register tests 4 (SSE2, NEON) or 8 (AVX2)
+// world space AABBs against a frustum plane at once. Bands of instances are culled on persistent worker
+// threads, then the world matrices of the visible ones are packed in instance order straight into the
+// destination (usually a mapped upload buffer) for a single instanced draw.
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#include <immintrin.h>
+#define INSTANCE_CULLING_SSE2 1
+#if defined(__AVX2__)
+#define INSTANCE_CULLING_AVX2 1
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#include <arm_neon.h>
+#define INSTANCE_CULLING_NEON 1
+#endif
+
+namespace InstanceCulling
+{
+	// Rows of the 3x4 world matrix, world = mul(float3x4(row0, row1, row2), float4(position, 1))
+	struct InstanceData
+	{
+		float rows[3][4];
+	};
+	static_assert(sizeof(InstanceData) == 48, "Instance buffer stride");
+	constexpr uint32_t InstanceStride = sizeof(InstanceData);
+
+	// Inside when a * x + b * y + c * z + d >= 0 for all planes
+	struct Frustum
+	{
+		float planes[6][4];
+	};
+
+	// From a row-major view projection matrix applied to row vectors (DirectXMath), depth in [0, w]
+	inline Frustum FrustumFromViewProj(const float m[16])
+	{
+		Frustum f;
+		const int sign[6] = { 1, -1, 1, -1, 0, -1 };
+		const int axis[6] = { 0, 0, 1, 1, 2, 2 };
+		for (int p = 0; p < 6; ++p)
+		{
+			float length = 0.0f;
+			for (int i = 0; i < 4; ++i)
+			{
+				const float w = m[4 * i + 3];
+				const float a = m[4 * i + axis[p]];
+				f.planes[p][i] = p == 4 ? a : w + sign[p] * a;
+				if (i < 3)
+					length += f.planes[p][i] * f.planes[p][i];
+			}
+			length = std::sqrt(length);
+			for (int i = 0; i < 4; ++i)
+				f.planes[p][i] = length > 0.0f ? f.planes[p][i] / length : f.planes[p][i];
+		}
+		return f;
+	}
+
+	struct Scene
+	{
+		// World space bounding boxes, one array per component
+		std::vector<float> centerX, centerY, centerZ;
+		std::vector<float> extentX, extentY, extentZ;
+		std::vector<InstanceData> instances;
+
+		size_t Size() const { return instances.size(); }
+
+		void Reserve(size_t count)
+		{
+			for (auto* a : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+				a->reserve(count);
+			instances.reserve(count);
+		}
+
+		// The local box is transformed and enclosed again (Arvo), so rotations only grow it
+		void Add(const InstanceData& instance, const float localCenter[3], const float localExtent[3])
+		{
+			float center[3], extent[3];
+			for (int r = 0; r < 3; ++r)
+			{
+				const float* row = instance.rows[r];
+				center[r] = row[0] * localCenter[0] + row[1] * localCenter[1] + row[2] * localCenter[2] + row[3];
+				extent[r] = std::fabs(row[0]) * localExtent[0] + std::fabs(row[1]) * localExtent[1] + std::fabs(row[2]) * localExtent[2];
+			}
+			centerX.push_back(center[0]);
+			centerY.push_back(center[1]);
+			centerZ.push_back(center[2]);
+			extentX.push_back(extent[0]);
+			extentY.push_back(extent[1]);
+			extentZ.push_back(extent[2]);
+			instances.push_back(instance);
+		}
+	};
+
+	namespace Detail
+	{
+		// Same numbers on every compiler, unlike the std distributions
+		inline float NextFloat(uint32_t& state)
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return (state >> 8) * (1.0f / 16777216.0f);
+		}
+
+		struct ScalarOps
+		{
+			using F = float;
+			using M = bool;
+			static constexpr size_t Width = 1;
+			static F Load(const float* p) { return *p; }
+			static F Set(float a) { return a; }
+			static F Add(F a, F b) { return a + b; }
+			static F Mul(F a, F b) { return a * b; }
+			static M True() { return true; }
+			static M And(M a, M b) { return a && b; }
+			static M GreaterEqual(F a, F b) { return a >= b; }
+			static uint32_t Bits(M a) { return a ? 1u : 0u; }
+		};
+
+#ifdef INSTANCE_CULLING_SSE2
+		struct Sse2Ops
+		{
+			using F = __m128;
+			using M = __m128;
+			static constexpr size_t Width = 4;
+			static F Load(const float* p) { return _mm_loadu_ps(p); }
+			static F Set(float a) { return _mm_set1_ps(a); }
+			static F Add(F a, F b) { return _mm_add_ps(a, b); }
+			static F Mul(F a, F b) { return _mm_mul_ps(a, b); }
+			static M True() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+			static M And(M a, M b) { return _mm_and_ps(a, b); }
+			static M GreaterEqual(F a, F b) { return _mm_cmpge_ps(a, b); }
+			static uint32_t Bits(M a) { return static_cast<uint32_t>(_mm_movemask_ps(a)); }
+		};
+#endif
+
+#ifdef INSTANCE_CULLING_AVX2
+		struct Avx2Ops
+		{
+			using F = __m256;
+			using M = __m256;
+			static constexpr size_t Width = 8;
+			static F Load(const float* p) { return _mm256_loadu_ps(p); }
+			static F Set(float a) { return _mm256_set1_ps(a); }
+			static F Add(F a, F b) { return _mm256_add_ps(a, b); }
+			static F Mul(F a, F b) { return _mm256_mul_ps(a, b); }
+			static M True() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+			static M And(M a, M b) { return _mm256_and_ps(a, b); }
+			static M GreaterEqual(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+			static uint32_t Bits(M a) { return static_cast<uint32_t>(_mm256_movemask_ps(a)); }
+		};
+#endif
+
+#ifdef INSTANCE_CULLING_NEON
+		struct NeonOps
+		{
+			using F = float32x4_t;
+			using M = uint32x4_t;
+			static constexpr size_t Width = 4;
+			static F Load(const float* p) { return vld1q_f32(p); }
+			static F Set(float a) { return vdupq_n_f32(a); }
+			static F Add(F a, F b) { return vaddq_f32(a, b); }
+			static F Mul(F a, F b) { return vmulq_f32(a, b); }
+			static M True() { return vdupq_n_u32(~0u); }
+			static M And(M a, M b) { return vandq_u32(a, b); }
+			static M GreaterEqual(F a, F b) { return vcgeq_f32(a, b); }
+			static uint32_t Bits(M a)
+			{
+				const uint32_t lanes[4] = { 1, 2, 4, 8 };
+				return vaddvq_u32(vandq_u32(a, vld1q_u32(lanes)));
+			}
+		};
+#endif
+
+#if defined(INSTANCE_CULLING_AVX2)
+		using BestOps = Avx2Ops;
+#elif defined(INSTANCE_CULLING_SSE2)
+		using BestOps = Sse2Ops;
+#elif defined(INSTANCE_CULLING_NEON)
+		using BestOps = NeonOps;
+#else
+		using BestOps = ScalarOps;
+#endif
+
+		// Frustum planes broadcast once per range, |n| gives the projected radius of a box
+		template<class V>
+		struct Planes
+		{
+			typename V::F n[6][4];
+			typename V::F absN[6][3];
+
+			explicit Planes(const Frustum& frustum)
+			{
+				for (int p = 0; p < 6; ++p)
+				{
+					for (int i = 0; i < 4; ++i)
+						n[p][i] = V::Set(frustum.planes[p][i]);
+					for (int i = 0; i < 3; ++i)
+						absN[p][i] = V::Set(std::fabs(frustum.planes[p][i]));
+				}
+			}
+		};
+
+		// Box center distance plus projected radius, every backend adds in the same order
+		template<class V>
+		inline uint32_t VisibleBits(const Scene& scene, const Planes<V>& planes, size_t i)
+		{
+			using F = typename V::F;
+			const F cx = V::Load(scene.centerX.data() + i), cy = V::Load(scene.centerY.data() + i), cz = V::Load(scene.centerZ.data() + i);
+			const F ex = V::Load(scene.extentX.data() + i), ey = V::Load(scene.extentY.data() + i), ez = V::Load(scene.extentZ.data() + i);
+			auto inside = V::True();
+			for (int p = 0; p < 6; ++p)
+			{
+				const auto* n = planes.n[p];
+				const auto* a = planes.absN[p];
+				const F distance = V::Add(V::Add(V::Mul(cx, n[0]), V::Mul(cy, n[1])), V::Add(V::Mul(cz, n[2]), n[3]));
+				const F radius = V::Add(V::Add(V::Mul(ex, a[0]), V::Mul(ey, a[1])), V::Mul(ez, a[2]));
+				inside = V::And(inside, V::GreaterEqual(V::Add(distance, radius), V::Set(0.0f)));
+			}
+			return V::Bits(inside);
+		}
+
+		// Writes the visible indices of [begin, end) to visible and returns how many
+		template<class V>
+		inline size_t CullRange(const Scene& scene, const Frustum& frustum, size_t begin, size_t end, uint32_t* visible)
+		{
+			const Planes<V> planes(frustum);
+			const Planes<ScalarOps> scalarPlanes(frustum);
+			size_t count = 0;
+			size_t i = begin;
+			for (; i + V::Width <= end; i += V::Width)
+			{
+				for (uint32_t bits = VisibleBits<V>(scene, planes, i); bits; bits &= bits - 1)
+				{
+					uint32_t lane = 0;
+					while (!(bits & (1u << lane)))
+						++lane;
+					visible[count++] = static_cast<uint32_t>(i + lane);
+				}
+			}
+			for (; i < end; ++i)
+			{
+				if (VisibleBits<ScalarOps>(scene, scalarPlanes, i))
+					visible[count++] = static_cast<uint32_t>(i);
+			}
+			return count;
+		}
+	}
+
+	inline const char* SimdName()
+	{
+#if defined(INSTANCE_CULLING_AVX2)
+		return "avx2";
+#elif defined(INSTANCE_CULLING_SSE2)
+		return "sse2";
+#elif defined(INSTANCE_CULLING_NEON)
+		return "neon";
+#else
+		return "scalar";
+#endif
+	}
+
+	// Instance 0 is the unit sphere at the origin, the rest are spread over [-fieldHalfSize, fieldHalfSize] on X and Z
+	// with random yaw and scale. Local bounds are the unit cube around the origin.
+	inline Scene RandomScene(uint32_t count, float fieldHalfSize = 100.0f, uint32_t seed = 1)
+	{
+		Scene scene;
+		scene.Reserve(count);
+		const float localCenter[3] = { 0.0f, 0.0f, 0.0f };
+		const float localExtent[3] = { 1.0f, 1.0f, 1.0f };
+		uint32_t state = seed ? seed : 1;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			InstanceData instance = { { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } } };
+			if (i > 0)
+			{
+				const float x = (Detail::NextFloat(state) * 2 - 1) * fieldHalfSize;
+				const float y = (Detail::NextFloat(state) * 2 - 1) * 2.5f;
+				const float z = (Detail::NextFloat(state) * 2 - 1) * fieldHalfSize;
+				const float yaw = Detail::NextFloat(state) * 6.2831853f;
+				const float scale = 0.05f + 0.2f * Detail::NextFloat(state);
+				const float c = std::cos(yaw) * scale, s = std::sin(yaw) * scale;
+				instance = { { { c, 0, s, x }, { 0, scale, 0, y }, { -s, 0, c, z } } };
+			}
+			scene.Add(instance, localCenter, localExtent);
+		}
+		return scene;
+	}
+
+	// Persistent band workers, the calling thread culls band 0
+	class Culler
+	{
+	public:
+		// 0 picks one band per hardware thread
+		explicit Culler(uint32_t threadCount = 0)
+		{
+			mThreadCount = threadCount ? threadCount : (std::max)(std::thread::hardware_concurrency(), 1u);
+			mBands.resize(mThreadCount);
+			for (uint32_t i = 1; i < mThreadCount; ++i)
+				mThreads.emplace_back([this, i]() { Worker(i); });
+		}
+
+		~Culler()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mExit = true;
+			}
+			mCvJob.notify_all();
+			for (auto& t : mThreads)
+				t.join();
+		}
+
+		Culler(const Culler&) = delete;
+		Culler& operator=(const Culler&) = delete;
+
+		uint32_t ThreadCount() const { return mThreadCount; }
+
+		// Packs the InstanceData of the visible instances into dst and their indices into visibleIndices,
+		// both in instance order and both optional. Returns the visible count.
+		size_t Cull(const Scene& scene, const Frustum& frustum, void* dst, uint32_t* visibleIndices = nullptr, bool simd = true)
+		{
+			// Bands are whole SIMD blocks and small scenes use fewer of them
+			const size_t size = scene.Size();
+			const size_t block = Detail::BestOps::Width;
+			const size_t bandCount = std::min<size_t>(mThreadCount, std::max<size_t>(size / MinBandSize, 1));
+			const size_t blocksPerBand = (size / block + bandCount - 1) / bandCount;
+			for (size_t b = 0; b < mThreadCount; ++b)
+			{
+				auto& band = mBands[b];
+				band.begin = (std::min)(size, b * blocksPerBand * block);
+				band.end = b + 1 == bandCount ? size : (std::min)(size, (b + 1) * blocksPerBand * block);
+				if (b >= bandCount)
+					band.begin = band.end = size;
+				band.visible.resize(band.end - band.begin);
+			}
+			Run([&](uint32_t b)
+			{
+				auto& band = mBands[b];
+				band.count = simd
+					? Detail::CullRange<Detail::BestOps>(scene, frustum, band.begin, band.end, band.visible.data())
+					: Detail::CullRange<Detail::ScalarOps>(scene, frustum, band.begin, band.end, band.visible.data());
+			});
+			size_t total = 0;
+			for (auto& band : mBands)
+			{
+				band.offset = total;
+				total += band.count;
+			}
+			// Sequential writes per band, kind to write-combined upload memory
+			Run([&](uint32_t b)
+			{
+				const auto& band = mBands[b];
+				if (dst)
+				{
+					auto* out = static_cast<InstanceData*>(dst) + band.offset;
+					for (size_t k = 0; k < band.count; ++k)
+						memcpy(out + k, &scene.instances[band.visible[k]], sizeof(InstanceData));
+				}
+				if (visibleIndices)
+					memcpy(visibleIndices + band.offset, band.visible.data(), band.count * sizeof(uint32_t));
+			});
+			return total;
+		}
+
+	private:
+		static constexpr size_t MinBandSize = 4096;
+
+		struct Band
+		{
+			size_t begin = 0;
+			size_t end = 0;
+			size_t count = 0;
+			size_t offset = 0;
+			std::vector<uint32_t> visible;
+		};
+
+		template<class Func>
+		void Run(Func&& func)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				using Job = typename std::remove_reference<Func>::type;
+				mJob = [](void* context, uint32_t band) { (*static_cast<Job*>(context))(band); };
+				mJobContext = &func;
+				mPending = mThreadCount - 1;
+				mGeneration++;
+			}
+			mCvJob.notify_all();
+			func(0);
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCvDone.wait(lock, [&]() { return mPending == 0; });
+		}
+
+		void Worker(uint32_t band)
+		{
+			uint64_t seen = 0;
+			for (;;)
+			{
+				void (*job)(void*, uint32_t);
+				void* context;
+				{
+					std::unique_lock<std::mutex> lock(mMutex);
+					mCvJob.wait(lock, [&]() { return mExit || mGeneration != seen; });
+					if (mExit)
+						return;
+					seen = mGeneration;
+					job = mJob;
+					context = mJobContext;
+				}
+				job(context, band);
+				std::lock_guard<std::mutex> lock(mMutex);
+				if (--mPending == 0)
+					mCvDone.notify_one();
+			}
+		}
+
+		uint32_t mThreadCount = 1;
+		std::vector<Band> mBands;
+		std::vector<std::thread> mThreads;
+		std::mutex mMutex;
+		std::condition_variable mCvJob;
+		std::condition_variable mCvDone;
+		void (*mJob)(void*, uint32_t) = nullptr;
+		void* mJobContext = nullptr;
+		uint64_t mGeneration = 0;
+		uint32_t mPending = 0;
+		bool mExit = false;
+	};
+}
@@ -0,0 +1,455 @@
+#pragma once
+
+// Triangle and vertex reordering for meshes built by ProceduralMesh
+// Triangles are ordered for the post-transform vertex cache with Tipsify (Sander, Nehab and Barczak 2007),
+// the resulting clusters are split and sorted outside-in to reduce overdraw, and vertices are renumbered
+// in first use order for fetch locality. Everything happens in place, so the buffers can be the mapped ones.
+// Nothing depends on hashing or pointer order, the same input always gives the same bytes.
+
+#include "ProceduralMesh.h"
+#include <cmath>
+
+namespace MeshOptimizer
+{
+	using ProceduralMesh::VertexLayout;
+	using ProceduralMesh::IndexedMesh;
+
+	constexpr uint32_t DefaultCacheSize = 16;
+
+	struct CacheStats
+	{
+		float acmr = 0.0f; // Transformed vertices per triangle, 3 is the worst, about 0.5 the best on grids
+		float atvr = 0.0f; // Transformed vertices per vertex, 1 is the best
+	};
+
+	namespace Detail
+	{
+		// FIFO cache with timestamps, a vertex is resident while fewer than cacheSize vertices were inserted after it
+		struct FifoCache
+		{
+			std::vector<uint32_t> timestamp;
+			uint32_t time = 0;
+			uint32_t size = 0;
+
+			void Reset(size_t vertexCount, uint32_t cacheSize)
+			{
+				timestamp.assign(vertexCount, 0);
+				size = cacheSize;
+				time = cacheSize + 1;
+			}
+			void Flush() { time += size + 1; }
+			bool Resident(uint32_t v) const { return time - timestamp[v] <= size; }
+			// Returns 1 on a miss
+			uint32_t Access(uint32_t v)
+			{
+				if (Resident(v))
+					return 0;
+				timestamp[v] = time++;
+				return 1;
+			}
+		};
+
+		// Triangles around every vertex in CSR form, live counts the ones not emitted yet
+		struct Adjacency
+		{
+			std::vector<uint32_t> offsets;
+			std::vector<uint32_t> triangles;
+			std::vector<uint32_t> live;
+
+			void Build(const uint32_t* indices, size_t indexCount, size_t vertexCount)
+			{
+				live.assign(vertexCount, 0);
+				for (size_t i = 0; i < indexCount; ++i)
+					live[indices[i]]++;
+				offsets.assign(vertexCount + 1, 0);
+				for (size_t v = 0; v < vertexCount; ++v)
+					offsets[v + 1] = offsets[v] + live[v];
+				triangles.resize(indexCount);
+				std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+				for (size_t i = 0; i < indexCount; ++i)
+					triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		};
+
+		struct Float3
+		{
+			float x, y, z;
+		};
+
+		inline Float3 Position(const void* vertices, const VertexLayout& layout, uint32_t v)
+		{
+			Float3 p;
+			memcpy(&p, static_cast<const uint8_t*>(vertices) + static_cast<size_t>(layout.stride) * v + layout.positionOffset, sizeof(p));
+			return p;
+		}
+
+		inline uint32_t ReadIndex(const void* indices, uint32_t indexSize, size_t i)
+		{
+			if (indexSize == 4)
+				return static_cast<const uint32_t*>(indices)[i];
+			return static_cast<const uint16_t*>(indices)[i];
+		}
+
+		inline void WriteIndex(void* indices, uint32_t indexSize, size_t i, uint32_t v)
+		{
+			if (indexSize == 4)
+				static_cast<uint32_t*>(indices)[i] = v;
+			else
+				static_cast<uint16_t*>(indices)[i] = static_cast<uint16_t>(v);
+		}
+	}
+
+	inline CacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = DefaultCacheSize)
+	{
+		Detail::FifoCache cache;
+		cache.Reset(vertexCount, cacheSize);
+		uint64_t misses = 0;
+		for (size_t i = 0; i < indexCount; ++i)
+			misses += cache.Access(indices[i]);
+		CacheStats stats;
+		if (indexCount)
+			stats.acmr = static_cast<float>(3.0 * misses / indexCount);
+		if (vertexCount)
+			stats.atvr = static_cast<float>(double(misses) / vertexCount);
+		return stats;
+	}
+
+	// Tipsify, fans around the vertex that stays in the cache longest and backtracks through recent
+	// vertices at dead ends. hardClusters receives the first triangle of every run that had to restart
+	// from an unrelated vertex, the cache is cold there anyway.
+	inline void OptimizeVertexCache(uint32_t* dst, const uint32_t* src, size_t indexCount, size_t vertexCount,
+		uint32_t cacheSize = DefaultCacheSize, std::vector<uint32_t>* hardClusters = nullptr)
+	{
+		const size_t triangleCount = indexCount / 3;
+		Detail::Adjacency adjacency;
+		adjacency.Build(src, indexCount, vertexCount);
+		Detail::FifoCache cache;
+		cache.Reset(vertexCount, cacheSize);
+		std::vector<uint8_t> emitted(triangleCount, 0);
+		std::vector<uint32_t> deadEnd, candidates;
+		deadEnd.reserve(indexCount);
+		if (hardClusters)
+			hardClusters->clear();
+
+		size_t cursor = 0, out = 0;
+		bool restarted = true;
+		auto nextUnrelated = [&]() -> int64_t
+		{
+			while (cursor < vertexCount)
+			{
+				const auto v = cursor++;
+				if (adjacency.live[v] > 0)
+					return static_cast<int64_t>(v);
+			}
+			return -1;
+		};
+
+		int64_t fan = nextUnrelated();
+		while (fan >= 0)
+		{
+			candidates.clear();
+			for (auto k = adjacency.offsets[fan]; k < adjacency.offsets[fan + 1]; ++k)
+			{
+				const auto t = adjacency.triangles[k];
+				if (emitted[t])
+					continue;
+				if (restarted && hardClusters)
+					hardClusters->push_back(static_cast<uint32_t>(out / 3));
+				restarted = false;
+				for (int c = 0; c < 3; ++c)
+				{
+					const auto v = src[3 * t + c];
+					dst[out++] = v;
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					adjacency.live[v]--;
+					cache.Access(v);
+				}
+				emitted[t] = 1;
+			}
+
+			// Oldest candidate that is still resident after emitting its remaining triangles
+			fan = -1;
+			int64_t bestPriority = -1;
+			for (auto v : candidates)
+			{
+				if (adjacency.live[v] == 0)
+					continue;
+				int64_t priority = 0;
+				const auto age = cache.time - cache.timestamp[v];
+				if (age + 2 * adjacency.live[v] <= cacheSize)
+					priority = age;
+				if (priority > bestPriority)
+				{
+					bestPriority = priority;
+					fan = v;
+				}
+			}
+			if (fan >= 0)
+				continue;
+			while (!deadEnd.empty() && fan < 0)
+			{
+				const auto v = deadEnd.back();
+				deadEnd.pop_back();
+				if (adjacency.live[v] > 0)
+					fan = v;
+			}
+			if (fan < 0)
+			{
+				fan = nextUnrelated();
+				restarted = true;
+			}
+		}
+	}
+
+	// Splits every hard cluster where its running ACMR already is within threshold of the whole cluster's,
+	// then emits the clusters whose surface faces away from the mesh center first, as they tend to occlude
+	// the rest. src must come from OptimizeVertexCache together with its hard clusters.
+	inline void OptimizeOverdraw(uint32_t* dst, const uint32_t* src, size_t indexCount, const void* vertices, size_t vertexCount,
+		const VertexLayout& layout, const std::vector<uint32_t>& hardClusters, uint32_t cacheSize = DefaultCacheSize, float threshold = 1.05f)
+	{
+		const auto triangleCount = static_cast<uint32_t>(indexCount / 3);
+		if (triangleCount == 0)
+			return;
+		std::vector<uint32_t> hard = hardClusters;
+		if (hard.empty() || hard[0] != 0)
+			hard.insert(hard.begin(), 0);
+		hard.push_back(triangleCount);
+
+		Detail::FifoCache cache;
+		cache.Reset(vertexCount, cacheSize);
+		auto triangleMisses = [&](uint32_t t)
+		{
+			return cache.Access(src[3 * t]) + cache.Access(src[3 * t + 1]) + cache.Access(src[3 * t + 2]);
+		};
+		std::vector<uint32_t> clusters;
+		for (size_t h = 0; h + 1 < hard.size(); ++h)
+		{
+			const uint32_t begin = hard[h], end = hard[h + 1];
+			if (begin >= end)
+				continue;
+			cache.Flush();
+			uint32_t misses = 0;
+			for (auto t = begin; t < end; ++t)
+				misses += triangleMisses(t);
+			const float limit = threshold * misses / (end - begin);
+
+			cache.Flush();
+			clusters.push_back(begin);
+			uint32_t start = begin, running = 0;
+			for (auto t = begin; t < end; ++t)
+			{
+				running += triangleMisses(t);
+				if (t + 1 < end && running <= limit * (t + 1 - start))
+				{
+					clusters.push_back(t + 1);
+					start = t + 1;
+					running = 0;
+					cache.Flush();
+				}
+			}
+		}
+		clusters.push_back(triangleCount);
+
+		// Area weighted centroid and normal per cluster
+		const size_t clusterCount = clusters.size() - 1;
+		std::vector<Detail::Float3> centroids(clusterCount), normals(clusterCount);
+		std::vector<double> areas(clusterCount);
+		double meshArea = 0.0, meshCenter[3] = {};
+		for (size_t c = 0; c < clusterCount; ++c)
+		{
+			double center[3] = {}, normal[3] = {}, area = 0.0;
+			for (auto t = clusters[c]; t < clusters[c + 1]; ++t)
+			{
+				const auto p0 = Detail::Position(vertices, layout, src[3 * t]);
+				const auto p1 = Detail::Position(vertices, layout, src[3 * t + 1]);
+				const auto p2 = Detail::Position(vertices, layout, src[3 * t + 2]);
+				const double e1[3] = { p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+				const double e2[3] = { p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+				const double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				const double a = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+				center[0] += (p0.x + p1.x + p2.x) / 3.0 * a;
+				center[1] += (p0.y + p1.y + p2.y) / 3.0 * a;
+				center[2] += (p0.z + p1.z + p2.z) / 3.0 * a;
+				normal[0] += n[0];
+				normal[1] += n[1];
+				normal[2] += n[2];
+				area += a;
+			}
+			for (int i = 0; i < 3; ++i)
+				meshCenter[i] += center[i];
+			meshArea += area;
+			const double inv = area > 0.0 ? 1.0 / area : 0.0;
+			const double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			const double invLength = length > 0.0 ? 1.0 / length : 0.0;
+			centroids[c] = { float(center[0] * inv), float(center[1] * inv), float(center[2] * inv) };
+			normals[c] = { float(normal[0] * invLength), float(normal[1] * invLength), float(normal[2] * invLength) };
+			areas[c] = area;
+		}
+		const double invMesh = meshArea > 0.0 ? 1.0 / meshArea : 0.0;
+		std::vector<float> keys(clusterCount);
+		for (size_t c = 0; c < clusterCount; ++c)
+		{
+			keys[c] = float((centroids[c].x - meshCenter[0] * invMesh) * normals[c].x
+				+ (centroids[c].y - meshCenter[1] * invMesh) * normals[c].y
+				+ (centroids[c].z - meshCenter[2] * invMesh) * normals[c].z);
+		}
+		std::vector<uint32_t> order(clusterCount);
+		for (size_t c = 0; c < clusterCount; ++c)
+			order[c] = static_cast<uint32_t>(c);
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+		size_t out = 0;
+		for (auto c : order)
+		{
+			const size_t count = 3 * static_cast<size_t>(clusters[c + 1] - clusters[c]);
+			memcpy(dst + out, src + 3 * static_cast<size_t>(clusters[c]), count * sizeof(uint32_t));
+			out += count;
+		}
+	}
+
+	// Renumbers vertices in first use order in place, unused ones go after the used ones.
+	// The first pinnedHead and last pinnedTail vertices keep their place, they are shared with neighbor chunks.
+	inline void OptimizeVertexFetch(void* vertices, uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t stride,
+		uint32_t pinnedHead = 0, uint32_t pinnedTail = 0)
+	{
+		std::vector<uint32_t> remap(vertexCount, ~0u);
+		const auto middleEnd = static_cast<uint32_t>(vertexCount - pinnedTail);
+		for (uint32_t v = 0; v < pinnedHead; ++v)
+			remap[v] = v;
+		for (auto v = middleEnd; v < vertexCount; ++v)
+			remap[v] = v;
+		uint32_t next = pinnedHead;
+		for (size_t i = 0; i < indexCount; ++i)
+		{
+			auto& r = remap[indices[i]];
+			if (r == ~0u)
+				r = next++;
+			indices[i] = r;
+		}
+		for (auto v = pinnedHead; v < middleEnd; ++v)
+		{
+			if (remap[v] == ~0u)
+				remap[v] = next++;
+		}
+
+		// Follow every cycle of the permutation with two vertices of scratch
+		auto* data = static_cast<uint8_t*>(vertices);
+		std::vector<uint8_t> carry(stride), swap(stride), placed(vertexCount, 0);
+		for (auto v = pinnedHead; v < middleEnd; ++v)
+		{
+			if (placed[v])
+				continue;
+			memcpy(carry.data(), data + static_cast<size_t>(stride) * v, stride);
+			auto from = v;
+			do
+			{
+				const auto to = remap[from];
+				auto* slot = data + static_cast<size_t>(stride) * to;
+				memcpy(swap.data(), slot, stride);
+				memcpy(slot, carry.data(), stride);
+				carry.swap(swap);
+				placed[to] = 1;
+				from = to;
+			} while (from != v);
+		}
+	}
+
+	// Chunks are ordered independently, the rows a chunk shares with its neighbors stay in place,
+	// so vertex and index counts and every chunk's vertex range are unchanged
+	inline void OptimizeInPlace(IndexedMesh& mesh, void* vertices, void* indices, const VertexLayout& layout,
+		uint32_t cacheSize = DefaultCacheSize, CacheStats* before = nullptr, CacheStats* after = nullptr)
+	{
+		std::vector<uint32_t> original, optimized;
+		if (before)
+			original.resize(mesh.indexCount);
+		if (after)
+			optimized.resize(mesh.indexCount);
+		std::vector<uint32_t> local, cached, hardClusters;
+		auto* data = static_cast<uint8_t*>(vertices);
+		for (size_t k = 0; k < mesh.chunks.size(); ++k)
+		{
+			const auto& c = mesh.chunks[k];
+			uint32_t pinnedHead = 0, pinnedTail = 0;
+			if (k > 0)
+			{
+				const auto& prev = mesh.chunks[k - 1];
+				if (prev.baseVertex + prev.vertexCount > c.baseVertex)
+					pinnedHead = prev.baseVertex + prev.vertexCount - c.baseVertex;
+			}
+			if (k + 1 < mesh.chunks.size() && c.baseVertex + c.vertexCount > mesh.chunks[k + 1].baseVertex)
+				pinnedTail = c.baseVertex + c.vertexCount - mesh.chunks[k + 1].baseVertex;
+
+			local.resize(c.indexCount);
+			cached.resize(c.indexCount);
+			for (uint32_t i = 0; i < c.indexCount; ++i)
+			{
+				local[i] = Detail::ReadIndex(indices, mesh.indexSize, c.firstIndex + i);
+				if (before)
+					original[c.firstIndex + i] = c.baseVertex + local[i];
+			}
+			auto* chunkVertices = data + static_cast<size_t>(layout.stride) * c.baseVertex;
+			OptimizeVertexCache(cached.data(), local.data(), c.indexCount, c.vertexCount, cacheSize, &hardClusters);
+			OptimizeOverdraw(local.data(), cached.data(), c.indexCount, chunkVertices, c.vertexCount, layout, hardClusters, cacheSize);
+			OptimizeVertexFetch(chunkVertices, local.data(), c.indexCount, c.vertexCount, layout.stride, pinnedHead, pinnedTail);
+			for (uint32_t i = 0; i < c.indexCount; ++i)
+			{
+				Detail::WriteIndex(indices, mesh.indexSize, c.firstIndex + i, local[i]);
+				if (after)
+					optimized[c.firstIndex + i] = c.baseVertex + local[i];
+			}
+		}
+		if (before)
+			*before = AnalyzeVertexCache(original.data(), original.size(), mesh.vertexCount, cacheSize);
+		if (after)
+			*after = AnalyzeVertexCache(optimized.data(), optimized.size(), mesh.vertexCount, cacheSize);
+	}
+
+	struct Result
+	{
+		IndexedMesh mesh;
+		std::vector<uint8_t> vertices;
+		std::vector<uint8_t> indices; // mesh.indexSize bytes each
+		CacheStats before;
+		CacheStats after;
+
+		// FNV-1a over the output, equal inputs must give equal fingerprints
+		uint64_t Fingerprint() const
+		{
+			uint64_t hash = 14695981039346656037ull;
+			for (const auto* buffer : { &vertices, &indices })
+			{
+				for (auto b : *buffer)
+					hash = (hash ^ b) * 1099511628211ull;
+			}
+			return hash;
+		}
+	};
+
+	inline Result Optimize(const IndexedMesh& mesh, const void* vertices, const void* indices, const VertexLayout& layout, uint32_t cacheSize = DefaultCacheSize)
+	{
+		Result result;
+		result.mesh = mesh;
+		const auto* src = static_cast<const uint8_t*>(vertices);
+		result.vertices.assign(src, src + static_cast<size_t>(layout.stride) * mesh.vertexCount);
+		src = static_cast<const uint8_t*>(indices);
+		result.indices.assign(src, src + mesh.IndexBufferSize());
+		OptimizeInPlace(result.mesh, result.vertices.data(), result.indices.data(), layout, cacheSize, &result.before, &result.after);
+		return result;
+	}
+
+	template<class Vertex>
+	inline Result OptimizeSphere(uint32_t slices, uint32_t stacks,
+		ProceduralMesh::IndexPolicy policy = ProceduralMesh::IndexPolicy::Auto, uint32_t cacheSize = DefaultCacheSize)
+	{
+		Result result;
+		result.mesh = ProceduralMesh::PlanSphere(slices, stacks, policy);
+		const auto layout = ProceduralMesh::LayoutOf<Vertex>();
+		result.vertices.resize(static_cast<size_t>(layout.stride) * result.mesh.vertexCount);
+		result.indices.resize(result.mesh.IndexBufferSize());
+		ProceduralMesh::WriteSphereVertices(result.vertices.data(), layout, slices, stacks);
+		ProceduralMesh::WriteSphereIndices(result.indices.data(), result.mesh);
+		OptimizeInPlace(result.mesh, result.vertices.data(), result.indices.data(), layout, cacheSize, &result.before, &result.after);
+		return result;
+	}
+}
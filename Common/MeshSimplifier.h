@@ -0,0 +1,392 @@
+#pragma once
+
+// Mesh simplification with quadric error metrics (Garland and Heckbert 1997) and LOD chains
+// Edges collapse onto one of their vertices, so every LOD indexes the original vertex buffer.
+// Vertices are welded by position for the topology, open borders and attribute seams are locked.
+// The error of a collapse is the area weighted RMS distance to the planes around the removed vertex,
+// plus the normal change scaled by attributeWeight times the mesh extent, both in mesh units.
+// Collapses run in passes sorted by cost with ties broken by index, the same input always gives the same bytes.
+
+#include "MeshOptimizer.h"
+#include <cfloat>
+
+namespace MeshSimplifier
+{
+	using ProceduralMesh::VertexLayout;
+	using ProceduralMesh::IndexedMesh;
+
+	constexpr float DefaultAttributeWeight = 0.05f;
+
+	namespace Detail
+	{
+		using MeshOptimizer::Detail::Float3;
+		using MeshOptimizer::Detail::Position;
+
+		inline Float3 Normal(const void* vertices, const VertexLayout& layout, uint32_t v)
+		{
+			Float3 n = { 0.0f, 0.0f, 0.0f };
+			if (layout.normalOffset != ProceduralMesh::NoAttribute)
+				memcpy(&n, static_cast<const uint8_t*>(vertices) + static_cast<size_t>(layout.stride) * v + layout.normalOffset, sizeof(n));
+			return n;
+		}
+
+		// Q(p) = p^T A p + 2 b.p + c of the planes around a vertex, weighted by triangle area
+		struct Quadric
+		{
+			double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+			double b0 = 0, b1 = 0, b2 = 0, c = 0;
+			double weight = 0;
+
+			void AddPlane(double nx, double ny, double nz, double d, double w)
+			{
+				a00 += w * nx * nx; a01 += w * nx * ny; a02 += w * nx * nz;
+				a11 += w * ny * ny; a12 += w * ny * nz; a22 += w * nz * nz;
+				b0 += w * nx * d; b1 += w * ny * d; b2 += w * nz * d;
+				c += w * d * d;
+				weight += w;
+			}
+			void Add(const Quadric& q)
+			{
+				a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+				b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c;
+				weight += q.weight;
+			}
+			// Mean squared distance
+			double Error(const Float3& p) const
+			{
+				const double x = p.x, y = p.y, z = p.z;
+				const double e = a00 * x * x + a11 * y * y + a22 * z * z + 2 * (a01 * x * y + a02 * x * z + a12 * y * z)
+					+ 2 * (b0 * x + b1 * y + b2 * z) + c;
+				return weight > 0.0 ? (std::max)(e, 0.0) / weight : 0.0;
+			}
+		};
+
+		inline double Dot(const double a[3], const double b[3]) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+		inline void TriangleNormal(const Float3& p0, const Float3& p1, const Float3& p2, double n[3])
+		{
+			const double e1[3] = { double(p1.x) - p0.x, double(p1.y) - p0.y, double(p1.z) - p0.z };
+			const double e2[3] = { double(p2.x) - p0.x, double(p2.y) - p0.y, double(p2.z) - p0.z };
+			n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+			n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+			n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		}
+
+		struct Collapse
+		{
+			float cost;
+			uint32_t from;
+			uint32_t to;
+		};
+	}
+
+	// Writes at most indexCount indices to dst and returns how many, stops at targetIndexCount or when the
+	// next collapse would exceed targetError. error receives the largest error of the collapses done.
+	inline size_t Simplify(uint32_t* dst, const uint32_t* indices, size_t indexCount, const void* vertices, size_t vertexCount,
+		const VertexLayout& layout, size_t targetIndexCount, float targetError = FLT_MAX,
+		float attributeWeight = DefaultAttributeWeight, float* error = nullptr)
+	{
+		using namespace Detail;
+		if (error)
+			*error = 0.0f;
+
+		// Weld by position on a fine grid, the generated seams and poles differ in the last bits
+		Float3 lo = { FLT_MAX, FLT_MAX, FLT_MAX }, hi = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t v = 0; v < vertexCount; ++v)
+		{
+			const auto p = Position(vertices, layout, v);
+			lo = { (std::min)(lo.x, p.x), (std::min)(lo.y, p.y), (std::min)(lo.z, p.z) };
+			hi = { (std::max)(hi.x, p.x), (std::max)(hi.y, p.y), (std::max)(hi.z, p.z) };
+		}
+		const float extent = vertexCount ? (std::max)({ hi.x - lo.x, hi.y - lo.y, hi.z - lo.z, FLT_MIN }) : 1.0f;
+		const double cell = 1e-6 * extent;
+		struct Key
+		{
+			int64_t x, y, z;
+			uint32_t v;
+			bool operator<(const Key& k) const { return x != k.x ? x < k.x : y != k.y ? y < k.y : z != k.z ? z < k.z : v < k.v; }
+			bool Same(const Key& k) const { return x == k.x && y == k.y && z == k.z; }
+		};
+		std::vector<Key> keys(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; ++v)
+		{
+			const auto p = Position(vertices, layout, v);
+			keys[v] = { std::llround(p.x / cell), std::llround(p.y / cell), std::llround(p.z / cell), v };
+		}
+		std::sort(keys.begin(), keys.end());
+		std::vector<uint32_t> canonical(vertexCount);
+		std::vector<uint8_t> locked(vertexCount, 0);
+		for (size_t begin = 0, end = 0; begin < keys.size(); begin = end)
+		{
+			const auto first = keys[begin].v;
+			const auto n0 = Normal(vertices, layout, first);
+			bool seam = false;
+			for (end = begin; end < keys.size() && keys[end].Same(keys[begin]); ++end)
+			{
+				const auto n = Normal(vertices, layout, keys[end].v);
+				const float dx = n.x - n0.x, dy = n.y - n0.y, dz = n.z - n0.z;
+				seam |= dx * dx + dy * dy + dz * dz > 1e-6f;
+			}
+			// Wedges with different normals stay apart and keep their position
+			for (auto k = begin; k < end; ++k)
+			{
+				canonical[keys[k].v] = seam ? keys[k].v : first;
+				locked[keys[k].v] = seam;
+			}
+		}
+
+		std::vector<uint32_t> work;
+		work.reserve(indexCount);
+		for (size_t i = 0; i + 2 < indexCount; i += 3)
+		{
+			const uint32_t a = canonical[indices[i]], b = canonical[indices[i + 1]], c = canonical[indices[i + 2]];
+			if (a != b && b != c && c != a)
+				work.insert(work.end(), { a, b, c });
+		}
+
+		// Around a vertex every interior edge leaves through one triangle and comes back through another,
+		// open and non-manifold edges lock both vertices
+		MeshOptimizer::Detail::Adjacency adjacency;
+		adjacency.Build(work.data(), work.size(), vertexCount);
+		std::vector<uint32_t> next, previous;
+		for (uint32_t v = 0; v < vertexCount; ++v)
+		{
+			next.clear();
+			previous.clear();
+			for (auto k = adjacency.offsets[v]; k < adjacency.offsets[v + 1]; ++k)
+			{
+				const auto* t = &work[3 * size_t(adjacency.triangles[k])];
+				const int corner = t[0] == v ? 0 : t[1] == v ? 1 : 2;
+				next.push_back(t[(corner + 1) % 3]);
+				previous.push_back(t[(corner + 2) % 3]);
+			}
+			for (auto n : next)
+			{
+				if (std::count(next.begin(), next.end(), n) != 1 || std::count(previous.begin(), previous.end(), n) != 1)
+					locked[v] = locked[n] = 1;
+			}
+			for (auto n : previous)
+			{
+				if (std::count(previous.begin(), previous.end(), n) != 1 || std::count(next.begin(), next.end(), n) != 1)
+					locked[v] = locked[n] = 1;
+			}
+		}
+
+		std::vector<Quadric> quadrics(vertexCount);
+		for (size_t i = 0; i < work.size(); i += 3)
+		{
+			const auto p0 = Position(vertices, layout, work[i]);
+			double n[3];
+			TriangleNormal(p0, Position(vertices, layout, work[i + 1]), Position(vertices, layout, work[i + 2]), n);
+			const double length = std::sqrt(Dot(n, n));
+			if (length == 0.0)
+				continue;
+			const double unit[3] = { n[0] / length, n[1] / length, n[2] / length };
+			const double d = -(unit[0] * p0.x + unit[1] * p0.y + unit[2] * p0.z);
+			for (int c = 0; c < 3; ++c)
+				quadrics[work[i + c]].AddPlane(unit[0], unit[1], unit[2], d, length * 0.5);
+		}
+
+		const double attributeScale = double(attributeWeight) * extent;
+		auto attributeCost = [&](uint32_t from, uint32_t to)
+		{
+			const auto n0 = Normal(vertices, layout, from), n1 = Normal(vertices, layout, to);
+			const double dn = double(n0.x - n1.x) * (n0.x - n1.x) + double(n0.y - n1.y) * (n0.y - n1.y) + double(n0.z - n1.z) * (n0.z - n1.z);
+			return attributeScale * attributeScale * dn;
+		};
+		auto cost = [&](uint32_t from, uint32_t to)
+		{
+			return quadrics[from].Error(Position(vertices, layout, to)) + attributeCost(from, to);
+		};
+
+		std::vector<uint32_t> remap(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; ++v)
+			remap[v] = v;
+		std::vector<uint8_t> touched(vertexCount);
+		std::vector<double> bestCost(vertexCount);
+		std::vector<uint32_t> bestTarget(vertexCount);
+		std::vector<uint64_t> order;
+		const double maxCost = double(targetError) * targetError;
+		double worst = 0.0;
+
+		while (work.size() > targetIndexCount)
+		{
+			adjacency.Build(work.data(), work.size(), vertexCount);
+			// Cheapest target of every vertex, interior edges are visited once in each direction
+			std::fill(bestCost.begin(), bestCost.end(), DBL_MAX);
+			for (size_t i = 0; i < work.size(); i += 3)
+			{
+				for (int e = 0; e < 3; ++e)
+				{
+					const uint32_t a = work[i + e], b = work[i + (e + 1) % 3];
+					if (locked[a])
+						continue;
+					const double c = cost(a, b);
+					if (c < bestCost[a] || (c == bestCost[a] && b < bestTarget[a]))
+					{
+						bestCost[a] = c;
+						bestTarget[a] = b;
+					}
+				}
+			}
+			// Non-negative floats sort like their bits, the vertex breaks ties
+			order.clear();
+			for (uint32_t v = 0; v < vertexCount; ++v)
+			{
+				if (bestCost[v] == DBL_MAX)
+					continue;
+				const float c = float(bestCost[v]);
+				uint32_t bits;
+				memcpy(&bits, &c, sizeof(bits));
+				order.push_back(uint64_t(bits) << 32 | v);
+			}
+			std::sort(order.begin(), order.end());
+
+			std::fill(touched.begin(), touched.end(), 0);
+			size_t triangles = work.size() / 3, done = 0;
+			const size_t targetTriangles = targetIndexCount / 3;
+			for (auto key : order)
+			{
+				const Collapse c = { float(bestCost[uint32_t(key)]), uint32_t(key), bestTarget[uint32_t(key)] };
+				if (triangles <= targetTriangles || c.cost > maxCost)
+					break;
+				if (touched[c.from] || touched[c.to])
+					continue;
+				// Triangles around the removed vertex must not flip, the ones on the edge disappear
+				const auto p = Position(vertices, layout, c.to);
+				size_t removed = 0;
+				bool flip = false;
+				for (auto k = adjacency.offsets[c.from]; k < adjacency.offsets[c.from + 1] && !flip; ++k)
+				{
+					const auto* t = &work[3 * size_t(adjacency.triangles[k])];
+					const uint32_t corner[3] = { remap[t[0]], remap[t[1]], remap[t[2]] };
+					if (corner[0] == corner[1] || corner[1] == corner[2] || corner[2] == corner[0])
+						continue;
+					if (corner[0] == c.to || corner[1] == c.to || corner[2] == c.to)
+					{
+						removed++;
+						continue;
+					}
+					Float3 before[3], after[3];
+					for (int i = 0; i < 3; ++i)
+					{
+						before[i] = Position(vertices, layout, corner[i]);
+						after[i] = corner[i] == c.from ? p : before[i];
+					}
+					double n0[3], n1[3];
+					TriangleNormal(before[0], before[1], before[2], n0);
+					TriangleNormal(after[0], after[1], after[2], n1);
+					// Turning further than about 75 degrees makes slivers standing up from the surface
+					flip = Dot(n0, n1) <= 0.25 * std::sqrt(Dot(n0, n0) * Dot(n1, n1));
+				}
+				if (flip)
+					continue;
+				remap[c.from] = c.to;
+				// The normal change stays in the error of the merged vertex
+				quadrics[c.to].c += attributeCost(c.from, c.to) * quadrics[c.from].weight;
+				quadrics[c.to].Add(quadrics[c.from]);
+				touched[c.from] = touched[c.to] = 1;
+				worst = (std::max)(worst, double(c.cost));
+				triangles -= (std::min)(triangles, removed);
+				done++;
+			}
+			if (done == 0)
+				break;
+
+			size_t out = 0;
+			for (size_t i = 0; i < work.size(); i += 3)
+			{
+				const uint32_t a = remap[work[i]], b = remap[work[i + 1]], c = remap[work[i + 2]];
+				if (a == b || b == c || c == a)
+					continue;
+				work[out++] = a;
+				work[out++] = b;
+				work[out++] = c;
+			}
+			work.resize(out);
+		}
+
+		memcpy(dst, work.data(), work.size() * sizeof(uint32_t));
+		if (error)
+			*error = float(std::sqrt(worst));
+		return work.size();
+	}
+
+	// Projected error of a LOD in pixels is error * ProjectionScale(...) / distance
+	inline float ProjectionScale(float fovY, float viewportHeight)
+	{
+		return viewportHeight / (2.0f * std::tan(fovY * 0.5f));
+	}
+
+	struct Lod
+	{
+		IndexedMesh mesh; // Chunks index the shared index buffer
+		float error = 0.0f; // In mesh units, accumulated from LOD 0
+	};
+
+	struct LodChain
+	{
+		std::vector<Lod> lods;
+		std::vector<uint8_t> indices; // All LODs, mesh.indexSize bytes each
+
+		// The coarsest LOD whose error stays within maxPixelError at distance from the camera
+		const IndexedMesh& Select(float distance, float projectionScale, float maxPixelError = 1.0f) const
+		{
+			size_t best = 0;
+			for (size_t i = 1; i < lods.size(); ++i)
+			{
+				if (lods[i].error * projectionScale > maxPixelError * (std::max)(distance, FLT_MIN))
+					break;
+				best = i;
+			}
+			return lods[best].mesh;
+		}
+	};
+
+	// LOD 0 is the mesh itself, every further LOD simplifies the previous one to ratio of its triangles
+	// per chunk and is reordered for the vertex cache. The chain ends at maxLods or when a LOD cannot shrink much.
+	inline LodChain BuildLodChain(const IndexedMesh& mesh, const void* vertices, const void* indices, const VertexLayout& layout,
+		uint32_t maxLods = 4, float ratio = 0.5f, float attributeWeight = DefaultAttributeWeight)
+	{
+		LodChain chain;
+		chain.lods.push_back({ mesh, 0.0f });
+		chain.indices.assign(static_cast<const uint8_t*>(indices), static_cast<const uint8_t*>(indices) + mesh.IndexBufferSize());
+		std::vector<uint32_t> source, simplified, ordered;
+		while (chain.lods.size() < maxLods)
+		{
+			const auto& previous = chain.lods.back();
+			Lod lod = { previous.mesh, previous.error };
+			lod.mesh.indexCount = 0;
+			float error = 0.0f;
+			for (auto& c : lod.mesh.chunks)
+			{
+				source.resize(c.indexCount);
+				for (uint32_t i = 0; i < c.indexCount; ++i)
+					source[i] = MeshOptimizer::Detail::ReadIndex(chain.indices.data(), mesh.indexSize, c.firstIndex + i);
+				simplified.resize(c.indexCount);
+				ordered.resize(c.indexCount);
+				const auto* chunkVertices = static_cast<const uint8_t*>(vertices) + static_cast<size_t>(layout.stride) * c.baseVertex;
+				const auto target = static_cast<size_t>(c.indexCount / 3 * ratio) * 3;
+				float chunkError = 0.0f;
+				const auto count = Simplify(simplified.data(), source.data(), source.size(), chunkVertices, c.vertexCount, layout,
+					target, FLT_MAX, attributeWeight, &chunkError);
+				MeshOptimizer::OptimizeVertexCache(ordered.data(), simplified.data(), count, c.vertexCount);
+				c.firstIndex = static_cast<uint32_t>(chain.indices.size() / mesh.indexSize);
+				c.indexCount = static_cast<uint32_t>(count);
+				chain.indices.resize(chain.indices.size() + count * mesh.indexSize);
+				for (size_t i = 0; i < count; ++i)
+					MeshOptimizer::Detail::WriteIndex(chain.indices.data(), mesh.indexSize, c.firstIndex + i, ordered[i]);
+				lod.mesh.indexCount += c.indexCount;
+				error = (std::max)(error, chunkError);
+			}
+			if (lod.mesh.indexCount == 0 || lod.mesh.indexCount > previous.mesh.indexCount * 9 / 10)
+			{
+				chain.indices.resize(chain.indices.size() - size_t(lod.mesh.indexCount) * mesh.indexSize);
+				break;
+			}
+			lod.error += error;
+			chain.lods.push_back(lod);
+		}
+		return chain;
+	}
+}
@@ -0,0 +1,408 @@
+#pragma once
+
+// Meshlet clustering for the mesh shader path
+// Triangles are grown greedily into meshlets of at most MaxVertices vertices and MaxPrimitives triangles.
+// The next triangle is the neighbor adding the fewest new vertices (triangles about to be left alone count
+// as adding none), then the one closest to the meshlet center and best aligned with its normal.
+// A meshlet is seeded in a corner next to the previous one, so the order of the input (e.g. from
+// MeshOptimizer) carries over and few small leftover meshlets remain.
+// Every meshlet gets a bounding sphere and a normal cone for culling on the GPU.
+// Ties are broken by triangle index, the same input always gives the same bytes.
+
+#include "MeshOptimizer.h"
+#include <limits>
+
+namespace MeshletBuilder
+{
+	using ProceduralMesh::VertexLayout;
+	using ProceduralMesh::IndexedMesh;
+
+	constexpr uint32_t MaxVertices = 64;
+	constexpr uint32_t MaxPrimitives = 124;
+	constexpr float DefaultConeWeight = 0.25f;
+
+	// Layout of the structured buffers read by the mesh shader
+	struct Meshlet
+	{
+		uint32_t vertexOffset; // First entry in vertexIndices
+		uint32_t vertexCount;
+		uint32_t primitiveOffset; // First entry in primitives
+		uint32_t primitiveCount;
+	};
+
+	// The meshlet faces away from the camera when dot(normalize(coneApex - camera), coneAxis) >= coneCutoff
+	struct Bounds
+	{
+		float center[3];
+		float radius;
+		float coneApex[3];
+		float coneCutoff; // 1 when the normals spread too far to cull
+		float coneAxis[3];
+		float padding;
+	};
+	static_assert(sizeof(Bounds) == 48, "Bounds is read as a structured buffer");
+
+	// Three meshlet-local vertex indices in 10 bits each
+	inline uint32_t PackPrimitive(uint32_t i0, uint32_t i1, uint32_t i2)
+	{
+		return i0 | (i1 << 10) | (i2 << 20);
+	}
+
+	inline void UnpackPrimitive(uint32_t primitive, uint32_t out[3])
+	{
+		out[0] = primitive & 0x3FF;
+		out[1] = (primitive >> 10) & 0x3FF;
+		out[2] = (primitive >> 20) & 0x3FF;
+	}
+
+	inline bool ConeCulled(const Bounds& bounds, const float camera[3])
+	{
+		const float d[3] = { bounds.coneApex[0] - camera[0], bounds.coneApex[1] - camera[1], bounds.coneApex[2] - camera[2] };
+		const float length = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		const float dp = d[0] * bounds.coneAxis[0] + d[1] * bounds.coneAxis[1] + d[2] * bounds.coneAxis[2];
+		return bounds.coneCutoff < 1.0f && dp >= bounds.coneCutoff * length;
+	}
+
+	struct Result
+	{
+		std::vector<Meshlet> meshlets;
+		std::vector<uint32_t> vertexIndices; // Vertex buffer index of every meshlet vertex
+		std::vector<uint32_t> primitives; // PackPrimitive per triangle
+		std::vector<Bounds> bounds; // One per meshlet
+
+		// FNV-1a over all buffers, equal inputs must give equal fingerprints
+		uint64_t Fingerprint() const
+		{
+			uint64_t hash = 14695981039346656037ull;
+			auto add = [&](const void* data, size_t size)
+			{
+				for (size_t i = 0; i < size; ++i)
+					hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 1099511628211ull;
+			};
+			add(meshlets.data(), sizeof(Meshlet) * meshlets.size());
+			add(vertexIndices.data(), sizeof(uint32_t) * vertexIndices.size());
+			add(primitives.data(), sizeof(uint32_t) * primitives.size());
+			add(bounds.data(), sizeof(Bounds) * bounds.size());
+			return hash;
+		}
+	};
+
+	namespace Detail
+	{
+		using MeshOptimizer::Detail::Float3;
+		using MeshOptimizer::Detail::Position;
+
+		inline Float3 Sub(const Float3& a, const Float3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+		inline float Dot(const Float3& a, const Float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+		inline Float3 Cross(const Float3& a, const Float3& b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+		inline Float3 Normalize(const Float3& a)
+		{
+			const float length = std::sqrt(Dot(a, a));
+			return length > 0.0f ? Float3{ a.x / length, a.y / length, a.z / length } : Float3{ 0.0f, 0.0f, 0.0f };
+		}
+
+		// Ritter's sphere, grown from the two most distant points found in two sweeps
+		inline void BoundingSphere(Bounds& bounds, const std::vector<Float3>& points)
+		{
+			auto farthest = [&](const Float3& from)
+			{
+				size_t best = 0;
+				float bestDistance = -1.0f;
+				for (size_t i = 0; i < points.size(); ++i)
+				{
+					const auto d = Sub(points[i], from);
+					if (Dot(d, d) > bestDistance)
+					{
+						bestDistance = Dot(d, d);
+						best = i;
+					}
+				}
+				return points[best];
+			};
+			const auto a = farthest(points[0]);
+			const auto b = farthest(a);
+			Float3 center = { (a.x + b.x) * 0.5f, (a.y + b.y) * 0.5f, (a.z + b.z) * 0.5f };
+			const auto half = Sub(b, center);
+			float radius = std::sqrt(Dot(half, half));
+			for (const auto& p : points)
+			{
+				const auto d = Sub(p, center);
+				const float distance = std::sqrt(Dot(d, d));
+				if (distance > radius)
+				{
+					const float grown = (radius + distance) * 0.5f;
+					const float shift = (grown - radius) / distance;
+					center = { center.x + d.x * shift, center.y + d.y * shift, center.z + d.z * shift };
+					radius = grown;
+				}
+			}
+			// Float error of the growth steps
+			radius *= 1.0f + 1e-5f;
+			bounds.center[0] = center.x;
+			bounds.center[1] = center.y;
+			bounds.center[2] = center.z;
+			bounds.radius = radius;
+		}
+
+		// Normal cone of the triangles, the apex is moved back until every triangle plane is in front of it
+		inline void NormalCone(Bounds& bounds, const std::vector<Float3>& corners)
+		{
+			const Float3 center = { bounds.center[0], bounds.center[1], bounds.center[2] };
+			std::vector<Float3> normals;
+			Float3 sum = { 0.0f, 0.0f, 0.0f };
+			for (size_t i = 0; i < corners.size(); i += 3)
+			{
+				const auto n = Normalize(Cross(Sub(corners[i + 1], corners[i]), Sub(corners[i + 2], corners[i])));
+				normals.push_back(n);
+				sum = { sum.x + n.x, sum.y + n.y, sum.z + n.z };
+			}
+			const auto axis = Normalize(sum);
+			float minDot = 1.0f;
+			bool any = false;
+			for (const auto& n : normals)
+			{
+				if (Dot(n, n) == 0.0f)
+					continue;
+				minDot = (std::min)(minDot, Dot(n, axis));
+				any = true;
+			}
+			for (int i = 0; i < 3; ++i)
+			{
+				bounds.coneApex[i] = bounds.center[i];
+				bounds.coneAxis[i] = (&axis.x)[i];
+			}
+			bounds.coneCutoff = 1.0f;
+			bounds.padding = 0.0f;
+			// Close to a hemisphere the apex would go to infinity
+			if (!any || minDot <= 0.1f)
+				return;
+			float maxT = 0.0f;
+			for (size_t t = 0; t < normals.size(); ++t)
+			{
+				const auto& n = normals[t];
+				if (Dot(n, n) == 0.0f)
+					continue;
+				maxT = (std::max)(maxT, Dot(Sub(center, corners[3 * t]), n) / Dot(axis, n));
+			}
+			for (int i = 0; i < 3; ++i)
+				bounds.coneApex[i] = bounds.center[i] - (&axis.x)[i] * maxT;
+			bounds.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+		}
+	}
+
+	// Appends the meshlets of one index range, the vertices referenced by indices start at baseVertex
+	inline void Build(Result& result, const uint32_t* indices, size_t indexCount, const void* vertices, size_t vertexCount,
+		const VertexLayout& layout, uint32_t baseVertex = 0,
+		uint32_t maxVertices = MaxVertices, uint32_t maxPrimitives = MaxPrimitives, float coneWeight = DefaultConeWeight)
+	{
+		using namespace Detail;
+		if (maxVertices < 3 || maxVertices > 256 || maxPrimitives < 1 || maxPrimitives > 256)
+			throw std::runtime_error("Meshlet limits are out of range.");
+		const auto triangleCount = static_cast<uint32_t>(indexCount / 3);
+		if (triangleCount == 0)
+			return;
+
+		MeshOptimizer::Detail::Adjacency adjacency;
+		adjacency.Build(indices, indexCount, vertexCount);
+		std::vector<Float3> centroids(triangleCount), normals(triangleCount);
+		for (uint32_t t = 0; t < triangleCount; ++t)
+		{
+			const auto p0 = Position(vertices, layout, indices[3 * t]);
+			const auto p1 = Position(vertices, layout, indices[3 * t + 1]);
+			const auto p2 = Position(vertices, layout, indices[3 * t + 2]);
+			centroids[t] = { (p0.x + p1.x + p2.x) / 3.0f, (p0.y + p1.y + p2.y) / 3.0f, (p0.z + p1.z + p2.z) / 3.0f };
+			normals[t] = Normalize(Cross(Sub(p1, p0), Sub(p2, p0)));
+		}
+
+		std::vector<uint8_t> emitted(triangleCount, 0);
+		std::vector<uint32_t> local(vertexCount, ~0u);
+		std::vector<uint32_t> meshletVertices, meshletTriangles, candidates;
+		std::vector<uint32_t> candidateOf(triangleCount, ~0u); // Meshlet that listed the triangle last
+		uint32_t meshletIndex = 0;
+		std::vector<Float3> points, corners;
+		Float3 centerSum = {}, normalSum = {};
+
+		// Live lists only keep the triangles not emitted yet, so the candidate scans stay short
+		auto removeLive = [&](uint32_t v, uint32_t t)
+		{
+			const auto begin = adjacency.offsets[v];
+			auto& live = adjacency.live[v];
+			for (uint32_t k = begin; k < begin + live; ++k)
+			{
+				if (adjacency.triangles[k] == t)
+				{
+					std::swap(adjacency.triangles[k], adjacency.triangles[begin + live - 1]);
+					live--;
+					return;
+				}
+			}
+		};
+		auto newVertices = [&](uint32_t t)
+		{
+			return uint32_t(local[indices[3 * t]] == ~0u) + uint32_t(local[indices[3 * t + 1]] == ~0u) + uint32_t(local[indices[3 * t + 2]] == ~0u);
+		};
+		auto dangling = [&](uint32_t t)
+		{
+			return adjacency.live[indices[3 * t]] == 1 || adjacency.live[indices[3 * t + 1]] == 1 || adjacency.live[indices[3 * t + 2]] == 1;
+		};
+		auto distanceTo = [&](uint32_t t, const Float3& center)
+		{
+			const auto d = Sub(centroids[t], center);
+			return Dot(d, d);
+		};
+		// Candidates are the live triangles touching the meshlet, each listed once
+		auto add = [&](uint32_t t)
+		{
+			emitted[t] = 1;
+			meshletTriangles.push_back(t);
+			for (int c = 0; c < 3; ++c)
+				removeLive(indices[3 * t + c], t);
+			for (int c = 0; c < 3; ++c)
+			{
+				const auto v = indices[3 * t + c];
+				if (local[v] != ~0u)
+					continue;
+				local[v] = static_cast<uint32_t>(meshletVertices.size());
+				meshletVertices.push_back(v);
+				for (auto k = adjacency.offsets[v]; k < adjacency.offsets[v] + adjacency.live[v]; ++k)
+				{
+					const auto n = adjacency.triangles[k];
+					if (candidateOf[n] != meshletIndex)
+					{
+						candidateOf[n] = meshletIndex;
+						candidates.push_back(n);
+					}
+				}
+			}
+			centerSum = { centerSum.x + centroids[t].x, centerSum.y + centroids[t].y, centerSum.z + centroids[t].z };
+			normalSum = { normalSum.x + normals[t].x, normalSum.y + normals[t].y, normalSum.z + normals[t].z };
+		};
+		auto meshletCenter = [&]()
+		{
+			const float inv = 1.0f / meshletTriangles.size();
+			return Float3{ centerSum.x * inv, centerSum.y * inv, centerSum.z * inv };
+		};
+
+		uint32_t cursor = 0;
+		int64_t seed = -1;
+		while (true)
+		{
+			if (seed < 0)
+			{
+				while (cursor < triangleCount && emitted[cursor])
+					++cursor;
+				if (cursor == triangleCount)
+					break;
+				seed = cursor;
+			}
+			meshletVertices.clear();
+			meshletTriangles.clear();
+			candidates.clear();
+			centerSum = normalSum = { 0.0f, 0.0f, 0.0f };
+			add(static_cast<uint32_t>(seed));
+
+			while (meshletTriangles.size() < maxPrimitives)
+			{
+				const auto center = meshletCenter();
+				const auto axis = Normalize(normalSum);
+				int64_t best = -1;
+				uint32_t bestNew = 4;
+				float bestScore = (std::numeric_limits<float>::max)();
+				size_t live = 0;
+				for (auto t : candidates)
+				{
+					if (emitted[t])
+						continue;
+					candidates[live++] = t;
+					auto extra = newVertices(t);
+					if (meshletVertices.size() + extra > maxVertices)
+						continue;
+					// A triangle left alone on a vertex would end up in a tiny meshlet later
+					if (extra > 0 && dangling(t))
+						extra = 0;
+					if (extra > bestNew)
+						continue;
+					const float score = distanceTo(t, center) * (1.0f + coneWeight * (1.0f - Dot(normals[t], axis)));
+					if (extra < bestNew || score < bestScore || (score == bestScore && t < best))
+					{
+						best = t;
+						bestNew = extra;
+						bestScore = score;
+					}
+				}
+				candidates.resize(live);
+				if (best < 0)
+					break;
+				add(static_cast<uint32_t>(best));
+			}
+
+			Meshlet meshlet;
+			meshlet.vertexOffset = static_cast<uint32_t>(result.vertexIndices.size());
+			meshlet.vertexCount = static_cast<uint32_t>(meshletVertices.size());
+			meshlet.primitiveOffset = static_cast<uint32_t>(result.primitives.size());
+			meshlet.primitiveCount = static_cast<uint32_t>(meshletTriangles.size());
+			result.meshlets.push_back(meshlet);
+			points.clear();
+			for (auto v : meshletVertices)
+			{
+				result.vertexIndices.push_back(baseVertex + v);
+				points.push_back(Position(vertices, layout, v));
+			}
+			corners.clear();
+			for (auto t : meshletTriangles)
+			{
+				const auto* i = indices + 3 * t;
+				result.primitives.push_back(PackPrimitive(local[i[0]], local[i[1]], local[i[2]]));
+				for (int c = 0; c < 3; ++c)
+					corners.push_back(Position(vertices, layout, i[c]));
+			}
+			Bounds bounds;
+			BoundingSphere(bounds, points);
+			NormalCone(bounds, corners);
+			result.bounds.push_back(bounds);
+
+			// Continue around this meshlet with the triangle that has the fewest live neighbors,
+			// starting in corners keeps the leftover regions from being enclosed
+			const auto center = meshletCenter();
+			seed = -1;
+			uint32_t bestLive = ~0u;
+			float bestDistance = (std::numeric_limits<float>::max)();
+			for (auto v : meshletVertices)
+			{
+				for (auto k = adjacency.offsets[v]; k < adjacency.offsets[v] + adjacency.live[v]; ++k)
+				{
+					const auto t = adjacency.triangles[k];
+					const auto* i = indices + 3 * t;
+					const auto live = adjacency.live[i[0]] + adjacency.live[i[1]] + adjacency.live[i[2]];
+					const float distance = distanceTo(t, center);
+					if (live < bestLive || (live == bestLive && (distance < bestDistance || (distance == bestDistance && t < seed))))
+					{
+						seed = t;
+						bestLive = live;
+						bestDistance = distance;
+					}
+				}
+			}
+			for (auto v : meshletVertices)
+				local[v] = ~0u;
+			meshletIndex++;
+		}
+	}
+
+	// Chunks are clustered independently, vertexIndices address the whole vertex buffer
+	inline Result Build(const IndexedMesh& mesh, const void* vertices, const void* indices, const VertexLayout& layout,
+		uint32_t maxVertices = MaxVertices, uint32_t maxPrimitives = MaxPrimitives, float coneWeight = DefaultConeWeight)
+	{
+		Result result;
+		std::vector<uint32_t> local;
+		for (const auto& c : mesh.chunks)
+		{
+			local.resize(c.indexCount);
+			for (uint32_t i = 0; i < c.indexCount; ++i)
+				local[i] = MeshOptimizer::Detail::ReadIndex(indices, mesh.indexSize, c.firstIndex + i);
+			const auto* chunkVertices = static_cast<const uint8_t*>(vertices) + static_cast<size_t>(layout.stride) * c.baseVertex;
+			Build(result, local.data(), local.size(), chunkVertices, c.vertexCount, layout, c.baseVertex, maxVertices, maxPrimitives, coneWeight);
+		}
+		return result;
+	}
+}
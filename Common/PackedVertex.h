@@ -0,0 +1,385 @@
+#pragma once
+
+// 12-byte vertex: half float position (w = 1) and an octahedral normal in two snorm16
+// Replaces the 24-byte float3 position + float3 normal of the samples, halving vertex fetch and upload.
+// The SIMD encoders (F16C or SSE2, NEON) are bit-exact with the scalar one.
+// Shaders read the position as usual, the normal arrives as float2 in [-1, 1] and is decoded with
+//   float3 n = float3(e, 1 - abs(e.x) - abs(e.y)); float t = saturate(-n.z);
+//   n.x += n.x >= 0 ? -t : t; n.y += n.y >= 0 ? -t : t; n = normalize(n);
+
+#include "ProceduralMesh.h"
+#include <cfloat>
+#include <cmath>
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#include <immintrin.h>
+#define PACKED_VERTEX_SSE2 1
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#include <arm_neon.h>
+#define PACKED_VERTEX_NEON 1
+#endif
+
+namespace PackedVertex
+{
+	struct Vertex
+	{
+		uint16_t position[4]; // Half x, y, z, 1
+		int16_t normal[2];    // Octahedral
+	};
+	static_assert(sizeof(Vertex) == 12, "PackedVertex::Vertex must stay 12 bytes");
+
+	constexpr uint16_t HalfOne = 0x3C00;
+
+	// Round to nearest even, overflow goes to infinity, NaN is quieted and keeps the top of its payload like F16C
+	inline uint16_t FloatToHalf(float f)
+	{
+		uint32_t u;
+		memcpy(&u, &f, sizeof(u));
+		const uint32_t sign = u & 0x80000000u;
+		u ^= sign;
+		uint32_t h;
+		if (u >= (127u + 16) << 23)
+		{
+			h = u > 255u << 23 ? 0x7E00 | ((u >> 13) & 0x1FF) : 0x7C00;
+		}
+		else if (u < 113u << 23)
+		{
+			// Subnormal or zero, let the FPU round by adding a magic number
+			const uint32_t magicBits = ((127u - 15) + (23 - 10) + 1) << 23;
+			float magic, v;
+			memcpy(&magic, &magicBits, sizeof(magic));
+			memcpy(&v, &u, sizeof(v));
+			v += magic;
+			memcpy(&h, &v, sizeof(h));
+			h -= magicBits;
+		}
+		else
+		{
+			const uint32_t odd = (u >> 13) & 1;
+			h = (u + ((15u - 127) << 23) + 0xFFF + odd) >> 13;
+		}
+		return static_cast<uint16_t>(h | (sign >> 16));
+	}
+
+	inline float HalfToFloat(uint16_t h)
+	{
+		const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+		const uint32_t exponent = (h >> 10) & 0x1F;
+		const uint32_t mantissa = h & 0x3FF;
+		uint32_t u;
+		if (exponent == 0x1F)
+		{
+			u = sign | 0x7F800000u | (mantissa << 13);
+		}
+		else if (exponent == 0)
+		{
+			const float v = mantissa * (1.0f / 16777216.0f); // 2^-24
+			memcpy(&u, &v, sizeof(u));
+			u |= sign;
+		}
+		else
+		{
+			u = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		}
+		float f;
+		memcpy(&f, &u, sizeof(f));
+		return f;
+	}
+
+	// n does not need to be normalized, the L1 projection divides its length out
+	inline void OctEncode(float x, float y, float z, int16_t out[2])
+	{
+		const float l1 = (std::max)(std::fabs(x) + std::fabs(y) + std::fabs(z), FLT_MIN);
+		float px = x / l1;
+		float py = y / l1;
+		if (z < 0.0f)
+		{
+			const float sx = px >= 0.0f ? 1.0f : -1.0f;
+			const float sy = py >= 0.0f ? 1.0f : -1.0f;
+			const float fx = (1.0f - std::fabs(py)) * sx;
+			const float fy = (1.0f - std::fabs(px)) * sy;
+			px = fx;
+			py = fy;
+		}
+		px = (std::min)((std::max)(px, -1.0f), 1.0f);
+		py = (std::min)((std::max)(py, -1.0f), 1.0f);
+		out[0] = static_cast<int16_t>(std::lrint(px * 32767.0f));
+		out[1] = static_cast<int16_t>(std::lrint(py * 32767.0f));
+	}
+
+	// Same math as the shader, D3D maps -32768 and -32767 both to -1
+	inline void OctDecode(const int16_t e[2], float n[3])
+	{
+		const float ex = (std::max)(e[0] / 32767.0f, -1.0f);
+		const float ey = (std::max)(e[1] / 32767.0f, -1.0f);
+		n[0] = ex;
+		n[1] = ey;
+		n[2] = 1.0f - std::fabs(ex) - std::fabs(ey);
+		const float t = (std::max)(-n[2], 0.0f);
+		n[0] += n[0] >= 0.0f ? -t : t;
+		n[1] += n[1] >= 0.0f ? -t : t;
+		const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		n[0] /= length;
+		n[1] /= length;
+		n[2] /= length;
+	}
+
+	namespace Detail
+	{
+		inline void Load3(const uint8_t* src, uint32_t offset, float v[3])
+		{
+			memcpy(v, src + offset, 3 * sizeof(float));
+		}
+
+		// Without a normal attribute the position is the normal, as on a unit sphere
+		inline void LoadVertex(const uint8_t* src, const ProceduralMesh::VertexLayout& layout, float p[3], float n[3])
+		{
+			Load3(src, layout.positionOffset, p);
+			if (layout.normalOffset != ProceduralMesh::NoAttribute)
+				Load3(src, layout.normalOffset, n);
+			else
+				memcpy(n, p, 3 * sizeof(float));
+		}
+
+		inline void EncodeScalar(Vertex* dst, const uint8_t* src, const ProceduralMesh::VertexLayout& layout, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i, src += layout.stride)
+			{
+				float p[3], n[3];
+				LoadVertex(src, layout, p, n);
+				Vertex v;
+				v.position[0] = FloatToHalf(p[0]);
+				v.position[1] = FloatToHalf(p[1]);
+				v.position[2] = FloatToHalf(p[2]);
+				v.position[3] = HalfOne;
+				OctEncode(n[0], n[1], n[2], v.normal);
+				memcpy(dst + i, &v, sizeof(v));
+			}
+		}
+
+#if defined(PACKED_VERTEX_SSE2)
+		inline __m128i FloatToHalf4(__m128 f)
+		{
+#if defined(__F16C__) || defined(__AVX2__)
+			return _mm_cvtepu16_epi32(_mm_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT));
+#else
+			const __m128i u0 = _mm_castps_si128(f);
+			const __m128i sign = _mm_and_si128(u0, _mm_set1_epi32(static_cast<int>(0x80000000u)));
+			const __m128i u = _mm_xor_si128(u0, sign);
+			const __m128i magicBits = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+			const __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(u), _mm_castsi128_ps(magicBits))), magicBits);
+			const __m128i odd = _mm_and_si128(_mm_srli_epi32(u, 13), _mm_set1_epi32(1));
+			const __m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(u, _mm_set1_epi32(((15 - 127) << 23) + 0xFFF)), odd), 13);
+			const __m128i payload = _mm_or_si128(_mm_set1_epi32(0x200), _mm_and_si128(_mm_srli_epi32(u, 13), _mm_set1_epi32(0x1FF)));
+			const __m128i infNaN = _mm_or_si128(_mm_set1_epi32(0x7C00), _mm_and_si128(_mm_cmpgt_epi32(u, _mm_set1_epi32(255 << 23)), payload));
+			const __m128i isSubnormal = _mm_cmplt_epi32(u, _mm_set1_epi32(113 << 23));
+			const __m128i isLarge = _mm_cmpgt_epi32(u, _mm_set1_epi32(((127 + 16) << 23) - 1));
+			__m128i h = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+			h = _mm_or_si128(_mm_and_si128(isLarge, infNaN), _mm_andnot_si128(isLarge, h));
+			return _mm_or_si128(h, _mm_srli_epi32(sign, 16));
+#endif
+		}
+
+		// float3 of four vertices as x, y, z registers. Reads 16 bytes per vertex when the stride leaves room,
+		// from 4 bytes before the attribute otherwise, and gathers lane by lane as the last resort.
+		inline void LoadFloat3x4(const uint8_t* src, uint32_t stride, uint32_t offset, __m128& x, __m128& y, __m128& z)
+		{
+			if (offset + 16 <= stride || offset >= 4)
+			{
+				const uint32_t start = offset + 16 <= stride ? offset : offset - 4;
+				__m128 r0 = _mm_loadu_ps(reinterpret_cast<const float*>(src + start));
+				__m128 r1 = _mm_loadu_ps(reinterpret_cast<const float*>(src + stride + start));
+				__m128 r2 = _mm_loadu_ps(reinterpret_cast<const float*>(src + 2 * stride + start));
+				__m128 r3 = _mm_loadu_ps(reinterpret_cast<const float*>(src + 3 * stride + start));
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+				if (start == offset)
+				{
+					x = r0; y = r1; z = r2;
+				}
+				else
+				{
+					x = r1; y = r2; z = r3;
+				}
+				return;
+			}
+			float v[4][3];
+			for (int k = 0; k < 4; ++k)
+				Load3(src + k * stride, offset, v[k]);
+			x = _mm_setr_ps(v[0][0], v[1][0], v[2][0], v[3][0]);
+			y = _mm_setr_ps(v[0][1], v[1][1], v[2][1], v[3][1]);
+			z = _mm_setr_ps(v[0][2], v[1][2], v[2][2], v[3][2]);
+		}
+
+		// Four vertices per iteration in SoA registers, written back as three 16-byte stores
+		inline size_t EncodeSse(Vertex* dst, const uint8_t* src, const ProceduralMesh::VertexLayout& layout, size_t count)
+		{
+			const __m128 signMask = _mm_set1_ps(-0.0f);
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 minusOne = _mm_set1_ps(-1.0f);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128i low16 = _mm_set1_epi32(0xFFFF);
+			const __m128i wOne = _mm_set1_epi32(HalfOne << 16);
+			auto* out = reinterpret_cast<uint8_t*>(dst);
+			size_t i = 0;
+			for (; i + 4 <= count; i += 4, src += 4 * layout.stride, out += 4 * sizeof(Vertex))
+			{
+				__m128 px, py, pz, x, y, z;
+				LoadFloat3x4(src, layout.stride, layout.positionOffset, px, py, pz);
+				if (layout.normalOffset != ProceduralMesh::NoAttribute)
+					LoadFloat3x4(src, layout.stride, layout.normalOffset, x, y, z);
+				else
+				{
+					x = px; y = py; z = pz;
+				}
+				const __m128i d0 = _mm_or_si128(FloatToHalf4(px), _mm_slli_epi32(FloatToHalf4(py), 16));
+				const __m128i d1 = _mm_or_si128(FloatToHalf4(pz), wOne);
+
+				const __m128 ax = _mm_andnot_ps(signMask, x), ay = _mm_andnot_ps(signMask, y), az = _mm_andnot_ps(signMask, z);
+				const __m128 l1 = _mm_max_ps(_mm_add_ps(_mm_add_ps(ax, ay), az), _mm_set1_ps(FLT_MIN));
+				__m128 ox = _mm_div_ps(x, l1);
+				__m128 oy = _mm_div_ps(y, l1);
+				const __m128 sx = _mm_or_ps(_mm_and_ps(_mm_cmpge_ps(ox, zero), one), _mm_andnot_ps(_mm_cmpge_ps(ox, zero), minusOne));
+				const __m128 sy = _mm_or_ps(_mm_and_ps(_mm_cmpge_ps(oy, zero), one), _mm_andnot_ps(_mm_cmpge_ps(oy, zero), minusOne));
+				const __m128 fx = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, oy)), sx);
+				const __m128 fy = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signMask, ox)), sy);
+				const __m128 lower = _mm_cmplt_ps(z, zero);
+				ox = _mm_or_ps(_mm_and_ps(lower, fx), _mm_andnot_ps(lower, ox));
+				oy = _mm_or_ps(_mm_and_ps(lower, fy), _mm_andnot_ps(lower, oy));
+				ox = _mm_min_ps(_mm_max_ps(ox, minusOne), one);
+				oy = _mm_min_ps(_mm_max_ps(oy, minusOne), one);
+				const __m128i ex = _mm_cvtps_epi32(_mm_mul_ps(ox, _mm_set1_ps(32767.0f)));
+				const __m128i ey = _mm_cvtps_epi32(_mm_mul_ps(oy, _mm_set1_ps(32767.0f)));
+				const __m128i d2 = _mm_or_si128(_mm_and_si128(ex, low16), _mm_slli_epi32(ey, 16));
+
+				// Lane k of d0, d1, d2 is vertex k, transpose to one 12-byte vertex per row and pack the rows
+				__m128 v0 = _mm_castsi128_ps(d0), v1 = _mm_castsi128_ps(d1), v2 = _mm_castsi128_ps(d2), v3 = zero;
+				_MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+				const __m128i r0 = _mm_castps_si128(v0), r1 = _mm_castps_si128(v1), r2 = _mm_castps_si128(v2), r3 = _mm_castps_si128(v3);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_or_si128(r0, _mm_slli_si128(r1, 12)));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_or_si128(_mm_srli_si128(r1, 4), _mm_slli_si128(r2, 8)));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32), _mm_or_si128(_mm_srli_si128(r2, 8), _mm_slli_si128(r3, 4)));
+			}
+			return i;
+		}
+#endif
+
+#if defined(PACKED_VERTEX_NEON)
+		inline size_t EncodeNeon(Vertex* dst, const uint8_t* src, const ProceduralMesh::VertexLayout& layout, size_t count)
+		{
+			const float32x4_t one = vdupq_n_f32(1.0f);
+			const float32x4_t minusOne = vdupq_n_f32(-1.0f);
+			const float32x4_t zero = vdupq_n_f32(0.0f);
+			size_t i = 0;
+			for (; i + 4 <= count; i += 4)
+			{
+				float p[3][4], n[3][4];
+				for (int k = 0; k < 4; ++k)
+				{
+					float pv[3], nv[3];
+					LoadVertex(src + layout.stride * (i + k), layout, pv, nv);
+					for (int c = 0; c < 3; ++c)
+					{
+						p[c][k] = pv[c];
+						n[c][k] = nv[c];
+					}
+				}
+				uint16_t hx[4], hy[4], hz[4];
+				vst1_u16(hx, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(p[0]))));
+				vst1_u16(hy, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(p[1]))));
+				vst1_u16(hz, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(p[2]))));
+
+				const float32x4_t x = vld1q_f32(n[0]), y = vld1q_f32(n[1]), z = vld1q_f32(n[2]);
+				const float32x4_t l1 = vmaxq_f32(vaddq_f32(vaddq_f32(vabsq_f32(x), vabsq_f32(y)), vabsq_f32(z)), vdupq_n_f32(FLT_MIN));
+				float32x4_t px = vdivq_f32(x, l1);
+				float32x4_t py = vdivq_f32(y, l1);
+				const float32x4_t sx = vbslq_f32(vcgeq_f32(px, zero), one, minusOne);
+				const float32x4_t sy = vbslq_f32(vcgeq_f32(py, zero), one, minusOne);
+				const float32x4_t fx = vmulq_f32(vsubq_f32(one, vabsq_f32(py)), sx);
+				const float32x4_t fy = vmulq_f32(vsubq_f32(one, vabsq_f32(px)), sy);
+				const uint32x4_t lower = vcltq_f32(z, zero);
+				px = vminq_f32(vmaxq_f32(vbslq_f32(lower, fx, px), minusOne), one);
+				py = vminq_f32(vmaxq_f32(vbslq_f32(lower, fy, py), minusOne), one);
+				int32_t ox[4], oy[4];
+				vst1q_s32(ox, vcvtnq_s32_f32(vmulq_n_f32(px, 32767.0f)));
+				vst1q_s32(oy, vcvtnq_s32_f32(vmulq_n_f32(py, 32767.0f)));
+
+				for (int k = 0; k < 4; ++k)
+				{
+					const Vertex v = {
+						{ hx[k], hy[k], hz[k], HalfOne },
+						{ static_cast<int16_t>(ox[k]), static_cast<int16_t>(oy[k]) },
+					};
+					memcpy(dst + i + k, &v, sizeof(v));
+				}
+			}
+			return i;
+		}
+#endif
+	}
+
+	inline const char* SimdName()
+	{
+#if defined(PACKED_VERTEX_SSE2) && (defined(__F16C__) || defined(__AVX2__))
+		return "f16c";
+#elif defined(PACKED_VERTEX_SSE2)
+		return "sse2";
+#elif defined(PACKED_VERTEX_NEON)
+		return "neon";
+#else
+		return "scalar";
+#endif
+	}
+
+	// Packs count vertices with float3 position (and normal) described by layout, dst may be write-combined memory
+	inline void Encode(Vertex* dst, const void* src, const ProceduralMesh::VertexLayout& layout, size_t count, bool simd = true)
+	{
+		const auto* bytes = static_cast<const uint8_t*>(src);
+		size_t done = 0;
+		if (simd)
+		{
+#if defined(PACKED_VERTEX_SSE2)
+			done = Detail::EncodeSse(dst, bytes, layout, count);
+#elif defined(PACKED_VERTEX_NEON)
+			done = Detail::EncodeNeon(dst, bytes, layout, count);
+#endif
+		}
+		Detail::EncodeScalar(dst + done, bytes + layout.stride * done, layout, count - done);
+	}
+
+	struct ErrorStats
+	{
+		float maxPositionError = 0.0f; // Absolute, per component
+		float maxNormalDegrees = 0.0f;
+	};
+
+	inline ErrorStats MeasureError(const Vertex* packed, const void* src, const ProceduralMesh::VertexLayout& layout, size_t count)
+	{
+		ErrorStats stats;
+		const auto* bytes = static_cast<const uint8_t*>(src);
+		for (size_t i = 0; i < count; ++i, bytes += layout.stride)
+		{
+			float p[3], n[3], d[3];
+			Detail::LoadVertex(bytes, layout, p, n);
+			for (int c = 0; c < 3; ++c)
+				stats.maxPositionError = (std::max)(stats.maxPositionError, std::fabs(HalfToFloat(packed[i].position[c]) - p[c]));
+			OctDecode(packed[i].normal, d);
+			// atan2 of |cross| and dot stays accurate for tiny angles, acos does not
+			const double cross[3] = {
+				double(n[1]) * d[2] - double(n[2]) * d[1], double(n[2]) * d[0] - double(n[0]) * d[2], double(n[0]) * d[1] - double(n[1]) * d[0] };
+			const double dot = double(n[0]) * d[0] + double(n[1]) * d[1] + double(n[2]) * d[2];
+			const double angle = std::atan2(std::sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]), dot);
+			stats.maxNormalDegrees = (std::max)(stats.maxNormalDegrees, static_cast<float>(angle * 57.29577951308232));
+		}
+		return stats;
+	}
+
+#if defined(__d3d12_h__)
+	inline D3D12_INPUT_LAYOUT_DESC InputLayout()
+	{
+		static const D3D12_INPUT_ELEMENT_DESC elements[] = {
+			{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+			{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		};
+		return { elements, static_cast<UINT>(sizeof(elements) / sizeof(elements[0])) };
+	}
+#endif
+}
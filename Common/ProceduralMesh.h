@@ -0,0 +1,331 @@
+#pragma once
+
+// Procedural meshes shared by the samples
+// Vertices and indices are written straight into caller memory (usually a mapped upload buffer),
+// sequentially and write-only so write-combined memory stays fast.
+// Sphere sin/cos values only depend on the slice or the stack, so they are computed once per ring
+// and cached per thread.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace ProceduralMesh
+{
+	// Where the attributes live in the caller's vertex struct
+	struct VertexLayout
+	{
+		uint32_t stride;
+		uint32_t positionOffset;
+		uint32_t normalOffset; // NoAttribute to skip normals
+	};
+	constexpr uint32_t NoAttribute = ~0u;
+
+	// For structs with float position[3] and float normal[3]
+	template<class Vertex>
+	constexpr VertexLayout LayoutOf()
+	{
+		return { static_cast<uint32_t>(sizeof(Vertex)), static_cast<uint32_t>(offsetof(Vertex, position)), static_cast<uint32_t>(offsetof(Vertex, normal)) };
+	}
+
+	struct MeshSize
+	{
+		uint32_t vertexCount;
+		uint32_t indexCount;
+	};
+
+	// UV sphere, (slices + 1) * (stacks + 1) vertices with a seam column, two triangles per quad
+	inline MeshSize SphereSize(uint32_t slices, uint32_t stacks)
+	{
+		return { (slices + 1) * (stacks + 1), 6 * slices * stacks };
+	}
+
+	// Grid on the XZ plane facing +Y, (cols + 1) * (rows + 1) vertices
+	inline MeshSize GridSize(uint32_t cols, uint32_t rows)
+	{
+		return { (cols + 1) * (rows + 1), 6 * cols * rows };
+	}
+
+	// Single quad, same as a 1x1 grid
+	inline MeshSize PlaneSize()
+	{
+		return GridSize(1, 1);
+	}
+
+	namespace Detail
+	{
+		inline void WriteFloat3(uint8_t* dst, float x, float y, float z)
+		{
+			const float v[3] = { x, y, z };
+			memcpy(dst, v, sizeof(v));
+		}
+	}
+
+	// sin/cos per slice (longitude) and per stack (latitude), the sphere is their outer product
+	struct SphereRings
+	{
+		uint32_t slices = 0;
+		uint32_t stacks = 0;
+		std::vector<float> sinTheta, cosTheta;
+		std::vector<float> sinPhi, cosPhi;
+
+		void Build(uint32_t newSlices, uint32_t newStacks)
+		{
+			slices = newSlices;
+			stacks = newStacks;
+			sinTheta.resize(slices + 1);
+			cosTheta.resize(slices + 1);
+			for (uint32_t x = 0; x <= slices; ++x)
+			{
+				const float theta = 2 * 3.14159265f * x / slices;
+				sinTheta[x] = std::sin(theta);
+				cosTheta[x] = std::cos(theta);
+			}
+			sinPhi.resize(stacks + 1);
+			cosPhi.resize(stacks + 1);
+			for (uint32_t y = 0; y <= stacks; ++y)
+			{
+				const float phi = 3.14159265f * y / stacks;
+				sinPhi[y] = std::sin(phi);
+				cosPhi[y] = std::cos(phi);
+			}
+		}
+
+		// Last used resolution is kept, the samples build the same sphere over and over
+		static const SphereRings& Get(uint32_t slices, uint32_t stacks)
+		{
+			thread_local SphereRings cache;
+			if (cache.slices != slices || cache.stacks != stacks)
+				cache.Build(slices, stacks);
+			return cache;
+		}
+	};
+
+	// Row y, column x: theta = 2 pi x / slices, phi = pi y / stacks, north pole first
+	inline void WriteSphereVertices(void* dst, const VertexLayout& layout, const SphereRings& rings, float radius = 1.0f)
+	{
+		auto* out = static_cast<uint8_t*>(dst);
+		for (uint32_t y = 0; y <= rings.stacks; ++y)
+		{
+			const float sp = rings.sinPhi[y];
+			const float cp = rings.cosPhi[y];
+			for (uint32_t x = 0; x <= rings.slices; ++x)
+			{
+				const float nx = sp * rings.sinTheta[x];
+				const float nz = sp * rings.cosTheta[x];
+				Detail::WriteFloat3(out + layout.positionOffset, nx * radius, cp * radius, nz * radius);
+				if (layout.normalOffset != NoAttribute)
+					Detail::WriteFloat3(out + layout.normalOffset, nx, cp, nz);
+				out += layout.stride;
+			}
+		}
+	}
+
+	inline void WriteSphereVertices(void* dst, const VertexLayout& layout, uint32_t slices, uint32_t stacks, float radius = 1.0f)
+	{
+		WriteSphereVertices(dst, layout, SphereRings::Get(slices, stacks), radius);
+	}
+
+	// Index is uint16_t or uint32_t, baseVertex is added to every index
+	template<class Index>
+	inline void WriteSphereIndices(Index* dst, uint32_t slices, uint32_t stacks, uint32_t baseVertex = 0)
+	{
+		const uint32_t s = slices + 1;
+		for (uint32_t y = 0; y < stacks; ++y)
+		{
+			for (uint32_t x = 0; x < slices; ++x)
+			{
+				const uint32_t b = baseVertex + y * s + x;
+				const Index quad[6] = {
+					static_cast<Index>(b), static_cast<Index>(b + s), static_cast<Index>(b + 1),
+					static_cast<Index>(b + s), static_cast<Index>(b + s + 1), static_cast<Index>(b + 1),
+				};
+				memcpy(dst, quad, sizeof(quad));
+				dst += 6;
+			}
+		}
+	}
+
+	// Spans [-halfSize, +halfSize] on X and Z at height y, rows go from +Z to -Z
+	inline void WriteGridVertices(void* dst, const VertexLayout& layout, uint32_t cols, uint32_t rows, float halfSize, float y)
+	{
+		auto* out = static_cast<uint8_t*>(dst);
+		for (uint32_t r = 0; r <= rows; ++r)
+		{
+			const float z = halfSize - 2 * halfSize * r / rows;
+			for (uint32_t c = 0; c <= cols; ++c)
+			{
+				const float x = -halfSize + 2 * halfSize * c / cols;
+				Detail::WriteFloat3(out + layout.positionOffset, x, y, z);
+				if (layout.normalOffset != NoAttribute)
+					Detail::WriteFloat3(out + layout.normalOffset, 0, 1, 0);
+				out += layout.stride;
+			}
+		}
+	}
+
+	template<class Index>
+	inline void WriteGridIndices(Index* dst, uint32_t cols, uint32_t rows, uint32_t baseVertex = 0)
+	{
+		const uint32_t s = cols + 1;
+		for (uint32_t r = 0; r < rows; ++r)
+		{
+			for (uint32_t c = 0; c < cols; ++c)
+			{
+				const uint32_t b = baseVertex + r * s + c;
+				const Index quad[6] = {
+					static_cast<Index>(b), static_cast<Index>(b + 1), static_cast<Index>(b + s),
+					static_cast<Index>(b + s), static_cast<Index>(b + 1), static_cast<Index>(b + s + 1),
+				};
+				memcpy(dst, quad, sizeof(quad));
+				dst += 6;
+			}
+		}
+	}
+
+	inline void WritePlaneVertices(void* dst, const VertexLayout& layout, float halfSize, float y)
+	{
+		WriteGridVertices(dst, layout, 1, 1, halfSize, y);
+	}
+
+	template<class Index>
+	inline void WritePlaneIndices(Index* dst, uint32_t baseVertex = 0)
+	{
+		WriteGridIndices(dst, 1, 1, baseVertex);
+	}
+
+	// How the index buffer of a row-based mesh (sphere, grid) is laid out
+	enum class IndexPolicy
+	{
+		Auto,      // 16-bit when every vertex is addressable, 32-bit otherwise
+		Index32,
+		Chunked16, // always 16-bit, split into bands of rows drawn with a base vertex
+	};
+
+	constexpr uint32_t MaxIndex16Vertices = 0x10000;
+
+	// Band of rows, indices are relative to baseVertex
+	struct MeshChunk
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t baseVertex;
+		uint32_t vertexCount;
+		uint32_t firstRow;
+		uint32_t rowCount;
+	};
+
+	// All chunks share one vertex buffer and one index buffer, neighbor bands share their boundary row
+	struct IndexedMesh
+	{
+		uint32_t columns = 0;
+		uint32_t rows = 0;
+		uint32_t vertexCount = 0;
+		uint32_t indexCount = 0;
+		uint32_t indexSize = 2; // Bytes
+		std::vector<MeshChunk> chunks;
+
+		size_t IndexBufferSize() const { return static_cast<size_t>(indexSize) * indexCount; }
+	};
+
+	// columns x rows quads over (columns + 1) * (rows + 1) vertices
+	inline IndexedMesh PlanRows(uint32_t columns, uint32_t rows, IndexPolicy policy = IndexPolicy::Auto, uint32_t maxChunkVertices = MaxIndex16Vertices)
+	{
+		IndexedMesh mesh;
+		mesh.columns = columns;
+		mesh.rows = rows;
+		mesh.vertexCount = (columns + 1) * (rows + 1);
+		mesh.indexCount = 6 * columns * rows;
+		if (policy == IndexPolicy::Auto)
+			policy = mesh.vertexCount <= MaxIndex16Vertices ? IndexPolicy::Chunked16 : IndexPolicy::Index32;
+		if (policy == IndexPolicy::Index32)
+		{
+			mesh.indexSize = 4;
+			mesh.chunks.push_back({ 0, mesh.indexCount, 0, mesh.vertexCount, 0, rows });
+			return mesh;
+		}
+		// n rows of quads need n + 1 rows of vertices
+		const uint32_t rowVertices = columns + 1;
+		const uint32_t maxRows = (std::min)(maxChunkVertices, MaxIndex16Vertices) / rowVertices;
+		if (maxRows < 2)
+			throw std::runtime_error("Mesh rows are too wide for 16-bit indices.");
+		for (uint32_t row = 0; row < rows; row += maxRows - 1)
+		{
+			const uint32_t count = (std::min)(maxRows - 1, rows - row);
+			mesh.chunks.push_back({ 6 * columns * row, 6 * columns * count, rowVertices * row, rowVertices * (count + 1), row, count });
+		}
+		return mesh;
+	}
+
+	inline IndexedMesh PlanSphere(uint32_t slices, uint32_t stacks, IndexPolicy policy = IndexPolicy::Auto)
+	{
+		return PlanRows(slices, stacks, policy);
+	}
+
+	inline IndexedMesh PlanGrid(uint32_t cols, uint32_t rows, IndexPolicy policy = IndexPolicy::Auto)
+	{
+		return PlanRows(cols, rows, policy);
+	}
+
+	// Every band has the same local pattern as a sphere or grid of rowCount rows
+	inline void WriteSphereIndices(void* dst, const IndexedMesh& mesh)
+	{
+		for (const auto& c : mesh.chunks)
+		{
+			if (mesh.indexSize == 4)
+				WriteSphereIndices(static_cast<uint32_t*>(dst) + c.firstIndex, mesh.columns, c.rowCount);
+			else
+				WriteSphereIndices(static_cast<uint16_t*>(dst) + c.firstIndex, mesh.columns, c.rowCount);
+		}
+	}
+
+	inline void WriteGridIndices(void* dst, const IndexedMesh& mesh)
+	{
+		for (const auto& c : mesh.chunks)
+		{
+			if (mesh.indexSize == 4)
+				WriteGridIndices(static_cast<uint32_t*>(dst) + c.firstIndex, mesh.columns, c.rowCount);
+			else
+				WriteGridIndices(static_cast<uint16_t*>(dst) + c.firstIndex, mesh.columns, c.rowCount);
+		}
+	}
+
+#if defined(__d3d12_h__)
+	inline DXGI_FORMAT IndexFormat(const IndexedMesh& mesh)
+	{
+		return mesh.indexSize == 4 ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+	}
+
+	// One draw per chunk, vertex and index buffers must be bound already
+	inline void DrawIndexed(ID3D12GraphicsCommandList* cmdList, const IndexedMesh& mesh, UINT instanceCount = 1, UINT startInstance = 0)
+	{
+		for (const auto& c : mesh.chunks)
+			cmdList->DrawIndexedInstanced(c.indexCount, instanceCount, c.firstIndex, static_cast<INT>(c.baseVertex), startInstance);
+	}
+
+	// One triangle geometry per chunk, DXR has no base vertex so the vertex buffer start moves instead
+	inline void AppendGeometryDescs(std::vector<D3D12_RAYTRACING_GEOMETRY_DESC>& descs, const IndexedMesh& mesh,
+		D3D12_GPU_VIRTUAL_ADDRESS vb, UINT64 vbStride, D3D12_GPU_VIRTUAL_ADDRESS ib,
+		D3D12_RAYTRACING_GEOMETRY_FLAGS flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE)
+	{
+		for (const auto& c : mesh.chunks)
+		{
+			D3D12_RAYTRACING_GEOMETRY_DESC desc = {};
+			desc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+			desc.Flags = flags;
+			desc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+			desc.Triangles.VertexCount = c.vertexCount;
+			desc.Triangles.VertexBuffer.StartAddress = vb + vbStride * c.baseVertex;
+			desc.Triangles.VertexBuffer.StrideInBytes = vbStride;
+			desc.Triangles.IndexFormat = IndexFormat(mesh);
+			desc.Triangles.IndexCount = c.indexCount;
+			desc.Triangles.IndexBuffer = ib + static_cast<UINT64>(mesh.indexSize) * c.firstIndex;
+			descs.push_back(desc);
+		}
+	}
+#endif
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+// Adaptive ray budget
+// A ladder of quality levels, each a resolution divisor with shadow and AO ray counts, sorted by rays per
+// full-resolution pixel. The controller learns the GPU time per ray from timestamps of the ray and upsample passes,
+// which arrive a few frames late and tagged with the level they were measured at, and picks the richest level
+// predicted to fit the target time.
+// It drops immediately when over budget but climbs one level at a time after a few frames of headroom.
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace RayBudget
+{
+	struct Level
+	{
+		uint32_t divisor;    // Ray pass runs at 1/divisor of the width and height
+		uint32_t shadowRays; // Per ray pass pixel
+		uint32_t aoRays;
+	};
+
+	inline double RaysPerPixel(const Level& level)
+	{
+		return double(level.shadowRays + level.aoRays) / (level.divisor * level.divisor);
+	}
+
+	// Every divisor when pinnedDivisor is 0, otherwise only the levels of that divisor
+	inline std::vector<Level> DefaultLadder(uint32_t pinnedDivisor = 0)
+	{
+		std::vector<Level> ladder;
+		const uint32_t rays[][2] = { { 1, 1 }, { 1, 2 }, { 2, 4 }, { 4, 8 } };
+		for (uint32_t divisor : { 4u, 2u, 1u })
+		{
+			if (pinnedDivisor && divisor != pinnedDivisor)
+				continue;
+			for (const auto& r : rays)
+				ladder.push_back({ divisor, r[0], r[1] });
+		}
+		// Of levels with the same cost, keep the finer resolution
+		std::stable_sort(ladder.begin(), ladder.end(), [](const Level& a, const Level& b) {
+			return RaysPerPixel(a) < RaysPerPixel(b) || (RaysPerPixel(a) == RaysPerPixel(b) && a.divisor < b.divisor);
+		});
+		ladder.erase(std::unique(ladder.begin(), ladder.end(), [](const Level& a, const Level& b) {
+			return RaysPerPixel(a) == RaysPerPixel(b);
+		}), ladder.end());
+		return ladder;
+	}
+
+	class Controller
+	{
+	public:
+		explicit Controller(double targetMs = 2.0, std::vector<Level> ladder = DefaultLadder())
+			: mLadder(std::move(ladder)), mTargetMs(targetMs)
+		{
+			mLevel = static_cast<uint32_t>(mLadder.size() / 2);
+		}
+
+		// Time of a ray pass that ran at measuredLevel, returns the level for the next frame
+		uint32_t Update(uint32_t measuredLevel, double ms)
+		{
+			const double work = RaysPerPixel(mLadder[measuredLevel]);
+			const double msPerWork = ms / work;
+			mMsPerWork = mMsPerWork > 0 ? mMsPerWork + Smoothing * (msPerWork - mMsPerWork) : msPerWork;
+			// An over budget frame pulls the estimate up at once, so the drop below is not delayed by smoothing
+			if (ms > mTargetMs)
+				mMsPerWork = (std::max)(mMsPerWork, msPerWork);
+
+			uint32_t fit = 0;
+			while (fit + 1 < mLadder.size() && Predict(fit + 1) <= mTargetMs * Headroom)
+				fit++;
+			if (fit < mLevel)
+			{
+				mLevel = fit;
+				mCalm = 0;
+			}
+			else if (fit > mLevel && ++mCalm >= SettleFrames)
+			{
+				mLevel++;
+				mCalm = 0;
+			}
+			else if (fit == mLevel)
+			{
+				mCalm = 0;
+			}
+			mLastMs = ms;
+			return mLevel;
+		}
+
+		double Predict(uint32_t level) const { return mMsPerWork * RaysPerPixel(mLadder[level]); }
+		void SetTarget(double targetMs) { mTargetMs = (std::max)(0.1, targetMs); }
+		double Target() const { return mTargetMs; }
+		uint32_t LevelIndex() const { return mLevel; }
+		const Level& Current() const { return mLadder[mLevel]; }
+		const std::vector<Level>& Ladder() const { return mLadder; }
+		double LastMs() const { return mLastMs; }
+
+		static constexpr double Headroom = 0.9;
+		static constexpr double Smoothing = 0.2;
+		static constexpr uint32_t SettleFrames = 8;
+
+	private:
+		std::vector<Level> mLadder;
+		double mTargetMs;
+		double mMsPerWork = 0;
+		double mLastMs = 0;
+		uint32_t mLevel = 0;
+		uint32_t mCalm = 0;
+	};
+}
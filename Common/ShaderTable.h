@@ -0,0 +1,165 @@
+#pragma once
+
+// Shader binding table layout and incremental writes
+// Ray generation, miss and hit group tables follow each other, each starting on a 64-byte boundary. A record is the
+// 32-byte shader identifier followed by its local root arguments, with the stride of a table rounded to 32 bytes
+// from its largest arguments. Records remember when they last changed, so a copy in an upload buffer is brought
+// up to date by writing only the records changed since that copy was written.
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace ShaderTable
+{
+	constexpr uint32_t IdentifierSize = 32;   // D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES
+	constexpr uint32_t RecordAlignment = 32;  // D3D12_RAYTRACING_SHADER_RECORD_BYTE_ALIGNMENT
+	constexpr uint32_t TableAlignment = 64;   // D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT
+	constexpr uint32_t MaxRecordStride = 4096; // D3D12_RAYTRACING_MAX_SHADER_RECORD_STRIDE
+
+	enum class Kind
+	{
+		RayGen,
+		Miss,
+		HitGroup,
+		Count,
+	};
+
+	struct Table
+	{
+		uint64_t offset = 0;
+		uint32_t stride = 0;
+		uint32_t count = 0;
+		uint32_t argSize = 0;
+
+		uint64_t Size() const { return uint64_t(stride) * count; }
+	};
+
+	class Builder
+	{
+	public:
+		// Record count and largest local root arguments of each table fix the layout, and clear the records
+		void Resize(Kind kind, uint32_t count, uint32_t argSize = 0)
+		{
+			const auto stride = static_cast<uint32_t>(Align(IdentifierSize + argSize, RecordAlignment));
+			if (stride > MaxRecordStride)
+				throw std::runtime_error("Shader record is too large.");
+			auto& table = mTables[int(kind)];
+			table.count = count;
+			table.stride = stride;
+			table.argSize = argSize;
+			uint64_t offset = 0;
+			for (auto& t : mTables)
+			{
+				t.offset = offset;
+				offset = Align(offset + t.Size(), TableAlignment);
+			}
+			mSize = offset;
+			mData.assign(mSize, 0);
+			for (int k = 0; k < int(Kind::Count); k++)
+				mVersions[k].assign(mTables[k].count, 0);
+			mLayoutVersion = ++mVersion;
+		}
+
+		void Set(Kind kind, uint32_t index, const void* identifier, const void* args = nullptr, uint32_t argSize = 0)
+		{
+			SetIdentifier(kind, index, identifier);
+			SetArgs(kind, index, args, argSize);
+		}
+
+		void SetIdentifier(Kind kind, uint32_t index, const void* identifier)
+		{
+			uint8_t* record = Record(kind, index);
+			if (memcmp(record, identifier, IdentifierSize))
+			{
+				memcpy(record, identifier, IdentifierSize);
+				mVersions[int(kind)][index] = ++mVersion;
+			}
+		}
+
+		void SetArgs(Kind kind, uint32_t index, const void* args, uint32_t argSize)
+		{
+			if (argSize > mTables[int(kind)].argSize)
+				throw std::runtime_error("Local root arguments exceed the shader record.");
+			uint8_t* record = Record(kind, index) + IdentifierSize;
+			if (argSize && memcmp(record, args, argSize))
+			{
+				memcpy(record, args, argSize);
+				mVersions[int(kind)][index] = ++mVersion;
+			}
+		}
+
+		// Brings a copy last written at version up to date, returns its new version. Version 0 is a fresh copy.
+		uint64_t Write(uint8_t* dst, uint64_t version, uint64_t* bytesWritten = nullptr) const
+		{
+			uint64_t bytes = 0;
+			if (version < mLayoutVersion)
+			{
+				memcpy(dst, mData.data(), mSize);
+				bytes = mSize;
+			}
+			else
+			{
+				for (int k = 0; k < int(Kind::Count); k++)
+				{
+					const auto& table = mTables[k];
+					for (uint32_t i = 0; i < table.count; i++)
+					{
+						if (mVersions[k][i] <= version)
+							continue;
+						const uint64_t offset = table.offset + uint64_t(table.stride) * i;
+						memcpy(dst + offset, mData.data() + offset, table.stride);
+						bytes += table.stride;
+					}
+				}
+			}
+			if (bytesWritten)
+				*bytesWritten = bytes;
+			return mVersion;
+		}
+
+		const Table& Get(Kind kind) const { return mTables[int(kind)]; }
+		uint64_t Size() const { return mSize; }
+		uint64_t Version() const { return mVersion; }
+		const uint8_t* Data() const { return mData.data(); }
+
+#if defined(__d3d12_h__)
+		void Describe(D3D12_DISPATCH_RAYS_DESC& desc, D3D12_GPU_VIRTUAL_ADDRESS base) const
+		{
+			const auto& rayGen = Get(Kind::RayGen);
+			const auto& miss = Get(Kind::Miss);
+			const auto& hitGroup = Get(Kind::HitGroup);
+			desc.RayGenerationShaderRecord.StartAddress = base + rayGen.offset;
+			desc.RayGenerationShaderRecord.SizeInBytes = rayGen.stride;
+			desc.MissShaderTable.StartAddress = base + miss.offset;
+			desc.MissShaderTable.SizeInBytes = miss.Size();
+			desc.MissShaderTable.StrideInBytes = miss.stride;
+			desc.HitGroupTable.StartAddress = base + hitGroup.offset;
+			desc.HitGroupTable.SizeInBytes = hitGroup.Size();
+			desc.HitGroupTable.StrideInBytes = hitGroup.stride;
+		}
+#endif
+
+	private:
+		static uint64_t Align(uint64_t value, uint64_t alignment)
+		{
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		uint8_t* Record(Kind kind, uint32_t index)
+		{
+			const auto& table = mTables[int(kind)];
+			if (index >= table.count)
+				throw std::runtime_error("Shader record index out of range.");
+			return mData.data() + table.offset + uint64_t(table.stride) * index;
+		}
+
+		Table mTables[int(Kind::Count)];
+		std::vector<uint64_t> mVersions[int(Kind::Count)];
+		std::vector<uint8_t> mData;
+		uint64_t mSize = 0;
+		uint64_t mVersion = 0;
+		uint64_t mLayoutVersion = 0;
+	};
+}
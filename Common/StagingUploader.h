@@ -0,0 +1,307 @@
+#pragma once
+
+// Uploads packed into batches on the copy queue
+// Subresource footprints from GetCopyableFootprints() are written one after another into a persistently mapped
+// staging ring, and their copies are recorded into the command list of the open batch. A batch is submitted once it
+// holds a quarter of the ring, or when the ring has no room left, so the copy queue works while the CPU packs the
+// next one. Each upload returns a ticket, the fence value of the batch holding its last copy; the ring space and
+// command allocator of a batch are reused once its ticket completes. A subresource too large for the ring is split
+// into bands of rows. Destinations are left in COMMON, which copy queues promote to COPY_DEST and decay back from.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+#include "ConstantRing.h"
+
+namespace StagingUploader
+{
+	using Ticket = uint64_t;
+
+	// D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT
+	constexpr uint64_t TextureAlignment = 512;
+	constexpr uint64_t DefaultCapacity = 32 * 1024 * 1024;
+
+	// Staging ranges of the batches
+	class Batches
+	{
+	public:
+		explicit Batches(uint64_t capacity = 0)
+		{
+			Reset(capacity);
+		}
+
+		// The capacity is rounded down to the texture alignment
+		void Reset(uint64_t capacity)
+		{
+			mRing.Reset(capacity / TextureAlignment * TextureAlignment);
+			mInFlight.clear();
+			mOpen = 1;
+			mOpenBytes = mOpenCopies = 0;
+			mSubmitted = mCopies = mBytes = 0;
+		}
+
+		// Offset in the ring, Invalid while the space is still read by a batch in flight
+		uint64_t Allocate(uint64_t size, uint64_t alignment)
+		{
+			const uint64_t offset = mRing.Allocate(size, alignment);
+			if (offset != ConstantRing::Ring::Invalid)
+			{
+				mOpenBytes += size;
+				mOpenCopies++;
+			}
+			return offset;
+		}
+
+		// Rows per band so that a band leaves room for the batch before it
+		uint32_t BandRows(uint32_t rows, uint64_t rowPitch) const
+		{
+			const uint64_t band = Capacity() / 2 / rowPitch;
+			if (band == 0)
+				throw std::runtime_error("A row is larger than half the staging ring.");
+			return static_cast<uint32_t>((std::min)(uint64_t(rows), band));
+		}
+
+		// Calls band(first row, rows, bytes) for each band of rows, the last row of a band being rowSize long
+		template<class Band>
+		void ForEachBand(uint32_t rows, uint64_t rowPitch, uint64_t rowSize, Band&& band) const
+		{
+			const uint32_t bandRows = BandRows(rows, rowPitch);
+			for (uint32_t first = 0; first < rows; first += bandRows)
+			{
+				const uint32_t count = (std::min)(bandRows, rows - first);
+				band(first, count, rowPitch * (count - 1) + rowSize);
+			}
+		}
+
+		// The open batch completes with the returned ticket
+		Ticket Close()
+		{
+			mRing.Close(mOpen);
+			mInFlight.push_back(mOpen);
+			mSubmitted++;
+			mCopies += mOpenCopies;
+			mBytes += mOpenBytes;
+			mOpenBytes = mOpenCopies = 0;
+			return mOpen++;
+		}
+
+		void Retire(uint64_t completedValue)
+		{
+			mRing.Retire(completedValue);
+			while (!mInFlight.empty() && mInFlight.front() <= completedValue)
+				mInFlight.pop_front();
+		}
+
+		Ticket Open() const { return mOpen; }
+		bool Empty() const { return mOpenCopies == 0; }
+		bool Full() const { return mOpenBytes >= Capacity() / 4; } // Worth submitting
+		Ticket Oldest() const { return mInFlight.empty() ? 0 : mInFlight.front(); }
+		uint64_t Capacity() const { return mRing.Capacity(); }
+		uint64_t Used() const { return mRing.Used(); }
+		uint64_t Submitted() const { return mSubmitted; }
+
+	private:
+		ConstantRing::Ring mRing;
+		std::deque<Ticket> mInFlight;
+		Ticket mOpen = 1;
+		uint64_t mOpenBytes = 0;
+		uint64_t mOpenCopies = 0;
+		uint64_t mSubmitted = 0;
+		uint64_t mCopies = 0;
+		uint64_t mBytes = 0;
+	};
+
+#if defined(__d3d12_h__)
+	class Uploader
+	{
+	public:
+		void Create(ID3D12Device* device, ID3D12CommandQueue* queue, uint64_t capacity = DefaultCapacity)
+		{
+			mDevice = device;
+			mQueue = queue;
+			mBatches.Reset(capacity);
+			D3D12_HEAP_PROPERTIES heapProp = {};
+			heapProp.Type = D3D12_HEAP_TYPE_UPLOAD;
+			D3D12_RESOURCE_DESC resDesc = {};
+			resDesc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+			resDesc.Width = mBatches.Capacity();
+			resDesc.Height = 1;
+			resDesc.DepthOrArraySize = 1;
+			resDesc.MipLevels = 1;
+			resDesc.SampleDesc.Count = 1;
+			resDesc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+			resDesc.Flags = D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE;
+			if (FAILED(device->CreateCommittedResource(&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+				D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mStaging))))
+				throw std::runtime_error("Cannot create the staging ring.");
+			const D3D12_RANGE noRead = {};
+			if (FAILED(mStaging->Map(0, &noRead, reinterpret_cast<void**>(&mCpu))))
+				throw std::runtime_error("Cannot map the staging ring.");
+			if (FAILED(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence))))
+				throw std::runtime_error("Cannot create the upload fence.");
+			mType = queue->GetDesc().Type;
+		}
+
+		Ticket UploadBuffer(ID3D12Resource* dst, uint64_t dstOffset, const void* data, uint64_t size)
+		{
+			mBatches.ForEachBand(static_cast<uint32_t>((size + 255) / 256), 256, 256, [&](uint32_t first, uint32_t, uint64_t bytes) {
+				const uint64_t done = uint64_t(first) * 256;
+				bytes = (std::min)(bytes, size - done);
+				const uint64_t offset = Reserve(bytes, 16);
+				memcpy(mCpu + offset, static_cast<const uint8_t*>(data) + done, static_cast<size_t>(bytes));
+				mList->CopyBufferRegion(dst, dstOffset + done, mStaging.Get(), offset, bytes);
+			});
+			return Recorded();
+		}
+
+		// Subresources firstSubresource to firstSubresource + count - 1 of dst, data laid out as for UpdateSubresources()
+		Ticket UploadTexture(ID3D12Resource* dst, UINT firstSubresource, UINT count, const D3D12_SUBRESOURCE_DATA* data)
+		{
+			const auto desc = dst->GetDesc();
+			for (UINT i = 0; i < count; i++)
+			{
+				D3D12_PLACED_SUBRESOURCE_FOOTPRINT layout;
+				UINT rows;
+				UINT64 rowSize, total;
+				mDevice->GetCopyableFootprints(&desc, firstSubresource + i, 1, 0, &layout, &rows, &rowSize, &total);
+				// Texel rows per row of the footprint, 4 for block compression
+				const UINT blockHeight = rows ? layout.Footprint.Height / rows : 1;
+				D3D12_TEXTURE_COPY_LOCATION dstLocation = {};
+				dstLocation.pResource = dst;
+				dstLocation.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+				dstLocation.SubresourceIndex = firstSubresource + i;
+				for (UINT z = 0; z < layout.Footprint.Depth; z++)
+				{
+					const auto* slice = static_cast<const uint8_t*>(data[i].pData) + z * data[i].SlicePitch;
+					mBatches.ForEachBand(rows, layout.Footprint.RowPitch, rowSize, [&](uint32_t first, uint32_t bandRows, uint64_t bytes) {
+						const uint64_t offset = Reserve(bytes, TextureAlignment);
+						for (uint32_t row = 0; row < bandRows; row++)
+						{
+							memcpy(mCpu + offset + uint64_t(row) * layout.Footprint.RowPitch,
+								slice + (first + row) * data[i].RowPitch, static_cast<size_t>(rowSize));
+						}
+						D3D12_TEXTURE_COPY_LOCATION src = {};
+						src.pResource = mStaging.Get();
+						src.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+						src.PlacedFootprint.Offset = offset;
+						src.PlacedFootprint.Footprint = layout.Footprint;
+						src.PlacedFootprint.Footprint.Height = bandRows * blockHeight;
+						src.PlacedFootprint.Footprint.Depth = 1;
+						mList->CopyTextureRegion(&dstLocation, 0, first * blockHeight, z, &src, nullptr);
+					});
+				}
+			}
+			return Recorded();
+		}
+
+		// Starts the copies recorded so far, the returned ticket completes with them
+		Ticket Submit()
+		{
+			if (mBatches.Empty())
+				return mBatches.Open() - 1;
+			if (FAILED(mList->Close()))
+				throw std::runtime_error("Cannot close the upload command list.");
+			ID3D12CommandList* lists[] = { mList.Get() };
+			mQueue->ExecuteCommandLists(1, lists);
+			const Ticket ticket = mBatches.Close();
+			if (FAILED(mQueue->Signal(mFence.Get(), ticket)))
+				throw std::runtime_error("Cannot signal the upload fence.");
+			mAllocators.push_back({ ticket, std::move(mAllocator) });
+			return ticket;
+		}
+
+		bool IsComplete(Ticket ticket) const
+		{
+			return ticket < mBatches.Open() && mFence->GetCompletedValue() >= ticket;
+		}
+
+		// Blocks the CPU until the ticket completes, submitting its batch when still open
+		void Wait(Ticket ticket)
+		{
+			if (ticket >= mBatches.Open())
+				Submit();
+			if (mFence->GetCompletedValue() < ticket && FAILED(mFence->SetEventOnCompletion(ticket, nullptr)))
+				throw std::runtime_error("Cannot wait for the upload fence.");
+			mBatches.Retire(mFence->GetCompletedValue());
+		}
+
+		// Work submitted to queue from now on waits for the ticket on the GPU
+		void QueueWait(ID3D12CommandQueue* queue, Ticket ticket)
+		{
+			if (ticket >= mBatches.Open())
+				Submit();
+			if (FAILED(queue->Wait(mFence.Get(), ticket)))
+				throw std::runtime_error("Cannot wait for the upload fence.");
+		}
+
+		const Batches& Ranges() const { return mBatches; }
+
+	private:
+		// Ring space for the copy and an open command list to record it in
+		uint64_t Reserve(uint64_t size, uint64_t alignment)
+		{
+			for (;;)
+			{
+				mBatches.Retire(mFence->GetCompletedValue());
+				const uint64_t offset = mBatches.Allocate(size, alignment);
+				if (offset != ConstantRing::Ring::Invalid)
+				{
+					BeginList();
+					return offset;
+				}
+				if (!mBatches.Empty())
+					Submit();
+				else if (mBatches.Oldest())
+					Wait(mBatches.Oldest());
+				else
+					throw std::runtime_error("Upload is larger than the staging ring.");
+			}
+		}
+
+		void BeginList()
+		{
+			if (mAllocator)
+				return;
+			if (!mAllocators.empty() && mFence->GetCompletedValue() >= mAllocators.front().first)
+			{
+				mAllocator = std::move(mAllocators.front().second);
+				mAllocators.pop_front();
+				if (FAILED(mAllocator->Reset()))
+					throw std::runtime_error("Cannot reset an upload command allocator.");
+			}
+			else if (FAILED(mDevice->CreateCommandAllocator(mType, IID_PPV_ARGS(&mAllocator))))
+				throw std::runtime_error("Cannot create an upload command allocator.");
+			if (!mList)
+			{
+				if (FAILED(mDevice->CreateCommandList(0, mType, mAllocator.Get(), nullptr, IID_PPV_ARGS(&mList))))
+					throw std::runtime_error("Cannot create the upload command list.");
+			}
+			else if (FAILED(mList->Reset(mAllocator.Get(), nullptr)))
+				throw std::runtime_error("Cannot reset the upload command list.");
+		}
+
+		// Ticket of the batch holding the last copy, submitted early once it is full
+		Ticket Recorded()
+		{
+			const Ticket ticket = mBatches.Open();
+			if (mBatches.Full())
+				Submit();
+			return ticket;
+		}
+
+		ID3D12Device* mDevice = nullptr;
+		ID3D12CommandQueue* mQueue = nullptr;
+		D3D12_COMMAND_LIST_TYPE mType = D3D12_COMMAND_LIST_TYPE_COPY;
+		Microsoft::WRL::ComPtr<ID3D12Resource> mStaging;
+		uint8_t* mCpu = nullptr;
+		Microsoft::WRL::ComPtr<ID3D12Fence> mFence;
+		Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> mList;
+		Microsoft::WRL::ComPtr<ID3D12CommandAllocator> mAllocator; // Of the open batch
+		std::deque<std::pair<Ticket, Microsoft::WRL::ComPtr<ID3D12CommandAllocator>>> mAllocators;
+		Batches mBatches;
+	};
+#endif
+}
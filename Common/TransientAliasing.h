@@ -0,0 +1,217 @@
+#pragma once
+
+// Memory aliasing of transient resources
+// Each transient resource declares the passes it lives in. Resources whose lifetimes do not overlap may share memory,
+// so they are placed largest first at the lowest offset that does not collide with a placed resource whose lifetime
+// does overlap. Heap classes (render target and depth textures, other textures, buffers on tier 1 hardware) get
+// separate heaps, and a heap that would exceed the size limit spills into another heap of its class. A resource
+// that shares memory is activated at its first pass with an aliasing barrier and must be cleared or discarded.
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+namespace TransientAliasing
+{
+	// D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT
+	constexpr uint64_t DefaultAlignment = 64 * 1024;
+	constexpr uint32_t None = ~0u;
+
+	enum class Init
+	{
+		Clear,   // The first pass clears every texel
+		Discard, // DiscardResource() before the first pass
+	};
+
+	struct Resource
+	{
+		uint64_t size;
+		uint64_t alignment;
+		uint32_t heapClass;
+		uint32_t firstPass;
+		uint32_t lastPass; // Inclusive
+		Init init;
+	};
+
+	struct Placement
+	{
+		uint32_t heap;
+		uint64_t offset;
+	};
+
+	// A resource taking over memory at its first pass. before is the resource it replaces,
+	// None when it replaces several or when the memory was last used in the previous frame.
+	struct Activation
+	{
+		uint32_t pass;
+		uint32_t resource;
+		uint32_t before;
+		Init init;
+	};
+
+	struct Plan
+	{
+		std::vector<Placement> placements;   // Per resource
+		std::vector<uint64_t> heapSizes;
+		std::vector<uint32_t> heapClasses;   // Per heap
+		std::vector<uint64_t> heapAlignments;
+		std::vector<Activation> activations; // In pass order
+		uint64_t unaliasedSize = 0;          // Every resource in memory of its own
+
+		uint64_t PeakSize() const { return std::accumulate(heapSizes.begin(), heapSizes.end(), uint64_t(0)); }
+	};
+
+	inline uint64_t AlignUp(uint64_t size, uint64_t alignment)
+	{
+		return (size + alignment - 1) / alignment * alignment;
+	}
+
+	inline bool LifetimesOverlap(const Resource& a, const Resource& b)
+	{
+		return a.firstPass <= b.lastPass && b.firstPass <= a.lastPass;
+	}
+
+	inline bool MemoryOverlaps(const Resource& a, const Placement& pa, const Resource& b, const Placement& pb)
+	{
+		return pa.heap == pb.heap && pa.offset < pb.offset + b.size && pb.offset < pa.offset + a.size;
+	}
+
+	// maxHeapSize 0 keeps one heap per class
+	inline Plan PlanHeaps(const std::vector<Resource>& resources, uint64_t maxHeapSize = 0)
+	{
+		Plan plan;
+		plan.placements.assign(resources.size(), { None, 0 });
+		std::vector<uint32_t> order(resources.size());
+		std::iota(order.begin(), order.end(), 0u);
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return resources[a].size > resources[b].size; });
+
+		std::vector<std::vector<uint32_t>> heapResources;
+		std::vector<std::pair<uint64_t, uint64_t>> taken;
+		for (uint32_t r : order)
+		{
+			const auto& resource = resources[r];
+			if (resource.firstPass > resource.lastPass || resource.size == 0)
+				throw std::runtime_error("Transient resource has an empty lifetime or size.");
+			if (maxHeapSize && resource.size > maxHeapSize)
+				throw std::runtime_error("Transient resource is larger than a heap.");
+			plan.unaliasedSize = AlignUp(plan.unaliasedSize, resource.alignment) + resource.size;
+			for (uint32_t heap = 0;; heap++)
+			{
+				if (heap == plan.heapSizes.size())
+				{
+					plan.heapSizes.push_back(0);
+					plan.heapClasses.push_back(resource.heapClass);
+					plan.heapAlignments.push_back(DefaultAlignment);
+					heapResources.emplace_back();
+				}
+				if (plan.heapClasses[heap] != resource.heapClass)
+					continue;
+				// Memory of resources alive at the same time, lowest fitting gap first
+				taken.clear();
+				for (uint32_t other : heapResources[heap])
+				{
+					if (LifetimesOverlap(resource, resources[other]))
+						taken.push_back({ plan.placements[other].offset, plan.placements[other].offset + resources[other].size });
+				}
+				std::sort(taken.begin(), taken.end());
+				uint64_t offset = 0;
+				for (const auto& range : taken)
+				{
+					if (offset + resource.size <= range.first)
+						break;
+					offset = (std::max)(offset, AlignUp(range.second, resource.alignment));
+				}
+				if (maxHeapSize && offset + resource.size > maxHeapSize)
+					continue;
+				plan.placements[r] = { heap, offset };
+				plan.heapSizes[heap] = (std::max)(plan.heapSizes[heap], offset + resource.size);
+				plan.heapAlignments[heap] = (std::max)(plan.heapAlignments[heap], resource.alignment);
+				heapResources[heap].push_back(r);
+				break;
+			}
+		}
+
+		for (uint32_t r = 0; r < resources.size(); r++)
+		{
+			const auto& resource = resources[r];
+			uint32_t before = None, sharing = 0, predecessors = 0;
+			for (uint32_t other = 0; other < resources.size(); other++)
+			{
+				if (other == r || !MemoryOverlaps(resource, plan.placements[r], resources[other], plan.placements[other]))
+					continue;
+				sharing++;
+				if (resources[other].lastPass < resource.firstPass)
+				{
+					before = other;
+					predecessors++;
+				}
+			}
+			// A barrier naming one resource only covers its memory, the rest may hold anything from the previous frame
+			if (predecessors != 1 || plan.placements[before].offset > plan.placements[r].offset ||
+				plan.placements[before].offset + resources[before].size < plan.placements[r].offset + resource.size)
+				before = None;
+			if (sharing)
+				plan.activations.push_back({ resource.firstPass, r, before, resource.init });
+		}
+		std::stable_sort(plan.activations.begin(), plan.activations.end(), [](const Activation& a, const Activation& b) { return a.pass < b.pass; });
+		return plan;
+	}
+
+#if defined(__d3d12_h__)
+	// Size and alignment as the device lays the resource out
+	inline Resource Describe(ID3D12Device* device, const D3D12_RESOURCE_DESC& desc, uint32_t heapClass, uint32_t firstPass, uint32_t lastPass, Init init)
+	{
+		const auto info = device->GetResourceAllocationInfo(0, 1, &desc);
+		return { info.SizeInBytes, info.Alignment, heapClass, firstPass, lastPass, init };
+	}
+
+	inline void CreateHeaps(ID3D12Device* device, const Plan& plan, const std::vector<D3D12_HEAP_FLAGS>& classFlags,
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Heap>>& heaps)
+	{
+		heaps.resize(plan.heapSizes.size());
+		for (size_t heap = 0; heap < heaps.size(); heap++)
+		{
+			D3D12_HEAP_DESC heapDesc = {};
+			heapDesc.SizeInBytes = AlignUp(plan.heapSizes[heap], DefaultAlignment);
+			heapDesc.Properties.Type = D3D12_HEAP_TYPE_DEFAULT;
+			heapDesc.Alignment = plan.heapAlignments[heap];
+			heapDesc.Flags = classFlags[plan.heapClasses[heap]];
+			if (FAILED(device->CreateHeap(&heapDesc, IID_PPV_ARGS(&heaps[heap]))))
+				throw std::runtime_error("Cannot create a transient heap.");
+		}
+	}
+
+	// Aliasing barriers and discards of the resources activated at pass. Clears are left to the pass.
+	inline void Activate(ID3D12GraphicsCommandList* cmdList, const Plan& plan, uint32_t pass, ID3D12Resource* const* resources)
+	{
+		constexpr UINT BatchSize = 16;
+		D3D12_RESOURCE_BARRIER barriers[BatchSize];
+		UINT count = 0;
+		auto flush = [&]() {
+			if (count)
+				cmdList->ResourceBarrier(count, barriers);
+			count = 0;
+		};
+		for (const auto& activation : plan.activations)
+		{
+			if (activation.pass != pass)
+				continue;
+			auto& barrier = barriers[count++];
+			barrier = {};
+			barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_ALIASING;
+			barrier.Aliasing.pResourceBefore = activation.before == None ? nullptr : resources[activation.before];
+			barrier.Aliasing.pResourceAfter = resources[activation.resource];
+			if (count == BatchSize)
+				flush();
+		}
+		flush();
+		for (const auto& activation : plan.activations)
+		{
+			if (activation.pass == pass && activation.init == Init::Discard)
+				cmdList->DiscardResource(resources[activation.resource], nullptr);
+		}
+	}
+#endif
+}
@@ -5,6 +5,12 @@
 #include <dxgi1_4.h>
 #include <d3d12.h>
 #include "d3dx12.h"
+#include "ProceduralMesh.h"
+#include "MeshOptimizer.h"
+#include "Bvh.h"
+#include "AccelerationStructurePool.h"
+#include "BlasScheduler.h"
+#include "ShaderTable.h"
 #include <DirectXMath.h>
 #include <vector>
 #include <iterator>
@@ -92,15 +98,55 @@ class D3D
 	ComPtr<ID3D12Resource> mIB;
 	const int SphereSlices = 12;
 	const int SphereStacks = 12;
+	ProceduralMesh::IndexedMesh mSphereMesh;
 
 	ComPtr<ID3D12Resource> mVBPlane;
 	ComPtr<ID3D12Resource> mIBPlane;
 
-	ComPtr<ID3D12Resource> mBlas;
-	ComPtr<ID3D12Resource> mBlasPlane;
-	ComPtr<ID3D12Resource> mTlasInstance;
+	// Every BLAS lives in the pool, the static ones compacted
+	enum {
+		StaticSphere,
+		StaticPlane,
+		StaticBlasCount,
+	};
+	AccelerationStructurePool::Pool mAsPool;
+	D3D12_GPU_VIRTUAL_ADDRESS mBlas = 0; // Deforming sphere
+	D3D12_GPU_VIRTUAL_ADDRESS mBlasStatic[StaticBlasCount] = {};
+	ComPtr<ID3D12Resource> mTlasInstance[BUFFER_COUNT];
+	D3D12_RAYTRACING_INSTANCE_DESC* mTlasInstanceData[BUFFER_COUNT];
 	ComPtr<ID3D12Resource> mTlas;
 
+	// The sphere deforms every frame and small copies of it orbit, so both levels are updated per frame
+	static const int OrbitCount = 6;
+	static const int InstanceCount = 2 + OrbitCount;
+	vector<uint8_t> mSphereVertices; // Rest pose
+	vector<uint8_t> mSphereIndices;
+	vector<VertexElement> mSphereDeformed;
+	ComPtr<ID3D12Resource> mVBAnim[BUFFER_COUNT];
+	void* mVBAnimData[BUFFER_COUNT];
+	vector<D3D12_RAYTRACING_GEOMETRY_DESC> mSphereGeomDescs;
+	// Initial builds are batched over a shared scratch arena on a persistent compute queue
+	static const UINT64 BlasScratchBudget = 1024 * 1024;
+	BlasScheduler::Scheduler mBlasBuilder;
+	ComPtr<ID3D12Resource> mScratchBlas;
+	ComPtr<ID3D12Resource> mScratchTlas;
+	// CPU copies of both levels measure how far refits degrade the trees
+	Bvh::BottomLevel mCpuSphere;
+	Bvh::BottomLevel mCpuPlane;
+	Bvh::BottomLevel mCpuSphereRest;
+	Bvh::TopLevel mCpuScene;
+	vector<Bvh::Instance> mCpuInstances;
+	Bvh::RefitPolicy mBlasPolicy;
+	Bvh::RefitPolicy mTlasPolicy;
+	// Timestamps before the BLAS, after the BLAS and after the TLAS of every frame
+	ComPtr<ID3D12QueryHeap> mTimestampHeap;
+	ComPtr<ID3D12Resource> mTimestampReadback;
+	uint64_t* mTimestampData;
+	uint64_t mTimestampFrequency;
+	bool mAsRebuilt[BUFFER_COUNT][2] = {};
+	double mAsSeconds[2][2] = {}; // [BLAS, TLAS][refit, rebuild]
+	uint32_t mAsFrames[2][2] = {};
+
 	ComPtr<ID3D12StateObject> mStateObject;
 	ComPtr<ID3D12StateObjectProperties> mStateObjectProps;
 	ComPtr<ID3D12RootSignature> mSceneRootSigGlobal;
@@ -108,18 +154,20 @@ class D3D
 	ComPtr<ID3D12RootSignature> mSceneRootSigLocalNull;
 	ComPtr<ID3D12Resource> mShaderBindingTable[BUFFER_COUNT];
 
-	static int Align(int val, int align)
-	{
-		return ((val + align - 1) & ~(align - 1));
-	}
-
-	const uint32_t oRayGen = 0;
-	const uint32_t oRayGenRootConstant = oRayGen + D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES;
-	const uint32_t oHitGroup = Align(oRayGenRootConstant + 4, D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT);
-	const uint32_t oMiss = Align(oHitGroup + D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES, D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT);
-	const uint32_t oMax = Align(oMiss + D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES, D3D12_RAYTRACING_SHADER_TABLE_BYTE_ALIGNMENT);
+	// One hit group per raytracing mode, the mode picks which one every hit record points at
+	static const int HitGroupCount = 4;
+	const wchar_t* HitGroupNames[HitGroupCount] = { L"MyHitGroupWhite", L"MyHitGroupBarycentrics", L"MyHitGroupPrimitive", L"MyHitGroupMaterial" };
+	const wchar_t* ClosestHitNames[HitGroupCount] = { L"MyClosestHitWhite", L"MyClosestHitBarycentrics", L"MyClosestHitPrimitive", L"MyClosestHitMaterial" };
+	const wchar_t* ClosestHitEntries[HitGroupCount] = { L"White", L"Barycentrics", L"Primitive", L"Material" };
 
-	unique_ptr<uint8_t[]> mShaderBindingTableDefaultData;
+	// One hit record per geometry of every instance, carrying the instance's texture index
+	struct HitGroupArgs {
+		uint32_t textureIndex;
+	};
+	ShaderTable::Builder mShaderTable;
+	uint64_t mShaderTableVersion[BUFFER_COUNT] = {};
+	UINT mHitGroupBase[InstanceCount] = {};
+	UINT mHitGroupCount = 0;
 
 public:
 	~D3D()
@@ -187,6 +235,18 @@ public:
 
 		CHK(mDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence)));
 
+		D3D12_QUERY_HEAP_DESC queryHeapDesc = {};
+		queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+		queryHeapDesc.Count = 3 * BUFFER_COUNT;
+		CHK(mDevice->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(&mTimestampHeap)));
+		auto readbackProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK);
+		auto readbackDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeof(uint64_t) * queryHeapDesc.Count);
+		CHK(mDevice->CreateCommittedResource(
+			&readbackProp, D3D12_HEAP_FLAG_NONE, &readbackDesc,
+			D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&mTimestampReadback)));
+		CHK(mTimestampReadback->Map(0, nullptr, reinterpret_cast<void**>(&mTimestampData)));
+		CHK(mCmdQueue->GetTimestampFrequency(&mTimestampFrequency));
+
 		CHK(mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, mCmdAllocCopy.Get(), nullptr, IID_PPV_ARGS(&mCmdListCopy)));
 
 		D3D12_DESCRIPTOR_HEAP_DESC descHeapDesc = {};
@@ -221,7 +281,7 @@ public:
 		CHK(D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1, &rootSigBlob, &rootSigError));
 		CHK(mDevice->CreateRootSignature(0, rootSigBlob->GetBufferPointer(), rootSigBlob->GetBufferSize(), IID_PPV_ARGS(&mSceneRootSigGlobal)));
 
-		rootParam[0].InitAsConstants(1, 0, 1); // b0, space1
+		rootParam[0].InitAsConstants(sizeof(HitGroupArgs) / 4, 0, 1); // b0, space1
 		rootSigDesc.Init(1, rootParam, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_LOCAL_ROOT_SIGNATURE);
 
 		CHK(D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1, &rootSigBlob, &rootSigError));
@@ -235,12 +295,9 @@ public:
 		// Shader
 
 		static const char shaderCodeSceneRayGen[] = R"#(
-#define SHADER_INC_PER_BOTTOM_INSTANCE 0
-struct Payload { float4 color; uint mode; };
+#define SHADER_INC_PER_BOTTOM_INSTANCE 1
+struct Payload { float4 color; };
 
-cbuffer CMode : register(b0, space1) {
-	uint Mode;
-};
 cbuffer CScene : register(b0) {
 	float4x4 InvViewProj;
 	float4 CameraPos;
@@ -260,7 +317,7 @@ void main()
 	ray.Direction = normalize(farPos.xyz - CameraPos.xyz);
 	ray.TMin = 0.01;
 	ray.TMax = 100.0;
-	Payload payload = { (float4)0, Mode };
+	Payload payload = { (float4)0 };
 	TraceRay(myAS, RAY_FLAG_CULL_NON_OPAQUE,
 		0x1, 0, SHADER_INC_PER_BOTTOM_INSTANCE, 0, ray, payload);
 
@@ -269,32 +326,38 @@ void main()
 )#";
 
 		static const char shaderCodeSceneClosestHit[] = R"#(
-struct Payload { float4 color; uint mode; };
+struct Payload { float4 color; };
 
+cbuffer CMaterial : register(b0, space1) {
+	uint TextureIndex;
+};
 Texture2D<float4> ColorMap[] : register(t0, space1);
 [shader("closesthit")]
-void main(inout Payload payload, BuiltInTriangleIntersectionAttributes attr)
+void White(inout Payload payload, BuiltInTriangleIntersectionAttributes attr)
 {
-	if (payload.mode == 0) {
-		payload.color = float4(1, 1, 1, 1);
-	}
-	else if (payload.mode == 1) {
-		float3 barycentrics = float3(1 - attr.barycentrics.x - attr.barycentrics.y, attr.barycentrics.x, attr.barycentrics.y);
-		payload.color = float4(barycentrics, 1);
-	}
-	else if (payload.mode == 2) {
-		uint id = PrimitiveIndex() % 8;
-		payload.color = ColorMap[NonUniformResourceIndex(id)].Load(int3(0, 0, 0));
-	}
-	else if (payload.mode == 3) {
-		uint id = InstanceIndex() % 8;
-		payload.color = ColorMap[NonUniformResourceIndex(id)].Load(int3(0, 0, 0));
-	}
+	payload.color = float4(1, 1, 1, 1);
+}
+[shader("closesthit")]
+void Barycentrics(inout Payload payload, BuiltInTriangleIntersectionAttributes attr)
+{
+	float3 barycentrics = float3(1 - attr.barycentrics.x - attr.barycentrics.y, attr.barycentrics.x, attr.barycentrics.y);
+	payload.color = float4(barycentrics, 1);
+}
+[shader("closesthit")]
+void Primitive(inout Payload payload, BuiltInTriangleIntersectionAttributes attr)
+{
+	uint id = PrimitiveIndex() % 8;
+	payload.color = ColorMap[NonUniformResourceIndex(id)].Load(int3(0, 0, 0));
+}
+[shader("closesthit")]
+void Material(inout Payload payload, BuiltInTriangleIntersectionAttributes attr)
+{
+	payload.color = ColorMap[NonUniformResourceIndex(TextureIndex)].Load(int3(0, 0, 0));
 }
 )#";
 
 		static const char shaderCodeSceneMiss[] = R"#(
-struct Payload { float4 color; uint mode; };
+struct Payload { float4 color; };
 
 [shader("miss")]
 void main(inout Payload payload)
@@ -361,17 +424,21 @@ void main(inout Payload payload)
 			libRG->SetDXILLibrary(&libDxilRG);
 			libRG->DefineExport(L"MyRayGen", L"main");
 			libCH->SetDXILLibrary(&libDxilCH);
-			libCH->DefineExport(L"MyClosestHit", L"main");
+			for (int i = 0; i < HitGroupCount; i++)
+				libCH->DefineExport(ClosestHitNames[i], ClosestHitEntries[i]);
 			libMiss->SetDXILLibrary(&libDxilMiss);
 			libMiss->DefineExport(L"MyMiss", L"main");
 
-			auto hitGroup = rtDesc.CreateSubobject<CD3DX12_HIT_GROUP_SUBOBJECT>();
-			hitGroup->SetHitGroupType(D3D12_HIT_GROUP_TYPE_TRIANGLES);
-			hitGroup->SetHitGroupExport(L"MyHitGroup");
-			hitGroup->SetClosestHitShaderImport(L"MyClosestHit");
+			for (int i = 0; i < HitGroupCount; i++)
+			{
+				auto hitGroup = rtDesc.CreateSubobject<CD3DX12_HIT_GROUP_SUBOBJECT>();
+				hitGroup->SetHitGroupType(D3D12_HIT_GROUP_TYPE_TRIANGLES);
+				hitGroup->SetHitGroupExport(HitGroupNames[i]);
+				hitGroup->SetClosestHitShaderImport(ClosestHitNames[i]);
+			}
 
 			auto shaderConfig = rtDesc.CreateSubobject<CD3DX12_RAYTRACING_SHADER_CONFIG_SUBOBJECT>();
-			UINT payloadSize = 4 * sizeof(float) + 1 * sizeof(unsigned);   // color + mode
+			UINT payloadSize = 4 * sizeof(float);   // color
 			UINT attributeSize = 2 * sizeof(float); // barycentrics
 			shaderConfig->Config(payloadSize, attributeSize);
 
@@ -384,14 +451,15 @@ void main(inout Payload payload)
 			// Bind local root signature to shader stage
 			auto rootSigAssociation = rtDesc.CreateSubobject<CD3DX12_SUBOBJECT_TO_EXPORTS_ASSOCIATION_SUBOBJECT>();
 			rootSigAssociation->SetSubobjectToAssociate(*rootSigLocal);
-			rootSigAssociation->AddExport(L"MyRayGen");
+			for (int i = 0; i < HitGroupCount; i++)
+				rootSigAssociation->AddExport(ClosestHitNames[i]);
 #if 1
 			// On PIX unbind local signatures show warnings...
 			auto rootSigLocalNull = rtDesc.CreateSubobject<CD3DX12_LOCAL_ROOT_SIGNATURE_SUBOBJECT>();
 			rootSigLocalNull->SetRootSignature(mSceneRootSigLocalNull.Get());
 			auto rootSigNullAssociation = rtDesc.CreateSubobject<CD3DX12_SUBOBJECT_TO_EXPORTS_ASSOCIATION_SUBOBJECT>();
 			rootSigNullAssociation->SetSubobjectToAssociate(*rootSigLocalNull);
-			rootSigNullAssociation->AddExport(L"MyClosestHit");
+			rootSigNullAssociation->AddExport(L"MyRayGen");
 			rootSigNullAssociation->AddExport(L"MyMiss");
 #endif
 
@@ -402,31 +470,7 @@ void main(inout Payload payload)
 			CHK(device5->CreateStateObject(rtDesc, IID_PPV_ARGS(&mStateObject)));
 		}
 
-		// Shader Table
-
-		{
-			CHK(mStateObject.As(&mStateObjectProps));
-			void* pRayGenID = mStateObjectProps->GetShaderIdentifier(L"MyRayGen");
-			void* pMissID = mStateObjectProps->GetShaderIdentifier(L"MyMiss");
-			void* pHitGroupID = mStateObjectProps->GetShaderIdentifier(L"MyHitGroup");
-
-			mShaderBindingTableDefaultData = std::make_unique<uint8_t[]>(oMax);
-			uint8_t* sbt = mShaderBindingTableDefaultData.get();
-			memset(sbt, 0, oMax); // zero fill
-			memcpy(sbt + oRayGen, pRayGenID, D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-			memset(sbt + oRayGenRootConstant, 0, sizeof(uint32_t));
-			memcpy(sbt + oHitGroup, pHitGroupID, D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-			memcpy(sbt + oMiss, pMissID, D3D12_SHADER_IDENTIFIER_SIZE_IN_BYTES);
-
-			for (auto& sbtr : mShaderBindingTable)
-			{
-				auto heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-				auto resDesc = CD3DX12_RESOURCE_DESC::Buffer(oMax);
-				CHK(mDevice->CreateCommittedResource(
-					&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-					D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&sbtr)));
-			}
-		}
+		CHK(mStateObject.As(&mStateObjectProps));
 
 		// Resources
 
@@ -537,46 +581,16 @@ void main(inout Payload payload)
 		CD3DX12_CPU_DESCRIPTOR_HANDLE samplerHandle(mSampler->GetCPUDescriptorHandleForHeapStart());
 		mDevice->CreateSampler(&samplerDesc, samplerHandle);
 
-		// Generate sphere triangles
+		// Generate sphere triangles, reordered in place for the vertex cache, overdraw and vertex fetch
+		mSphereMesh = ProceduralMesh::PlanSphere(SphereSlices, SphereStacks);
+		mSphereVertices.resize(sizeof(VertexElement) * mSphereMesh.vertexCount);
+		mSphereIndices.resize(mSphereMesh.IndexBufferSize());
+		ProceduralMesh::WriteSphereVertices(mSphereVertices.data(), ProceduralMesh::LayoutOf<VertexElement>(), SphereSlices, SphereStacks);
+		ProceduralMesh::WriteSphereIndices(mSphereIndices.data(), mSphereMesh);
+		MeshOptimizer::OptimizeInPlace(mSphereMesh, mSphereVertices.data(), mSphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
+		mSphereDeformed.resize(mSphereMesh.vertexCount);
 
-		struct IndexList
-		{
-			short a[6];
-		};
-		vector<VertexElement> vertices;
-		vector<IndexList> indices;
-		vertices.reserve((SphereStacks + 1) * (SphereSlices + 1));
-		for (int y = 0; y < SphereStacks + 1; ++y)
-		{
-			for (int x = 0; x < SphereSlices + 1; ++x)
-			{
-				// Generate a evenly tesselated plane
-				float v[3] = { (float)x / (float)(SphereSlices), (float)y / (float)(SphereStacks), 0.0f };
-				// Convert to spherical coordinate system
-				float theta = 2 * 3.14159265f * v[0];
-				float phi = 2 * 3.14159265f * v[1] / 2.0f;
-				VertexElement ve = { sinf(phi) * sinf(theta), cosf(phi), sinf(phi) * cosf(theta), 0, 0, 0 };
-				// Setup normal
-				float r = 1.0f;
-				ve.normal[0] = ve.position[0] / r;
-				ve.normal[1] = ve.position[1] / r;
-				ve.normal[2] = ve.position[2] / r;
-				vertices.push_back(ve);
-			}
-		}
-		indices.reserve(SphereStacks * SphereSlices);
-		for (int y = 0; y < SphereStacks; ++y)
-		{
-			for (int x = 0; x < SphereSlices; ++x)
-			{
-				short b = static_cast<short>(y * (SphereSlices + 1) + x);
-				short s = SphereSlices + 1;
-				IndexList il = { b, b + s, b + 1, b + s, b + s + 1, b + 1 };
-				indices.push_back(il);
-			}
-		}
-
-		auto sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		auto sizeVB = static_cast<uint32_t>(mSphereVertices.size());
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
@@ -584,41 +598,44 @@ void main(inout Payload payload)
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVB)));
 		void* gpuMem;
 		CHK(mVB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		memcpy(gpuMem, mSphereVertices.data(), mSphereVertices.size());
 
-		auto sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		auto sizeIB = static_cast<uint32_t>(mSphereIndices.size());
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeIB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIB)));
 		CHK(mIB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		memcpy(gpuMem, mSphereIndices.data(), mSphereIndices.size());
+
+		// Deformed sphere of every frame
+		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
+		for (int i = 0; i < BUFFER_COUNT; i++)
+		{
+			CHK(mDevice->CreateCommittedResource(
+				&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+				D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVBAnim[i])));
+			CHK(mVBAnim[i]->Map(0, nullptr, &mVBAnimData[i]));
+		}
 
 		// Generate plane triangles
-		vertices.clear();
-		indices.clear();
-		vertices.push_back({ -1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ -1, -1, -1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, -1,  0, +1,  0 });
-		for (auto& v : vertices) { v.position[0] *= 3; v.position[1] *= 3; v.position[2] *= 3; }
-		indices.push_back({ 0, 1, 2, 2, 1, 3 });
-
-		sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		const auto planeSize = ProceduralMesh::PlaneSize();
+
+		sizeVB = static_cast<uint32_t>(sizeof(VertexElement) * planeSize.vertexCount);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVBPlane)));
 		CHK(mVBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		ProceduralMesh::WritePlaneVertices(gpuMem, ProceduralMesh::LayoutOf<VertexElement>(), 3.0f, -3.0f);
 
-		sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		sizeIB = static_cast<uint32_t>(sizeof(uint16_t) * planeSize.indexCount);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeIB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIBPlane)));
 		CHK(mIBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		ProceduralMesh::WritePlaneIndices(static_cast<uint16_t*>(gpuMem));
 
 		// DMA
 
@@ -630,6 +647,7 @@ void main(inout Payload payload)
 		mCmdQueueCopy->ExecuteCommandLists(1, CommandListCast(cmdLists));
 		CHK(mCmdQueueCopy->Signal(fenceCopy.Get(), 1));
 		BuildBVH(fenceCopy.Get()); // Include command wait
+		BuildShaderTable();
 		CHK(mCmdAllocCopy->Reset());
 	}
 
@@ -638,136 +656,203 @@ void main(inout Payload payload)
 		ComPtr<ID3D12Device5> device5;
 		CHK(mDevice.As(&device5));
 
-		ComPtr<ID3D12CommandQueue> cmdQueue;
-		ComPtr<ID3D12GraphicsCommandList4> cmdList4;
-		ComPtr<ID3D12CommandAllocator> cmdAlloc;
-		ComPtr<ID3D12Fence> fence;
-		ComPtr<ID3D12Resource> scratchBufBlas, scratchBufTlas;
-
-		// Create compute queue
+		ComPtr<ID3D12Resource> uncompactedBlas, compactedSizes, compactedSizesReadback;
 
-		D3D12_COMMAND_QUEUE_DESC queueDesc = { D3D12_COMMAND_LIST_TYPE_COMPUTE };
-		CHK(device5->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&cmdQueue)));
-		CHK(device5->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COMPUTE, IID_PPV_ARGS(&cmdAlloc)));
-		CHK(device5->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COMPUTE, cmdAlloc.Get(), nullptr, IID_PPV_ARGS(&cmdList4)));
-		CHK(device5->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence)));
+		// Builds run on the scheduler's compute queue
 
-		CHK(cmdQueue->Wait(fenceCopy, 1));
+		mBlasBuilder.Create(device5.Get(), BlasScratchBudget);
+		auto cmdList4 = mBlasBuilder.Begin();
+		CHK(mBlasBuilder.Queue()->Wait(fenceCopy, 1));
 
 		// Prebuild BLAS
 
-		D3D12_RAYTRACING_GEOMETRY_DESC blasGeomDescs[2] = {};
-		// Sphere
-		blasGeomDescs[0].Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-		blasGeomDescs[0].Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
-		blasGeomDescs[0].Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-		blasGeomDescs[0].Triangles.VertexCount = (SphereStacks + 1) * (SphereSlices + 1);
-		blasGeomDescs[0].Triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
-		blasGeomDescs[0].Triangles.IndexCount = (SphereStacks * SphereSlices) * 6;
-		blasGeomDescs[0].Triangles.IndexBuffer = mIB->GetGPUVirtualAddress();
-		blasGeomDescs[0].Triangles.VertexBuffer.StartAddress = mVB->GetGPUVirtualAddress();
-		blasGeomDescs[0].Triangles.VertexBuffer.StrideInBytes = sizeof(VertexElement);
+		// Sphere, one geometry per 16-bit chunk
+		vector<D3D12_RAYTRACING_GEOMETRY_DESC> blasGeomDescs;
+		ProceduralMesh::AppendGeometryDescs(blasGeomDescs, mSphereMesh,
+			mVB->GetGPUVirtualAddress(), sizeof(VertexElement), mIB->GetGPUVirtualAddress());
+		const auto sphereGeomCount = static_cast<UINT>(blasGeomDescs.size());
+		// Hit records of each instance, one per geometry of its BLAS
+		mHitGroupCount = 0;
+		for (int i = 0; i < InstanceCount; i++)
+		{
+			mHitGroupBase[i] = mHitGroupCount;
+			mHitGroupCount += i == 1 ? 1 : sphereGeomCount;
+		}
+		mSphereGeomDescs.assign(blasGeomDescs.begin(), blasGeomDescs.end());
 		// Plane
-		blasGeomDescs[1] = blasGeomDescs[0];
-		blasGeomDescs[1].Triangles.VertexCount = 4;
-		blasGeomDescs[1].Triangles.IndexCount = 6;
-		blasGeomDescs[1].Triangles.IndexBuffer = mIBPlane->GetGPUVirtualAddress();
-		blasGeomDescs[1].Triangles.VertexBuffer.StartAddress = mVBPlane->GetGPUVirtualAddress();
+		D3D12_RAYTRACING_GEOMETRY_DESC planeGeomDesc = blasGeomDescs[0];
+		planeGeomDesc.Triangles.VertexCount = 4;
+		planeGeomDesc.Triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
+		planeGeomDesc.Triangles.IndexCount = 6;
+		planeGeomDesc.Triangles.IndexBuffer = mIBPlane->GetGPUVirtualAddress();
+		planeGeomDesc.Triangles.VertexBuffer.StartAddress = mVBPlane->GetGPUVirtualAddress();
+		blasGeomDescs.push_back(planeGeomDesc);
 		// Two geometries can merge together, but shaders cannot classify each other on SM6.3
 
-		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS blasInput = {}, blasPlaneInput = {};
-		// Sphere
+		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS blasInput = {}, blasStaticInput[StaticBlasCount] = {};
+		// Sphere, refitted every frame
 		blasInput.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-		blasInput.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
-		blasInput.NumDescs = 1;
+		blasInput.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE
+			| D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+		blasInput.NumDescs = sphereGeomCount;
 		blasInput.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-		blasInput.pGeometryDescs = blasGeomDescs + 0;
-		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO blasPrebuildInfo, blasPlanePrebuildInfo;
+		blasInput.pGeometryDescs = blasGeomDescs.data();
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO blasPrebuildInfo, blasStaticPrebuildInfo[StaticBlasCount];
 		device5->GetRaytracingAccelerationStructurePrebuildInfo(&blasInput, &blasPrebuildInfo);
-		// Plane
-		blasPlaneInput = blasInput;
-		blasPlaneInput.pGeometryDescs = blasGeomDescs + 1;
-		device5->GetRaytracingAccelerationStructurePrebuildInfo(&blasPlaneInput, &blasPlanePrebuildInfo);
+		// Sphere at rest and plane, static so they are built once and compacted
+		for (int i = 0; i < StaticBlasCount; i++)
+		{
+			blasStaticInput[i] = blasInput;
+			blasStaticInput[i].Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION
+				| D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+		}
+		blasStaticInput[StaticSphere].NumDescs = sphereGeomCount;
+		blasStaticInput[StaticPlane].NumDescs = 1;
+		blasStaticInput[StaticPlane].pGeometryDescs = blasGeomDescs.data() + sphereGeomCount;
+		UINT64 uncompactedSize = 0;
+		UINT64 uncompactedOffset[StaticBlasCount];
+		for (int i = 0; i < StaticBlasCount; i++)
+		{
+			device5->GetRaytracingAccelerationStructurePrebuildInfo(&blasStaticInput[i], &blasStaticPrebuildInfo[i]);
+			uncompactedOffset[i] = uncompactedSize;
+			uncompactedSize += AccelerationStructurePool::AlignUp(blasStaticPrebuildInfo[i].ResultDataMaxSizeInBytes);
+		}
 
-		// Scratch(Sphere + Plane)
+		// Scratch for the per-frame updates and rebuilds of the sphere, the initial builds share the arena
 		auto heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
-		UINT64 scratchSize =
-			Align(blasPrebuildInfo.ScratchDataSizeInBytes, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT)
-			+ blasPlanePrebuildInfo.ScratchDataSizeInBytes;
-		auto resDesc = CD3DX12_RESOURCE_DESC::Buffer(scratchSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+		auto resDesc = CD3DX12_RESOURCE_DESC::Buffer(
+			max(blasPrebuildInfo.ScratchDataSizeInBytes, blasPrebuildInfo.UpdateScratchDataSizeInBytes), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-			D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&scratchBufBlas)));
+			D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&mScratchBlas)));
 
-		// Sphere
-		resDesc = CD3DX12_RESOURCE_DESC::Buffer(blasPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+		// Every BLAS lives in the pool, the static ones are built into a temporary buffer first
+		// Sized from the prebuild info, a compacted BLAS never outgrows its uncompacted size
+		mAsPool.Create(mDevice.Get(), AccelerationStructurePool::AlignUp(blasPrebuildInfo.ResultDataMaxSizeInBytes) + uncompactedSize);
+		mBlas = mAsPool.Allocate(blasPrebuildInfo.ResultDataMaxSizeInBytes);
+		resDesc = CD3DX12_RESOURCE_DESC::Buffer(uncompactedSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-			D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nullptr, IID_PPV_ARGS(&mBlas)));
-		// Plane
-		resDesc = CD3DX12_RESOURCE_DESC::Buffer(blasPlanePrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+			D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nullptr, IID_PPV_ARGS(&uncompactedBlas)));
+		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeof(UINT64) * StaticBlasCount, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-			D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nullptr, IID_PPV_ARGS(&mBlasPlane)));
+			D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&compactedSizes)));
+		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK);
+		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeof(UINT64) * StaticBlasCount);
+		CHK(mDevice->CreateCommittedResource(
+			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+			D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&compactedSizesReadback)));
 
 		// Build BLAS
 
-		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC blasDesc = {}, blasPlaneDesc = {};
-		// Sphere
-		blasDesc.Inputs = blasInput;
-		blasDesc.ScratchAccelerationStructureData = scratchBufBlas->GetGPUVirtualAddress();
-		blasDesc.DestAccelerationStructureData = mBlas->GetGPUVirtualAddress();
-		cmdList4->BuildRaytracingAccelerationStructure(&blasDesc, 0, nullptr);
-		// Plane
-		blasPlaneDesc.Inputs = blasPlaneInput;
-		blasPlaneDesc.ScratchAccelerationStructureData = scratchBufBlas->GetGPUVirtualAddress()
-			+ Align(blasPrebuildInfo.ScratchDataSizeInBytes, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
-		blasPlaneDesc.DestAccelerationStructureData = mBlasPlane->GetGPUVirtualAddress();
-		cmdList4->BuildRaytracingAccelerationStructure(&blasPlaneDesc, 0, nullptr);
+		auto transition = CD3DX12_RESOURCE_BARRIER::Transition(compactedSizes.Get(),
+			D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		cmdList4->ResourceBarrier(1, &transition);
+		// Sphere, and the static ones with their compacted sizes
+		vector<BlasScheduler::Build> builds;
+		builds.push_back({ blasInput, mBlas, blasPrebuildInfo.ScratchDataSizeInBytes, 0 });
+		for (int i = 0; i < StaticBlasCount; i++)
+		{
+			builds.push_back({ blasStaticInput[i], uncompactedBlas->GetGPUVirtualAddress() + uncompactedOffset[i],
+				blasStaticPrebuildInfo[i].ScratchDataSizeInBytes, compactedSizes->GetGPUVirtualAddress() + sizeof(UINT64) * i });
+		}
+		mBlasBuilder.Record(builds);
+		{
+			const auto& plan = mBlasBuilder.LastPlan();
+			char text[256];
+			snprintf(text, sizeof(text), "BLAS builds: %zu in %zu batches, %zu barriers, %llu bytes of scratch\n",
+				builds.size(), plan.batches.size(), plan.Barriers(), mBlasBuilder.ArenaSize());
+			OutputDebugStringA(text);
+		}
 
 		CD3DX12_RESOURCE_BARRIER uavBarriers[] = {
-			CD3DX12_RESOURCE_BARRIER::UAV(mBlas.Get()),
-			CD3DX12_RESOURCE_BARRIER::UAV(mBlasPlane.Get())
+			CD3DX12_RESOURCE_BARRIER::UAV(mAsPool.Resource()),
+			CD3DX12_RESOURCE_BARRIER::UAV(uncompactedBlas.Get()),
+			CD3DX12_RESOURCE_BARRIER::UAV(compactedSizes.Get()),
 		};
 		cmdList4->ResourceBarrier(_countof(uavBarriers), uavBarriers);
+		transition = CD3DX12_RESOURCE_BARRIER::Transition(compactedSizes.Get(),
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE);
+		cmdList4->ResourceBarrier(1, &transition);
+		cmdList4->CopyResource(compactedSizesReadback.Get(), compactedSizes.Get());
 
-		// Setup TLAS
+		// Compacted sizes are only known after the builds ran
 
-		D3D12_RAYTRACING_INSTANCE_DESC instanceDescs[2] = {};
-		// Sphere
-		instanceDescs[0].Transform[0][0] = instanceDescs[0].Transform[1][1] = instanceDescs[0].Transform[2][2] = 1.0f;
-		instanceDescs[0].InstanceMask = 1;
-		instanceDescs[0].AccelerationStructure = mBlas->GetGPUVirtualAddress();
-		//instanceDesc[0].Flags = D3D12_RAYTRACING_INSTANCE_FLAG_TRIANGLE_CULL_DISABLE;
-		// Plane
-		instanceDescs[1] = instanceDescs[0];
-		instanceDescs[1].AccelerationStructure = mBlasPlane->GetGPUVirtualAddress();
+		mBlasBuilder.Wait(mBlasBuilder.Submit());
+		cmdList4 = mBlasBuilder.Begin();
+
+		// Compact BLAS
+
+		UINT64* sizes;
+		CHK(compactedSizesReadback->Map(0, nullptr, reinterpret_cast<void**>(&sizes)));
+		const char* staticNames[StaticBlasCount] = { "sphere", "plane" };
+		for (int i = 0; i < StaticBlasCount; i++)
+		{
+			mBlasStatic[i] = mAsPool.Allocate(sizes[i]);
+			cmdList4->CopyRaytracingAccelerationStructure(mBlasStatic[i],
+				uncompactedBlas->GetGPUVirtualAddress() + uncompactedOffset[i], D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_COMPACT);
+			char text[256];
+			snprintf(text, sizeof(text), "BLAS %s: %llu -> %llu bytes compacted, %llu saved\n", staticNames[i],
+				blasStaticPrebuildInfo[i].ResultDataMaxSizeInBytes, sizes[i], blasStaticPrebuildInfo[i].ResultDataMaxSizeInBytes - sizes[i]);
+			OutputDebugStringA(text);
+		}
+		compactedSizesReadback->Unmap(0, nullptr);
+		{
+			const auto& ranges = mAsPool.Ranges();
+			char text[256];
+			snprintf(text, sizeof(text), "AS pool: %llu of %llu bytes used by %zu structures\n",
+				ranges.Used(), ranges.Capacity(), ranges.AllocationCount());
+			OutputDebugStringA(text);
+		}
+		auto poolBarrier = CD3DX12_RESOURCE_BARRIER::UAV(mAsPool.Resource());
+		cmdList4->ResourceBarrier(1, &poolBarrier);
+
+		// CPU copies at rest
+		const auto layout = ProceduralMesh::LayoutOf<VertexElement>();
+		mCpuSphere.Build(mSphereMesh, mSphereVertices.data(), mSphereIndices.data(), layout, 1);
+		mBlasPolicy.OnBuild(mCpuSphere.tree.stats.sahCost);
+		mCpuSphereRest.Build(mSphereMesh, mSphereVertices.data(), mSphereIndices.data(), layout, 1);
+		VertexElement planeVertices[4];
+		uint16_t planeIndices[6];
+		ProceduralMesh::WritePlaneVertices(planeVertices, layout, 3.0f, -3.0f);
+		ProceduralMesh::WritePlaneIndices(planeIndices);
+		mCpuPlane.Build(ProceduralMesh::PlanGrid(1, 1), planeVertices, planeIndices, layout, 1);
+
+		// Setup TLAS, one instance buffer per frame
 
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeof(instanceDescs));
-		CHK(mDevice->CreateCommittedResource(
-			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mTlasInstance)));
-		void* gpuMem;
-		CHK(mTlasInstance->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, instanceDescs, sizeof(instanceDescs));
+		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * InstanceCount);
+		for (int i = 0; i < BUFFER_COUNT; i++)
+		{
+			CHK(mDevice->CreateCommittedResource(
+				&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+				D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mTlasInstance[i])));
+			CHK(mTlasInstance[i]->Map(0, nullptr, reinterpret_cast<void**>(&mTlasInstanceData[i])));
+		}
+		mCpuInstances.resize(InstanceCount);
+		AnimateInstances(0.0f, mTlasInstanceData[0]);
+		mCpuScene.Build(mCpuInstances);
+		mTlasPolicy.OnBuild(mCpuScene.tree.stats.sahCost);
 
 		// Prebuild TLAS
 
 		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS tlasInput = {};
 		tlasInput.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
-		tlasInput.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
-		tlasInput.NumDescs = _countof(instanceDescs);
+		tlasInput.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE
+			| D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+		tlasInput.NumDescs = InstanceCount;
 		tlasInput.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-		tlasInput.InstanceDescs = mTlasInstance->GetGPUVirtualAddress();
+		tlasInput.InstanceDescs = mTlasInstance[0]->GetGPUVirtualAddress();
 		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO tlasPrebuildInfo;
 		device5->GetRaytracingAccelerationStructurePrebuildInfo(&tlasInput, &tlasPrebuildInfo);
 
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
-		resDesc = CD3DX12_RESOURCE_DESC::Buffer(tlasPrebuildInfo.ScratchDataSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+		resDesc = CD3DX12_RESOURCE_DESC::Buffer(
+			max(tlasPrebuildInfo.ScratchDataSizeInBytes, tlasPrebuildInfo.UpdateScratchDataSizeInBytes), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-			D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&scratchBufTlas)));
+			D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&mScratchTlas)));
 
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(tlasPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 		CHK(mDevice->CreateCommittedResource(
@@ -778,22 +863,15 @@ void main(inout Payload payload)
 
 		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC tlasDesc = {};
 		tlasDesc.Inputs = tlasInput;
-		tlasDesc.ScratchAccelerationStructureData = scratchBufTlas->GetGPUVirtualAddress();
+		tlasDesc.ScratchAccelerationStructureData = mScratchTlas->GetGPUVirtualAddress();
 		tlasDesc.DestAccelerationStructureData = mTlas->GetGPUVirtualAddress();
 		cmdList4->BuildRaytracingAccelerationStructure(&tlasDesc, 0, nullptr);
 
 		// Submit building AS
 
-		CHK(cmdList4->Close());
-		ID3D12GraphicsCommandList* cmdLists[] = { cmdList4.Get() };
-		cmdQueue->ExecuteCommandLists(1, CommandListCast(cmdLists));
-		CHK(cmdQueue->Signal(fence.Get(), 1));
-		CHK(mCmdQueue->Wait(fence.Get(), 1));
-		while (fence->GetCompletedValue() != 1)
-		{
-			Sleep(1);
-		};
-		CHK(cmdAlloc->Reset());
+		const auto asBuilt = mBlasBuilder.Submit();
+		CHK(mCmdQueue->Wait(mBlasBuilder.Fence(), asBuilt));
+		mBlasBuilder.Wait(asBuilt);
 
 		// Create views
 
@@ -811,6 +889,185 @@ void main(inout Payload payload)
 		}
 	}
 
+	void BuildShaderTable()
+	{
+		using ShaderTable::Kind;
+		mShaderTable.Resize(Kind::RayGen, 1);
+		mShaderTable.Resize(Kind::Miss, 1);
+		mShaderTable.Resize(Kind::HitGroup, mHitGroupCount, sizeof(HitGroupArgs));
+		mShaderTable.Set(Kind::RayGen, 0, mStateObjectProps->GetShaderIdentifier(L"MyRayGen"));
+		mShaderTable.Set(Kind::Miss, 0, mStateObjectProps->GetShaderIdentifier(L"MyMiss"));
+		for (int i = 0; i < InstanceCount; i++)
+		{
+			// Same colors as InstanceIndex() % 8 of the CPU reference
+			const HitGroupArgs args = { static_cast<uint32_t>(i % 8) };
+			const UINT end = i + 1 < InstanceCount ? mHitGroupBase[i + 1] : mHitGroupCount;
+			for (UINT r = mHitGroupBase[i]; r < end; r++)
+				mShaderTable.SetArgs(Kind::HitGroup, r, &args, sizeof(args));
+		}
+		SetHitGroupMode(mRaytracingMode);
+
+		for (auto& sbtr : mShaderBindingTable)
+		{
+			auto heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
+			auto resDesc = CD3DX12_RESOURCE_DESC::Buffer(mShaderTable.Size());
+			CHK(mDevice->CreateCommittedResource(
+				&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+				D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&sbtr)));
+		}
+	}
+
+	// Only the identifiers change, each frame's table picks them up on its next write
+	void SetHitGroupMode(uint32_t mode)
+	{
+		const void* id = mStateObjectProps->GetShaderIdentifier(HitGroupNames[mode % HitGroupCount]);
+		for (UINT r = 0; r < mHitGroupCount; r++)
+			mShaderTable.SetIdentifier(ShaderTable::Kind::HitGroup, r, id);
+	}
+
+	// Sphere in the middle, plane below, and small spheres orbiting at their own height and spin.
+	// Only the middle sphere deforms, the orbiting ones share the compacted BLAS at rest.
+	void AnimateInstances(float time, D3D12_RAYTRACING_INSTANCE_DESC* dst)
+	{
+		for (int i = 0; i < InstanceCount; i++)
+		{
+			auto& inst = mCpuInstances[i];
+			float transform[3][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } };
+			if (i >= 2)
+			{
+				const float orbit = time * 0.5f + DirectX::XM_2PI * (i - 2) / OrbitCount;
+				const float spin = time * 2.0f + i;
+				const float scale = 0.3f;
+				transform[0][0] = scale * cosf(spin);
+				transform[0][2] = scale * sinf(spin);
+				transform[1][1] = scale;
+				transform[2][0] = -scale * sinf(spin);
+				transform[2][2] = scale * cosf(spin);
+				transform[0][3] = 2.0f * cosf(orbit);
+				transform[1][3] = 0.5f * sinf(time * 1.3f + i);
+				transform[2][3] = 2.0f * sinf(orbit);
+			}
+			memcpy(inst.transform, transform, sizeof(transform));
+			inst.instanceMask = 1;
+			inst.blas = i == 0 ? &mCpuSphere : i == 1 ? &mCpuPlane : &mCpuSphereRest;
+
+			D3D12_RAYTRACING_INSTANCE_DESC desc = {};
+			memcpy(desc.Transform, transform, sizeof(transform));
+			desc.InstanceMask = 1;
+			desc.InstanceContributionToHitGroupIndex = mHitGroupBase[i];
+			desc.AccelerationStructure = i == 0 ? mBlas : mBlasStatic[i == 1 ? StaticPlane : StaticSphere];
+			dst[i] = desc;
+		}
+	}
+
+	// Refit with PERFORM_UPDATE while the CPU copy of a level stays within its policy, rebuild otherwise.
+	// The CPU trees are not the driver's, but they degrade under the same motion.
+	void UpdateBVH(ID3D12GraphicsCommandList4* cmdList4, uint32_t slot)
+	{
+		// Timestamps of the last use of this slot are resolved by now
+		if (mFrameCount > BUFFER_COUNT)
+		{
+			const uint64_t* t = mTimestampData + 3 * slot;
+			for (int level = 0; level < 2; level++)
+			{
+				const int kind = mAsRebuilt[slot][level] ? 1 : 0;
+				mAsSeconds[level][kind] += double(t[level + 1] - t[level]) / mTimestampFrequency;
+				mAsFrames[level][kind]++;
+			}
+		}
+		if (mFrameCount % 256 == 0)
+		{
+			auto ms = [&](int level, int kind) { return mAsFrames[level][kind] ? mAsSeconds[level][kind] * 1e3 / mAsFrames[level][kind] : 0.0; };
+			char text[256];
+			snprintf(text, sizeof(text), "BVH: BLAS refit %.3f ms (%u) rebuild %.3f ms (%u), TLAS refit %.3f ms (%u) rebuild %.3f ms (%u), SAH BLAS %.2f/%.2f TLAS %.2f/%.2f\n",
+				ms(0, 0), mAsFrames[0][0], ms(0, 1), mAsFrames[0][1], ms(1, 0), mAsFrames[1][0], ms(1, 1), mAsFrames[1][1],
+				mCpuSphere.tree.stats.sahCost, mBlasPolicy.builtCost, mCpuScene.tree.stats.sahCost, mTlasPolicy.builtCost);
+			OutputDebugStringA(text);
+			memset(mAsSeconds, 0, sizeof(mAsSeconds));
+			memset(mAsFrames, 0, sizeof(mAsFrames));
+		}
+
+		const float time = mFrameCount / 60.0f;
+		const auto layout = ProceduralMesh::LayoutOf<VertexElement>();
+
+		// Sphere waves around its rest pose
+		const auto* rest = reinterpret_cast<const VertexElement*>(mSphereVertices.data());
+		for (uint32_t v = 0; v < mSphereMesh.vertexCount; v++)
+		{
+			const auto* p = rest[v].position;
+			const float scale = 1.0f + 0.15f * sinf(4.0f * p[1] + 2.0f * time) * cosf(3.0f * atan2f(p[2], p[0]) + time);
+			mSphereDeformed[v] = rest[v];
+			for (int k = 0; k < 3; k++)
+				mSphereDeformed[v].position[k] = p[k] * scale;
+		}
+		memcpy(mVBAnimData[slot], mSphereDeformed.data(), sizeof(VertexElement) * mSphereDeformed.size());
+		mCpuSphere.Refit(mSphereMesh, mSphereDeformed.data(), mSphereIndices.data(), layout);
+		const bool rebuildBlas = mBlasPolicy.ShouldRebuild(mCpuSphere.tree.stats.sahCost);
+		if (rebuildBlas)
+		{
+			mCpuSphere.Build(mSphereMesh, mSphereDeformed.data(), mSphereIndices.data(), layout, 1);
+			mBlasPolicy.OnBuild(mCpuSphere.tree.stats.sahCost);
+		}
+		else
+			mBlasPolicy.OnRefit();
+
+		AnimateInstances(time, mTlasInstanceData[slot]);
+		mCpuScene.Refit(mCpuInstances);
+		const bool rebuildTlas = mTlasPolicy.ShouldRebuild(mCpuScene.tree.stats.sahCost);
+		if (rebuildTlas)
+		{
+			mCpuScene.Build(mCpuInstances);
+			mTlasPolicy.OnBuild(mCpuScene.tree.stats.sahCost);
+		}
+		else
+			mTlasPolicy.OnRefit();
+		mAsRebuilt[slot][0] = rebuildBlas;
+		mAsRebuilt[slot][1] = rebuildTlas;
+
+		const auto updateFlag = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+		cmdList4->EndQuery(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 3 * slot);
+
+		// BLAS of the sphere, in place
+		auto geomDescs = mSphereGeomDescs;
+		for (size_t g = 0; g < geomDescs.size(); g++)
+		{
+			geomDescs[g].Triangles.VertexBuffer.StartAddress =
+				mVBAnim[slot]->GetGPUVirtualAddress() + sizeof(VertexElement) * mSphereMesh.chunks[g].baseVertex;
+		}
+		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC blasDesc = {};
+		blasDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+		blasDesc.Inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE
+			| D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE | (rebuildBlas ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE : updateFlag);
+		blasDesc.Inputs.NumDescs = static_cast<UINT>(geomDescs.size());
+		blasDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+		blasDesc.Inputs.pGeometryDescs = geomDescs.data();
+		blasDesc.SourceAccelerationStructureData = rebuildBlas ? 0 : mBlas;
+		blasDesc.DestAccelerationStructureData = mBlas;
+		blasDesc.ScratchAccelerationStructureData = mScratchBlas->GetGPUVirtualAddress();
+		cmdList4->BuildRaytracingAccelerationStructure(&blasDesc, 0, nullptr);
+		auto uavBarrier = CD3DX12_RESOURCE_BARRIER::UAV(mAsPool.Resource());
+		cmdList4->ResourceBarrier(1, &uavBarrier);
+		cmdList4->EndQuery(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 3 * slot + 1);
+
+		// TLAS, in place
+		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC tlasDesc = {};
+		tlasDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+		tlasDesc.Inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE
+			| D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE | (rebuildTlas ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE : updateFlag);
+		tlasDesc.Inputs.NumDescs = InstanceCount;
+		tlasDesc.Inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+		tlasDesc.Inputs.InstanceDescs = mTlasInstance[slot]->GetGPUVirtualAddress();
+		tlasDesc.SourceAccelerationStructureData = rebuildTlas ? 0 : mTlas->GetGPUVirtualAddress();
+		tlasDesc.DestAccelerationStructureData = mTlas->GetGPUVirtualAddress();
+		tlasDesc.ScratchAccelerationStructureData = mScratchTlas->GetGPUVirtualAddress();
+		cmdList4->BuildRaytracingAccelerationStructure(&tlasDesc, 0, nullptr);
+		uavBarrier = CD3DX12_RESOURCE_BARRIER::UAV(mTlas.Get());
+		cmdList4->ResourceBarrier(1, &uavBarrier);
+		cmdList4->EndQuery(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 3 * slot + 2);
+		cmdList4->ResolveQueryData(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 3 * slot, 3,
+			mTimestampReadback.Get(), sizeof(uint64_t) * 3 * slot);
+	}
+
 	void Draw()
 	{
 		mFrameCount++;
@@ -855,11 +1112,10 @@ void main(inout Payload payload)
 		sceneMatrix.cameraPos = mCameraPos;
 		memcpy(pCBSceneMatrix, &sceneMatrix, sizeof(sceneMatrix));
 
-		// Make shader binding table
+		// Update shader binding table, only records changed since this buffer was last written
 
-		memcpy(pSBT, mShaderBindingTableDefaultData.get(), oMax);
-		_mm_sfence(); // overwrite data to write combining memory so insert a fence
-		memcpy(pSBT + oRayGenRootConstant, &mRaytracingMode, sizeof(uint32_t));
+		auto& sbtVersion = mShaderTableVersion[mFrameCount % BUFFER_COUNT];
+		sbtVersion = mShaderTable.Write(pSBT, sbtVersion);
 
 		// Start recording commands
 
@@ -869,6 +1125,10 @@ void main(inout Payload payload)
 		ID3D12DescriptorHeap* descHeap[] = { mShaderView[mFrameCount % BUFFER_COUNT].Get(), mSampler.Get() };
 		mCmdList->SetDescriptorHeaps(_countof(descHeap), descHeap);
 
+		// Animate and update acceleration structures
+
+		UpdateBVH(cmdList4.Get(), mFrameCount % BUFFER_COUNT);
+
 		// Draw scene
 
 		CD3DX12_RESOURCE_BARRIER transitions[10];
@@ -880,14 +1140,7 @@ void main(inout Payload payload)
 		mCmdList->SetComputeRootDescriptorTable(0, svScene);
 		cmdList4->SetPipelineState1(mStateObject.Get());
 		D3D12_DISPATCH_RAYS_DESC drDesc = {};
-		drDesc.RayGenerationShaderRecord.StartAddress = mShaderBindingTable[mFrameCount % BUFFER_COUNT]->GetGPUVirtualAddress();
-		drDesc.RayGenerationShaderRecord.SizeInBytes = oHitGroup;
-		drDesc.HitGroupTable.StartAddress = drDesc.RayGenerationShaderRecord.StartAddress + oHitGroup;
-		drDesc.HitGroupTable.SizeInBytes = oMiss - oHitGroup;
-		drDesc.HitGroupTable.StrideInBytes = oMiss - oHitGroup;
-		drDesc.MissShaderTable.StartAddress = drDesc.RayGenerationShaderRecord.StartAddress + oMiss;
-		drDesc.MissShaderTable.SizeInBytes = oMax - oMiss;
-		drDesc.MissShaderTable.StrideInBytes = oMax - oMiss;
+		mShaderTable.Describe(drDesc, mShaderBindingTable[mFrameCount % BUFFER_COUNT]->GetGPUVirtualAddress());
 		drDesc.Width = WINDOW_WIDTH;
 		drDesc.Height = WINDOW_HEIGHT;
 		drDesc.Depth = 1;
@@ -979,6 +1232,7 @@ public:
 	void ChangeMode(uint32_t mode)
 	{
 		mRaytracingMode = mode;
+		SetHitGroupMode(mode);
 	}
 };
 
@@ -5,9 +5,16 @@
 #include <dxgi1_4.h>
 #include <d3d12.h>
 #include "d3dx12.h"
+#include "ProceduralMesh.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "RayBudget.h"
 #include <DirectXMath.h>
+#include <algorithm>
 #include <vector>
+#include <string>
 #include <iterator>
+#include <cstdio>
 #include <dxcapi.h>
 
 #pragma comment(lib, "dxgi.lib")
@@ -58,12 +65,14 @@ class D3D
 
 	enum class Constants {
 		SceneMatrix,
+		RayQuery,
 		Max,
 	};
 	ComPtr<ID3D12Resource> mConstantBuffer[BUFFER_COUNT];
 
 	enum class RTVs {
 		Scene,
+		SceneNormal,
 		Max,
 	};
 	ComPtr<ID3D12DescriptorHeap> mRTV;
@@ -78,7 +87,16 @@ class D3D
 		// Base pass
 		SceneCBVMatrix,
 		SceneBindlessResource,
-		Max = SceneBindlessResource + MAX_BINDLESS_RESOURCE,
+		// Ray query passes, one table
+		RayQueryCBV = SceneBindlessResource + MAX_BINDLESS_RESOURCE,
+		RayQueryTlas,
+		RayQueryDepth,
+		RayQueryNormal,
+		RayQueryColor,
+		RayQueryVisibility,
+		RayQueryVisibilityUAV,
+		RayQueryOutputUAV,
+		Max,
 	};
 	ComPtr<ID3D12DescriptorHeap> mShaderView[BUFFER_COUNT];
 
@@ -91,8 +109,37 @@ class D3D
 	ComPtr<ID3D12RootSignature> mSceneRootSig;
 	ComPtr<ID3D12PipelineState> mScenePSO;
 	ComPtr<ID3D12Resource> mSceneTex;
+	ComPtr<ID3D12Resource> mSceneNormal;
 	ComPtr<ID3D12Resource> mSceneZ;
 
+	// Shadow and AO rays at a fraction of the resolution, then upsampled onto the scene
+	ComPtr<ID3D12RootSignature> mRayQueryRootSig;
+	ComPtr<ID3D12PipelineState> mVisibilityPSO;
+	ComPtr<ID3D12PipelineState> mUpsamplePSO;
+	ComPtr<ID3D12Resource> mVisibility; // Shadow, AO
+	ComPtr<ID3D12Resource> mRayQueryOutput;
+	struct RayQueryParams {
+		uint32_t passSize[2];
+		uint32_t divisor;
+		uint32_t shadowRays;
+		uint32_t aoRays;
+		uint32_t frameIndex;
+		float aoRadius;
+	};
+	RayBudget::Controller mRayBudget{ 2.0 };
+	bool mRayQuery = true;
+	uint32_t mFixedDivisor = 0; // 0 lets the budget pick the resolution
+
+	// Timestamps before the scene, after the scene, after the rays and after the upsampling of every frame
+	ComPtr<ID3D12QueryHeap> mTimestampHeap;
+	ComPtr<ID3D12Resource> mTimestampReadback;
+	uint64_t* mTimestampData;
+	uint64_t mTimestampFrequency;
+	int mSlotLevel[BUFFER_COUNT] = { -1, -1, -1 }; // Ray budget level, -1 without ray queries
+	double mPassSeconds[3] = {};
+	uint32_t mPassFrames = 0;
+	double mRaysPerPixel = 0;
+
 	ComPtr<ID3D12Resource> mBindlessResource[MAX_BINDLESS_RESOURCE];
 
 	struct VertexElement
@@ -107,6 +154,8 @@ class D3D
 	D3D12_INDEX_BUFFER_VIEW mIBView = {};
 	const int SphereSlices = 12;
 	const int SphereStacks = 12;
+	ProceduralMesh::IndexedMesh mSphereMesh;
+	MeshSimplifier::LodChain mSphereLods;
 
 	ComPtr<ID3D12Resource> mVBPlane;
 	ComPtr<ID3D12Resource> mIBPlane;
@@ -115,6 +164,7 @@ class D3D
 
 	ComPtr<ID3D12Resource> mBlas;
 	ComPtr<ID3D12Resource> mBlasPlane;
+	static const int InstanceCount = 2;
 	ComPtr<ID3D12Resource> mTlasInstance;
 	ComPtr<ID3D12Resource> mTlas;
 
@@ -192,6 +242,18 @@ public:
 
 		CHK(mDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence)));
 
+		D3D12_QUERY_HEAP_DESC queryHeapDesc = {};
+		queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+		queryHeapDesc.Count = 4 * BUFFER_COUNT;
+		CHK(mDevice->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(&mTimestampHeap)));
+		auto readbackProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK);
+		auto readbackDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeof(uint64_t) * queryHeapDesc.Count);
+		CHK(mDevice->CreateCommittedResource(
+			&readbackProp, D3D12_HEAP_FLAG_NONE, &readbackDesc,
+			D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&mTimestampReadback)));
+		CHK(mTimestampReadback->Map(0, nullptr, reinterpret_cast<void**>(&mTimestampData)));
+		CHK(mCmdQueue->GetTimestampFrequency(&mTimestampFrequency));
+
 		CHK(mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, mCmdAllocCopy.Get(), nullptr, IID_PPV_ARGS(&mCmdListCopy)));
 
 		D3D12_DESCRIPTOR_HEAP_DESC descHeapDesc = {};
@@ -231,6 +293,16 @@ public:
 		CHK(D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1, &rootSigBlob, &rootSigError));
 		CHK(mDevice->CreateRootSignature(0, rootSigBlob->GetBufferPointer(), rootSigBlob->GetBufferSize(), IID_PPV_ARGS(&mSceneRootSig)));
 
+		descRange[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0);
+		descRange[4].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 5, 0);
+		descRange[5].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 2, 0);
+		rootParam[0].InitAsDescriptorTable(3, descRange + 3); // CBV_SRV_UAV
+		rootParam[1].InitAsConstants(sizeof(RayQueryParams) / 4, 1); // b1
+		rootSigDesc.Init(2, rootParam, 0, nullptr);
+
+		CHK(D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1, &rootSigBlob, &rootSigError));
+		CHK(mDevice->CreateRootSignature(0, rootSigBlob->GetBufferPointer(), rootSigBlob->GetBufferSize(), IID_PPV_ARGS(&mRayQueryRootSig)));
+
 		static const char shaderCodeSceneVS[] = R"#(
 cbuffer CScene {
 	float4x4 ViewProj;
@@ -254,30 +326,16 @@ cbuffer CRootParam : register(b0) {
 	uint RootParamOffset;
 };
 Texture2D<float4> ColorMap[] : register(t0, space1);
-RaytracingAccelerationStructure myAS : register(t0);
 struct Input {
 	float4 position : SV_Position;
 	float3 world : WorldPosition;
 	float3 normal : Normal;
 };
-float4 main(Input input) : SV_Target {
-	RayQuery<RAY_FLAG_CULL_NON_OPAQUE 
-			| RAY_FLAG_SKIP_PROCEDURAL_PRIMITIVES
-			| RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH> query;
-	RayDesc rayDesc;
-	rayDesc.Origin = float3(0, 0, 0);
-	rayDesc.TMin = 0.0001;
-	rayDesc.Direction = float3(0, 1, 0);
-	rayDesc.TMax = 10000;
-	query.TraceRayInline(myAS, RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH, 0x1, rayDesc);
-	query.Proceed();
-	if(query.CommittedStatus() == COMMITTED_TRIANGLE_HIT) {
-		return float4(0,1,0,1);
-	}
-	else {
-		return float4(1,0,1,1);
-	}
-
+struct Output {
+	float4 color : SV_Target0;
+	float4 normal : SV_Target1;
+};
+Output main(Input input) {
 	float4 color;
 	if (RootParamOffset < 8) {
 		color = ColorMap[RootParamOffset].Load(int3(0, 0, 0));
@@ -285,9 +343,152 @@ float4 main(Input input) : SV_Target {
 		uint index = ((uint)(input.position.x) + (uint)(input.position.y)) % 8;
 		color = ColorMap[ NonUniformResourceIndex(index) ].Load(int3(0, 0, 0));
 	}
-	float intensity = input.normal.y * 0.5 + 0.5;
+	float3 normal = normalize(input.normal);
+	float intensity = normal.y * 0.5 + 0.5;
 	color.xyz *= intensity;
-	return color;
+	Output output = { color, float4(normal * 0.5 + 0.5, 1) };
+	return output;
+}
+)#";
+
+		static const char shaderCodeRayQueryCommon[] = R"#(
+cbuffer CRayQuery : register(b0) {
+	float4x4 InvViewProj;
+	float4 LightDir; // Toward the light, w is the tangent of its cone
+	float2 NearFar;
+};
+cbuffer CPass : register(b1) {
+	uint2 PassSize; // Ray pass pixels
+	uint Divisor;
+	uint ShadowRays;
+	uint AoRays;
+	uint FrameIndex;
+	float AoRadius;
+};
+RaytracingAccelerationStructure Scene : register(t0);
+Texture2D<float> Depth : register(t1);
+Texture2D<float4> Normal : register(t2);
+Texture2D<float4> Color : register(t3);
+Texture2D<float2> Visibility : register(t4);
+RWTexture2D<float2> VisibilityOut : register(u0);
+RWTexture2D<float4> Output : register(u1);
+
+uint2 FullSize() {
+	uint2 size;
+	Depth.GetDimensions(size.x, size.y);
+	return size;
+}
+// Full-resolution texel a ray pass pixel stands for
+uint2 Representative(uint2 pass) {
+	return min(pass * Divisor + Divisor / 2, FullSize() - 1);
+}
+float3 DecodeNormal(uint2 texel) {
+	return normalize(Normal[texel].xyz * 2 - 1);
+}
+float LinearDepth(float depth) {
+	return NearFar.x * NearFar.y / (NearFar.y - depth * (NearFar.y - NearFar.x));
+}
+)#";
+
+		static const char shaderCodeVisibilityCS[] = R"#(
+uint Hash(uint x) {
+	x ^= x >> 16; x *= 0x7feb352d; x ^= x >> 15; x *= 0x846ca68b; x ^= x >> 16;
+	return x;
+}
+float Random(inout uint state) {
+	state = state * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return ((word >> 22u) ^ word) / 4294967296.0;
+}
+float3 Around(float3 n, float3 local) {
+	float3 t = normalize(cross(n, abs(n.y) < 0.99 ? float3(0, 1, 0) : float3(1, 0, 0)));
+	float3 b = cross(n, t);
+	return t * local.x + b * local.y + n * local.z;
+}
+bool Occluded(float3 origin, float3 direction, float tMax) {
+	RayQuery<RAY_FLAG_CULL_NON_OPAQUE
+			| RAY_FLAG_SKIP_PROCEDURAL_PRIMITIVES
+			| RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH> query;
+	RayDesc ray;
+	ray.Origin = origin;
+	ray.Direction = direction;
+	ray.TMin = 0.001;
+	ray.TMax = tMax;
+	query.TraceRayInline(Scene, RAY_FLAG_NONE, 0x1, ray);
+	query.Proceed();
+	return query.CommittedStatus() == COMMITTED_TRIANGLE_HIT;
+}
+[numthreads(8, 8, 1)]
+void main(uint2 id : SV_DispatchThreadID) {
+	if (any(id >= PassSize)) {
+		return;
+	}
+	uint2 texel = Representative(id);
+	float depth = Depth[texel];
+	if (depth >= 1) {
+		VisibilityOut[id] = float2(1, 1);
+		return;
+	}
+	float2 ndc = (texel + 0.5) / FullSize() * float2(2, -2) + float2(-1, 1);
+	float4 world = mul(float4(ndc, depth, 1), InvViewProj);
+	world.xyz /= world.w;
+	float3 n = DecodeNormal(texel);
+	float3 origin = world.xyz + n * 0.01;
+	uint state = Hash(id.x + id.y * 65536u) ^ Hash(FrameIndex);
+
+	float lit = 0;
+	for (uint i = 0; i < ShadowRays; i++) {
+		// Inside the light's cone for soft edges
+		float r = sqrt(Random(state)) * LightDir.w;
+		float phi = 6.2831853 * Random(state);
+		float3 direction = normalize(Around(LightDir.xyz, float3(r * cos(phi), r * sin(phi), 1)));
+		lit += dot(direction, n) > 0 && !Occluded(origin, direction, 100.0) ? 1 : 0;
+	}
+	float open = 0;
+	for (uint j = 0; j < AoRays; j++) {
+		// Cosine weighted hemisphere
+		float u = Random(state);
+		float phi = 6.2831853 * Random(state);
+		float3 direction = Around(n, float3(sqrt(u) * cos(phi), sqrt(u) * sin(phi), sqrt(1 - u)));
+		open += Occluded(origin, direction, AoRadius) ? 0 : 1;
+	}
+	VisibilityOut[id] = float2(ShadowRays ? lit / ShadowRays : 1, AoRays ? open / AoRays : 1);
+}
+)#";
+
+		static const char shaderCodeUpsampleCS[] = R"#(
+// Joint bilateral upsampling from the four nearest ray pass pixels
+[numthreads(8, 8, 1)]
+void main(uint2 id : SV_DispatchThreadID) {
+	if (any(id >= FullSize())) {
+		return;
+	}
+	float4 color = Color[id];
+	float depth = Depth[id];
+	if (depth >= 1) {
+		Output[id] = color;
+		return;
+	}
+	float z = LinearDepth(depth);
+	float3 n = DecodeNormal(id);
+	float2 f = (id + 0.5) / Divisor - 0.5;
+	int2 base = (int2)floor(f);
+	float2 w = f - base;
+	float2 sum = 0;
+	float weightSum = 0;
+	for (int k = 0; k < 4; k++) {
+		int2 o = int2(k & 1, k >> 1);
+		uint2 pass = (uint2)clamp(base + o, 0, (int2)PassSize - 1);
+		uint2 texel = Representative(pass);
+		float bilinear = (o.x ? w.x : 1 - w.x) * (o.y ? w.y : 1 - w.y);
+		float dz = abs(LinearDepth(Depth[texel]) - z) / z;
+		float weight = (bilinear + 1e-3) * exp(-50 * dz) * pow(saturate(dot(DecodeNormal(texel), n)), 8);
+		sum += Visibility[pass] * weight;
+		weightSum += weight;
+	}
+	// Nearest when no neighbour lies on the same surface
+	float2 visibility = weightSum > 1e-4 ? sum / weightSum : Visibility[(uint2)clamp((int2)round(f), 0, (int2)PassSize - 1)];
+	Output[id] = float4(color.rgb * visibility.y * (0.4 + 0.6 * visibility.x), color.a);
 }
 )#";
 
@@ -322,6 +523,28 @@ float4 main(Input input) : SV_Target {
 		}
 		dxcRes->GetResult(&dxcBlobScenePS);
 
+		const string shaderCodeVisibility = string(shaderCodeRayQueryCommon) + shaderCodeVisibilityCS;
+		const string shaderCodeUpsample = string(shaderCodeRayQueryCommon) + shaderCodeUpsampleCS;
+		ComPtr<IDxcBlobEncoding> dxcTxtVisibilityCS, dxcTxtUpsampleCS;
+		CHK(dxcLib->CreateBlobWithEncodingFromPinned(shaderCodeVisibility.c_str(), static_cast<UINT32>(shaderCodeVisibility.size()), CP_UTF8, &dxcTxtVisibilityCS));
+		CHK(dxcLib->CreateBlobWithEncodingFromPinned(shaderCodeUpsample.c_str(), static_cast<UINT32>(shaderCodeUpsample.size()), CP_UTF8, &dxcTxtUpsampleCS));
+
+		ComPtr<IDxcBlob> dxcBlobVisibilityCS, dxcBlobUpsampleCS;
+		dxc->Compile(dxcTxtVisibilityCS.Get(), nullptr, L"main", L"cs_6_5", shaderArgs, _countof(shaderArgs), nullptr, 0, nullptr, &dxcRes);
+		dxcRes->GetErrorBuffer(&dxcError);
+		if (dxcError->GetBufferSize()) {
+			OutputDebugStringA(reinterpret_cast<char*>(dxcError->GetBufferPointer()));
+			throw runtime_error("Shader compile error.");
+		}
+		dxcRes->GetResult(&dxcBlobVisibilityCS);
+		dxc->Compile(dxcTxtUpsampleCS.Get(), nullptr, L"main", L"cs_6_5", shaderArgs, _countof(shaderArgs), nullptr, 0, nullptr, &dxcRes);
+		dxcRes->GetErrorBuffer(&dxcError);
+		if (dxcError->GetBufferSize()) {
+			OutputDebugStringA(reinterpret_cast<char*>(dxcError->GetBufferPointer()));
+			throw runtime_error("Shader compile error.");
+		}
+		dxcRes->GetResult(&dxcBlobUpsampleCS);
+
 		D3D12_INPUT_ELEMENT_DESC ieDesc[] = {
 			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
@@ -343,12 +566,20 @@ float4 main(Input input) : SV_Target {
 		psoDesc.DepthStencilState = dsDesc;
 		psoDesc.BlendState = CD3DX12_BLEND_DESC(CD3DX12_DEFAULT());
 		psoDesc.SampleMask = UINT_MAX;
-		psoDesc.NumRenderTargets = 1;
+		psoDesc.NumRenderTargets = 2;
 		psoDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
+		psoDesc.RTVFormats[1] = DXGI_FORMAT_R10G10B10A2_UNORM;
 		psoDesc.DSVFormat = DXGI_FORMAT_D32_FLOAT;
 		psoDesc.SampleDesc.Count = 1;
 		CHK(mDevice->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&mScenePSO)));
 
+		D3D12_COMPUTE_PIPELINE_STATE_DESC computePsoDesc = {};
+		computePsoDesc.pRootSignature = mRayQueryRootSig.Get();
+		computePsoDesc.CS = CD3DX12_SHADER_BYTECODE(dxcBlobVisibilityCS->GetBufferPointer(), dxcBlobVisibilityCS->GetBufferSize());
+		CHK(mDevice->CreateComputePipelineState(&computePsoDesc, IID_PPV_ARGS(&mVisibilityPSO)));
+		computePsoDesc.CS = CD3DX12_SHADER_BYTECODE(dxcBlobUpsampleCS->GetBufferPointer(), dxcBlobUpsampleCS->GetBufferSize());
+		CHK(mDevice->CreateComputePipelineState(&computePsoDesc, IID_PPV_ARGS(&mUpsamplePSO)));
+
 		// Resources
 
 		for (auto& cb : mConstantBuffer)
@@ -368,13 +599,32 @@ float4 main(Input input) : SV_Target {
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, &clearValue, IID_PPV_ARGS(&mSceneTex)));
 
-		resDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_D32_FLOAT, WINDOW_WIDTH, WINDOW_HEIGHT, 1, 1);
-		resDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL | D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE;
+		resDesc.Format = DXGI_FORMAT_R10G10B10A2_UNORM;
+		clearValue = CD3DX12_CLEAR_VALUE(DXGI_FORMAT_R10G10B10A2_UNORM, kDefaultRTClearColor);
+		CHK(mDevice->CreateCommittedResource(
+			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+			D3D12_RESOURCE_STATE_GENERIC_READ, &clearValue, IID_PPV_ARGS(&mSceneNormal)));
+
+		// Typeless, read back by the ray query passes
+		resDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_TYPELESS, WINDOW_WIDTH, WINDOW_HEIGHT, 1, 1);
+		resDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
 		clearValue = CD3DX12_CLEAR_VALUE(DXGI_FORMAT_D32_FLOAT, kDefaultDSClearColor);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_DEPTH_WRITE, &clearValue, IID_PPV_ARGS(&mSceneZ)));
 
+		// Sized for the finest level, coarser ones use its top left corner
+		resDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R16G16_FLOAT, WINDOW_WIDTH, WINDOW_HEIGHT, 1, 1);
+		resDesc.Flags = D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS;
+		CHK(mDevice->CreateCommittedResource(
+			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(&mVisibility)));
+
+		resDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		CHK(mDevice->CreateCommittedResource(
+			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+			D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(&mRayQueryOutput)));
+
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(4 * 1024 * 1024);
 		resDesc.Flags = D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE;
@@ -423,6 +673,8 @@ float4 main(Input input) : SV_Target {
 
 		CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle(mRTV->GetCPUDescriptorHandleForHeapStart());
 		mDevice->CreateRenderTargetView(mSceneTex.Get(), nullptr, rtvHandle);
+		rtvHandle.Offset(1, mRTVStride);
+		mDevice->CreateRenderTargetView(mSceneNormal.Get(), nullptr, rtvHandle);
 
 		descHeapDesc = {};
 		descHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV;
@@ -430,7 +682,10 @@ float4 main(Input input) : SV_Target {
 		CHK(mDevice->CreateDescriptorHeap(&descHeapDesc, IID_PPV_ARGS(&mDSV)));
 
 		CD3DX12_CPU_DESCRIPTOR_HANDLE dsvHandle(mDSV->GetCPUDescriptorHandleForHeapStart());
-		mDevice->CreateDepthStencilView(mSceneZ.Get(), nullptr, dsvHandle);
+		D3D12_DEPTH_STENCIL_VIEW_DESC dsv = {};
+		dsv.Format = DXGI_FORMAT_D32_FLOAT;
+		dsv.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
+		mDevice->CreateDepthStencilView(mSceneZ.Get(), &dsv, dsvHandle);
 
 		for (int i = 0; i < BUFFER_COUNT; i++)
 		{
@@ -459,6 +714,35 @@ float4 main(Input input) : SV_Target {
 			cbv.SizeInBytes = 256;
 			auto sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)ShaderViews::SceneCBVMatrix, mResourceStride);
 			mDevice->CreateConstantBufferView(&cbv, sv);
+
+			cbv.BufferLocation = addrCB + 256 * (int)Constants::RayQuery;
+			sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)ShaderViews::RayQueryCBV, mResourceStride);
+			mDevice->CreateConstantBufferView(&cbv, sv);
+
+			const struct {
+				ID3D12Resource* resource;
+				DXGI_FORMAT format;
+				ShaderViews view;
+			} rayQuerySrvs[] = {
+				{ mSceneZ.Get(), DXGI_FORMAT_R32_FLOAT, ShaderViews::RayQueryDepth },
+				{ mSceneNormal.Get(), DXGI_FORMAT_R10G10B10A2_UNORM, ShaderViews::RayQueryNormal },
+				{ mSceneTex.Get(), DXGI_FORMAT_R8G8B8A8_UNORM, ShaderViews::RayQueryColor },
+				{ mVisibility.Get(), DXGI_FORMAT_R16G16_FLOAT, ShaderViews::RayQueryVisibility },
+			};
+			for (const auto& view : rayQuerySrvs) {
+				D3D12_SHADER_RESOURCE_VIEW_DESC srv = {};
+				srv.Format = view.format;
+				srv.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+				srv.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+				srv.Texture2D.MipLevels = 1;
+				sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)view.view, mResourceStride);
+				mDevice->CreateShaderResourceView(view.resource, &srv, sv);
+			}
+
+			sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)ShaderViews::RayQueryVisibilityUAV, mResourceStride);
+			mDevice->CreateUnorderedAccessView(mVisibility.Get(), nullptr, nullptr, sv);
+			sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)ShaderViews::RayQueryOutputUAV, mResourceStride);
+			mDevice->CreateUnorderedAccessView(mRayQueryOutput.Get(), nullptr, nullptr, sv);
 		}
 
 		descHeapDesc = {};
@@ -476,46 +760,10 @@ float4 main(Input input) : SV_Target {
 		CD3DX12_CPU_DESCRIPTOR_HANDLE samplerHandle(mSampler->GetCPUDescriptorHandleForHeapStart());
 		mDevice->CreateSampler(&samplerDesc, samplerHandle);
 
-		// Generate sphere triangles
+		// Generate sphere triangles, reordered in place for the vertex cache, overdraw and vertex fetch
+		mSphereMesh = ProceduralMesh::PlanSphere(SphereSlices, SphereStacks);
 
-		struct IndexList
-		{
-			short a[6];
-		};
-		vector<VertexElement> vertices;
-		vector<IndexList> indices;
-		vertices.reserve((SphereStacks + 1) * (SphereSlices + 1));
-		for (int y = 0; y < SphereStacks + 1; ++y)
-		{
-			for (int x = 0; x < SphereSlices + 1; ++x)
-			{
-				// Generate a evenly tesselated plane
-				float v[3] = { (float)x / (float)(SphereSlices), (float)y / (float)(SphereStacks), 0.0f };
-				// Convert to spherical coordinate system
-				float theta = 2 * 3.14159265f * v[0];
-				float phi = 2 * 3.14159265f * v[1] / 2.0f;
-				VertexElement ve = { sinf(phi) * sinf(theta), cosf(phi), sinf(phi) * cosf(theta), 0, 0, 0 };
-				// Setup normal
-				float r = 1.0f;
-				ve.normal[0] = ve.position[0] / r;
-				ve.normal[1] = ve.position[1] / r;
-				ve.normal[2] = ve.position[2] / r;
-				vertices.push_back(ve);
-			}
-		}
-		indices.reserve(SphereStacks * SphereSlices);
-		for (int y = 0; y < SphereStacks; ++y)
-		{
-			for (int x = 0; x < SphereSlices; ++x)
-			{
-				short b = static_cast<short>(y * (SphereSlices + 1) + x);
-				short s = SphereSlices + 1;
-				IndexList il = { b, b + s, b + 1, b + s, b + s + 1, b + 1 };
-				indices.push_back(il);
-			}
-		}
-
-		auto sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		auto sizeVB = static_cast<uint32_t>(sizeof(VertexElement) * mSphereMesh.vertexCount);
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
@@ -523,48 +771,45 @@ float4 main(Input input) : SV_Target {
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVB)));
 		void* gpuMem;
 		CHK(mVB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		ProceduralMesh::WriteSphereVertices(gpuMem, ProceduralMesh::LayoutOf<VertexElement>(), SphereSlices, SphereStacks);
+		vector<uint8_t> sphereIndices(mSphereMesh.IndexBufferSize());
+		ProceduralMesh::WriteSphereIndices(sphereIndices.data(), mSphereMesh);
+		MeshOptimizer::OptimizeInPlace(mSphereMesh, gpuMem, sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
+		mSphereLods = MeshSimplifier::BuildLodChain(mSphereMesh, gpuMem, sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
 
-		auto sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		auto sizeIB = static_cast<uint32_t>(mSphereLods.indices.size());
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeIB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIB)));
 		CHK(mIB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		memcpy(gpuMem, mSphereLods.indices.data(), mSphereLods.indices.size());
 
 		mVBView.BufferLocation = mVB->GetGPUVirtualAddress();
 		mVBView.StrideInBytes = sizeof(VertexElement);
 		mVBView.SizeInBytes = sizeVB;
 		mIBView.BufferLocation = mIB->GetGPUVirtualAddress();
-		mIBView.Format = DXGI_FORMAT_R16_UINT;
+		mIBView.Format = ProceduralMesh::IndexFormat(mSphereMesh);
 		mIBView.SizeInBytes = sizeIB;
 
 		// Generate plane triangles
-		vertices.clear();
-		indices.clear();
-		vertices.push_back({ -1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ -1, -1, -1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, -1,  0, +1,  0 });
-		for (auto& v : vertices) { v.position[0] *= 3; v.position[1] *= 3; v.position[2] *= 3; }
-		indices.push_back({ 0, 1, 2, 2, 1, 3 });
-
-		sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		const auto planeSize = ProceduralMesh::PlaneSize();
+
+		sizeVB = static_cast<uint32_t>(sizeof(VertexElement) * planeSize.vertexCount);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVBPlane)));
 		CHK(mVBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		ProceduralMesh::WritePlaneVertices(gpuMem, ProceduralMesh::LayoutOf<VertexElement>(), 3.0f, -3.0f);
 
-		sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		sizeIB = static_cast<uint32_t>(sizeof(uint16_t) * planeSize.indexCount);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeIB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIBPlane)));
 		CHK(mIBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		ProceduralMesh::WritePlaneIndices(static_cast<uint16_t*>(gpuMem));
 
 		mVBPlaneView.BufferLocation = mVBPlane->GetGPUVirtualAddress();
 		mVBPlaneView.StrideInBytes = sizeof(VertexElement);
@@ -595,7 +840,7 @@ float4 main(Input input) : SV_Target {
 		ComPtr<ID3D12GraphicsCommandList4> cmdList4;
 		ComPtr<ID3D12CommandAllocator> cmdAlloc;
 		ComPtr<ID3D12Fence> fence;
-		ComPtr<ID3D12Resource> scratchBufBlas, scratchBufTlas;
+		ComPtr<ID3D12Resource> scratchBufBlas, scratchBufBlasPlane, scratchBufTlas;
 
 		// Create compute queue
 
@@ -609,22 +854,15 @@ float4 main(Input input) : SV_Target {
 
 		// Prebuild BLAS
 
-		D3D12_RAYTRACING_GEOMETRY_DESC blasGeomDesc = {};
-		blasGeomDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-		blasGeomDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
-		blasGeomDesc.Triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
-		blasGeomDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-		blasGeomDesc.Triangles.VertexCount = (SphereStacks + 1) * (SphereSlices + 1);
-		blasGeomDesc.Triangles.IndexCount = (SphereStacks * SphereSlices);
-		blasGeomDesc.Triangles.IndexBuffer = mIB->GetGPUVirtualAddress();
-		blasGeomDesc.Triangles.VertexBuffer.StartAddress = mVB->GetGPUVirtualAddress();
-		blasGeomDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(VertexElement);
+		vector<D3D12_RAYTRACING_GEOMETRY_DESC> blasGeomDescs;
+		ProceduralMesh::AppendGeometryDescs(blasGeomDescs, mSphereMesh,
+			mVB->GetGPUVirtualAddress(), sizeof(VertexElement), mIB->GetGPUVirtualAddress());
 		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS blasInput = {};
 		blasInput.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
 		blasInput.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
-		blasInput.NumDescs = 1;
+		blasInput.NumDescs = static_cast<UINT>(blasGeomDescs.size());
 		blasInput.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-		blasInput.pGeometryDescs = &blasGeomDesc;
+		blasInput.pGeometryDescs = blasGeomDescs.data();
 		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO blasPrebuildInfo;
 		device5->GetRaytracingAccelerationStructurePrebuildInfo(&blasInput, &blasPrebuildInfo);
 
@@ -647,15 +885,50 @@ float4 main(Input input) : SV_Target {
 		blasDesc.DestAccelerationStructureData = mBlas->GetGPUVirtualAddress();
 		cmdList4->BuildRaytracingAccelerationStructure(&blasDesc, 0, nullptr);
 
-		auto uavBarrier = CD3DX12_RESOURCE_BARRIER::UAV(mBlas.Get());
-		cmdList4->ResourceBarrier(1, &uavBarrier);
+		// Plane BLAS, the ground the sphere casts its shadow on
+
+		D3D12_RAYTRACING_GEOMETRY_DESC planeGeomDesc = blasGeomDescs[0];
+		planeGeomDesc.Triangles.VertexCount = 4;
+		planeGeomDesc.Triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
+		planeGeomDesc.Triangles.IndexCount = 6;
+		planeGeomDesc.Triangles.IndexBuffer = mIBPlane->GetGPUVirtualAddress();
+		planeGeomDesc.Triangles.VertexBuffer.StartAddress = mVBPlane->GetGPUVirtualAddress();
+		blasInput.NumDescs = 1;
+		blasInput.pGeometryDescs = &planeGeomDesc;
+		device5->GetRaytracingAccelerationStructurePrebuildInfo(&blasInput, &blasPrebuildInfo);
+
+		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+		resDesc = CD3DX12_RESOURCE_DESC::Buffer(blasPrebuildInfo.ScratchDataSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+		CHK(mDevice->CreateCommittedResource(
+			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+			D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&scratchBufBlasPlane)));
+
+		resDesc = CD3DX12_RESOURCE_DESC::Buffer(blasPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+		CHK(mDevice->CreateCommittedResource(
+			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
+			D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, nullptr, IID_PPV_ARGS(&mBlasPlane)));
+
+		blasDesc.Inputs = blasInput;
+		blasDesc.ScratchAccelerationStructureData = scratchBufBlasPlane->GetGPUVirtualAddress();
+		blasDesc.DestAccelerationStructureData = mBlasPlane->GetGPUVirtualAddress();
+		cmdList4->BuildRaytracingAccelerationStructure(&blasDesc, 0, nullptr);
+
+		CD3DX12_RESOURCE_BARRIER uavBarriers[] = {
+			CD3DX12_RESOURCE_BARRIER::UAV(mBlas.Get()),
+			CD3DX12_RESOURCE_BARRIER::UAV(mBlasPlane.Get()),
+		};
+		cmdList4->ResourceBarrier(_countof(uavBarriers), uavBarriers);
 
 		// Setup TLAS
 
-		D3D12_RAYTRACING_INSTANCE_DESC instanceDesc[1] = {};
-		instanceDesc[0].Transform[0][0] = instanceDesc[0].Transform[1][1] = instanceDesc[0].Transform[2][2] = 1.0f;
-		instanceDesc[0].InstanceMask = 1;
+		D3D12_RAYTRACING_INSTANCE_DESC instanceDesc[InstanceCount] = {};
+		for (auto& instance : instanceDesc)
+		{
+			instance.Transform[0][0] = instance.Transform[1][1] = instance.Transform[2][2] = 1.0f;
+			instance.InstanceMask = 1;
+		}
 		instanceDesc[0].AccelerationStructure = mBlas->GetGPUVirtualAddress();
+		instanceDesc[1].AccelerationStructure = mBlasPlane->GetGPUVirtualAddress();
 		//tlasDesc.Flags = D3D12_RAYTRACING_INSTANCE_FLAG_TRIANGLE_CULL_DISABLE;
 
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
@@ -709,18 +982,61 @@ float4 main(Input input) : SV_Target {
 			Sleep(1);
 		};
 		CHK(cmdAlloc->Reset());
+
+		for (auto& shaderView : mShaderView)
+		{
+			D3D12_SHADER_RESOURCE_VIEW_DESC srv = {};
+			srv.ViewDimension = D3D12_SRV_DIMENSION_RAYTRACING_ACCELERATION_STRUCTURE;
+			srv.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+			srv.RaytracingAccelerationStructure.Location = mTlas->GetGPUVirtualAddress();
+			auto sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderView->GetCPUDescriptorHandleForHeapStart(), (int)ShaderViews::RayQueryTlas, mResourceStride);
+			mDevice->CreateShaderResourceView(nullptr, &srv, sv);
+		}
+	}
+
+	// Timestamps of the last use of this slot are resolved by now, feed the ray and upsample pass time to the budget
+	void ReadTimestamps(uint32_t slot)
+	{
+		if (mFrameCount > BUFFER_COUNT)
+		{
+			const uint64_t* t = mTimestampData + 4 * slot;
+			for (int pass = 0; pass < 3; pass++)
+				mPassSeconds[pass] += double(t[pass + 1] - t[pass]) / mTimestampFrequency;
+			if (mSlotLevel[slot] >= 0)
+			{
+				const auto level = static_cast<uint32_t>(mSlotLevel[slot]);
+				mRayBudget.Update(level, double(t[3] - t[1]) * 1e3 / mTimestampFrequency);
+				mRaysPerPixel += RayBudget::RaysPerPixel(mRayBudget.Ladder()[level]);
+			}
+			mPassFrames++;
+		}
+		if (mFrameCount % 256 == 0 && mPassFrames)
+		{
+			const auto& level = mRayBudget.Current();
+			char text[256];
+			snprintf(text, sizeof(text), "Ray query: 1/%u res, %u shadow + %u AO rays, %.3f rays/pixel, raster %.3f ms, rays %.3f ms, upsample %.3f ms, target %.2f ms\n",
+				level.divisor, level.shadowRays, level.aoRays, mRaysPerPixel / mPassFrames,
+				mPassSeconds[0] * 1e3 / mPassFrames, mPassSeconds[1] * 1e3 / mPassFrames, mPassSeconds[2] * 1e3 / mPassFrames, mRayBudget.Target());
+			OutputDebugStringA(text);
+			memset(mPassSeconds, 0, sizeof(mPassSeconds));
+			mPassFrames = 0;
+			mRaysPerPixel = 0;
+		}
 	}
 
 	void Draw()
 	{
 		mFrameCount++;
 		auto frameIndex = mSwapChain->GetCurrentBackBufferIndex();
+		const auto slot = static_cast<uint32_t>(mFrameCount % BUFFER_COUNT);
+		ReadTimestamps(slot);
 
 		//-------------------------------
 
 		float* pCB;
 		CHK(mConstantBuffer[mFrameCount % BUFFER_COUNT]->Map(0, nullptr, reinterpret_cast<void**>(&pCB)));
 		float* pCBSceneMatrix = pCB + 256 * (int)Constants::SceneMatrix / sizeof(*pCB);
+		float* pCBRayQuery = pCB + 256 * (int)Constants::RayQuery / sizeof(*pCB);
 
 		auto rtvScene = CD3DX12_CPU_DESCRIPTOR_HANDLE(mRTV->GetCPUDescriptorHandleForHeapStart());
 
@@ -744,6 +1060,7 @@ float4 main(Input input) : SV_Target {
 		auto worldMat = DirectX::XMMatrixIdentity();
 		auto viewMat = DirectX::XMMatrixLookAtLH(mCameraPos, mCameraTarget, mCameraUp);
 		auto projMat = DirectX::XMMatrixPerspectiveFovLH(fov, aspect, nearClip, farClip);
+		const auto& sphereLod = mSphereLods.Select(DirectX::XMVectorGetX(DirectX::XMVector3Length(mCameraPos)) - 1.0f, MeshSimplifier::ProjectionScale(fov, (float)WINDOW_HEIGHT));
 
 		auto shadowDir = DirectX::XMVectorSet(0.0f, -1.0f, 0.0f, 0);
 		auto shadowPos = DirectX::XMVectorSet(0.0f, 5.0f, 0.0f, 0);
@@ -756,6 +1073,23 @@ float4 main(Input input) : SV_Target {
 
 		*reinterpret_cast<DirectX::XMMATRIX*>(pCBSceneMatrix) = DirectX::XMMatrixTranspose(worldMat * viewMat * projMat);
 
+		*reinterpret_cast<DirectX::XMMATRIX*>(pCBRayQuery) = DirectX::XMMatrixTranspose(DirectX::XMMatrixInverse(nullptr, viewMat * projMat));
+		auto lightDir = DirectX::XMVector3Normalize(DirectX::XMVectorSet(0.4f, 1.0f, -0.3f, 0));
+		DirectX::XMStoreFloat4(reinterpret_cast<DirectX::XMFLOAT4*>(pCBRayQuery + 16), DirectX::XMVectorSetW(lightDir, 0.05f));
+		pCBRayQuery[20] = nearClip;
+		pCBRayQuery[21] = farClip;
+
+		const auto& level = mRayBudget.Current();
+		RayQueryParams params = {};
+		params.passSize[0] = (WINDOW_WIDTH + level.divisor - 1) / level.divisor;
+		params.passSize[1] = (WINDOW_HEIGHT + level.divisor - 1) / level.divisor;
+		params.divisor = level.divisor;
+		params.shadowRays = level.shadowRays;
+		params.aoRays = level.aoRays;
+		params.frameIndex = static_cast<uint32_t>(mFrameCount);
+		params.aoRadius = 1.0f;
+		mSlotLevel[slot] = mRayQuery ? static_cast<int>(mRayBudget.LevelIndex()) : -1;
+
 		// Start recording commands
 
 		CHK(mCmdAlloc[mFrameCount % BUFFER_COUNT]->Reset());
@@ -766,12 +1100,18 @@ float4 main(Input input) : SV_Target {
 
 		// Draw scene
 
+		mCmdList->EndQuery(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 4 * slot);
+
 		CD3DX12_RESOURCE_BARRIER transitions[10];
 		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mSceneTex.Get(),
 			D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_RENDER_TARGET);
-		mCmdList->ResourceBarrier(1, transitions);
+		transitions[1] = CD3DX12_RESOURCE_BARRIER::Transition(mSceneNormal.Get(),
+			D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_RENDER_TARGET);
+		mCmdList->ResourceBarrier(2, transitions);
 
+		auto rtvSceneNormal = CD3DX12_CPU_DESCRIPTOR_HANDLE(rtvScene, (int)RTVs::SceneNormal, mRTVStride);
 		mCmdList->ClearRenderTargetView(rtvScene, kDefaultRTClearColor, 0, nullptr);
+		mCmdList->ClearRenderTargetView(rtvSceneNormal, kDefaultRTClearColor, 0, nullptr);
 		mCmdList->ClearDepthStencilView(dsvScene, D3D12_CLEAR_FLAG_DEPTH, kDefaultDSClearColor[0], 0, 0, nullptr);
 
 		mCmdList->SetGraphicsRootSignature(mSceneRootSig.Get());
@@ -787,26 +1127,75 @@ float4 main(Input input) : SV_Target {
 		mCmdList->RSSetViewports(1, &viewport);
 		auto scissor = CD3DX12_RECT(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 		mCmdList->RSSetScissorRects(1, &scissor);
-		mCmdList->OMSetRenderTargets(1, &rtvScene, TRUE, &dsvScene);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		mCmdList->OMSetRenderTargets(2, &rtvScene, TRUE, &dsvScene);
+		ProceduralMesh::DrawIndexed(mCmdList.Get(), sphereLod);
 
 		mCmdList->IASetVertexBuffers(0, 1, &mVBPlaneView);
 		mCmdList->IASetIndexBuffer(&mIBPlaneView);
 		mCmdList->DrawIndexedInstanced(6, 1, 0, 0, 0);
 
-		// Copy scene image to swap chain
+		mCmdList->EndQuery(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 4 * slot + 1);
 
 		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mSceneTex.Get(),
 			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ);
-		transitions[1] = CD3DX12_RESOURCE_BARRIER::Transition(mSwapChainTex[frameIndex].Get(),
+		transitions[1] = CD3DX12_RESOURCE_BARRIER::Transition(mSceneNormal.Get(),
+			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ);
+		transitions[2] = CD3DX12_RESOURCE_BARRIER::Transition(mSceneZ.Get(),
+			D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		mCmdList->ResourceBarrier(mRayQuery ? 3 : 2, transitions);
+
+		ID3D12Resource* sceneImage = mSceneTex.Get();
+		if (mRayQuery)
+		{
+			// Shadow and AO visibility at the pass resolution
+			auto svRayQuery = CD3DX12_GPU_DESCRIPTOR_HANDLE(svBase, (int)ShaderViews::RayQueryCBV, mResourceStride);
+			mCmdList->SetComputeRootSignature(mRayQueryRootSig.Get());
+			mCmdList->SetComputeRootDescriptorTable(0, svRayQuery);
+			mCmdList->SetComputeRoot32BitConstants(1, sizeof(params) / 4, &params, 0);
+			mCmdList->SetPipelineState(mVisibilityPSO.Get());
+			mCmdList->Dispatch((params.passSize[0] + 7) / 8, (params.passSize[1] + 7) / 8, 1);
+
+			mCmdList->EndQuery(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 4 * slot + 2);
+
+			// Joint bilateral upsampling onto the scene image
+			transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mVisibility.Get(),
+				D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			mCmdList->ResourceBarrier(1, transitions);
+			mCmdList->SetPipelineState(mUpsamplePSO.Get());
+			mCmdList->Dispatch((WINDOW_WIDTH + 7) / 8, (WINDOW_HEIGHT + 7) / 8, 1);
+
+			mCmdList->EndQuery(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 4 * slot + 3);
+
+			transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mVisibility.Get(),
+				D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+			transitions[1] = CD3DX12_RESOURCE_BARRIER::Transition(mSceneZ.Get(),
+				D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+			transitions[2] = CD3DX12_RESOURCE_BARRIER::Transition(mRayQueryOutput.Get(),
+				D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE);
+			mCmdList->ResourceBarrier(3, transitions);
+			sceneImage = mRayQueryOutput.Get();
+		}
+		else
+		{
+			mCmdList->EndQuery(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 4 * slot + 2);
+			mCmdList->EndQuery(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 4 * slot + 3);
+		}
+		mCmdList->ResolveQueryData(mTimestampHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 4 * slot, 4,
+			mTimestampReadback.Get(), sizeof(uint64_t) * 4 * slot);
+
+		// Copy scene image to swap chain
+
+		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mSwapChainTex[frameIndex].Get(),
 			D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_COPY_DEST);
-		mCmdList->ResourceBarrier(2, transitions);
+		mCmdList->ResourceBarrier(1, transitions);
 
-		mCmdList->CopyResource(mSwapChainTex[frameIndex].Get(), mSceneTex.Get());
+		mCmdList->CopyResource(mSwapChainTex[frameIndex].Get(), sceneImage);
 
 		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mSwapChainTex[frameIndex].Get(),
 			D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PRESENT);
-		mCmdList->ResourceBarrier(1, transitions);
+		transitions[1] = CD3DX12_RESOURCE_BARRIER::Transition(mRayQueryOutput.Get(),
+			D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		mCmdList->ResourceBarrier(mRayQuery ? 2 : 1, transitions);
 
 		// Finish recording commands
 		CHK(mCmdList->Close());
@@ -882,6 +1271,27 @@ public:
 		float newIndex = forward ? (mBindlessTextureIndex + 0.1f) : (mBindlessTextureIndex - 0.1f);
 		mBindlessTextureIndex = max(0.0f, min((float)MAX_BINDLESS_RESOURCE + 1.0f, newIndex));
 	}
+
+	// Raster only, or ray query shadows and AO at the resolution divisor, 0 for the one the budget picks
+	void ChangeRayQuery(bool enable, uint32_t divisor)
+	{
+		if (enable == mRayQuery && divisor == mFixedDivisor)
+			return;
+		mRayQuery = enable;
+		if (enable && divisor != mFixedDivisor)
+		{
+			mRayBudget = RayBudget::Controller(mRayBudget.Target(), RayBudget::DefaultLadder(divisor));
+			mFixedDivisor = divisor;
+			// Levels of frames in flight index the old ladder
+			for (auto& level : mSlotLevel)
+				level = -1;
+		}
+	}
+
+	void ChangeRayBudget(bool up)
+	{
+		mRayBudget.SetTarget(mRayBudget.Target() + (up ? 0.05 : -0.05));
+	}
 };
 
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
@@ -981,6 +1391,27 @@ int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 					if (keyState[VK_LEFT] & 0x80) {
 						d3d.ChangeTexture(false);
 					}
+					if (keyState[VK_UP] & 0x80) {
+						d3d.ChangeRayBudget(true);
+					}
+					if (keyState[VK_DOWN] & 0x80) {
+						d3d.ChangeRayBudget(false);
+					}
+					if (keyState['1'] & 0x80) {
+						d3d.ChangeRayQuery(false, 0);
+					}
+					if (keyState['2'] & 0x80) {
+						d3d.ChangeRayQuery(true, 0);
+					}
+					if (keyState['3'] & 0x80) {
+						d3d.ChangeRayQuery(true, 1);
+					}
+					if (keyState['4'] & 0x80) {
+						d3d.ChangeRayQuery(true, 2);
+					}
+					if (keyState['5'] & 0x80) {
+						d3d.ChangeRayQuery(true, 4);
+					}
 				}
 				d3d.Wait();
 				d3d.Draw();
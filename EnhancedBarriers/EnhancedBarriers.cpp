@@ -5,6 +5,9 @@
 #include <dxgi1_4.h>
 #include <d3d12.h>
 #include "d3dx12.h"
+#include "ProceduralMesh.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
 #include <DirectXMath.h>
 #include <vector>
 #include <iterator>
@@ -110,6 +113,8 @@ class D3D
 	D3D12_INDEX_BUFFER_VIEW mIBView = {};
 	const int SphereSlices = 12;
 	const int SphereStacks = 12;
+	ProceduralMesh::IndexedMesh mSphereMesh;
+	MeshSimplifier::LodChain mSphereLods;
 
 	ComPtr<ID3D12Resource> mVBPlane;
 	ComPtr<ID3D12Resource> mIBPlane;
@@ -529,46 +534,10 @@ float4 main(Input input) : SV_Target {
 		CD3DX12_CPU_DESCRIPTOR_HANDLE samplerHandle(mSampler->GetCPUDescriptorHandleForHeapStart());
 		mDevice->CreateSampler(&samplerDesc, samplerHandle);
 
-		// Generate sphere triangles
+		// Generate sphere triangles, reordered in place for the vertex cache, overdraw and vertex fetch
+		mSphereMesh = ProceduralMesh::PlanSphere(SphereSlices, SphereStacks);
 
-		struct IndexList
-		{
-			short a[6];
-		};
-		vector<VertexElement> vertices;
-		vector<IndexList> indices;
-		vertices.reserve((SphereStacks + 1) * (SphereSlices + 1));
-		for (int y = 0; y < SphereStacks + 1; ++y)
-		{
-			for (int x = 0; x < SphereSlices + 1; ++x)
-			{
-				// Generate a evenly tesselated plane
-				float v[3] = { (float)x / (float)(SphereSlices), (float)y / (float)(SphereStacks), 0.0f };
-				// Convert to spherical coordinate system
-				float theta = 2 * 3.14159265f * v[0];
-				float phi = 2 * 3.14159265f * v[1] / 2.0f;
-				VertexElement ve = { sinf(phi) * sinf(theta), cosf(phi), sinf(phi) * cosf(theta), 0, 0, 0 };
-				// Setup normal
-				float r = 1.0f;
-				ve.normal[0] = ve.position[0] / r;
-				ve.normal[1] = ve.position[1] / r;
-				ve.normal[2] = ve.position[2] / r;
-				vertices.push_back(ve);
-			}
-		}
-		indices.reserve(SphereStacks * SphereSlices);
-		for (int y = 0; y < SphereStacks; ++y)
-		{
-			for (int x = 0; x < SphereSlices; ++x)
-			{
-				short b = static_cast<short>(y * (SphereSlices + 1) + x);
-				short s = SphereSlices + 1;
-				IndexList il = { b, b + s, b + 1, b + s, b + s + 1, b + 1 };
-				indices.push_back(il);
-			}
-		}
-
-		auto sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		auto sizeVB = static_cast<uint32_t>(sizeof(VertexElement) * mSphereMesh.vertexCount);
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
 		resDesc1.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
 		resDesc1.Width = sizeVB;
@@ -584,9 +553,13 @@ float4 main(Input input) : SV_Target {
 			nullptr, 0, nullptr, IID_PPV_ARGS(&mVB)));
 		void* gpuMem;
 		CHK(mVB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		ProceduralMesh::WriteSphereVertices(gpuMem, ProceduralMesh::LayoutOf<VertexElement>(), SphereSlices, SphereStacks);
+		vector<uint8_t> sphereIndices(mSphereMesh.IndexBufferSize());
+		ProceduralMesh::WriteSphereIndices(sphereIndices.data(), mSphereMesh);
+		MeshOptimizer::OptimizeInPlace(mSphereMesh, gpuMem, sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
+		mSphereLods = MeshSimplifier::BuildLodChain(mSphereMesh, gpuMem, sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
 
-		auto sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		auto sizeIB = static_cast<uint32_t>(mSphereLods.indices.size());
 		resDesc1.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
 		resDesc1.Width = sizeIB;
 		resDesc1.Height = 1;
@@ -600,26 +573,19 @@ float4 main(Input input) : SV_Target {
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc1, D3D12_BARRIER_LAYOUT_UNDEFINED, nullptr,
 			nullptr, 0, nullptr, IID_PPV_ARGS(&mIB)));
 		CHK(mIB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		memcpy(gpuMem, mSphereLods.indices.data(), mSphereLods.indices.size());
 
 		mVBView.BufferLocation = mVB->GetGPUVirtualAddress();
 		mVBView.StrideInBytes = sizeof(VertexElement);
 		mVBView.SizeInBytes = sizeVB;
 		mIBView.BufferLocation = mIB->GetGPUVirtualAddress();
-		mIBView.Format = DXGI_FORMAT_R16_UINT;
+		mIBView.Format = ProceduralMesh::IndexFormat(mSphereMesh);
 		mIBView.SizeInBytes = sizeIB;
 
 		// Generate plane triangles
-		vertices.clear();
-		indices.clear();
-		vertices.push_back({ -1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ -1, -1, -1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, -1,  0, +1,  0 });
-		for (auto& v : vertices) { v.position[0] *= 3; v.position[1] *= 3; v.position[2] *= 3; }
-		indices.push_back({ 0, 1, 2, 2, 1, 3 });
-
-		sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		const auto planeSize = ProceduralMesh::PlaneSize();
+
+		sizeVB = static_cast<uint32_t>(sizeof(VertexElement) * planeSize.vertexCount);
 		resDesc1.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
 		resDesc1.Width = sizeVB;
 		resDesc1.Height = 1;
@@ -633,9 +599,9 @@ float4 main(Input input) : SV_Target {
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc1, D3D12_BARRIER_LAYOUT_UNDEFINED, nullptr,
 			nullptr, 0, nullptr, IID_PPV_ARGS(&mVBPlane)));
 		CHK(mVBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		ProceduralMesh::WritePlaneVertices(gpuMem, ProceduralMesh::LayoutOf<VertexElement>(), 3.0f, -3.0f);
 
-		sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		sizeIB = static_cast<uint32_t>(sizeof(uint16_t) * planeSize.indexCount);
 		resDesc1.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
 		resDesc1.Width = sizeIB;
 		resDesc1.Height = 1;
@@ -649,7 +615,7 @@ float4 main(Input input) : SV_Target {
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc1, D3D12_BARRIER_LAYOUT_UNDEFINED, nullptr,
 			nullptr, 0, nullptr, IID_PPV_ARGS(&mIBPlane)));
 		CHK(mIBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		ProceduralMesh::WritePlaneIndices(static_cast<uint16_t*>(gpuMem));
 
 		mVBPlaneView.BufferLocation = mVBPlane->GetGPUVirtualAddress();
 		mVBPlaneView.StrideInBytes = sizeof(VertexElement);
@@ -710,6 +676,7 @@ float4 main(Input input) : SV_Target {
 		auto worldMat = DirectX::XMMatrixIdentity();
 		auto viewMat = DirectX::XMMatrixLookAtLH(mCameraPos, mCameraTarget, mCameraUp);
 		auto projMat = DirectX::XMMatrixPerspectiveFovLH(fov, aspect, nearClip, farClip);
+		const auto& sphereLod = mSphereLods.Select(DirectX::XMVectorGetX(DirectX::XMVector3Length(mCameraPos)) - 1.0f, MeshSimplifier::ProjectionScale(fov, (float)WINDOW_HEIGHT));
 
 		auto shadowDir = DirectX::XMVectorSet(0.0f, -1.0f, 0.0f, 0);
 		auto shadowPos = DirectX::XMVectorSet(0.0f, 5.0f, 0.0f, 0);
@@ -785,7 +752,7 @@ float4 main(Input input) : SV_Target {
 		auto scissor = CD3DX12_RECT(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 		mCmdList->RSSetScissorRects(1, &scissor);
 		mCmdList->OMSetRenderTargets(1, &rtvScene, TRUE, &dsvScene);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		ProceduralMesh::DrawIndexed(mCmdList.Get(), sphereLod);
 
 		mCmdList->IASetVertexBuffers(0, 1, &mVBPlaneView);
 		mCmdList->IASetIndexBuffer(&mIBPlaneView);
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include "Bench.h"
+#include "AccelerationStructurePool.h"
+
+using namespace std;
+
+// Random churn of acceleration-structure-sized blocks, with a shadow copy checking every range
+int RunAsPoolBenchmark(const Options& opt)
+{
+	const uint64_t capacity = 64ull << 20;
+	AccelerationStructurePool::RangeAllocator ranges(capacity);
+	mt19937 rng(1);
+	// Mostly small BLASes with a few large ones, as compacted meshes are
+	auto randomSize = [&]() {
+		const uint64_t size = (rng() % 16 ? 1024 + rng() % 65536 : 256 * 1024 + rng() % (2 << 20));
+		return size - rng() % 256;
+	};
+	struct Block
+	{
+		uint64_t offset;
+		uint64_t size;
+	};
+	vector<Block> blocks;
+	uint64_t operations = 0, failed = 0;
+	double peakUse = 0;
+	auto check = [&]() {
+		// Free and allocated ranges tile the capacity without gaps, and no two free ranges touch
+		vector<pair<uint64_t, uint64_t>> all(ranges.FreeRanges().begin(), ranges.FreeRanges().end());
+		for (const auto& b : blocks)
+			all.push_back({ b.offset, ranges.SizeOf(b.offset) });
+		sort(all.begin(), all.end());
+		uint64_t end = 0;
+		for (const auto& r : all)
+		{
+			if (r.first != end || r.first % AccelerationStructurePool::Alignment || r.second == 0)
+				return false;
+			end += r.second;
+		}
+		uint64_t previous = ~0ull;
+		for (const auto& f : ranges.FreeRanges())
+		{
+			if (previous == f.first)
+				return false;
+			previous = f.first + f.second;
+		}
+		return end == ranges.Capacity();
+	};
+	const auto t0 = chrono::steady_clock::now();
+	for (uint32_t frame = 0; frame < opt.frames; ++frame)
+	{
+		for (int i = 0; i < 20000; ++i)
+		{
+			// Grow towards 3/4 full, then drain
+			const bool grow = blocks.empty() || (rng() % 4 != 0 && ranges.Used() < ranges.Capacity() * 3 / 4);
+			if (grow)
+			{
+				const uint64_t size = randomSize();
+				const uint64_t offset = ranges.Allocate(size);
+				if (offset == AccelerationStructurePool::RangeAllocator::Invalid)
+				{
+					++failed;
+					continue;
+				}
+				if (ranges.SizeOf(offset) < size)
+				{
+					cout << "Mismatch: range of " << ranges.SizeOf(offset) << " bytes for " << size << endl;
+					return 1;
+				}
+				blocks.push_back({ offset, size });
+			}
+			else
+			{
+				const size_t k = rng() % blocks.size();
+				ranges.Free(blocks[k].offset);
+				blocks[k] = blocks.back();
+				blocks.pop_back();
+			}
+			++operations;
+			peakUse = max(peakUse, double(ranges.Used()) / ranges.Capacity());
+		}
+		if (!check())
+		{
+			cout << "Mismatch: overlapping or leaked ranges after frame " << frame << endl;
+			return 1;
+		}
+	}
+	const double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	const size_t liveBlocks = blocks.size(), freeRanges = ranges.FreeRangeCount();
+	const double fragmentation = ranges.Used() == ranges.Capacity() ? 0.0 :
+		1.0 - double(ranges.LargestFree()) / (ranges.Capacity() - ranges.Used());
+	for (const auto& b : blocks)
+		ranges.Free(b.offset);
+	if (ranges.Used() != 0 || ranges.FreeRangeCount() != 1 || ranges.LargestFree() != ranges.Capacity())
+	{
+		cout << "Mismatch: freed pool did not coalesce into one range" << endl;
+		return 1;
+	}
+	bool threw = false;
+	try
+	{
+		ranges.Free(0);
+	}
+	catch (const runtime_error&)
+	{
+		threw = true;
+	}
+	if (!threw)
+	{
+		cout << "Mismatch: freeing an unknown range was accepted" << endl;
+		return 1;
+	}
+	const auto json = Json()
+		.Add("mode", "as-pool")
+		.Add("capacity", capacity)
+		.Add("operations", operations)
+		.Add("failed_allocations", failed)
+		.Add("mops_per_sec", operations / seconds / 1e6)
+		.Add("peak_use", peakUse)
+		.Add("live_blocks", liveBlocks)
+		.Add("free_ranges", freeRanges)
+		.Add("fragmentation", fragmentation);
+	return WriteJson(opt, json) ? 0 : 1;
+}
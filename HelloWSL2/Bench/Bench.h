@@ -0,0 +1,134 @@
+#pragma once
+
+// Options and JSON output shared by the HelloWSL2Bench modes
+// Every mode checks a module first, a failed check prints a "Mismatch:" line and returns 1
+// Results are printed as one JSON object, or written to --json FILE
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "../ImageEncoder.h"
+
+#define STRINGIFY(n) #n
+#define TOSTRING(n) STRINGIFY(n)
+#define CHK(hr) { auto e = ( hr ); if (FAILED(e)) { std::cout << std::hex << e << std::endl; throw std::runtime_error( __FILE__ "@" TOSTRING( __LINE__ ) ); } }
+
+constexpr uint32_t WIDTH = 256;
+constexpr uint32_t HEIGHT = 256;
+
+struct Options
+{
+	uint32_t width = WIDTH;
+	uint32_t height = HEIGHT;
+	uint32_t frames = 1;
+	uint32_t encodeThreads = 1;
+	uint32_t meshRes = 0;
+	uint32_t instances = 100000;
+	uint32_t threads = 0;
+	std::string jsonPath;
+	std::string outputPrefix;
+	ImageEncoder::Codec codec = ImageEncoder::Codec::PPM;
+	int rtMode = -1;
+};
+
+// JSON object, members are written in the order they are added
+class Json
+{
+public:
+	Json& Add(const char* key, const char* value) { return Member(key, Quote(value)); }
+	Json& Add(const char* key, const std::string& value) { return Member(key, Quote(value)); }
+	Json& Add(const char* key, bool value) { return Member(key, value ? "true" : "false"); }
+	template<class T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+	Json& Add(const char* key, T value) { return Member(key, std::to_string(value)); }
+	Json& Add(const char* key, const Json& value) { return Member(key, value.Str()); }
+	Json& Add(const char* key, const std::vector<Json>& values)
+	{
+		std::string array;
+		for (const auto& v : values)
+			array += (array.empty() ? "" : ",") + v.Str();
+		return Member(key, "[" + array + "]");
+	}
+	Json& Add(const char* key, const std::vector<std::string>& values)
+	{
+		std::string array;
+		for (const auto& v : values)
+			array += (array.empty() ? "" : ",") + Quote(v);
+		return Member(key, "[" + array + "]");
+	}
+	std::string Str() const { return "{" + mMembers + "}"; }
+
+private:
+	static std::string Quote(const std::string& s) { return "\"" + s + "\""; }
+	Json& Member(const char* key, const std::string& value)
+	{
+		mMembers += (mMembers.empty() ? "" : ",") + Quote(key) + ":" + value;
+		return *this;
+	}
+
+	std::string mMembers;
+};
+
+bool WriteJson(const Options& opt, const Json& json);
+
+auto Align(auto val, auto align)
+{
+	return ((val + align - 1) & ~(align - 1));
+}
+
+// Row-major, row vectors, as XMMatrixLookAtLH * XMMatrixPerspectiveFovLH
+inline std::array<float, 16> ViewProj(const float eye[3], const float target[3], float fovY, float aspect, float nearZ, float farZ)
+{
+	float z[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+	auto normalize = [](float v[3]) { const float l = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]); v[0] /= l; v[1] /= l; v[2] /= l; };
+	normalize(z);
+	float x[3] = { z[2], 0.0f, -z[0] }; // up = +Y
+	normalize(x);
+	const float y[3] = { z[1] * x[2] - z[2] * x[1], z[2] * x[0] - z[0] * x[2], z[0] * x[1] - z[1] * x[0] };
+	const float view[16] = {
+		x[0], y[0], z[0], 0,
+		x[1], y[1], z[1], 0,
+		x[2], y[2], z[2], 0,
+		-(x[0] * eye[0] + x[1] * eye[1] + x[2] * eye[2]), -(y[0] * eye[0] + y[1] * eye[1] + y[2] * eye[2]), -(z[0] * eye[0] + z[1] * eye[1] + z[2] * eye[2]), 1,
+	};
+	const float h = 1.0f / std::tan(fovY * 0.5f), range = farZ / (farZ - nearZ);
+	const float proj[16] = {
+		h / aspect, 0, 0, 0,
+		0, h, 0, 0,
+		0, 0, range, 1,
+		0, 0, -range * nearZ, 0,
+	};
+	std::array<float, 16> m = {};
+	for (int r = 0; r < 4; ++r)
+		for (int c = 0; c < 4; ++c)
+			for (int k = 0; k < 4; ++k)
+				m[4 * r + c] += view[4 * r + k] * proj[4 * k + c];
+	return m;
+}
+
+int RunConvertBenchmark(const Options& opt);
+int RunEncodeBenchmark(const Options& opt);
+int RunMeshBenchmark(const Options& opt);
+int RunMeshStress(const Options& opt);
+int RunMeshOptimize(const Options& opt);
+int RunPackBenchmark(const Options& opt);
+int RunMeshletBenchmark(const Options& opt);
+int RunSimplifyBenchmark(const Options& opt);
+int RunCullBenchmark(const Options& opt);
+int RunTraceCpu(const Options& opt);
+int RunTraceBenchmark(const Options& opt);
+int RunAsPoolBenchmark(const Options& opt);
+int RunBlasPlanBenchmark(const Options& opt);
+int RunShaderTableBenchmark(const Options& opt);
+int RunRayBudgetBenchmark(const Options& opt);
+int RunConstantRingBenchmark(const Options& opt);
+int RunAliasingBenchmark(const Options& opt);
+int RunHeapAllocatorBenchmark(const Options& opt);
+int RunBindlessBenchmark(const Options& opt);
+int RunDescriptorRingBenchmark(const Options& opt);
+int RunFileStreamBenchmark(const Options& opt);
+int RunUploadBenchmark(const Options& opt);
@@ -0,0 +1,146 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include "Bench.h"
+#include "BindlessDescriptors.h"
+
+using namespace std;
+
+// Streaming of views through a 1M descriptor table with the GPU two frames behind
+int RunBindlessBenchmark(const Options& opt)
+{
+	using namespace BindlessDescriptors;
+	const uint32_t capacity = 1000000;
+	const uint32_t lag = 2;
+	Table table(capacity);
+	// 0 free, 1 live, otherwise the fence value + 2 that frees the slot
+	vector<uint64_t> state(capacity, 0);
+	vector<Handle> live, stale;
+	mt19937 rng(17);
+	uint64_t allocations = 0, frees = 0, dirty = 0, runs = 0;
+	double seconds = 0;
+	string error;
+
+	const uint32_t perFrame = min<uint32_t>(opt.instances, 20000);
+	for (uint64_t frame = 1; frame <= opt.frames && error.empty(); ++frame)
+	{
+		const uint64_t completed = frame > lag ? frame - lag : 0;
+		auto t0 = chrono::steady_clock::now();
+		table.Retire(completed);
+		seconds += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		for (auto& s : state)
+		{
+			if (s > 1 && s - 2 <= completed)
+				s = 0;
+		}
+		// Fill towards 3/4 of the heap, then replace views as fast as they are created
+		const uint32_t freeCount = live.size() > capacity / 2 ? perFrame : perFrame / 4;
+		uint32_t allocateCount = live.size() + table.Pending() + perFrame < capacity * 3 / 4 ? perFrame : freeCount;
+		vector<uint32_t> frameSlots;
+		t0 = chrono::steady_clock::now();
+		for (uint32_t i = 0; i < allocateCount; ++i)
+		{
+			live.push_back(table.Allocate());
+			frameSlots.push_back(live.back().index);
+		}
+		for (uint32_t i = 0; i < freeCount && !live.empty(); ++i)
+		{
+			const size_t victim = rng() % live.size();
+			table.Free(live[victim], frame);
+			stale.push_back(live[victim]);
+			live[victim] = live.back();
+			live.pop_back();
+		}
+		const auto frameRuns = table.TakeDirtyRuns();
+		seconds += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		allocations += allocateCount;
+		frees += freeCount;
+
+		for (auto slot : frameSlots)
+		{
+			if (state[slot] != 0)
+				error = "slot " + to_string(slot) + " reused while " + (state[slot] == 1 ? "live" : "the GPU may still read it");
+			state[slot] = 1;
+		}
+		for (auto it = stale.end() - min<size_t>(stale.size(), freeCount); it != stale.end(); ++it)
+			state[it->index] = frame + 2;
+		// Runs cover exactly the slots written this frame, in order and apart
+		sort(frameSlots.begin(), frameSlots.end());
+		size_t covered = 0;
+		for (size_t r = 0; r < frameRuns.size() && error.empty(); ++r)
+		{
+			if (r && frameRuns[r].first <= frameRuns[r - 1].first + frameRuns[r - 1].second)
+				error = "copy runs overlap or touch";
+			for (uint32_t i = 0; i < frameRuns[r].second && error.empty(); ++i, ++covered)
+			{
+				if (covered >= frameSlots.size() || frameSlots[covered] != frameRuns[r].first + i)
+					error = "copy runs do not match the written slots";
+			}
+		}
+		if (error.empty() && covered != frameSlots.size())
+			error = "copy runs miss written slots";
+		dirty += frameSlots.size();
+		runs += frameRuns.size();
+		if (table.Live() != live.size())
+			error = "live count drifted";
+	}
+	for (size_t i = 0; i < stale.size() && error.empty(); i += 97)
+	{
+		if (table.IsValid(stale[i]))
+			error = "a freed handle still validates";
+	}
+	if (error.empty() && !stale.empty())
+	{
+		try
+		{
+			table.Free(stale.back(), 0);
+			error = "freeing a stale handle was accepted";
+		}
+		catch (const runtime_error&)
+		{
+		}
+	}
+	// A full heap throws instead of handing out a pending slot
+	if (error.empty())
+	{
+		Table small(64);
+		vector<Handle> handles;
+		for (int i = 0; i < 64; ++i)
+			handles.push_back(small.Allocate());
+		small.Free(handles[5], 10);
+		small.Retire(9);
+		try
+		{
+			small.Allocate();
+			error = "allocated a slot the GPU may still read";
+		}
+		catch (const runtime_error&)
+		{
+		}
+		small.Retire(10);
+		if (error.empty() && (small.Allocate().index != 5 || small.IsValid(handles[5])))
+			error = "a retired slot did not come back with a new generation";
+	}
+	if (!error.empty())
+	{
+		cout << "Mismatch: " << error << endl;
+		return 1;
+	}
+
+	const double opsPerSecond = (allocations + frees) / seconds;
+	const auto json = Json()
+		.Add("mode", "bindless")
+		.Add("capacity", capacity)
+		.Add("allocations", allocations)
+		.Add("frees", frees)
+		.Add("ops_per_second", opsPerSecond)
+		.Add("live", table.Live())
+		.Add("pending", table.Pending())
+		.Add("copy_calls", runs)
+		.Add("descriptors_copied", dirty)
+		.Add("descriptors_per_copy", double(dirty) / max<uint64_t>(runs, 1));
+	return WriteJson(opt, json) ? 0 : 1;
+}
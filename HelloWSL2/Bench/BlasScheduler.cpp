@@ -0,0 +1,90 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include "Bench.h"
+#include "BlasScheduler.h"
+
+using namespace std;
+
+// Packs random BLAS scratch sizes under several budgets and checks every batch against its budget and alignment
+int RunBlasPlanBenchmark(const Options& opt)
+{
+	mt19937 rng(3);
+	const uint32_t buildCount = 2000;
+	vector<uint64_t> sizes(buildCount);
+	for (auto& size : sizes)
+	{
+		// Mostly small meshes, a few large ones, and an occasional build above every budget
+		const uint32_t kind = rng() % 100;
+		size = kind < 80 ? 4096 + rng() % 262144 : kind < 99 ? 262144 + rng() % (4 << 20) : (20 << 20) + rng() % (8 << 20);
+	}
+	const uint64_t total = accumulate(sizes.begin(), sizes.end(), 0ull);
+	vector<Json> budgets;
+	for (uint64_t budget : { 1ull << 20, 4ull << 20, 16ull << 20, 64ull << 20 })
+	{
+		BlasScheduler::Plan plan;
+		const auto t0 = chrono::steady_clock::now();
+		for (uint32_t frame = 0; frame < opt.frames; ++frame)
+			plan = BlasScheduler::PlanBatches(sizes, budget);
+		const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count() / opt.frames;
+
+		vector<uint32_t> placed(buildCount, 0);
+		uint64_t lowerBound = 0, oversized = 0;
+		for (size_t b = 0; b < plan.batches.size(); ++b)
+		{
+			vector<pair<uint64_t, uint64_t>> ranges;
+			for (uint32_t i : plan.batches[b])
+			{
+				const auto& p = plan.placements[i];
+				if (p.batch != b || p.offset % AccelerationStructurePool::Alignment)
+				{
+					cout << "Mismatch: build " << i << " misplaced in batch " << b << endl;
+					return 1;
+				}
+				placed[i]++;
+				ranges.push_back({ p.offset, p.offset + AccelerationStructurePool::AlignUp(sizes[i]) });
+			}
+			sort(ranges.begin(), ranges.end());
+			for (size_t k = 1; k < ranges.size(); ++k)
+			{
+				if (ranges[k].first < ranges[k - 1].second)
+				{
+					cout << "Mismatch: overlapping scratch in batch " << b << endl;
+					return 1;
+				}
+			}
+			const uint64_t used = ranges.empty() ? 0 : ranges.back().second;
+			if (used != plan.batchScratch[b] || used > plan.arenaSize || (used > budget && ranges.size() != 1))
+			{
+				cout << "Mismatch: batch " << b << " uses " << used << " bytes of a " << budget << " budget" << endl;
+				return 1;
+			}
+			oversized += used > budget;
+		}
+		if (count(placed.begin(), placed.end(), 1u) != buildCount)
+		{
+			cout << "Mismatch: builds not placed exactly once" << endl;
+			return 1;
+		}
+		uint64_t fitting = 0;
+		for (auto size : sizes)
+			fitting += AccelerationStructurePool::AlignUp(size) <= budget ? AccelerationStructurePool::AlignUp(size) : 0;
+		lowerBound = oversized + (fitting + budget - 1) / budget;
+		budgets.push_back(Json()
+			.Add("budget", budget)
+			.Add("batches", plan.batches.size())
+			.Add("lower_bound", lowerBound)
+			.Add("barriers", plan.Barriers())
+			.Add("oversized", oversized)
+			.Add("arena", plan.arenaSize)
+			.Add("plan_ms", ms));
+	}
+	const auto json = Json()
+		.Add("mode", "blas-plan")
+		.Add("builds", buildCount)
+		.Add("scratch_total", total)
+		.Add("budgets", budgets);
+	return WriteJson(opt, json) ? 0 : 1;
+}
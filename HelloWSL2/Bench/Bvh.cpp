@@ -0,0 +1,373 @@
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "Bench.h"
+#include "MeshOptimizer.h"
+#include "Bvh.h"
+
+using namespace std;
+
+// Cofactor expansion, as XMMatrixInverse
+array<float, 16> Inverse(const array<float, 16>& m)
+{
+	array<float, 16> inv;
+	inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+	inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+	inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+	inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+	inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+	inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+	inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+	inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+	inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+	inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+	inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+	inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+	inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+	inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+	inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+	inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+	const float det = 1.0f / (m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12]);
+	for (auto& v : inv)
+		v *= det;
+	return inv;
+}
+
+// Sphere over the y = -3 plane as in the DXR sample, instance 0 is the sphere and instance 1 the plane
+struct TraceScene
+{
+	ProceduralMesh::IndexedMesh mesh;
+	vector<uint8_t> vertices;
+	vector<uint8_t> indices;
+	vector<Bvh::Instance> instances;
+	Bvh::BottomLevel sphere;
+	Bvh::BottomLevel plane;
+	Bvh::TopLevel top;
+	array<float, 16> invViewProj;
+	float cameraPos[3] = { 0.0f, 4.0f, -4.0f };
+};
+
+struct TraceVertex
+{
+	float position[3];
+	float normal[3];
+};
+
+// res 12 is the optimized sphere of the sample, larger spheres skip the optimizer
+void BuildTraceScene(TraceScene& scene, uint32_t res, uint32_t width, uint32_t height, uint32_t threads)
+{
+	using namespace ProceduralMesh;
+	const auto layout = LayoutOf<TraceVertex>();
+	if (res == 12)
+	{
+		auto sphere = MeshOptimizer::OptimizeSphere<TraceVertex>(res, res);
+		scene.mesh = sphere.mesh;
+		scene.vertices = move(sphere.vertices);
+		scene.indices = move(sphere.indices);
+	}
+	else
+	{
+		scene.mesh = PlanSphere(res, res);
+		scene.vertices.resize(static_cast<size_t>(layout.stride) * scene.mesh.vertexCount);
+		scene.indices.resize(scene.mesh.IndexBufferSize());
+		WriteSphereVertices(scene.vertices.data(), layout, res, res);
+		WriteSphereIndices(scene.indices.data(), scene.mesh);
+	}
+	scene.sphere.Build(scene.mesh, scene.vertices.data(), scene.indices.data(), layout, threads);
+	const auto planeMesh = PlanGrid(1, 1);
+	TraceVertex planeVertices[4];
+	uint16_t planeIndices[6];
+	WritePlaneVertices(planeVertices, layout, 3.0f, -3.0f);
+	WritePlaneIndices(planeIndices);
+	scene.plane.Build(planeMesh, planeVertices, planeIndices, layout, 1);
+	scene.instances.resize(2);
+	scene.instances[0].blas = &scene.sphere;
+	scene.instances[0].instanceMask = 1;
+	scene.instances[1].blas = &scene.plane;
+	scene.instances[1].instanceMask = 1;
+	scene.top.Build(scene.instances);
+	const float target[3] = { 0.0f, 0.0f, 0.0f };
+	scene.invViewProj = Inverse(ViewProj(scene.cameraPos, target, 0.7853982f, float(width) / height, 0.01f, 100.0f));
+}
+
+// ColorMap of the DXR sample
+const float TracePalette[8][4] = {
+	{ 1.0f, 0.0f, 0.0f, 1.0f }, { 0.7f, 0.7f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f, 1.0f }, { 0.0f, 0.7f, 0.7f, 1.0f },
+	{ 0.0f, 0.0f, 1.0f, 1.0f }, { 0.7f, 0.0f, 0.7f, 1.0f }, { 0.5f, 0.5f, 0.5f, 1.0f }, { 1.0f, 1.0f, 1.0f, 1.0f },
+};
+
+uint64_t HashImage(const vector<uint8_t>& rgba)
+{
+	uint64_t h = 14695981039346656037ull;
+	for (auto b : rgba)
+		h = (h ^ b) * 1099511628211ull;
+	return h;
+}
+
+// Golden images of the DXR closest hit modes, traced on the CPU
+int RunTraceCpu(const Options& opt)
+{
+	TraceScene scene;
+	BuildTraceScene(scene, opt.meshRes ? opt.meshRes : 12, opt.width, opt.height, opt.threads);
+	const string prefix = opt.outputPrefix.empty() ? "trace" : opt.outputPrefix;
+	vector<uint8_t> rgba(4ull * opt.width * opt.height), rgb(3ull * opt.width * opt.height), encoded;
+	vector<Json> images;
+	for (uint32_t mode = 0; mode < 4; ++mode)
+	{
+		if (opt.rtMode >= 0 && uint32_t(opt.rtMode) != mode)
+			continue;
+		Bvh::RenderRayGen(scene.top, scene.invViewProj.data(), scene.cameraPos, opt.width, opt.height,
+			static_cast<Bvh::RayGenMode>(mode), TracePalette, rgba.data(), opt.threads);
+		for (size_t i = 0; i < size_t(opt.width) * opt.height; ++i)
+			memcpy(&rgb[3 * i], &rgba[4 * i], 3);
+		ImageEncoder::Encode(opt.codec, rgb.data(), opt.width, opt.height, encoded, opt.encodeThreads);
+		const string path = prefix + "_mode" + to_string(mode) + ImageEncoder::Extension(opt.codec);
+		ofstream file(path, ios::binary);
+		file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+		if (!file)
+		{
+			cout << "Cannot write " << path << endl;
+			return 1;
+		}
+		char hash[17];
+		snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(HashImage(rgba)));
+		images.push_back(Json().Add("rt_mode", mode).Add("path", path).Add("hash", hash));
+	}
+	const auto json = Json()
+		.Add("mode", "trace-cpu")
+		.Add("width", opt.width)
+		.Add("height", opt.height)
+		.Add("images", images);
+	return WriteJson(opt, json) ? 0 : 1;
+}
+
+// Wide nodes must cover their children, leaves their triangles, and every triangle sits in exactly one leaf
+bool ValidateTree(const Bvh::BottomLevel& blas)
+{
+	const auto& tree = blas.tree;
+	vector<uint32_t> seen(blas.triangles.size());
+	vector<uint32_t> parents(tree.nodes.size(), ~0u);
+	for (size_t n = 0; n < tree.nodes.size(); ++n)
+	{
+		const auto& node = tree.nodes[n];
+		for (size_t l = 0; l < Bvh::Width; ++l)
+		{
+			if (node.child[l] == Bvh::EmptyChild)
+				continue;
+			// Vertices rebuilt from the edges may be an ulp off
+			auto inside = [&](const float p[3])
+			{
+				for (int a = 0; a < 3; ++a)
+				{
+					if (p[a] < node.lo[a][l] - 1e-6f || p[a] > node.hi[a][l] + 1e-6f)
+						return false;
+				}
+				return true;
+			};
+			if (node.count[l])
+			{
+				for (uint32_t i = node.child[l]; i < node.child[l] + node.count[l]; ++i)
+				{
+					const auto& t = blas.triangles[i];
+					const float p1[3] = { t.v0[0] + t.e1[0], t.v0[1] + t.e1[1], t.v0[2] + t.e1[2] };
+					const float p2[3] = { t.v0[0] + t.e2[0], t.v0[1] + t.e2[1], t.v0[2] + t.e2[2] };
+					if (seen[i]++ || !inside(t.v0) || !inside(p1) || !inside(p2))
+						return false;
+				}
+				continue;
+			}
+			const auto& child = tree.nodes[node.child[l]];
+			if (parents[node.child[l]] != ~0u)
+				return false;
+			parents[node.child[l]] = static_cast<uint32_t>(n);
+			for (size_t c = 0; c < Bvh::Width; ++c)
+			{
+				if (child.child[c] == Bvh::EmptyChild)
+					continue;
+				const float lo[3] = { child.lo[0][c], child.lo[1][c], child.lo[2][c] };
+				const float hi[3] = { child.hi[0][c], child.hi[1][c], child.hi[2][c] };
+				if (!inside(lo) || !inside(hi))
+					return false;
+			}
+		}
+	}
+	return all_of(seen.begin(), seen.end(), [](uint32_t s) { return s == 1; });
+}
+
+// Images of the SIMD and threaded tracer must equal the scalar tracer byte for byte, and closest hits must
+// equal a brute force loop over every triangle. Then the build and trace rates of a 1M-triangle sphere.
+int RunTraceBenchmark(const Options& opt)
+{
+	const uint32_t w = opt.width, h = opt.height;
+	vector<string> hashes;
+	// Brute force over both instances on a sparse set of camera rays
+	uint32_t checked = 0, hits = 0;
+	auto bruteForce = [&](const TraceScene& scene, uint32_t step)
+	{
+		for (uint32_t y = 0; y < h; y += step)
+		{
+			for (uint32_t x = y % step; x < w; x += step)
+			{
+				const float ndc[4] = { (0.5f + x) / w * 2 - 1, (0.5f + y) / h * -2 + 1, 1, 1 };
+				float farPos[4];
+				for (int c = 0; c < 4; ++c)
+					farPos[c] = ndc[0] * scene.invViewProj[c] + ndc[1] * scene.invViewProj[4 + c] + ndc[2] * scene.invViewProj[8 + c] + scene.invViewProj[12 + c];
+				Bvh::Ray ray;
+				float length = 0.0f;
+				for (int a = 0; a < 3; ++a)
+				{
+					ray.origin[a] = scene.cameraPos[a];
+					ray.direction[a] = farPos[a] / farPos[3] - scene.cameraPos[a];
+					length += ray.direction[a] * ray.direction[a];
+				}
+				for (auto& d : ray.direction)
+					d /= sqrtf(length);
+				ray.tmin = 0.01f;
+				ray.tmax = 100.0f;
+				Bvh::Hit hit, brute;
+				const bool found = scene.top.Trace(ray, hit);
+				Bvh::Hit any;
+				if (scene.top.Trace(ray, any, 0x1, true) != found)
+				{
+					cout << "Mismatch: first hit query of ray " << x << "," << y << " disagrees with the closest hit" << endl;
+					return false;
+				}
+				brute.t = ray.tmax;
+				for (uint32_t i = 0; i < 2; ++i)
+				{
+					// Identity transforms, the world ray is the object ray
+					const auto& blas = *scene.top.instances[i].blas;
+					const auto local = Bvh::Detail::MakeLocalRay(ray.origin, ray.direction);
+					for (const auto& t : blas.triangles)
+					{
+						if (Bvh::Detail::IntersectTriangle(t, local, ray.tmin, brute))
+							brute.instanceIndex = i;
+					}
+				}
+				// Ties between triangles sharing an edge may pick either primitive
+				if (found != brute.Valid() || (found && hit.t != brute.t))
+				{
+					cout << "Mismatch: ray " << x << "," << y << " hits t " << hit.t << " instead of " << brute.t << endl;
+					return false;
+				}
+				checked++;
+				hits += found ? 1 : 0;
+			}
+		}
+		return true;
+	};
+	{
+		TraceScene scene;
+		BuildTraceScene(scene, 12, w, h, opt.threads);
+		if (!ValidateTree(scene.sphere) || !ValidateTree(scene.plane))
+		{
+			cout << "Mismatch: invalid BVH of the sample scene" << endl;
+			return 1;
+		}
+		vector<uint8_t> image(4ull * w * h), reference(image.size());
+		for (uint32_t mode = 0; mode < 4; ++mode)
+		{
+			const auto m = static_cast<Bvh::RayGenMode>(mode);
+			Bvh::RenderRayGen(scene.top, scene.invViewProj.data(), scene.cameraPos, w, h, m, TracePalette, image.data(), opt.threads, true);
+			Bvh::RenderRayGen(scene.top, scene.invViewProj.data(), scene.cameraPos, w, h, m, TracePalette, reference.data(), 1, false);
+			if (image != reference)
+			{
+				cout << "Mismatch: SIMD image of mode " << mode << " differs from scalar" << endl;
+				return 1;
+			}
+			char hash[17];
+			snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(HashImage(image)));
+			hashes.push_back(hash);
+		}
+		if (!bruteForce(scene, 3))
+			return 1;
+	}
+
+	TraceScene scene;
+	const uint32_t res = opt.meshRes ? opt.meshRes : 708;
+	auto t0 = chrono::steady_clock::now();
+	BuildTraceScene(scene, res, w, h, 1);
+	const double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+	t0 = chrono::steady_clock::now();
+	BuildTraceScene(scene, res, w, h, opt.threads);
+	const double threadedBuildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+	if (!ValidateTree(scene.sphere))
+	{
+		cout << "Mismatch: invalid BVH at " << res << endl;
+		return 1;
+	}
+	if (!bruteForce(scene, 61))
+		return 1;
+
+	vector<uint8_t> image(4ull * w * h);
+	auto measure = [&](uint32_t threads, bool simd)
+	{
+		const auto start = chrono::steady_clock::now();
+		for (uint32_t f = 0; f < opt.frames; ++f)
+			Bvh::RenderRayGen(scene.top, scene.invViewProj.data(), scene.cameraPos, w, h, Bvh::RayGenMode::PrimitiveIndex, TracePalette, image.data(), threads, simd);
+		return double(w) * h * opt.frames / chrono::duration<double>(chrono::steady_clock::now() - start).count() / 1e6;
+	};
+	const double scalarRate = measure(1, false), simdRate = measure(1, true), threadedRate = measure(opt.threads, true);
+	const auto stats = scene.sphere.tree.stats;
+
+	// Wave the sphere like the DXR sample, refitted trees have to stay valid and keep tracing like brute force
+	const auto layout = ProceduralMesh::LayoutOf<TraceVertex>();
+	auto* vertices = reinterpret_cast<TraceVertex*>(scene.vertices.data());
+	const vector<TraceVertex> rest(vertices, vertices + scene.mesh.vertexCount);
+	const uint32_t refitSteps = 4;
+	double refitMs = 0.0;
+	for (uint32_t step = 1; step <= refitSteps; ++step)
+	{
+		const float time = 0.5f * step;
+		for (size_t v = 0; v < rest.size(); ++v)
+		{
+			const auto* p = rest[v].position;
+			const float scale = 1.0f + 0.15f * sinf(4.0f * p[1] + 2.0f * time) * cosf(3.0f * atan2f(p[2], p[0]) + time);
+			for (int k = 0; k < 3; ++k)
+				vertices[v].position[k] = p[k] * scale;
+		}
+		t0 = chrono::steady_clock::now();
+		scene.sphere.Refit(scene.mesh, scene.vertices.data(), scene.indices.data(), layout);
+		scene.top.Refit(scene.instances);
+		refitMs += chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+		if (!ValidateTree(scene.sphere))
+		{
+			cout << "Mismatch: invalid refitted BVH at step " << step << endl;
+			return 1;
+		}
+		if (!bruteForce(scene, 61))
+			return 1;
+	}
+	Bvh::BottomLevel rebuilt;
+	t0 = chrono::steady_clock::now();
+	rebuilt.Build(scene.mesh, scene.vertices.data(), scene.indices.data(), layout, opt.threads);
+	const double rebuildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+	const auto json = Json()
+		.Add("mode", "trace")
+		.Add("width", w)
+		.Add("height", h)
+		.Add("simd", Bvh::SimdName())
+		.Add("wide", Bvh::Width)
+		.Add("modes", hashes)
+		.Add("triangles", scene.sphere.triangles.size())
+		.Add("wide_nodes", stats.wideNodes)
+		.Add("leaves", stats.leaves)
+		.Add("depth", stats.maxDepth)
+		.Add("sah_cost", stats.sahCost)
+		.Add("build_ms", Json().Add("single", buildMs).Add("threads", threadedBuildMs))
+		.Add("brute_force_rays", checked)
+		.Add("brute_force_hits", hits)
+		.Add("mrays_per_sec", Json().Add("scalar", scalarRate).Add("simd", simdRate).Add("simd_threads", threadedRate))
+		.Add("refit", Json()
+			.Add("ms", refitMs / refitSteps)
+			.Add("rebuild_ms", rebuildMs)
+			.Add("sah", scene.sphere.tree.stats.sahCost)
+			.Add("sah_rebuilt", rebuilt.tree.stats.sahCost));
+	return WriteJson(opt, json) ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include "Bench.h"
+#include "ConstantRing.h"
+
+using namespace std;
+
+// Frames of per-draw constants with the GPU two frames behind, then a stalled GPU that fills the ring
+int RunConstantRingBenchmark(const Options& opt)
+{
+	const uint32_t draws = opt.instances;
+	const uint64_t latency = 2; // Frames in flight, as the samples' Wait() allows
+	mt19937 rng(11);
+	// Mostly one matrix per draw, some draws with a material block or a skinning palette
+	auto randomSize = [&]() -> uint64_t {
+		const uint32_t r = rng() % 64;
+		return r < 56 ? 64 : r < 63 ? 192 + rng() % 256 : 1024 + rng() % 3072;
+	};
+	vector<uint64_t> sizes(draws);
+	uint64_t frameBytes = 0;
+	for (auto& size : sizes)
+	{
+		size = randomSize();
+		frameBytes += ConstantRing::AlignUp(size);
+	}
+	// Room for the frames in flight and the one being written, with slack for the padding at the wrap
+	ConstantRing::Ring ring((latency + 1) * frameBytes + frameBytes / 4);
+	const uint64_t chunk = ConstantRing::Alignment;
+	vector<uint64_t> owner(ring.Capacity() / chunk, 0); // Fence value of the frame that last wrote each chunk
+	uint64_t completed = 0, wraps = 0, peakUsed = 0, previous = 0;
+	auto claim = [&](uint64_t offset, uint64_t size, uint64_t fence) {
+		if (offset == ConstantRing::Ring::Invalid || offset % ConstantRing::Alignment || offset + size > ring.Capacity())
+			return false;
+		for (uint64_t c = offset / chunk; c < (offset + size + chunk - 1) / chunk; ++c)
+		{
+			if (owner[c] > completed)
+				return false;
+			owner[c] = fence;
+		}
+		return true;
+	};
+	for (uint64_t frame = 1; frame <= opt.frames; ++frame)
+	{
+		completed = frame > latency ? frame - latency : 0;
+		ring.Retire(completed);
+		for (uint32_t d = 0; d < draws; ++d)
+		{
+			const uint64_t offset = ring.Allocate(sizes[d]);
+			if (!claim(offset, sizes[d], frame))
+			{
+				cout << "Mismatch: draw " << d << " of frame " << frame << " got offset " << offset << " over a live range" << endl;
+				return 1;
+			}
+			wraps += offset < previous;
+			previous = offset;
+		}
+		peakUsed = max(peakUsed, ring.Used());
+		ring.Close(frame);
+		if (ring.FramesInFlight() > latency + 1 || ring.LastFrameAllocations() != draws || ring.LastFrameBytes() + ConstantRing::Alignment < frameBytes)
+		{
+			cout << "Mismatch: " << ring.FramesInFlight() << " frames in flight, " << ring.LastFrameAllocations() << " allocations after frame " << frame << endl;
+			return 1;
+		}
+	}
+	// A stalled GPU fills the ring, then allocations fail without overwriting anything until a fence completes
+	const uint64_t stalled = opt.frames + 1;
+	uint64_t accepted = 0;
+	for (;;)
+	{
+		const uint64_t size = randomSize();
+		const uint64_t offset = ring.Allocate(size);
+		if (offset == ConstantRing::Ring::Invalid)
+			break;
+		if (!claim(offset, size, stalled))
+		{
+			cout << "Mismatch: stalled allocation at " << offset << " over a live range" << endl;
+			return 1;
+		}
+		++accepted;
+	}
+	if (ring.Used() > ring.Capacity() || ring.Capacity() - ring.Used() > 4096 + ring.Capacity() / 4)
+	{
+		cout << "Mismatch: ring refused allocations with " << ring.Capacity() - ring.Used() << " bytes free" << endl;
+		return 1;
+	}
+	ring.Close(stalled);
+	completed = stalled;
+	ring.Retire(completed);
+	if (ring.Used() != 0 || !claim(ring.Allocate(64), 64, stalled + 1))
+	{
+		cout << "Mismatch: ring not empty after every fence completed" << endl;
+		return 1;
+	}
+	// Throughput of the allocation and the constant write alone
+	ConstantRing::Ring timed(ring.Capacity());
+	vector<uint8_t> buffer(timed.Capacity());
+	float matrix[16] = {};
+	const auto t0 = chrono::steady_clock::now();
+	for (uint64_t frame = 1; frame <= opt.frames; ++frame)
+	{
+		timed.Retire(frame > latency ? frame - latency : 0);
+		for (uint32_t d = 0; d < draws; ++d)
+		{
+			matrix[0] = float(d);
+			memcpy(buffer.data() + timed.Allocate(sizes[d]), matrix, sizeof(matrix));
+		}
+		timed.Close(frame);
+	}
+	const double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	const double allocations = double(draws) * opt.frames;
+	const auto json = Json()
+		.Add("mode", "cb-ring")
+		.Add("draws_per_frame", draws)
+		.Add("frame_bytes", frameBytes)
+		.Add("capacity", ring.Capacity())
+		.Add("frames", opt.frames)
+		.Add("mallocs_per_sec", allocations / seconds / 1e6)
+		.Add("ns_per_draw", seconds * 1e9 / allocations)
+		.Add("wraps", wraps)
+		.Add("peak_use", double(peakUsed) / ring.Capacity())
+		.Add("stalled_allocations", accepted);
+	return WriteJson(opt, json) ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include "Bench.h"
+#include "DescriptorRing.h"
+
+using namespace std;
+
+// Draws of a frame share material tables, the GPU runs two frames behind
+int RunDescriptorRingBenchmark(const Options& opt)
+{
+	const uint32_t capacity = 65536;
+	const uint64_t stride = 32; // Descriptor increment of common hardware
+	const uint32_t lag = 2;
+	const uint32_t draws = min<uint32_t>(opt.instances, 4000);
+	const uint32_t materials = max<uint32_t>(draws / 8, 1);
+	DescriptorRing::Tables tables(capacity);
+	mt19937 rng(23);
+
+	// Material tables: runs of views next to each other in a staging heap, with some views from elsewhere
+	vector<vector<uint64_t>> materialSources(materials);
+	for (auto& sources : materialSources)
+	{
+		const uint64_t base = 0x10000 + (rng() % 100000) * stride;
+		const uint32_t count = 1 + rng() % 8;
+		for (uint32_t i = 0; i < count; ++i)
+			sources.push_back(rng() % 4 ? base + i * stride : 0x900000 + (rng() % 1000) * stride);
+	}
+
+	vector<uint64_t> owner(capacity, 0); // Frame holding each slot, 0 when free
+	deque<pair<uint64_t, vector<uint32_t>>> inFlight;
+	uint64_t copied = 0, copyCalls = 0, pushed = 0, hits = 0;
+	double seconds = 0;
+	string error;
+	for (uint64_t frame = 1; frame <= opt.frames && error.empty(); ++frame)
+	{
+		const uint64_t completed = frame > lag ? frame - lag : 0;
+		tables.Retire(completed);
+		while (!inFlight.empty() && inFlight.front().first <= completed)
+		{
+			for (auto slot : inFlight.front().second)
+				owner[slot] = 0;
+			inFlight.pop_front();
+		}
+		vector<uint32_t> frameSlots;
+		map<vector<uint64_t>, uint32_t> seen;
+		for (uint32_t draw = 0; draw < draws && error.empty(); ++draw)
+		{
+			// Most draws use a material, some a one-off table
+			vector<uint64_t> sources = rng() % 8 ? materialSources[rng() % materials] : vector<uint64_t>{ 0x800000 + (rng() % 100000) * stride, 0x700000 + draw * stride };
+			bool hit;
+			const auto t0 = chrono::steady_clock::now();
+			const uint32_t first = tables.Allocate(sources.data(), static_cast<uint32_t>(sources.size()), hit);
+			uint32_t calls = 0;
+			if (!hit)
+				DescriptorRing::ForEachRun(sources.data(), static_cast<uint32_t>(sources.size()), stride, [&](uint32_t, uint32_t) { calls++; });
+			seconds += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+			pushed++;
+			auto known = seen.find(sources);
+			if (hit != (known != seen.end()) || (hit && known->second != first))
+				error = "table cache " + string(hit ? "returned a table not pushed this frame" : "missed a table pushed this frame");
+			if (hit)
+			{
+				hits++;
+				continue;
+			}
+			seen[sources] = first;
+			for (uint32_t i = 0; i < sources.size() && error.empty(); ++i)
+			{
+				if (first + i >= capacity || owner[first + i])
+					error = "table of frame " + to_string(frame) + " overwrites a slot of frame " + to_string(first + i < capacity ? owner[first + i] : 0);
+				else
+				{
+					owner[first + i] = frame;
+					frameSlots.push_back(first + i);
+				}
+			}
+			copied += sources.size();
+			copyCalls += calls;
+		}
+		tables.Close(frame);
+		inFlight.push_back({ frame, move(frameSlots) });
+		if (error.empty() && tables.LastFrameTables() != draws)
+			error = "frame stats do not count every table";
+	}
+	// A ring smaller than a frame's tables throws instead of overwriting one in flight
+	if (error.empty())
+	{
+		DescriptorRing::Tables small(256);
+		vector<uint64_t> sources(100);
+		bool hit;
+		try
+		{
+			for (uint32_t i = 0; i < 3; ++i)
+			{
+				iota(sources.begin(), sources.end(), uint64_t(i) * 1000);
+				small.Allocate(sources.data(), 100, hit);
+			}
+			error = "a full descriptor ring handed out a range";
+		}
+		catch (const runtime_error&)
+		{
+		}
+	}
+	if (!error.empty())
+	{
+		cout << "Mismatch: " << error << endl;
+		return 1;
+	}
+
+	const double frames = opt.frames;
+	const auto json = Json()
+		.Add("mode", "desc-ring")
+		.Add("tables_per_frame", draws)
+		.Add("frames", opt.frames)
+		.Add("hit_rate", double(hits) / pushed)
+		.Add("copied_per_frame", copied / frames)
+		.Add("copy_calls_per_frame", copyCalls / frames)
+		.Add("tables_per_second", pushed / seconds)
+		.Add("in_flight", tables.Used());
+	return WriteJson(opt, json) ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Bench.h"
+#include "FileStreaming.h"
+
+using namespace std;
+
+// Resident set of the process, sampled while each path runs
+uint64_t ResidentBytes()
+{
+	ifstream status("/proc/self/status");
+	string line;
+	while (getline(status, line))
+	{
+		if (line.compare(0, 6, "VmRSS:") == 0)
+			return stoull(line.substr(6)) * 1024;
+	}
+	return 0;
+}
+
+// Stands in for the copy engine reading bytes at a file offset, independent of how the range is split
+uint64_t StreamChecksum(const uint8_t* data, uint64_t size, uint64_t offset)
+{
+	uint64_t sum = 0;
+	for (uint64_t i = 0; i < size; ++i)
+		sum += data[i] * (offset + i + 1);
+	return sum;
+}
+
+// A file of --frames windows and a tail, loaded as assets that straddle windows, the GPU two batches behind
+int RunFileStreamBenchmark(const Options& opt)
+{
+	using namespace FileStreaming;
+	const uint64_t fileSize = uint64_t(opt.frames) * DefaultWindowSize + 12345;
+	const uint64_t assetSize = 6000000;
+	const uint64_t lag = 2;
+
+	char path[] = "/tmp/HelloWSL2StreamXXXXXX";
+	const int fd = mkstemp(path);
+	if (fd < 0)
+	{
+		cout << "Cannot create the stream file." << endl;
+		return 1;
+	}
+	uint64_t expected = 0;
+	{
+		vector<uint8_t> chunk(1 << 20);
+		uint64_t state = 0x9E3779B97F4A7C15ull;
+		for (uint64_t written = 0; written < fileSize;)
+		{
+			const uint64_t length = min<uint64_t>(chunk.size(), fileSize - written);
+			for (auto& byte : chunk)
+			{
+				state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+				byte = uint8_t(state);
+			}
+			expected += StreamChecksum(chunk.data(), length, written);
+			if (write(fd, chunk.data(), length) != ssize_t(length))
+			{
+				close(fd);
+				unlink(path);
+				cout << "Cannot write the stream file." << endl;
+				return 1;
+			}
+			written += length;
+		}
+	}
+	const uint64_t assets = (fileSize + assetSize - 1) / assetSize;
+	string error;
+
+	// Zero copy: copies read the mapped windows, only the tail is copied on the CPU
+	uint64_t streamed = 0, streamCpuBytes = 0, streamPeak = 0;
+	uint32_t copies = 0;
+	double streamSeconds = 0;
+	WindowTable table;
+	{
+		const uint64_t baseline = ResidentBytes();
+		const auto t0 = chrono::steady_clock::now();
+		MappedFile file;
+		file.Open(path);
+		table.Reset(file.Size());
+		vector<uint8_t*> views(table.Count(), nullptr);
+		vector<uint8_t> tail(file.Size() - table.Bulk());
+		if (!tail.empty())
+		{
+			uint8_t* view = file.Map(table.Bulk(), tail.size());
+			memcpy(tail.data(), view, tail.size());
+			MappedFile::Unmap(view, tail.size());
+			streamCpuBytes += tail.size();
+		}
+		struct Copy
+		{
+			uint32_t window;
+			uint64_t offset, size, fileOffset;
+		};
+		deque<vector<Copy>> batches;
+		auto execute = [&](const vector<Copy>& batch) {
+			for (const auto& copy : batch)
+			{
+				if (copy.window != Invalid && !table.Mapped(copy.window))
+					error = "a window was unmapped while a copy reads it";
+				else
+					streamed += StreamChecksum(copy.window == Invalid ? tail.data() + copy.offset : views[copy.window] + copy.offset, copy.size, copy.fileOffset);
+			}
+		};
+		for (uint64_t asset = 0; asset < assets + lag && error.empty(); ++asset)
+		{
+			if (asset < assets)
+			{
+				vector<Copy> batch;
+				const uint64_t offset = asset * assetSize;
+				table.ForEachWindow(offset, min(assetSize, fileSize - offset), [&](uint32_t window, uint64_t at, uint64_t length, uint64_t done) {
+					if (window != Invalid && table.Use(window))
+						views[window] = file.Map(table.Get(window).offset, table.Get(window).size);
+					batch.push_back({ window, at, length, offset + done });
+				});
+				copies += uint32_t(batch.size());
+				table.Close(asset + 1);
+				batches.push_back(move(batch));
+			}
+			// The GPU finishes the batch submitted lag batches ago, its pages are resident until the windows are unmapped
+			if (asset >= lag || asset >= assets)
+			{
+				execute(batches.front());
+				batches.pop_front();
+				streamPeak = max(streamPeak, ResidentBytes() - min(baseline, ResidentBytes()));
+				for (uint32_t window : table.Retire(asset + 1 - lag))
+				{
+					MappedFile::Unmap(views[window], table.Get(window).size);
+					views[window] = nullptr;
+				}
+			}
+		}
+		if (error.empty() && table.MappedCount() != 0)
+			error = "windows are still mapped after the last batch completed";
+		streamSeconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	}
+
+	// Upload path: each asset is read into memory and copied into an upload buffer that lives until its batch completes
+	uint64_t uploaded = 0, uploadCpuBytes = 0, uploadPeak = 0;
+	double uploadSeconds = 0;
+	if (error.empty())
+	{
+		const uint64_t baseline = ResidentBytes();
+		const auto t0 = chrono::steady_clock::now();
+		const int file = open(path, O_RDONLY);
+		deque<pair<uint64_t, unique_ptr<uint8_t[]>>> uploads;
+		for (uint64_t asset = 0; asset < assets + lag && error.empty(); ++asset)
+		{
+			if (asset < assets)
+			{
+				const uint64_t offset = asset * assetSize;
+				const uint64_t length = min(assetSize, fileSize - offset);
+				vector<uint8_t> data(length);
+				if (pread(file, data.data(), length, off_t(offset)) != ssize_t(length))
+					error = "short read of the stream file";
+				unique_ptr<uint8_t[]> upload(new uint8_t[length]);
+				memcpy(upload.get(), data.data(), length);
+				uploadCpuBytes += 2 * length;
+				uploads.push_back({ offset, move(upload) });
+				uploadPeak = max(uploadPeak, ResidentBytes() - min(baseline, ResidentBytes()));
+			}
+			if (asset >= lag || asset >= assets)
+			{
+				const uint64_t offset = uploads.front().first;
+				uploaded += StreamChecksum(uploads.front().second.get(), min(assetSize, fileSize - offset), offset);
+				uploads.pop_front();
+			}
+		}
+		close(file);
+		uploadSeconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	}
+	unlink(path);
+
+	if (error.empty() && streamed != expected)
+		error = "the mapped windows did not deliver the file";
+	if (error.empty() && uploaded != expected)
+		error = "the upload path did not deliver the file";
+	if (!error.empty())
+	{
+		cout << "Mismatch: " << error << endl;
+		return 1;
+	}
+
+	const double gb = fileSize / 1e9;
+	const auto json = Json()
+		.Add("mode", "file-stream")
+		.Add("file_bytes", fileSize)
+		.Add("assets", assets)
+		.Add("windows", table.Count())
+		.Add("copies", copies)
+		.Add("stream_gb_per_second", gb / streamSeconds)
+		.Add("stream_cpu_bytes", streamCpuBytes)
+		.Add("stream_peak_rss", streamPeak)
+		.Add("peak_mapped_windows", table.PeakMapped())
+		.Add("peak_mapped_bytes", table.PeakMappedBytes())
+		.Add("upload_gb_per_second", gb / uploadSeconds)
+		.Add("upload_cpu_bytes", uploadCpuBytes)
+		.Add("upload_peak_rss", uploadPeak);
+	return WriteJson(opt, json) ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include "Bench.h"
+#include "HeapAllocator.h"
+
+using namespace std;
+
+// Heaps as byte counts, so the pool can be checked without a device
+struct FakeHeaps : HeapAllocator::Backend
+{
+	vector<uint64_t> sizes; // 0 once destroyed
+	uint64_t created = 0;
+	uint64_t limit = ~0ull;
+
+	bool CreateHeap(uint32_t heap, uint64_t size, uint64_t alignment) override
+	{
+		uint64_t total = size;
+		for (auto s : sizes)
+			total += s;
+		if (total > limit || alignment % HeapAllocator::DefaultAlignment)
+			return false;
+		if (heap >= sizes.size())
+			sizes.resize(heap + 1, 0);
+		if (sizes[heap])
+			return false;
+		sizes[heap] = size;
+		created++;
+		return true;
+	}
+
+	void DestroyHeap(uint32_t heap) override
+	{
+		sizes[heap] = 0;
+	}
+};
+
+// Live allocations inside live heaps, aligned, disjoint, and the pool stats adding up
+string CheckHeapPool(const HeapAllocator::Pool& pool, const FakeHeaps& heaps, const vector<pair<uint32_t, uint64_t>>& live, const vector<uint64_t>& sizes)
+{
+	vector<tuple<uint32_t, uint64_t, uint64_t>> ranges;
+	uint64_t used = 0;
+	for (const auto& allocation : live)
+	{
+		const auto p = pool.Get(allocation.first);
+		if (p.heap >= heaps.sizes.size() || !heaps.sizes[p.heap] || p.heap >= pool.HeapCount() || !pool.HeapLive(p.heap))
+			return "allocation " + to_string(allocation.first) + " in a released heap";
+		if (p.offset % allocation.second || p.size < sizes[allocation.first] || p.offset + p.size > heaps.sizes[p.heap])
+			return "allocation " + to_string(allocation.first) + " misaligned or outside its heap";
+		ranges.emplace_back(p.heap, p.offset, p.offset + p.size);
+		used += p.size;
+	}
+	sort(ranges.begin(), ranges.end());
+	for (size_t i = 1; i < ranges.size(); ++i)
+	{
+		if (get<0>(ranges[i]) == get<0>(ranges[i - 1]) && get<1>(ranges[i]) < get<2>(ranges[i - 1]))
+			return "allocations overlap in heap " + to_string(get<0>(ranges[i]));
+	}
+	const auto stats = pool.GetStats();
+	uint64_t heapBytes = 0;
+	for (auto size : heaps.sizes)
+		heapBytes += size;
+	if (stats.usedBytes != used || stats.heapBytes != heapBytes || stats.allocations != live.size() || stats.largestFree > stats.FreeBytes())
+		return "stats do not add up";
+	return "";
+}
+
+// Churn of small textures, buffers, MSAA targets and oversized resources through one pool, then defragmentation
+int RunHeapAllocatorBenchmark(const Options& opt)
+{
+	using namespace HeapAllocator;
+	// The bin search on its own: a heap cut into every size, then freed in random order back to one block
+	{
+		Tlsf tlsf(DefaultHeapSize);
+		vector<uint32_t> blocks;
+		mt19937 rng(3);
+		for (uint32_t block; (block = tlsf.Allocate(SmallAlignment * (1 + rng() % 300), rng() % 4 ? SmallAlignment : DefaultAlignment)) != Invalid;)
+			blocks.push_back(block);
+		shuffle(blocks.begin(), blocks.end(), rng);
+		for (auto block : blocks)
+			tlsf.Free(block);
+		if (tlsf.Used() || tlsf.FreeBlocks() != 1 || tlsf.LargestFree() != DefaultHeapSize || tlsf.Allocate(DefaultHeapSize) == Invalid)
+		{
+			cout << "Mismatch: a heap freed in random order does not merge back into one block" << endl;
+			return 1;
+		}
+	}
+
+	FakeHeaps heaps;
+	Pool pool(heaps, 16 << 20);
+	mt19937 rng(11);
+	vector<pair<uint32_t, uint64_t>> live; // Allocation and alignment
+	vector<uint64_t> sizes;
+	uint64_t committedBytes = 0, liveBytes = 0, allocations = 0, frees = 0;
+	double seconds = 0;
+	string error;
+	auto allocate = [&]() {
+		uint64_t size, alignment;
+		const uint32_t kind = rng() % 16;
+		if (kind < 8)
+		{
+			size = SmallAlignment * (1 + rng() % 16); // Small textures
+			alignment = SmallAlignment;
+		}
+		else if (kind < 14)
+		{
+			size = 256 + rng() % (2 << 20); // Buffers
+			alignment = DefaultAlignment;
+		}
+		else if (kind < 15)
+		{
+			size = (1 + rng() % 3) << 22; // 4x MSAA targets
+			alignment = 4 << 20;
+		}
+		else
+		{
+			size = rng() % 8 ? (1 + rng() % 4) << 20 : (17 + rng() % 16) << 20; // Some larger than a heap
+			alignment = DefaultAlignment;
+		}
+		const auto t0 = chrono::steady_clock::now();
+		const uint32_t allocation = pool.Allocate(size, alignment);
+		seconds += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		if (allocation >= sizes.size())
+			sizes.resize(allocation + 1);
+		sizes[allocation] = size;
+		live.push_back({ allocation, alignment });
+		liveBytes += AlignUp(size, alignment == SmallAlignment ? SmallAlignment : DefaultAlignment);
+		committedBytes += AlignUp(size, alignment == SmallAlignment ? DefaultAlignment : alignment);
+		allocations++;
+	};
+	auto release = [&](size_t i) {
+		const auto t0 = chrono::steady_clock::now();
+		pool.Free(live[i].first);
+		seconds += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		live[i] = live.back();
+		live.pop_back();
+		frees++;
+	};
+
+	const uint32_t opsPerFrame = 1024;
+	for (uint32_t frame = 0; frame < opt.frames && error.empty(); ++frame)
+	{
+		// Grow for the first half of the frames, then shrink, so heaps drain and scatter
+		const bool growing = frame < opt.frames / 2;
+		for (uint32_t op = 0; op < opsPerFrame; ++op)
+		{
+			if (live.empty() || rng() % 100 < (growing ? 60u : 45u))
+				allocate();
+			else
+				release(rng() % live.size());
+		}
+		error = CheckHeapPool(pool, heaps, live, sizes);
+	}
+	if (!error.empty())
+	{
+		cout << "Mismatch: " << error << endl;
+		return 1;
+	}
+
+	pool.Trim();
+	error = CheckHeapPool(pool, heaps, live, sizes);
+	const auto before = pool.GetStats();
+	const auto t0 = chrono::steady_clock::now();
+	uint64_t movedBytes = 0, moveCount = 0;
+	for (uint32_t pass = 0; pass < 16; ++pass)
+	{
+		const auto moves = pool.Defragment(32 << 20);
+		for (const auto& move : moves)
+		{
+			// The old range stays reserved until FinishMoves(), so a copy never reads from overwritten memory
+			if (move.from.heap == move.to.heap && move.from.offset < move.to.offset + move.to.size && move.to.offset < move.from.offset + move.from.size)
+				error = "allocation " + to_string(move.allocation) + " moved onto itself";
+			movedBytes += move.from.size;
+		}
+		moveCount += moves.size();
+		pool.FinishMoves();
+		pool.Trim();
+		if (error.empty())
+			error = CheckHeapPool(pool, heaps, live, sizes);
+		if (moves.empty() || !error.empty())
+			break;
+	}
+	const double defragSeconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	const auto after = pool.GetStats();
+	if (error.empty() && (after.heaps > before.heaps || after.heapBytes > before.heapBytes))
+		error = "defragmentation grew the pool";
+	if (!error.empty())
+	{
+		cout << "Mismatch: " << error << endl;
+		return 1;
+	}
+
+	// Out of memory surfaces as an exception and leaves the pool usable
+	FakeHeaps small;
+	small.limit = 32 << 20;
+	bool threw = false;
+	{
+		Pool limited(small, 16 << 20);
+		try
+		{
+			for (uint32_t i = 0; i < 64; ++i)
+				limited.Allocate(1 << 20, DefaultAlignment);
+		}
+		catch (const runtime_error&)
+		{
+			threw = limited.GetStats().allocations == 32;
+		}
+	}
+	if (!threw || any_of(small.sizes.begin(), small.sizes.end(), [](uint64_t size) { return size != 0; }))
+	{
+		cout << "Mismatch: running out of heaps did not throw or leaked a heap" << endl;
+		return 1;
+	}
+
+	const double opsPerSecond = (allocations + frees) / seconds;
+	const auto json = Json()
+		.Add("mode", "heap-alloc")
+		.Add("allocations", allocations)
+		.Add("frees", frees)
+		.Add("ops_per_second", opsPerSecond)
+		.Add("small_alignment_saving", 1.0 - double(liveBytes) / max<uint64_t>(committedBytes, 1))
+		.Add("heaps_before", before.heaps)
+		.Add("heaps_after", after.heaps)
+		.Add("free_blocks_before", before.freeBlocks)
+		.Add("free_blocks_after", after.freeBlocks)
+		.Add("fragmentation_before", before.Fragmentation())
+		.Add("fragmentation_after", after.Fragmentation())
+		.Add("moves", moveCount)
+		.Add("moved_bytes", movedBytes)
+		.Add("defrag_ms", defragSeconds * 1e3);
+	return WriteJson(opt, json) ? 0 : 1;
+}
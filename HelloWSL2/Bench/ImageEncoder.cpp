@@ -0,0 +1,80 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include "Bench.h"
+#include "../ImageEncoder.h"
+
+using namespace std;
+
+// Encode a synthetic frame with every codec, decode it back and compare, then report MB/s
+int RunEncodeBenchmark(const Options& opt)
+{
+	using namespace ImageEncoder;
+	// Flat background, gradients and a noisy block, roughly like rendered frames
+	vector<uint8_t> rgb(3ull * opt.width * opt.height);
+	mt19937 rng(12345);
+	for (uint32_t y = 0; y < opt.height; ++y)
+	{
+		for (uint32_t x = 0; x < opt.width; ++x)
+		{
+			auto* p = &rgb[3ull * (y * opt.width + x)];
+			if (x < opt.width / 2)
+			{
+				p[0] = 26; p[1] = 51; p[2] = 102;
+			}
+			else if (y < opt.height / 2)
+			{
+				p[0] = static_cast<uint8_t>(x); p[1] = static_cast<uint8_t>(y); p[2] = static_cast<uint8_t>(x ^ y);
+			}
+			else
+			{
+				p[0] = static_cast<uint8_t>(rng()); p[1] = static_cast<uint8_t>(rng()); p[2] = static_cast<uint8_t>(rng());
+			}
+		}
+	}
+	const Codec codecs[] = { Codec::PPM, Codec::QOI, Codec::PNG, Codec::PNGStore };
+	vector<Json> results;
+	// One band and several, so the seams between bands are always decoded
+	const uint32_t bandCounts[] = { 1, max(2u, thread::hardware_concurrency()), opt.encodeThreads };
+	vector<uint8_t> encoded, decoded;
+	for (auto codec : codecs)
+	{
+		for (auto bands : bandCounts)
+		{
+			if (codec == Codec::PPM)
+				break;
+			Encode(codec, rgb.data(), opt.width, opt.height, encoded, bands);
+			uint32_t w = 0, h = 0;
+			const bool ok = codec == Codec::QOI
+				? DecodeQOI(encoded.data(), encoded.size(), decoded, w, h)
+				: DecodePNG(encoded.data(), encoded.size(), decoded, w, h);
+			if (!ok || w != opt.width || h != opt.height || decoded != rgb)
+			{
+				cout << "Mismatch: " << CodecName(codec) << " round trip with " << bands << " bands" << endl;
+				return 1;
+			}
+		}
+		Encode(codec, rgb.data(), opt.width, opt.height, encoded, opt.encodeThreads);
+		const auto t0 = chrono::steady_clock::now();
+		for (uint32_t i = 0; i < opt.frames; ++i)
+			Encode(codec, rgb.data(), opt.width, opt.height, encoded, opt.encodeThreads);
+		const double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		results.push_back(Json()
+			.Add("codec", CodecName(codec))
+			.Add("bytes", encoded.size())
+			.Add("ratio", double(encoded.size()) / rgb.size())
+			.Add("ms_per_frame", seconds * 1e3 / opt.frames)
+			.Add("mb_per_sec", double(rgb.size()) * opt.frames / seconds / 1e6));
+	}
+	const auto json = Json()
+		.Add("mode", "encode")
+		.Add("width", opt.width)
+		.Add("height", opt.height)
+		.Add("iterations", opt.frames)
+		.Add("threads", opt.encodeThreads)
+		.Add("codecs", results);
+	return WriteJson(opt, json) ? 0 : 1;
+}
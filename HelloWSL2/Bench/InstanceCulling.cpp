@@ -0,0 +1,94 @@
+#include <iostream>
+#include <vector>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include "Bench.h"
+#include "InstanceCulling.h"
+
+using namespace std;
+
+// Every frame looks at the scene from another orbit position. The SIMD bands must return exactly the scalar
+// result, and may only disagree with a double precision test for boxes touching a plane.
+int RunCullBenchmark(const Options& opt)
+{
+	using namespace InstanceCulling;
+	const auto scene = RandomScene(opt.instances);
+	vector<Frustum> frustums;
+	for (uint32_t i = 0; i < opt.frames; ++i)
+	{
+		const float angle = 6.2831853f * i / opt.frames;
+		const float eye[3] = { 30.0f * cosf(angle), 4.0f, 30.0f * sinf(angle) };
+		const float target[3] = { 0.0f, 0.0f, 0.0f };
+		frustums.push_back(FrustumFromViewProj(ViewProj(eye, target, 0.7853982f, 16.0f / 9.0f, 0.01f, 100.0f).data()));
+	}
+
+	Culler single(1), multi(opt.threads);
+	vector<InstanceData> packed(scene.Size());
+	vector<uint32_t> visible(scene.Size()), reference(scene.Size());
+	size_t visibleTotal = 0, boundaryCases = 0;
+	for (const auto& frustum : frustums)
+	{
+		const size_t count = multi.Cull(scene, frustum, packed.data(), visible.data());
+		const size_t scalarCount = single.Cull(scene, frustum, nullptr, reference.data(), false);
+		if (count != scalarCount || !equal(visible.begin(), visible.begin() + count, reference.begin()))
+		{
+			cout << "Mismatch: SIMD culling differs from scalar" << endl;
+			return 1;
+		}
+		for (size_t k = 0; k < count; ++k)
+		{
+			if (memcmp(&packed[k], &scene.instances[visible[k]], sizeof(InstanceData)))
+			{
+				cout << "Mismatch: packed instance " << k << " is not instance " << visible[k] << endl;
+				return 1;
+			}
+		}
+		size_t next = 0;
+		for (size_t i = 0; i < scene.Size(); ++i)
+		{
+			double margin = DBL_MAX;
+			for (const auto& p : frustum.planes)
+			{
+				const double d = double(p[0]) * scene.centerX[i] + double(p[1]) * scene.centerY[i] + double(p[2]) * scene.centerZ[i] + p[3];
+				const double r = fabs(double(p[0])) * scene.extentX[i] + fabs(double(p[1])) * scene.extentY[i] + fabs(double(p[2])) * scene.extentZ[i];
+				margin = min(margin, d + r);
+			}
+			const bool culled = !(next < count && visible[next] == i);
+			next += culled ? 0 : 1;
+			if (culled == (margin < 0.0))
+				continue;
+			if (fabs(margin) > 1e-4)
+			{
+				cout << "Mismatch: instance " << i << " culled " << culled << " with margin " << margin << endl;
+				return 1;
+			}
+			boundaryCases++;
+		}
+		visibleTotal += count;
+	}
+
+	auto measure = [&](Culler& culler, bool simd)
+	{
+		const auto t0 = chrono::steady_clock::now();
+		for (const auto& frustum : frustums)
+			culler.Cull(scene, frustum, packed.data(), nullptr, simd);
+		return chrono::duration<double>(chrono::steady_clock::now() - t0).count() * 1e3 / frustums.size();
+	};
+	const double per100k = 100000.0 / scene.Size();
+	const double scalarMs = measure(single, false), simdMs = measure(single, true), threadedMs = measure(multi, true);
+	const auto json = Json()
+		.Add("mode", "cull")
+		.Add("instances", scene.Size())
+		.Add("frames", opt.frames)
+		.Add("simd", SimdName())
+		.Add("threads", multi.ThreadCount())
+		.Add("visible_per_frame", double(visibleTotal) / frustums.size())
+		.Add("boundary_cases", boundaryCases)
+		.Add("ms_per_100k", Json()
+			.Add("scalar", scalarMs * per100k)
+			.Add("simd", simdMs * per100k)
+			.Add("simd_threads", threadedMs * per100k));
+	return WriteJson(opt, json) ? 0 : 1;
+}
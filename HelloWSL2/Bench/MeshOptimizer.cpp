@@ -0,0 +1,103 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include "Bench.h"
+#include "MeshOptimizer.h"
+
+using namespace std;
+
+// The optimizer may only reorder, every triangle has to survive with its winding
+int RunMeshOptimize(const Options& opt)
+{
+	using namespace ProceduralMesh;
+	struct MeshVertex
+	{
+		float position[3];
+		float normal[3];
+	};
+	using Triangle = array<float, 9>;
+	auto triangles = [](const void* vertices, const void* indices, const IndexedMesh& mesh)
+	{
+		vector<Triangle> list;
+		for (const auto& c : mesh.chunks)
+		{
+			for (uint32_t i = c.firstIndex; i < c.firstIndex + c.indexCount; i += 3)
+			{
+				Triangle t;
+				for (int k = 0; k < 3; ++k)
+				{
+					const auto local = mesh.indexSize == 4 ? static_cast<const uint32_t*>(indices)[i + k] : static_cast<const uint16_t*>(indices)[i + k];
+					memcpy(&t[3 * k], static_cast<const MeshVertex*>(vertices)[c.baseVertex + local].position, 3 * sizeof(float));
+				}
+				// Rotate the smallest corner first, keeps the winding
+				Triangle best = t;
+				for (int r = 1; r < 3; ++r)
+				{
+					Triangle rotated;
+					for (int k = 0; k < 9; ++k)
+						rotated[k] = t[(k + 3 * r) % 9];
+					best = min(best, rotated);
+				}
+				list.push_back(best);
+			}
+		}
+		sort(list.begin(), list.end());
+		return list;
+	};
+
+	struct Case
+	{
+		uint32_t res;
+		IndexPolicy policy;
+	};
+	vector<Case> cases = { { 8, IndexPolicy::Auto }, { 12, IndexPolicy::Auto }, { 64, IndexPolicy::Auto }, { 256, IndexPolicy::Auto }, { 512, IndexPolicy::Chunked16 } };
+	if (opt.meshRes)
+		cases = { { opt.meshRes, IndexPolicy::Auto } };
+	vector<Json> meshes;
+	for (const auto& c : cases)
+	{
+		const auto mesh = PlanSphere(c.res, c.res, c.policy);
+		vector<MeshVertex> vertices(mesh.vertexCount);
+		vector<uint8_t> indices(mesh.IndexBufferSize());
+		WriteSphereVertices(vertices.data(), LayoutOf<MeshVertex>(), c.res, c.res);
+		WriteSphereIndices(indices.data(), mesh);
+
+		const auto t0 = chrono::steady_clock::now();
+		const auto result = MeshOptimizer::OptimizeSphere<MeshVertex>(c.res, c.res, c.policy);
+		const double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		if (triangles(vertices.data(), indices.data(), mesh) != triangles(result.vertices.data(), result.indices.data(), result.mesh))
+		{
+			cout << "Mismatch: triangles changed at " << c.res << endl;
+			return 1;
+		}
+		if (result.mesh.vertexCount != mesh.vertexCount)
+		{
+			cout << "Mismatch: " << result.mesh.vertexCount - mesh.vertexCount << " vertices duplicated at " << c.res << endl;
+			return 1;
+		}
+		if (MeshOptimizer::OptimizeSphere<MeshVertex>(c.res, c.res, c.policy).Fingerprint() != result.Fingerprint())
+		{
+			cout << "Mismatch: output is not deterministic at " << c.res << endl;
+			return 1;
+		}
+		meshes.push_back(Json()
+			.Add("slices", c.res)
+			.Add("stacks", c.res)
+			.Add("chunks", result.mesh.chunks.size())
+			.Add("vertices_before", mesh.vertexCount)
+			.Add("vertices_after", result.mesh.vertexCount)
+			.Add("acmr_before", result.before.acmr)
+			.Add("acmr_after", result.after.acmr)
+			.Add("atvr_before", result.before.atvr)
+			.Add("atvr_after", result.after.atvr)
+			.Add("optimize_ms", seconds * 1e3));
+	}
+	const auto json = Json()
+		.Add("mode", "optimize-mesh")
+		.Add("cache_size", MeshOptimizer::DefaultCacheSize)
+		.Add("meshes", meshes);
+	return WriteJson(opt, json) ? 0 : 1;
+}
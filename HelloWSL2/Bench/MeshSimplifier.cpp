@@ -0,0 +1,181 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include "Bench.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+
+using namespace std;
+
+// LODs must shrink, stay close to the sphere, keep facing outwards and stay closed, and a flat grid
+// must collapse without error while every border vertex survives
+int RunSimplifyBenchmark(const Options& opt)
+{
+	using namespace ProceduralMesh;
+	struct MeshVertex
+	{
+		float position[3];
+		float normal[3];
+	};
+	const auto layout = LayoutOf<MeshVertex>();
+	auto readTriangles = [](const MeshSimplifier::LodChain& chain, const IndexedMesh& mesh)
+	{
+		vector<array<uint32_t, 3>> triangles;
+		for (const auto& c : mesh.chunks)
+		{
+			for (uint32_t i = c.firstIndex; i < c.firstIndex + c.indexCount; i += 3)
+			{
+				array<uint32_t, 3> t;
+				for (int k = 0; k < 3; ++k)
+					t[k] = c.baseVertex + MeshOptimizer::Detail::ReadIndex(chain.indices.data(), mesh.indexSize, i + k);
+				triangles.push_back(t);
+			}
+		}
+		return triangles;
+	};
+	auto validate = [&](const MeshSimplifier::LodChain& chain, const MeshOptimizer::Result& sphere, uint32_t res, double& baseDeviation, double& worstDeviation) -> bool
+	{
+		const auto* vertices = reinterpret_cast<const MeshVertex*>(sphere.vertices.data());
+		// Same cell for the seam and pole copies of a position
+		auto cell = [&](uint32_t v)
+		{
+			const auto* p = vertices[v].position;
+			return array<int64_t, 3>{ llround(p[0] * 1e5), llround(p[1] * 1e5), llround(p[2] * 1e5) };
+		};
+		for (size_t l = 0; l < chain.lods.size(); ++l)
+		{
+			const auto& lod = chain.lods[l];
+			if (l > 0 && (lod.mesh.indexCount >= chain.lods[l - 1].mesh.indexCount || lod.error < chain.lods[l - 1].error))
+			{
+				cout << "Mismatch: LOD " << l << " does not shrink at " << res << endl;
+				return false;
+			}
+			double deviation = 0.0;
+			vector<pair<array<int64_t, 3>, array<int64_t, 3>>> edges;
+			for (const auto& t : readTriangles(chain, lod.mesh))
+			{
+				const auto* p0 = vertices[t[0]].position;
+				const auto* p1 = vertices[t[1]].position;
+				const auto* p2 = vertices[t[2]].position;
+				// Centroid and edge midpoints against the unit sphere
+				const double samples[4][3] = {
+					{ (p0[0] + p1[0] + p2[0]) / 3.0, (p0[1] + p1[1] + p2[1]) / 3.0, (p0[2] + p1[2] + p2[2]) / 3.0 },
+					{ (p0[0] + p1[0]) / 2.0, (p0[1] + p1[1]) / 2.0, (p0[2] + p1[2]) / 2.0 },
+					{ (p1[0] + p2[0]) / 2.0, (p1[1] + p2[1]) / 2.0, (p1[2] + p2[2]) / 2.0 },
+					{ (p2[0] + p0[0]) / 2.0, (p2[1] + p0[1]) / 2.0, (p2[2] + p0[2]) / 2.0 },
+				};
+				for (const auto& q : samples)
+					deviation = max(deviation, abs(1.0 - sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2])));
+				const array<int64_t, 3> c[3] = { cell(t[0]), cell(t[1]), cell(t[2]) };
+				if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0])
+					continue;
+				const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+				const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+				const double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				const double area = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+				if (area > 1e-9 && n[0] * samples[0][0] + n[1] * samples[0][1] + n[2] * samples[0][2] <= 0.0)
+				{
+					cout << "Mismatch: LOD " << l << " has an inward triangle at " << res << endl;
+					return false;
+				}
+				for (int e = 0; e < 3; ++e)
+					edges.push_back({ c[e], c[(e + 1) % 3] });
+			}
+			// Closed surface: every directed edge has exactly one reverse partner
+			sort(edges.begin(), edges.end());
+			for (size_t k = 0; k < edges.size(); ++k)
+			{
+				const auto reverse = equal_range(edges.begin(), edges.end(), make_pair(edges[k].second, edges[k].first));
+				if (reverse.second - reverse.first != 1 || (k > 0 && edges[k - 1] == edges[k]))
+				{
+					cout << "Mismatch: LOD " << l << " is not closed at " << res << endl;
+					return false;
+				}
+			}
+			if (l == 0)
+				baseDeviation = deviation;
+			// The quadric error is an area weighted mean, the worst sample may sit a few times above it
+			else if (deviation > baseDeviation + 4.0 * lod.error + 1e-4)
+			{
+				cout << "Mismatch: LOD " << l << " deviates " << deviation << " with error " << lod.error << " at " << res << endl;
+				return false;
+			}
+			worstDeviation = deviation;
+		}
+		return true;
+	};
+
+	// Flat grid, only the interior may collapse and the error stays zero
+	{
+		const uint32_t n = 64;
+		const auto size = GridSize(n, n);
+		vector<MeshVertex> vertices(size.vertexCount);
+		vector<uint32_t> indices(size.indexCount), simplified(size.indexCount);
+		WriteGridVertices(vertices.data(), layout, n, n, 1.0f, 0.0f);
+		WriteGridIndices(indices.data(), n, n);
+		float error = 1.0f;
+		const auto count = MeshSimplifier::Simplify(simplified.data(), indices.data(), indices.size(), vertices.data(), vertices.size(), layout,
+			0, FLT_MAX, MeshSimplifier::DefaultAttributeWeight, &error);
+		vector<uint8_t> used(vertices.size());
+		for (size_t i = 0; i < count; ++i)
+			used[simplified[i]] = 1;
+		for (uint32_t r = 0; r <= n; ++r)
+		{
+			for (uint32_t c = 0; c <= n; ++c)
+			{
+				if ((r == 0 || r == n || c == 0 || c == n) && !used[r * (n + 1) + c])
+				{
+					cout << "Mismatch: grid border vertex " << r << "," << c << " was collapsed" << endl;
+					return 1;
+				}
+			}
+		}
+		if (error != 0.0f || count >= indices.size() / 4)
+		{
+			cout << "Mismatch: grid simplified to " << count / 3 << " triangles with error " << error << endl;
+			return 1;
+		}
+	}
+
+	vector<uint32_t> resolutions = { 12, 64, 256, 708 };
+	if (opt.meshRes)
+		resolutions = { opt.meshRes };
+	vector<Json> meshes;
+	for (auto res : resolutions)
+	{
+		const auto sphere = MeshOptimizer::OptimizeSphere<MeshVertex>(res, res);
+		auto build = [&]() { return MeshSimplifier::BuildLodChain(sphere.mesh, sphere.vertices.data(), sphere.indices.data(), layout, 6); };
+		const auto t0 = chrono::steady_clock::now();
+		auto chain = build();
+		for (uint32_t i = 1; i < opt.frames; ++i)
+			chain = build();
+		const double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		double baseDeviation = 0.0, worstDeviation = 0.0;
+		if (!validate(chain, sphere, res, baseDeviation, worstDeviation))
+			return 1;
+		if (build().indices != chain.indices)
+		{
+			cout << "Mismatch: LOD chain is not deterministic at " << res << endl;
+			return 1;
+		}
+		vector<Json> lods;
+		for (const auto& lod : chain.lods)
+			lods.push_back(Json().Add("triangles", lod.mesh.indexCount / 3).Add("error", lod.error));
+		meshes.push_back(Json()
+			.Add("slices", res)
+			.Add("stacks", res)
+			.Add("lods", lods)
+			.Add("base_deviation", baseDeviation)
+			.Add("last_deviation", worstDeviation)
+			.Add("ms_per_chain", seconds * 1e3 / opt.frames)
+			.Add("mtriangles_per_sec", double(sphere.mesh.indexCount / 3) * opt.frames / seconds / 1e6));
+	}
+	const auto json = Json()
+		.Add("mode", "simplify")
+		.Add("attribute_weight", MeshSimplifier::DefaultAttributeWeight)
+		.Add("meshes", meshes);
+	return WriteJson(opt, json) ? 0 : 1;
+}
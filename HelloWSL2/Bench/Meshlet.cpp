@@ -0,0 +1,173 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include "Bench.h"
+#include "MeshOptimizer.h"
+#include "Meshlet.h"
+
+using namespace std;
+
+// Every triangle must land in exactly one meshlet within the limits, the spheres must hold their vertices
+// and a cone may only cull a meshlet when all of its triangles face away from the camera
+int RunMeshletBenchmark(const Options& opt)
+{
+	using namespace ProceduralMesh;
+	struct MeshVertex
+	{
+		float position[3];
+		float normal[3];
+	};
+	using Triangle = array<uint32_t, 3>;
+	auto canonical = [](Triangle t)
+	{
+		// Rotate the smallest index first, keeps the winding
+		while (t[0] > t[1] || t[0] > t[2])
+			t = { t[1], t[2], t[0] };
+		return t;
+	};
+	auto validate = [&](const MeshletBuilder::Result& result, const MeshOptimizer::Result& sphere, uint32_t res) -> bool
+	{
+		const auto* vertices = reinterpret_cast<const MeshVertex*>(sphere.vertices.data());
+		vector<Triangle> expected, actual;
+		for (const auto& c : sphere.mesh.chunks)
+		{
+			for (uint32_t i = c.firstIndex; i < c.firstIndex + c.indexCount; i += 3)
+			{
+				Triangle t;
+				for (int k = 0; k < 3; ++k)
+					t[k] = c.baseVertex + MeshOptimizer::Detail::ReadIndex(sphere.indices.data(), sphere.mesh.indexSize, i + k);
+				expected.push_back(canonical(t));
+			}
+		}
+		if (result.bounds.size() != result.meshlets.size())
+		{
+			cout << "Mismatch: " << result.bounds.size() << " bounds for " << result.meshlets.size() << " meshlets at " << res << endl;
+			return false;
+		}
+		mt19937 rng(res);
+		uniform_real_distribution<float> uniform(-4.0f, 4.0f);
+		vector<array<float, 3>> cameras(64);
+		for (auto& camera : cameras)
+			camera = { uniform(rng), uniform(rng), uniform(rng) };
+		for (size_t m = 0; m < result.meshlets.size(); ++m)
+		{
+			const auto& meshlet = result.meshlets[m];
+			const auto& bounds = result.bounds[m];
+			if (meshlet.vertexCount == 0 || meshlet.vertexCount > MeshletBuilder::MaxVertices ||
+				meshlet.primitiveCount == 0 || meshlet.primitiveCount > MeshletBuilder::MaxPrimitives)
+			{
+				cout << "Mismatch: meshlet " << m << " has " << meshlet.vertexCount << " vertices and " << meshlet.primitiveCount << " triangles" << endl;
+				return false;
+			}
+			const auto* globals = result.vertexIndices.data() + meshlet.vertexOffset;
+			for (uint32_t v = 0; v < meshlet.vertexCount; ++v)
+			{
+				const auto* p = vertices[globals[v]].position;
+				const float d[3] = { p[0] - bounds.center[0], p[1] - bounds.center[1], p[2] - bounds.center[2] };
+				if (sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) > bounds.radius)
+				{
+					cout << "Mismatch: meshlet " << m << " sphere misses vertex " << globals[v] << endl;
+					return false;
+				}
+			}
+			for (uint32_t p = 0; p < meshlet.primitiveCount; ++p)
+			{
+				uint32_t local[3];
+				MeshletBuilder::UnpackPrimitive(result.primitives[meshlet.primitiveOffset + p], local);
+				if (local[0] >= meshlet.vertexCount || local[1] >= meshlet.vertexCount || local[2] >= meshlet.vertexCount)
+				{
+					cout << "Mismatch: meshlet " << m << " primitive " << p << " is out of range" << endl;
+					return false;
+				}
+				actual.push_back(canonical({ globals[local[0]], globals[local[1]], globals[local[2]] }));
+			}
+			if (bounds.coneCutoff >= 1.0f)
+				continue;
+			for (const auto& camera : cameras)
+			{
+				if (!MeshletBuilder::ConeCulled(bounds, camera.data()))
+					continue;
+				for (uint32_t p = 0; p < meshlet.primitiveCount; ++p)
+				{
+					uint32_t local[3];
+					MeshletBuilder::UnpackPrimitive(result.primitives[meshlet.primitiveOffset + p], local);
+					const auto* p0 = vertices[globals[local[0]]].position;
+					const auto* p1 = vertices[globals[local[1]]].position;
+					const auto* p2 = vertices[globals[local[2]]].position;
+					const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+					const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+					const double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+					const double facing = n[0] * (camera[0] - p0[0]) + n[1] * (camera[1] - p0[1]) + n[2] * (camera[2] - p0[2]);
+					if (facing > 1e-6)
+					{
+						cout << "Mismatch: meshlet " << m << " cone culls a visible triangle" << endl;
+						return false;
+					}
+				}
+			}
+		}
+		sort(expected.begin(), expected.end());
+		sort(actual.begin(), actual.end());
+		if (expected != actual)
+		{
+			cout << "Mismatch: meshlet triangles differ from the mesh at " << res << endl;
+			return false;
+		}
+		return true;
+	};
+
+	struct Case
+	{
+		uint32_t res;
+		IndexPolicy policy;
+	};
+	vector<Case> cases = { { 8, IndexPolicy::Auto }, { 12, IndexPolicy::Auto }, { 64, IndexPolicy::Auto }, { 256, IndexPolicy::Auto }, { 512, IndexPolicy::Chunked16 } };
+	if (opt.meshRes)
+		cases = { { opt.meshRes, IndexPolicy::Auto } };
+	const auto layout = LayoutOf<MeshVertex>();
+	const float camera[3] = { 0.0f, 4.0f, -4.0f };
+	vector<Json> meshes;
+	for (const auto& c : cases)
+	{
+		const auto sphere = MeshOptimizer::OptimizeSphere<MeshVertex>(c.res, c.res, c.policy);
+		auto build = [&]() { return MeshletBuilder::Build(sphere.mesh, sphere.vertices.data(), sphere.indices.data(), layout); };
+		const auto result = build();
+		if (!validate(result, sphere, c.res))
+			return 1;
+		if (build().Fingerprint() != result.Fingerprint())
+		{
+			cout << "Mismatch: meshlets are not deterministic at " << c.res << endl;
+			return 1;
+		}
+
+		const auto t0 = chrono::steady_clock::now();
+		for (uint32_t i = 0; i < opt.frames; ++i)
+			build();
+		const double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		const size_t triangleCount = result.primitives.size();
+		size_t coneCulled = 0;
+		for (const auto& b : result.bounds)
+			coneCulled += MeshletBuilder::ConeCulled(b, camera) ? 1 : 0;
+		const double count = double(result.meshlets.size());
+		meshes.push_back(Json()
+			.Add("slices", c.res)
+			.Add("stacks", c.res)
+			.Add("triangles", triangleCount)
+			.Add("meshlets", result.meshlets.size())
+			.Add("vertices_per_meshlet", result.vertexIndices.size() / count)
+			.Add("triangles_per_meshlet", triangleCount / count)
+			.Add("cone_culled", coneCulled / count)
+			.Add("ms_per_mesh", seconds * 1e3 / opt.frames)
+			.Add("mtriangles_per_sec", double(triangleCount) * opt.frames / seconds / 1e6));
+	}
+	const auto json = Json()
+		.Add("mode", "meshlet")
+		.Add("max_vertices", MeshletBuilder::MaxVertices)
+		.Add("max_primitives", MeshletBuilder::MaxPrimitives)
+		.Add("meshes", meshes);
+	return WriteJson(opt, json) ? 0 : 1;
+}
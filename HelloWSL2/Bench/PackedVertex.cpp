@@ -0,0 +1,92 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include "Bench.h"
+#include "ProceduralMesh.h"
+#include "PackedVertex.h"
+
+using namespace std;
+
+// Half conversion must round trip every half and agree with the SIMD path on odd floats,
+// the packed sphere has to stay within half and 16-bit octahedral precision
+int RunPackBenchmark(const Options& opt)
+{
+	using namespace PackedVertex;
+	for (uint32_t h = 0; h < 0x10000; ++h)
+	{
+		const bool nan = (h & 0x7C00) == 0x7C00 && (h & 0x3FF);
+		if (!nan && FloatToHalf(HalfToFloat(static_cast<uint16_t>(h))) != h)
+		{
+			cout << "Mismatch: half " << hex << h << dec << " does not round trip" << endl;
+			return 1;
+		}
+	}
+
+	struct MeshVertex
+	{
+		float position[3];
+		float normal[3];
+	};
+	const auto layout = ProceduralMesh::LayoutOf<MeshVertex>();
+	// Random bits cover subnormals, infinities and NaNs, random directions cover every octant
+	mt19937 rng(12345);
+	vector<MeshVertex> randomVertices(100003);
+	for (auto& v : randomVertices)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			const uint32_t bits = rng();
+			memcpy(&v.position[c], &bits, sizeof(float));
+			v.normal[c] = uniform_real_distribution<float>(-1.0f, 1.0f)(rng);
+		}
+	}
+	vector<Vertex> scalar(randomVertices.size()), simd(randomVertices.size());
+	Encode(scalar.data(), randomVertices.data(), layout, randomVertices.size(), false);
+	Encode(simd.data(), randomVertices.data(), layout, randomVertices.size(), true);
+	if (memcmp(scalar.data(), simd.data(), sizeof(Vertex) * scalar.size()))
+	{
+		cout << "Mismatch: " << SimdName() << " encoder differs from scalar" << endl;
+		return 1;
+	}
+
+	const uint32_t res = opt.meshRes ? opt.meshRes : 1024;
+	const auto size = ProceduralMesh::SphereSize(res, res);
+	vector<MeshVertex> vertices(size.vertexCount);
+	ProceduralMesh::WriteSphereVertices(vertices.data(), layout, res, res);
+	vector<Vertex> packed(size.vertexCount);
+	vector<Json> encoders;
+	for (bool useSimd : { false, true })
+	{
+		Encode(packed.data(), vertices.data(), layout, vertices.size(), useSimd);
+		const auto t0 = chrono::steady_clock::now();
+		for (uint32_t i = 0; i < opt.frames; ++i)
+			Encode(packed.data(), vertices.data(), layout, vertices.size(), useSimd);
+		const double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		encoders.push_back(Json()
+			.Add("isa", useSimd ? SimdName() : "scalar")
+			.Add("ms_per_mesh", seconds * 1e3 / opt.frames)
+			.Add("mvertices_per_sec", double(size.vertexCount) * opt.frames / seconds / 1e6));
+	}
+	// Half keeps 11 significant bits, so half an ulp below 1 is 2^-12
+	const auto error = MeasureError(packed.data(), vertices.data(), layout, vertices.size());
+	const float positionBound = 1.0f / 4096.0f;
+	const float normalBound = 0.01f;
+	if (error.maxPositionError > positionBound || error.maxNormalDegrees > normalBound)
+	{
+		cout << "Mismatch: position error " << error.maxPositionError << ", normal error " << error.maxNormalDegrees << " degrees" << endl;
+		return 1;
+	}
+	const auto json = Json()
+		.Add("mode", "pack")
+		.Add("slices", res)
+		.Add("stacks", res)
+		.Add("vertices", size.vertexCount)
+		.Add("bytes_before", sizeof(MeshVertex) * size.vertexCount)
+		.Add("bytes_after", sizeof(Vertex) * size.vertexCount)
+		.Add("encoders", encoders)
+		.Add("max_position_error", error.maxPositionError)
+		.Add("max_normal_degrees", error.maxNormalDegrees);
+	return WriteJson(opt, json) ? 0 : 1;
+}
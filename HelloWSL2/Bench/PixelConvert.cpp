@@ -0,0 +1,84 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <wsl/wrladapter.h>
+#include <directx/d3d12.h>
+#include "Bench.h"
+#include "../PixelConvert.h"
+
+using namespace std;
+
+// Check every kernel bit-exact against the scalar path, then measure throughput
+int RunConvertBenchmark(const Options& opt)
+{
+	using namespace PixelConvert;
+	const Format formats[] = { Format::RGB, Format::BGR, Format::RGBA };
+	const char* formatNames[] = { "rgb", "bgr", "rgba" };
+	const Isa isas[] = { Isa::Scalar, Isa::SSSE3 };
+	mt19937 rng(12345);
+
+	// Odd widths exercise every tail path
+	const uint32_t checkWidths[] = { 1, 3, 15, 16, 17, 33, 35, 36, 63, 64, 65, 127, 255, 1000, opt.width };
+	for (auto width : checkWidths)
+	{
+		const uint32_t height = 4;
+		const uint32_t pitch = Align(4 * width, (uint32_t)D3D12_TEXTURE_DATA_PITCH_ALIGNMENT);
+		vector<uint8_t> src(static_cast<size_t>(pitch) * height);
+		for (auto& b : src)
+			b = static_cast<uint8_t>(rng());
+		for (auto format : formats)
+		{
+			// Guard bytes catch overruns past the packed image
+			const size_t size = static_cast<size_t>(BytesPerPixel(format)) * width * height;
+			vector<uint8_t> ref(size + 64, 0xCD), dst;
+			Convert(ref.data(), src.data(), pitch, width, height, format, Isa::Scalar);
+			for (auto isa : isas)
+			{
+				if (!IsSupported(isa))
+					continue;
+				dst.assign(ref.size(), 0xCD);
+				Convert(dst.data(), src.data(), pitch, width, height, format, isa);
+				if (dst != ref)
+				{
+					cout << "Mismatch: " << IsaName(isa) << " " << formatNames[(int)format] << " width " << width << endl;
+					return 1;
+				}
+			}
+		}
+	}
+
+	const uint32_t pitch = Align(4 * opt.width, (uint32_t)D3D12_TEXTURE_DATA_PITCH_ALIGNMENT);
+	vector<uint8_t> src(static_cast<size_t>(pitch) * opt.height);
+	for (auto& b : src)
+		b = static_cast<uint8_t>(rng());
+	vector<uint8_t> dst(4ull * opt.width * opt.height);
+	vector<Json> kernels;
+	for (auto format : formats)
+	{
+		for (auto isa : isas)
+		{
+			if (!IsSupported(isa))
+				continue;
+			Convert(dst.data(), src.data(), pitch, opt.width, opt.height, format, isa);
+			const auto t0 = chrono::steady_clock::now();
+			for (uint32_t i = 0; i < opt.frames; ++i)
+				Convert(dst.data(), src.data(), pitch, opt.width, opt.height, format, isa);
+			const double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+			const double bytes = 4.0 * opt.width * opt.height * opt.frames;
+			kernels.push_back(Json()
+				.Add("format", formatNames[(int)format])
+				.Add("isa", IsaName(isa))
+				.Add("ms_per_frame", seconds * 1e3 / opt.frames)
+				.Add("mb_per_sec", bytes / seconds / 1e6));
+		}
+	}
+	const auto json = Json()
+		.Add("mode", "convert")
+		.Add("width", opt.width)
+		.Add("height", opt.height)
+		.Add("iterations", opt.frames)
+		.Add("best", IsaName(BestIsa()))
+		.Add("kernels", kernels);
+	return WriteJson(opt, json) ? 0 : 1;
+}
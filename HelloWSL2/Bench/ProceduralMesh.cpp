@@ -0,0 +1,237 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <wsl/wrladapter.h>
+#include <directx/d3d12.h>
+#include "Bench.h"
+#include "ProceduralMesh.h"
+#include "../NullDevice.h"
+
+using namespace std;
+using namespace Microsoft::WRL;
+
+// Sphere with res x res quads, written into a buffer standing in for a mapped upload heap
+int RunMeshBenchmark(const Options& opt)
+{
+	struct MeshVertex
+	{
+		float position[3];
+		float normal[3];
+	};
+	const auto layout = ProceduralMesh::LayoutOf<MeshVertex>();
+	vector<uint32_t> resolutions = { 1024, 2048 };
+	if (opt.meshRes)
+		resolutions = { opt.meshRes };
+
+	vector<Json> meshes;
+	for (auto res : resolutions)
+	{
+		const auto size = ProceduralMesh::SphereSize(res, res);
+		vector<MeshVertex> mapped(size.vertexCount), ref;
+		vector<uint32_t> mappedIndices(size.indexCount), refIndices;
+
+		// The loop the samples used to carry: sinf/cosf per vertex, push_back, then memcpy
+		auto naive = [&]()
+		{
+			ref.clear();
+			refIndices.clear();
+			ref.reserve(size.vertexCount);
+			refIndices.reserve(size.indexCount);
+			for (uint32_t y = 0; y < res + 1; ++y)
+			{
+				for (uint32_t x = 0; x < res + 1; ++x)
+				{
+					float theta = 2 * 3.14159265f * x / res;
+					float phi = 3.14159265f * y / res;
+					MeshVertex ve = { sinf(phi) * sinf(theta), cosf(phi), sinf(phi) * cosf(theta), 0, 0, 0 };
+					memcpy(ve.normal, ve.position, sizeof(ve.normal));
+					ref.push_back(ve);
+				}
+			}
+			for (uint32_t y = 0; y < res; ++y)
+			{
+				for (uint32_t x = 0; x < res; ++x)
+				{
+					uint32_t b = y * (res + 1) + x;
+					uint32_t s = res + 1;
+					for (auto i : { b, b + s, b + 1, b + s, b + s + 1, b + 1 })
+						refIndices.push_back(i);
+				}
+			}
+			memcpy(mapped.data(), ref.data(), sizeof(MeshVertex) * ref.size());
+			memcpy(mappedIndices.data(), refIndices.data(), sizeof(uint32_t) * refIndices.size());
+		};
+		// Rings are rebuilt every iteration so their cost is included
+		auto generate = [&]()
+		{
+			ProceduralMesh::SphereRings rings;
+			rings.Build(res, res);
+			ProceduralMesh::WriteSphereVertices(mapped.data(), layout, rings);
+			ProceduralMesh::WriteSphereIndices(mappedIndices.data(), res, res);
+		};
+
+		struct Variant
+		{
+			const char* name;
+			function<void()> run;
+		};
+		const Variant variants[] = {
+			{ "naive", naive },
+			{ "rings", generate },
+		};
+		vector<Json> results;
+		double naiveSeconds = 0.0;
+		for (const auto& variant : variants)
+		{
+			variant.run();
+			if (&variant != &variants[0])
+			{
+				// ref still holds the naive result from the first variant
+				float maxError = 0.0f;
+				for (size_t i = 0; i < ref.size(); ++i)
+				{
+					for (int c = 0; c < 3; ++c)
+					{
+						maxError = max(maxError, fabsf(mapped[i].position[c] - ref[i].position[c]));
+						maxError = max(maxError, fabsf(mapped[i].normal[c] - ref[i].normal[c]));
+					}
+				}
+				if (maxError > 1e-5f || mappedIndices != refIndices)
+				{
+					cout << "Mismatch: " << variant.name << " " << res << " max error " << maxError << endl;
+					return 1;
+				}
+			}
+			const auto t0 = chrono::steady_clock::now();
+			for (uint32_t i = 0; i < opt.frames; ++i)
+				variant.run();
+			const double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+			if (&variant == &variants[0])
+				naiveSeconds = seconds;
+			results.push_back(Json()
+				.Add("name", variant.name)
+				.Add("ms_per_mesh", seconds * 1e3 / opt.frames)
+				.Add("mvertices_per_sec", double(size.vertexCount) * opt.frames / seconds / 1e6)
+				.Add("speedup", naiveSeconds / seconds));
+		}
+		meshes.push_back(Json()
+			.Add("slices", res)
+			.Add("stacks", res)
+			.Add("vertices", size.vertexCount)
+			.Add("indices", size.indexCount)
+			.Add("variants", results));
+	}
+	const auto json = Json()
+		.Add("mode", "mesh")
+		.Add("iterations", opt.frames)
+		.Add("meshes", meshes);
+	return WriteJson(opt, json) ? 0 : 1;
+}
+
+// Every layout must reproduce the 32-bit index list once base vertices are added back,
+// and the draws recorded on the null device must cover it chunk by chunk
+int RunMeshStress(const Options& opt)
+{
+	using namespace ProceduralMesh;
+	struct MeshVertex
+	{
+		float position[3];
+		float normal[3];
+	};
+	// 2 * 2237^2 = 10.0M triangles
+	const uint32_t res = opt.meshRes ? opt.meshRes : 2237;
+	const auto reference = PlanSphere(res, res, IndexPolicy::Index32);
+	vector<MeshVertex> vertices(reference.vertexCount);
+	vector<uint32_t> referenceIndices(reference.indexCount);
+	auto t0 = chrono::steady_clock::now();
+	WriteSphereVertices(vertices.data(), LayoutOf<MeshVertex>(), res, res);
+	const double vertexSeconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	WriteSphereIndices(referenceIndices.data(), reference);
+
+	ComPtr<ID3D12Device> device;
+	CHK(NullDevice::CreateDevice(IID_PPV_ARGS(&device)));
+	ComPtr<ID3D12CommandAllocator> cmdAlloc;
+	ComPtr<ID3D12GraphicsCommandList> cmdList;
+	CHK(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&cmdAlloc)));
+	CHK(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, cmdAlloc.Get(), nullptr, IID_PPV_ARGS(&cmdList)));
+	CHK(cmdList->Close());
+
+	const IndexPolicy policies[] = { IndexPolicy::Auto, IndexPolicy::Chunked16 };
+	const char* policyNames[] = { "auto", "index32", "chunked16" };
+	vector<Json> layouts;
+	for (auto policy : policies)
+	{
+		const auto mesh = PlanSphere(res, res, policy);
+		vector<uint8_t> indices(mesh.IndexBufferSize());
+		t0 = chrono::steady_clock::now();
+		WriteSphereIndices(indices.data(), mesh);
+		const double indexSeconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+		auto fail = [&](const char* what)
+		{
+			cout << "Mismatch: " << policyNames[(int)policy] << " " << what << endl;
+			return 1;
+		};
+		uint32_t nextIndex = 0;
+		for (const auto& c : mesh.chunks)
+		{
+			if (c.firstIndex != nextIndex || c.baseVertex + c.vertexCount > mesh.vertexCount)
+				return fail("chunk range");
+			if (mesh.indexSize == 2 && c.vertexCount > MaxIndex16Vertices)
+				return fail("chunk is not 16-bit addressable");
+			for (uint32_t i = c.firstIndex; i < c.firstIndex + c.indexCount; ++i)
+			{
+				uint32_t local = 0;
+				memcpy(&local, &indices[static_cast<size_t>(mesh.indexSize) * i], mesh.indexSize);
+				if (local >= c.vertexCount || c.baseVertex + local != referenceIndices[i])
+					return fail("index");
+			}
+			nextIndex += c.indexCount;
+		}
+		if (nextIndex != mesh.indexCount)
+			return fail("index count");
+
+		// The same calls the samples make in Draw()
+		CHK(cmdAlloc->Reset());
+		CHK(cmdList->Reset(cmdAlloc.Get(), nullptr));
+		D3D12_INDEX_BUFFER_VIEW ibView = {};
+		ibView.Format = IndexFormat(mesh);
+		ibView.SizeInBytes = static_cast<UINT>(mesh.IndexBufferSize());
+		cmdList->IASetIndexBuffer(&ibView);
+		DrawIndexed(cmdList.Get(), mesh);
+		CHK(cmdList->Close());
+		uint32_t draws = 0;
+		uint64_t drawnIndices = 0;
+		for (const auto& cmd : static_cast<NullDevice::GraphicsCommandList*>(cmdList.Get())->GetCommands())
+		{
+			if (cmd.op != NullDevice::Op::DrawIndexedInstanced)
+				continue;
+			const auto& c = mesh.chunks[draws++];
+			if (cmd.args[0] != c.indexCount || cmd.args[2] != c.firstIndex || static_cast<int64_t>(cmd.args[3]) != c.baseVertex)
+				return fail("draw arguments");
+			drawnIndices += cmd.args[0];
+		}
+		if (draws != mesh.chunks.size() || drawnIndices != mesh.indexCount)
+			return fail("draw count");
+
+		layouts.push_back(Json()
+			.Add("policy", policyNames[(int)policy])
+			.Add("index_bytes", mesh.indexSize)
+			.Add("index_buffer_mb", mesh.IndexBufferSize() / 1e6)
+			.Add("draws", draws)
+			.Add("index_ms", indexSeconds * 1e3));
+	}
+	const auto json = Json()
+		.Add("mode", "stress-mesh")
+		.Add("slices", res)
+		.Add("stacks", res)
+		.Add("vertices", reference.vertexCount)
+		.Add("triangles", reference.indexCount / 3)
+		.Add("vertex_ms", vertexSeconds * 1e3)
+		.Add("layouts", layouts);
+	return WriteJson(opt, json) ? 0 : 1;
+}
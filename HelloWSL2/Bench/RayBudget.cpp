@@ -0,0 +1,96 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include "Bench.h"
+#include "RayBudget.h"
+
+using namespace std;
+
+// Simulated GPU whose cost per ray changes twice, with timestamps arriving a few frames late
+int RunRayBudgetBenchmark(const Options& opt)
+{
+	const double targetMs = 2.0;
+	const uint32_t latency = 3; // Frames until a slot's timestamps are read back
+	const uint32_t phaseFrames = 200;
+	const double msPerRay[] = { 0.8, 2.5, 0.3 }; // Per ray per full-resolution pixel
+	RayBudget::Controller controller(targetMs);
+	const auto& ladder = controller.Ladder();
+	for (size_t i = 1; i < ladder.size(); ++i)
+	{
+		if (RayBudget::RaysPerPixel(ladder[i]) < RayBudget::RaysPerPixel(ladder[i - 1]))
+		{
+			cout << "Mismatch: ladder not sorted by rays per pixel at level " << i << endl;
+			return 1;
+		}
+	}
+	// A pinned divisor keeps every ray count of its own resolution
+	for (uint32_t divisor : { 1u, 2u, 4u })
+	{
+		if (RayBudget::DefaultLadder(divisor).size() != 4)
+		{
+			cout << "Mismatch: ladder pinned to 1/" << divisor << " has " << RayBudget::DefaultLadder(divisor).size() << " levels" << endl;
+			return 1;
+		}
+	}
+	mt19937 rng(7);
+	uniform_real_distribution<double> noise(0.95, 1.05);
+	vector<pair<uint32_t, double>> inFlight; // Level, ms
+	vector<Json> phases;
+	uint32_t level = controller.LevelIndex();
+	for (int phase = 0; phase < 3; ++phase)
+	{
+		// Richest level the true cost allows within the controller's headroom
+		uint32_t best = 0;
+		while (best + 1 < ladder.size() && 0.05 + msPerRay[phase] * RayBudget::RaysPerPixel(ladder[best + 1]) <= targetMs * RayBudget::Controller::Headroom)
+			best++;
+		uint32_t settledAt = phaseFrames, switches = 0, over = 0, overSettled = 0;
+		double settledMs = 0;
+		uint32_t settledFrames = 0;
+		for (uint32_t frame = 0; frame < phaseFrames; ++frame)
+		{
+			const double ms = (0.05 + msPerRay[phase] * RayBudget::RaysPerPixel(ladder[level])) * noise(rng);
+			inFlight.push_back({ level, ms });
+			over += ms > targetMs;
+			if (settledAt < phaseFrames)
+			{
+				overSettled += ms > targetMs * 1.05;
+				settledMs += ms;
+				settledFrames++;
+			}
+			if (inFlight.size() > latency)
+			{
+				const uint32_t next = controller.Update(inFlight.front().first, inFlight.front().second);
+				inFlight.erase(inFlight.begin());
+				switches += next != level;
+				level = next;
+			}
+			if (settledAt == phaseFrames && level + 1 >= best && level <= best)
+				settledAt = frame;
+		}
+		if (settledAt == phaseFrames || overSettled > settledFrames / 20 || level + 1 < best || level > best)
+		{
+			cout << "Mismatch: phase " << phase << " ended at level " << level << " of best " << best << " with "
+				<< overSettled << " of " << settledFrames << " settled frames over budget" << endl;
+			return 1;
+		}
+		const auto& l = ladder[level];
+		phases.push_back(Json()
+			.Add("ms_per_ray", msPerRay[phase])
+			.Add("settle_frames", settledAt)
+			.Add("level", level)
+			.Add("best", best)
+			.Add("divisor", l.divisor)
+			.Add("shadow_rays", l.shadowRays)
+			.Add("ao_rays", l.aoRays)
+			.Add("rays_per_pixel", RayBudget::RaysPerPixel(l))
+			.Add("ms", settledMs / settledFrames)
+			.Add("switches", switches)
+			.Add("frames_over", over));
+	}
+	const auto json = Json()
+		.Add("mode", "ray-budget")
+		.Add("target_ms", targetMs)
+		.Add("levels", ladder.size())
+		.Add("phases", phases);
+	return WriteJson(opt, json) ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include "Bench.h"
+#include "ShaderTable.h"
+
+using namespace std;
+
+// Per-instance hit records changing a few at a time, written incrementally into rotating copies like upload buffers
+int RunShaderTableBenchmark(const Options& opt)
+{
+	using ShaderTable::Kind;
+	const uint32_t geometries = 3;
+	const uint32_t hitRecords = opt.instances * geometries;
+	struct Args
+	{
+		uint32_t textureIndex;
+		uint32_t materialIndex;
+		uint64_t buffer; // A root descriptor, 8-byte aligned in the record
+	};
+	uint8_t ids[4][ShaderTable::IdentifierSize];
+	for (int i = 0; i < 4; ++i)
+		memset(ids[i], 0x10 * (i + 1), sizeof(ids[i]));
+	ShaderTable::Builder table;
+	table.Resize(Kind::RayGen, 1, 4);
+	table.Resize(Kind::Miss, 2);
+	table.Resize(Kind::HitGroup, hitRecords, sizeof(Args));
+	const uint32_t mode = 2;
+	table.Set(Kind::RayGen, 0, ids[0], &mode, sizeof(mode));
+	table.Set(Kind::Miss, 0, ids[1]);
+	table.Set(Kind::Miss, 1, ids[2]);
+	for (uint32_t r = 0; r < hitRecords; ++r)
+	{
+		const Args args = { r / geometries % 8, r % geometries, 0x1000ull * r };
+		table.Set(Kind::HitGroup, r, ids[3], &args, sizeof(args));
+	}
+
+	// Layout rules of D3D12
+	for (int k = 0; k < int(Kind::Count); ++k)
+	{
+		const auto& t = table.Get(Kind(k));
+		if (t.offset % ShaderTable::TableAlignment || t.stride % ShaderTable::RecordAlignment ||
+			t.stride < ShaderTable::IdentifierSize + t.argSize || t.offset + t.Size() > table.Size())
+		{
+			cout << "Mismatch: table " << k << " at " << t.offset << " with stride " << t.stride << endl;
+			return 1;
+		}
+	}
+	const auto& hits = table.Get(Kind::HitGroup);
+	for (uint32_t r = 0; r < hitRecords; r += 97)
+	{
+		const uint8_t* record = table.Data() + hits.offset + uint64_t(hits.stride) * r;
+		Args args;
+		memcpy(&args, record + ShaderTable::IdentifierSize, sizeof(args));
+		if (memcmp(record, ids[3], ShaderTable::IdentifierSize) || args.materialIndex != r % geometries || args.buffer != 0x1000ull * r)
+		{
+			cout << "Mismatch: hit record " << r << endl;
+			return 1;
+		}
+	}
+	bool threw = false;
+	try
+	{
+		const uint8_t tooLarge[sizeof(Args) + 4] = {};
+		table.SetArgs(Kind::HitGroup, 0, tooLarge, sizeof(tooLarge));
+	}
+	catch (const runtime_error&)
+	{
+		threw = true;
+	}
+	if (!threw)
+	{
+		cout << "Mismatch: oversized local root arguments were accepted" << endl;
+		return 1;
+	}
+
+	// Rotating copies stay equal to the builder while only changed records are written
+	const uint32_t copies = 3;
+	vector<vector<uint8_t>> buffers(copies, vector<uint8_t>(table.Size(), 0xcd));
+	vector<uint64_t> versions(copies, 0);
+	mt19937 rng(5);
+	uint64_t written = 0;
+	double writeMs = 0;
+	for (uint32_t frame = 0; frame < opt.frames; ++frame)
+	{
+		// A few instances switch texture, every 16th frame the mode switches every hit group
+		for (int i = 0; i < 16; ++i)
+		{
+			const uint32_t r = rng() % hitRecords;
+			const Args args = { uint32_t(rng() % 8), r % geometries, 0x1000ull * r };
+			table.SetArgs(Kind::HitGroup, r, &args, sizeof(args));
+		}
+		if (frame % 16 == 15)
+		{
+			for (uint32_t r = 0; r < hitRecords; ++r)
+				table.SetIdentifier(Kind::HitGroup, r, ids[frame / 16 % 2 ? 3 : 2]);
+		}
+		const uint32_t slot = frame % copies;
+		uint64_t bytes = 0;
+		const auto t0 = chrono::steady_clock::now();
+		versions[slot] = table.Write(buffers[slot].data(), versions[slot], &bytes);
+		writeMs += chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+		written += bytes;
+		if (memcmp(buffers[slot].data(), table.Data(), table.Size()))
+		{
+			cout << "Mismatch: incremental copy " << slot << " differs at frame " << frame << endl;
+			return 1;
+		}
+	}
+	const uint64_t full = table.Size() * opt.frames;
+	const auto json = Json()
+		.Add("mode", "sbt")
+		.Add("hit_records", hitRecords)
+		.Add("hit_stride", hits.stride)
+		.Add("size", table.Size())
+		.Add("frames", opt.frames)
+		.Add("bytes_written", written)
+		.Add("bytes_full", full)
+		.Add("write_ms", writeMs / opt.frames);
+	return WriteJson(opt, json) ? 0 : 1;
+}
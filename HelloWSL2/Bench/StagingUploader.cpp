@@ -0,0 +1,120 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <string>
+#include <wsl/wrladapter.h>
+#include <directx/d3d12.h>
+#include "Bench.h"
+#include "StagingUploader.h"
+#include "../NullDevice.h"
+
+using namespace std;
+using namespace Microsoft::WRL;
+
+// 10k 32x32 RGBA8 textures and three 4096x4096 ones through a 32MB ring on a null device copy queue, batched and with a wait per texture
+int RunUploadBenchmark(const Options& opt)
+{
+	const uint32_t smallCount = 10000, largeCount = 3;
+	const uint32_t smallSize = 32, largeSize = 4096;
+	const uint32_t textures = smallCount + largeCount;
+	vector<uint8_t> smallData(uint64_t(smallCount) * smallSize * smallSize * 4), largeData(uint64_t(largeSize) * largeSize * 4);
+	mt19937 rng(7);
+	for (auto& byte : smallData)
+		byte = uint8_t(rng());
+	for (auto& byte : largeData)
+		byte = uint8_t(rng());
+	auto size = [&](uint32_t t) { return t < smallCount ? smallSize : largeSize; };
+	auto data = [&](uint32_t t) { return t < smallCount ? smallData.data() + uint64_t(t) * smallSize * smallSize * 4 : largeData.data(); };
+	const double bytes = double(smallData.size()) + double(largeData.size()) * largeCount;
+	// Large textures come between the small ones, as a level would stream them
+	vector<uint32_t> order;
+	for (uint32_t t = 0; t < smallCount; ++t)
+	{
+		order.push_back(t);
+		if (t % (smallCount / largeCount) == smallCount / largeCount / 2)
+			order.push_back(smallCount + t / (smallCount / largeCount));
+	}
+
+	// The null device replays a batch when it is submitted, so a texture reads back complete exactly when its ticket is
+	string error;
+	auto run = [&](bool batched, double& seconds) {
+		ComPtr<ID3D12Device> device;
+		CHK(NullDevice::CreateDevice(IID_PPV_ARGS(&device)));
+		D3D12_COMMAND_QUEUE_DESC queueDesc = {};
+		queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+		ComPtr<ID3D12CommandQueue> queue;
+		CHK(device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&queue)));
+		D3D12_HEAP_PROPERTIES heapProp = {};
+		heapProp.Type = D3D12_HEAP_TYPE_DEFAULT;
+		D3D12_RESOURCE_DESC resDesc = {};
+		resDesc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+		resDesc.DepthOrArraySize = 1;
+		resDesc.MipLevels = 1;
+		resDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		resDesc.SampleDesc.Count = 1;
+		vector<ComPtr<ID3D12Resource>> dst(textures);
+		for (uint32_t t = 0; t < textures; ++t)
+		{
+			resDesc.Width = resDesc.Height = size(t);
+			CHK(device->CreateCommittedResource(&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc, D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&dst[t])));
+		}
+		vector<uint8_t> texels(largeData.size());
+		auto matches = [&](uint32_t t) {
+			const uint32_t pitch = size(t) * 4;
+			return SUCCEEDED(dst[t]->ReadFromSubresource(texels.data(), pitch, pitch * size(t), 0, nullptr)) &&
+				memcmp(texels.data(), data(t), uint64_t(pitch) * size(t)) == 0;
+		};
+
+		StagingUploader::Uploader uploader;
+		uploader.Create(device.Get(), queue.Get());
+		uint64_t waits = 0;
+		const auto t0 = chrono::steady_clock::now();
+		for (uint32_t t = 0; t < textures && error.empty(); ++t)
+		{
+			const uint32_t texture = order[t];
+			D3D12_SUBRESOURCE_DATA subresource = { data(texture), LONG_PTR(size(texture)) * 4, LONG_PTR(size(texture)) * size(texture) * 4 };
+			const auto ticket = uploader.UploadTexture(dst[texture].Get(), 0, 1, &subresource);
+			// A draw now and then needs a texture uploaded just before
+			if (!batched || t % 1000 == 999)
+			{
+				uploader.Wait(ticket);
+				waits++;
+				if (!uploader.IsComplete(ticket) || !matches(texture))
+					error = "texture " + to_string(texture) + " is not complete when its ticket is";
+			}
+		}
+		uploader.Wait(uploader.Submit());
+		seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		for (uint32_t t = 0; t < textures && error.empty(); ++t)
+		{
+			if (!matches(t))
+				error = "texture " + to_string(t) + " differs after the upload";
+		}
+		if (error.empty() && static_cast<NullDevice::Device*>(device.Get())->GetStats().errors != 0)
+			error = "the null device reported invalid copies";
+		return make_pair(uploader.Ranges().Submitted(), waits);
+	};
+	double batchedSeconds = 0, singleSeconds = 0;
+	const auto batched = run(true, batchedSeconds);
+	const auto single = error.empty() ? run(false, singleSeconds) : make_pair(uint64_t(0), uint64_t(0));
+	if (!error.empty())
+	{
+		cout << "Mismatch: " << error << endl;
+		return 1;
+	}
+
+	const auto json = Json()
+		.Add("mode", "upload")
+		.Add("textures", textures)
+		.Add("bytes", uint64_t(bytes))
+		.Add("batched_submits", batched.first)
+		.Add("batched_waits", batched.second)
+		.Add("batched_gb_per_second", bytes / batchedSeconds / 1e9)
+		.Add("single_submits", single.first)
+		.Add("single_waits", single.second)
+		.Add("single_gb_per_second", bytes / singleSeconds / 1e9);
+	return WriteJson(opt, json) ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <string>
+#include "Bench.h"
+#include "TransientAliasing.h"
+
+using namespace std;
+
+// Checks placements, heap limits and activations of a plan, returns an empty string when valid
+string CheckAliasingPlan(const vector<TransientAliasing::Resource>& resources, const TransientAliasing::Plan& plan, uint64_t maxHeapSize)
+{
+	using namespace TransientAliasing;
+	for (uint32_t r = 0; r < resources.size(); ++r)
+	{
+		const auto& p = plan.placements[r];
+		if (p.heap >= plan.heapSizes.size() || plan.heapClasses[p.heap] != resources[r].heapClass ||
+			p.offset % resources[r].alignment || p.offset + resources[r].size > plan.heapSizes[p.heap] ||
+			plan.heapAlignments[p.heap] < resources[r].alignment)
+			return "resource " + to_string(r) + " placed outside its heap or misaligned";
+		for (uint32_t o = r + 1; o < resources.size(); ++o)
+		{
+			if (LifetimesOverlap(resources[r], resources[o]) && MemoryOverlaps(resources[r], p, resources[o], plan.placements[o]))
+				return "resources " + to_string(r) + " and " + to_string(o) + " alive together in the same memory";
+		}
+	}
+	for (auto size : plan.heapSizes)
+	{
+		if (maxHeapSize && size > maxHeapSize)
+			return "heap of " + to_string(size) + " bytes over the limit";
+	}
+	vector<uint32_t> activated(resources.size(), 0);
+	uint32_t previousPass = 0;
+	for (const auto& a : plan.activations)
+	{
+		const auto& r = resources[a.resource];
+		if (a.pass != r.firstPass || a.pass < previousPass || a.init != r.init)
+			return "activation of " + to_string(a.resource) + " out of order";
+		previousPass = a.pass;
+		activated[a.resource]++;
+		if (a.before != None)
+		{
+			const auto& b = resources[a.before];
+			const auto& pb = plan.placements[a.before];
+			const auto& pr = plan.placements[a.resource];
+			if (b.lastPass >= r.firstPass || pb.heap != pr.heap || pb.offset > pr.offset || pb.offset + b.size < pr.offset + r.size)
+				return "aliasing barrier of " + to_string(a.resource) + " names " + to_string(a.before) + " which does not cover it";
+		}
+	}
+	for (uint32_t r = 0; r < resources.size(); ++r)
+	{
+		bool shares = false;
+		for (uint32_t o = 0; o < resources.size() && !shares; ++o)
+			shares = o != r && MemoryOverlaps(resources[r], plan.placements[r], resources[o], plan.placements[o]);
+		if (activated[r] != (shares ? 1u : 0u))
+			return "resource " + to_string(r) + " activated " + to_string(activated[r]) + " times";
+	}
+	return "";
+}
+
+// The four views of PlacedResource, then random frame graphs of render targets, depth buffers and buffers
+int RunAliasingBenchmark(const Options& opt)
+{
+	using namespace TransientAliasing;
+	vector<Resource> views;
+	for (uint32_t i = 0; i < 4; ++i)
+		views.push_back({ 5 * 65536, 65536, 0, i, i, Init::Clear }); // 320x180 RGBA8
+	for (uint32_t i = 0; i < 4; ++i)
+		views.push_back({ 4 * 65536, 65536, 0, i, i, Init::Clear }); // 320x180 D32
+	const auto viewPlan = PlanHeaps(views);
+	string error = CheckAliasingPlan(views, viewPlan, 0);
+	if (error.empty() && (viewPlan.PeakSize() != 9 * 65536 || viewPlan.activations.size() != 8 || viewPlan.activations[0].before != None ||
+		viewPlan.activations[2].before != 0 || viewPlan.activations[3].before != 4))
+		error = "the views of PlacedResource do not share one rt/ds pair of memory";
+	if (!error.empty())
+	{
+		cout << "Mismatch: " << error << endl;
+		return 1;
+	}
+
+	mt19937 rng(5);
+	const uint32_t passes = 64, count = 300;
+	// Full, half and quarter HD targets of common formats, some of them 4x MSAA
+	auto randomResource = [&]() {
+		Resource r = {};
+		const uint32_t scale = 1u << (rng() % 3);
+		const uint64_t bytesPerPixel = uint64_t(4) << (rng() % 3);
+		const bool msaa = rng() % 8 == 0;
+		r.heapClass = rng() % 3; // RT/DS textures, other textures, buffers
+		r.alignment = msaa && r.heapClass == 0 ? 4 << 20 : 65536;
+		r.size = AlignUp((1920 / scale) * (1080 / scale) * bytesPerPixel * (msaa ? 4 : 1), r.alignment);
+		if (r.heapClass == 2)
+			r.size = AlignUp(1024 + rng() % (8 << 20), 65536);
+		r.firstPass = rng() % passes;
+		r.lastPass = min(passes - 1, r.firstPass + uint32_t(rng() % 4 ? rng() % 4 : rng() % 24));
+		r.init = rng() % 2 ? Init::Clear : Init::Discard;
+		return r;
+	};
+	double ratio = 0, seconds = 0;
+	uint64_t peak = 0, unaliased = 0, barriers = 0, namedBarriers = 0, heaps = 0, spilledHeaps = 0;
+	const uint64_t maxHeapSize = 256ull << 20;
+	for (uint32_t frame = 0; frame < opt.frames; ++frame)
+	{
+		vector<Resource> resources(count);
+		for (auto& r : resources)
+			r = randomResource();
+		const auto t0 = chrono::steady_clock::now();
+		const auto plan = PlanHeaps(resources);
+		seconds += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		const auto limited = PlanHeaps(resources, maxHeapSize);
+		error = CheckAliasingPlan(resources, plan, 0);
+		if (error.empty())
+			error = CheckAliasingPlan(resources, limited, maxHeapSize);
+		if (error.empty() && (plan.PeakSize() > plan.unaliasedSize || plan.heapSizes.size() > 3))
+			error = "aliasing took more memory than no aliasing";
+		if (!error.empty())
+		{
+			cout << "Mismatch: frame graph " << frame << ": " << error << endl;
+			return 1;
+		}
+		peak += plan.PeakSize();
+		unaliased += plan.unaliasedSize;
+		ratio += double(plan.PeakSize()) / plan.unaliasedSize;
+		barriers += plan.activations.size();
+		for (const auto& a : plan.activations)
+			namedBarriers += a.before != None;
+		heaps += plan.heapSizes.size();
+		spilledHeaps += limited.heapSizes.size();
+	}
+	const double frames = opt.frames;
+	const auto json = Json()
+		.Add("mode", "aliasing")
+		.Add("resources", count)
+		.Add("passes", passes)
+		.Add("frames", opt.frames)
+		.Add("views_peak", viewPlan.PeakSize())
+		.Add("views_unaliased", viewPlan.unaliasedSize)
+		.Add("peak_bytes", peak / opt.frames)
+		.Add("unaliased_bytes", unaliased / opt.frames)
+		.Add("peak_ratio", ratio / frames)
+		.Add("barriers", barriers / frames)
+		.Add("named_barriers", namedBarriers / frames)
+		.Add("heaps", heaps / frames)
+		.Add("heaps_limited", spilledHeaps / frames)
+		.Add("plan_ms", seconds / frames * 1e3);
+	return WriteJson(opt, json) ? 0 : 1;
+}
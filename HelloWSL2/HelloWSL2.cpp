@@ -2,11 +2,22 @@
 #include <iostream>
 #include <vector>
 #include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <cstdio>
 #define INITGUID
 #include <wsl/wrladapter.h>
 #include <directx/dxcore.h>
 #include <directx/d3d12.h>
 #include <dxguids/dxguids.h>
+#include "PixelConvert.h"
+#include "ImageWriter.h"
+#include "NullDevice.h"
 
 using namespace std;
 using namespace Microsoft::WRL;
@@ -17,52 +28,203 @@ using namespace Microsoft::WRL;
 
 constexpr uint32_t WIDTH = 256;
 constexpr uint32_t HEIGHT = 256;
+constexpr uint32_t MAX_RING = 16;
 
 auto Align(auto val, auto align)
 {
 	return ((val + align - 1) & ~(align - 1));
 }
 
+// Command line options
+// No option renders a single frame and writes image.ppm, as before
+// --bench renders many frames through a ring of render targets and reports JSON
+// --output writes every frame as a numbered image from background writer threads
+// --format selects the image encoder
+// --null runs the same flow on the recording null device, no GPU is needed
+struct Options
+{
+	uint32_t width = WIDTH;
+	uint32_t height = HEIGHT;
+	uint32_t frames = 1;
+	uint32_t ring = 1;
+	bool bench = false;
+	PixelConvert::Isa isa = PixelConvert::Isa::Auto;
+	string jsonPath;
+	string outputPrefix;
+	uint32_t writers = 2;
+	bool directIO = true;
+	ImageEncoder::Codec codec = ImageEncoder::Codec::PPM;
+	uint32_t encodeThreads = 1;
+	bool nullDevice = false;
+};
+
+Options ParseOptions(int argc, char** argv)
+{
+	Options opt;
+	bool framesSet = false, ringSet = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		auto hasValue = [&]() { return i + 1 < argc; };
+		if (!strcmp(argv[i], "--bench"))
+			opt.bench = true;
+		else if (!strcmp(argv[i], "--format") && hasValue())
+		{
+			string format = argv[++i];
+			if (format == "ppm")
+				opt.codec = ImageEncoder::Codec::PPM;
+			else if (format == "qoi")
+				opt.codec = ImageEncoder::Codec::QOI;
+			else if (format == "png")
+				opt.codec = ImageEncoder::Codec::PNG;
+			else if (format == "png-store")
+				opt.codec = ImageEncoder::Codec::PNGStore;
+			else
+				throw runtime_error("Unknown image format.");
+		}
+		else if (!strcmp(argv[i], "--encode-threads") && hasValue())
+			opt.encodeThreads = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "--isa") && hasValue())
+		{
+			string isa = argv[++i];
+			if (isa == "scalar")
+				opt.isa = PixelConvert::Isa::Scalar;
+			else if (isa == "ssse3")
+				opt.isa = PixelConvert::Isa::SSSE3;
+			else
+				throw runtime_error("Unknown ISA.");
+		}
+		else if (!strcmp(argv[i], "--frames") && hasValue())
+			opt.frames = stoul(argv[++i]), framesSet = true;
+		else if (!strcmp(argv[i], "--ring") && hasValue())
+			opt.ring = stoul(argv[++i]), ringSet = true;
+		else if (!strcmp(argv[i], "--width") && hasValue())
+			opt.width = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "--height") && hasValue())
+			opt.height = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "--json") && hasValue())
+			opt.jsonPath = argv[++i];
+		else if (!strcmp(argv[i], "--output") && hasValue())
+			opt.outputPrefix = argv[++i];
+		else if (!strcmp(argv[i], "--writers") && hasValue())
+			opt.writers = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "--no-direct"))
+			opt.directIO = false;
+		else if (!strcmp(argv[i], "--null"))
+			opt.nullDevice = true;
+		else
+		{
+			cout << "Usage: " << argv[0] << " [--bench] [--frames N] [--ring K] [--width W] [--height H] [--isa scalar|ssse3] [--json FILE] [--output PREFIX [--writers N] [--no-direct]] [--format ppm|qoi|png|png-store] [--encode-threads N] [--null]" << endl;
+			throw runtime_error("Invalid argument.");
+		}
+	}
+	if (opt.bench)
+	{
+		opt.frames = framesSet ? opt.frames : 1000;
+		opt.ring = ringSet ? opt.ring : 3;
+	}
+	if (opt.frames == 0 || opt.width == 0 || opt.height == 0)
+		throw runtime_error("Frames and size must be non-zero.");
+	opt.ring = clamp(opt.ring, 1u, MAX_RING);
+	return opt;
+}
+
+// One render target / readback pair, reused every K frames
+struct FrameSlot
+{
+	ComPtr<ID3D12CommandAllocator> cmdAlloc;
+	ComPtr<ID3D12GraphicsCommandList> cmdList;
+	ComPtr<ID3D12Resource> targetTex;
+	ComPtr<ID3D12Resource> readbackBuf;
+	D3D12_CPU_DESCRIPTOR_HANDLE rtv = {};
+	uint64_t fenceValue = 0;
+	uint32_t frame = 0;
+	bool inFlight = false;
+	bool completed = false;
+	chrono::steady_clock::time_point submitTime;
+	chrono::steady_clock::time_point completeTime;
+	atomic<bool> writing = false; // Readback memory is still referenced by the image writer
+};
+
+double Percentile(vector<double> v, double p)
+{
+	if (v.empty())
+		return 0.0;
+	sort(v.begin(), v.end());
+	auto idx = static_cast<size_t>(ceil(p * v.size()));
+	return v[clamp<size_t>(idx, 1, v.size()) - 1];
+}
+
+bool WriteJson(const Options& opt, const string& json)
+{
+	if (opt.jsonPath.empty())
+	{
+		cout << json << endl;
+		return true;
+	}
+	ofstream ofs(opt.jsonPath, ios::trunc);
+	if (!ofs)
+	{
+		cout << "Cannot open json file." << endl;
+		return false;
+	}
+	ofs << json << endl;
+	return true;
+}
+
 int main(int argc, char** argv)
 {
+	const auto opt = ParseOptions(argc, argv);
 	cout << "Start" << endl;
-	// Get an adapter
-	ComPtr<IDXCoreAdapterFactory> adapterFactory;
-	CHK(DXCoreCreateAdapterFactory(IID_PPV_ARGS(&adapterFactory)));
-	ComPtr<IDXCoreAdapterList> adapterList;
-	GUID attributes[]{ DXCORE_ADAPTER_ATTRIBUTE_D3D12_GRAPHICS };
-	CHK(adapterFactory->CreateAdapterList(1, attributes, IID_PPV_ARGS(&adapterList)));
-	DXCoreAdapterPreference sortPreferences[]{ DXCoreAdapterPreference::Hardware, DXCoreAdapterPreference::HighPerformance };
-	CHK(adapterList->Sort(2, sortPreferences));
-	ComPtr<IDXCoreAdapter> adapter;
-	CHK(adapterList->GetAdapter(0, IID_PPV_ARGS(&adapter)));
-	DXCoreHardwareID hwid = {};
-	CHK(adapter->GetProperty(DXCoreAdapterProperty::HardwareID, &hwid));
-	cout << "HWID: " << hex << hwid.vendorID << "," << hwid.deviceID << "," << hwid.subSysID << "," << hwid.revision << endl;	
-	bool isHW = {};
-	CHK(adapter->GetProperty(DXCoreAdapterProperty::IsHardware, &isHW));
-	cout << "IsHW: " << (isHW ? "Yes" : "No") << endl;
-	uint64_t vram = {};
-	CHK(adapter->GetProperty(DXCoreAdapterProperty::DedicatedAdapterMemory, &vram));
-	cout << "VRAM: " << vram << " byte" << endl;
-	// Create a device
 	ComPtr<ID3D12Device> device;
-	CHK(D3D12CreateDevice(adapter.Get(), D3D_FEATURE_LEVEL_12_1, IID_PPV_ARGS(&device)));
+	NullDevice::Device* nullDevice = nullptr;
+	if (opt.nullDevice)
+	{
+		// Recording stand-in, commands are replayed on the CPU and fences complete immediately
+		CHK(NullDevice::CreateDevice(IID_PPV_ARGS(&device)));
+		nullDevice = static_cast<NullDevice::Device*>(device.Get());
+		nullDevice->SetTrace(true);
+		cout << "Device: null" << endl;
+	}
+	else
+	{
+		// Get an adapter
+		ComPtr<IDXCoreAdapterFactory> adapterFactory;
+		CHK(DXCoreCreateAdapterFactory(IID_PPV_ARGS(&adapterFactory)));
+		ComPtr<IDXCoreAdapterList> adapterList;
+		GUID attributes[]{ DXCORE_ADAPTER_ATTRIBUTE_D3D12_GRAPHICS };
+		CHK(adapterFactory->CreateAdapterList(1, attributes, IID_PPV_ARGS(&adapterList)));
+		DXCoreAdapterPreference sortPreferences[]{ DXCoreAdapterPreference::Hardware, DXCoreAdapterPreference::HighPerformance };
+		CHK(adapterList->Sort(2, sortPreferences));
+		ComPtr<IDXCoreAdapter> adapter;
+		CHK(adapterList->GetAdapter(0, IID_PPV_ARGS(&adapter)));
+		DXCoreHardwareID hwid = {};
+		CHK(adapter->GetProperty(DXCoreAdapterProperty::HardwareID, &hwid));
+		cout << "HWID: " << hex << hwid.vendorID << "," << hwid.deviceID << "," << hwid.subSysID << "," << hwid.revision << dec << endl;
+		bool isHW = {};
+		CHK(adapter->GetProperty(DXCoreAdapterProperty::IsHardware, &isHW));
+		cout << "IsHW: " << (isHW ? "Yes" : "No") << endl;
+		uint64_t vram = {};
+		CHK(adapter->GetProperty(DXCoreAdapterProperty::DedicatedAdapterMemory, &vram));
+		cout << "VRAM: " << vram << " byte" << endl;
+		// Create a device
+		CHK(D3D12CreateDevice(adapter.Get(), D3D_FEATURE_LEVEL_12_1, IID_PPV_ARGS(&device)));
+	}
 	// Create resourcews
-	ComPtr<ID3D12CommandAllocator> cmdAlloc;
-	CHK(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&cmdAlloc)));
 	const D3D12_COMMAND_QUEUE_DESC queueDesc = { D3D12_COMMAND_LIST_TYPE_DIRECT };
 	ComPtr<ID3D12CommandQueue> cmdQueue;
 	CHK(device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&cmdQueue)));
-	ComPtr<ID3D12GraphicsCommandList> cmdList;
-	CHK(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, cmdAlloc.Get(), nullptr, IID_PPV_ARGS(&cmdList)));
 	ComPtr<ID3D12Fence> fence;
 	CHK(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence)));
-	// Create a rendering texture
+	const D3D12_DESCRIPTOR_HEAP_DESC descHeapRtvDesc = { D3D12_DESCRIPTOR_HEAP_TYPE_RTV, MAX_RING };
+	ComPtr<ID3D12DescriptorHeap> descHeapRtv;
+	CHK(device->CreateDescriptorHeap(&descHeapRtvDesc, IID_PPV_ARGS(&descHeapRtv)));
+	const auto rtvStride = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+	// Rendering textures and readback buffers, one per ring slot
+	const uint32_t pitch = Align(4 * opt.width, (uint32_t)D3D12_TEXTURE_DATA_PITCH_ALIGNMENT);
 	const D3D12_RESOURCE_DESC targetTexDesc = {
 		.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D,
-		.Width = WIDTH,
-		.Height = HEIGHT,
+		.Width = opt.width,
+		.Height = opt.height,
 		.DepthOrArraySize = 1,
 		.MipLevels = 1,
 		.Format = DXGI_FORMAT_R8G8B8A8_UNORM,
@@ -70,16 +232,9 @@ int main(int argc, char** argv)
 		.Flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET,
 	};
 	const D3D12_HEAP_PROPERTIES targetHeapProp = { D3D12_HEAP_TYPE_DEFAULT };
-	ComPtr<ID3D12Resource> targetTex;
-	CHK(device->CreateCommittedResource(&targetHeapProp, D3D12_HEAP_FLAG_NONE, &targetTexDesc, D3D12_RESOURCE_STATE_RENDER_TARGET, nullptr, IID_PPV_ARGS(&targetTex)));
-	const D3D12_DESCRIPTOR_HEAP_DESC descHeapRtvDesc = { D3D12_DESCRIPTOR_HEAP_TYPE_RTV, 10 };
-	ComPtr<ID3D12DescriptorHeap> descHeapRtv;
-	CHK(device->CreateDescriptorHeap(&descHeapRtvDesc, IID_PPV_ARGS(&descHeapRtv)));
-	device->CreateRenderTargetView(targetTex.Get(), nullptr, descHeapRtv->GetCPUDescriptorHandleForHeapStart());
-	// Create a readback buffer
 	const D3D12_RESOURCE_DESC readbackBufDesc = {
 		.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER,
-		.Width = Align(4 * WIDTH, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT) * HEIGHT,
+		.Width = static_cast<uint64_t>(pitch) * opt.height,
 		.Height = 1,
 		.DepthOrArraySize = 1,
 		.MipLevels = 1,
@@ -88,65 +243,269 @@ int main(int argc, char** argv)
 		.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR,
 	};
 	const D3D12_HEAP_PROPERTIES readbackHeapProp = { D3D12_HEAP_TYPE_READBACK };
-	ComPtr<ID3D12Resource> readbackBuf;
-	CHK(device->CreateCommittedResource(&readbackHeapProp, D3D12_HEAP_FLAG_NONE, &readbackBufDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&readbackBuf)));
-	// Clear that texture
-	const auto h_rtv = descHeapRtv->GetCPUDescriptorHandleForHeapStart();
-	const float clearColor[4] = { 0.1f, 0.2f, 0.4f, 1.0f };
-	cmdList->ClearRenderTargetView(h_rtv, clearColor, 0, nullptr);
-	const D3D12_RESOURCE_BARRIER barrier = {
-		.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
-		.Transition = { targetTex.Get(), 0, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COPY_SOURCE },
+	vector<FrameSlot> slots(opt.ring);
+	for (uint32_t i = 0; i < opt.ring; ++i)
+	{
+		auto& slot = slots[i];
+		CHK(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&slot.cmdAlloc)));
+		CHK(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, slot.cmdAlloc.Get(), nullptr, IID_PPV_ARGS(&slot.cmdList)));
+		CHK(slot.cmdList->Close());
+		CHK(device->CreateCommittedResource(&targetHeapProp, D3D12_HEAP_FLAG_NONE, &targetTexDesc, D3D12_RESOURCE_STATE_RENDER_TARGET, nullptr, IID_PPV_ARGS(&slot.targetTex)));
+		CHK(device->CreateCommittedResource(&readbackHeapProp, D3D12_HEAP_FLAG_NONE, &readbackBufDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&slot.readbackBuf)));
+		slot.rtv = descHeapRtv->GetCPUDescriptorHandleForHeapStart();
+		slot.rtv.ptr += i * rtvStride;
+		device->CreateRenderTargetView(slot.targetTex.Get(), nullptr, slot.rtv);
+	}
+
+	uint64_t fenceValue = 0;
+	vector<uint8_t> pix(3ull * opt.width * opt.height);
+	vector<double> latencies;
+	latencies.reserve(opt.frames);
+	uint64_t readbackBytes = 0;
+	double readbackSeconds = 0.0;
+	// CPU cost of command recording and submission
+	double recordSeconds = 0.0;
+	double submitSeconds = 0.0;
+	uint64_t warmAllocations = 0;
+	// Numbered frame sequence is converted and written off the render thread
+	unique_ptr<ImageWriter> writer;
+	if (!opt.outputPrefix.empty())
+		writer = make_unique<ImageWriter>(opt.writers, opt.ring, opt.directIO, opt.codec, opt.encodeThreads, opt.isa);
+
+	// Stamp completion time of every finished slot so latency does not include our own wait
+	auto pollCompletion = [&]()
+	{
+		const auto completedValue = fence->GetCompletedValue();
+		const auto now = chrono::steady_clock::now();
+		for (auto& slot : slots)
+		{
+			if (slot.inFlight && !slot.completed && completedValue >= slot.fenceValue)
+			{
+				slot.completed = true;
+				slot.completeTime = now;
+			}
+		}
 	};
-	cmdList->ResourceBarrier(1, &barrier);
-	const D3D12_TEXTURE_COPY_LOCATION locSrc = {
-		.pResource = targetTex.Get(),
-		.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX,
-		.SubresourceIndex = 0,
+	// Wait a slot, then read back rendered data
+	auto retire = [&](FrameSlot& slot)
+	{
+		pollCompletion();
+		if (!slot.completed)
+		{
+			CHK(fence->SetEventOnCompletion(slot.fenceValue, (HANDLE)NULL));
+			slot.completed = true;
+			slot.completeTime = chrono::steady_clock::now();
+		}
+		latencies.push_back(chrono::duration<double, milli>(slot.completeTime - slot.submitTime).count());
+		slot.inFlight = false;
+
+		const auto t0 = chrono::steady_clock::now();
+		uint8_t* srcPix;
+		CHK(slot.readbackBuf->Map(0, nullptr, reinterpret_cast<void**>(&srcPix)));
+		if (writer)
+		{
+			// Hand off the mapped slot, the writer unmaps it after conversion
+			char name[32];
+			snprintf(name, sizeof(name), "%05u%s", slot.frame, ImageEncoder::Extension(opt.codec));
+			slot.writing = true;
+			writer->Submit({
+				.path = opt.outputPrefix + name,
+				.src = srcPix,
+				.srcPitch = pitch,
+				.width = opt.width,
+				.height = opt.height,
+				.onDone = [&slot]() {
+					slot.readbackBuf->Unmap(0, nullptr);
+					slot.writing = false;
+					slot.writing.notify_all();
+				},
+			});
+		}
+		else
+		{
+			PixelConvert::Convert(pix.data(), srcPix, pitch, opt.width, opt.height, PixelConvert::Format::RGB, opt.isa);
+			slot.readbackBuf->Unmap(0, nullptr);
+		}
+		readbackSeconds += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		readbackBytes += static_cast<uint64_t>(4) * opt.width * opt.height;
 	};
-	const D3D12_TEXTURE_COPY_LOCATION locDst = {
-		.pResource = readbackBuf.Get(),
-		.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT,
-		.PlacedFootprint = { .Offset = 0, .Footprint = { DXGI_FORMAT_R8G8B8A8_UNORM, WIDTH, HEIGHT, 1, Align(4 * WIDTH, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT) } },
+	// Retire finished slots early so the writer gets them while the GPU keeps rendering
+	auto retireCompleted = [&]()
+	{
+		pollCompletion();
+		for (uint32_t i = 0; i < opt.ring; ++i)
+		{
+			auto& slot = slots[i];
+			if (slot.inFlight && slot.completed)
+				retire(slot);
+		}
 	};
-	cmdList->CopyTextureRegion(&locDst, 0, 0, 0, &locSrc, nullptr);
-	// Execute GPU commands and wait
-	CHK(cmdList->Close());
-	ID3D12CommandList* cmdListP = cmdList.Get();
-	cmdQueue->ExecuteCommandLists(1, &cmdListP);
-	CHK(cmdQueue->Signal(fence.Get(), 1));
-	fence->SetEventOnCompletion(1, (HANDLE)NULL);
-	// Readback rendered data
-	vector<uint8_t> pix;
-	pix.resize(3 * WIDTH * HEIGHT);
-	uint32_t *srcPix;
-	CHK(readbackBuf->Map(0, nullptr, reinterpret_cast<void**>(&srcPix)));
-	cout << "Pixel[0, 0]: " << hex << *srcPix << endl;
-	for (int y = 0; y < HEIGHT; ++y)
-	{
-		auto pitch = Align(4 * WIDTH, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT);
-		auto *dst = pix.data() + 3 * y * WIDTH;
-		auto *src = reinterpret_cast<uint8_t*>(srcPix) + y * pitch;
-		for (int x = 0; x < WIDTH; ++x)
+
+	const auto startTime = chrono::steady_clock::now();
+	for (uint32_t frame = 0; frame < opt.frames; ++frame)
+	{
+		auto& slot = slots[frame % opt.ring];
+		if (slot.inFlight)
+			retire(slot);
+		slot.writing.wait(true);
+		// Keep the command stream of the first frame only, and count allocations after the first pass over the ring
+		if (nullDevice && frame == 1)
+			nullDevice->SetTrace(false);
+		if (nullDevice && frame == opt.ring)
+			warmAllocations = nullDevice->GetStats().allocations;
+		// Clear that texture
+		const auto recordStart = chrono::steady_clock::now();
+		CHK(slot.cmdAlloc->Reset());
+		CHK(slot.cmdList->Reset(slot.cmdAlloc.Get(), nullptr));
+		auto& cmdList = slot.cmdList;
+		const float clearColor[4] = { 0.1f, 0.2f, 0.4f + 0.5f * (frame % 64) / 64.0f, 1.0f };
+		cmdList->ClearRenderTargetView(slot.rtv, clearColor, 0, nullptr);
+		D3D12_RESOURCE_BARRIER barrier = {
+			.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
+			.Transition = { slot.targetTex.Get(), 0, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COPY_SOURCE },
+		};
+		cmdList->ResourceBarrier(1, &barrier);
+		const D3D12_TEXTURE_COPY_LOCATION locSrc = {
+			.pResource = slot.targetTex.Get(),
+			.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX,
+			.SubresourceIndex = 0,
+		};
+		const D3D12_TEXTURE_COPY_LOCATION locDst = {
+			.pResource = slot.readbackBuf.Get(),
+			.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT,
+			.PlacedFootprint = { .Offset = 0, .Footprint = { DXGI_FORMAT_R8G8B8A8_UNORM, opt.width, opt.height, 1, pitch } },
+		};
+		cmdList->CopyTextureRegion(&locDst, 0, 0, 0, &locSrc, nullptr);
+		swap(barrier.Transition.StateBefore, barrier.Transition.StateAfter);
+		cmdList->ResourceBarrier(1, &barrier);
+		// Execute GPU commands, do not wait here
+		CHK(cmdList->Close());
+		const auto submitStart = chrono::steady_clock::now();
+		ID3D12CommandList* cmdListP = cmdList.Get();
+		cmdQueue->ExecuteCommandLists(1, &cmdListP);
+		CHK(cmdQueue->Signal(fence.Get(), ++fenceValue));
+		const auto submitEnd = chrono::steady_clock::now();
+		recordSeconds += chrono::duration<double>(submitStart - recordStart).count();
+		submitSeconds += chrono::duration<double>(submitEnd - submitStart).count();
+		slot.fenceValue = fenceValue;
+		slot.frame = frame;
+		slot.inFlight = true;
+		slot.completed = false;
+		slot.submitTime = chrono::steady_clock::now();
+		retireCompleted();
+	}
+	// Drain remaining frames in submission order
+	for (uint32_t i = 0; i < opt.ring; ++i)
+	{
+		auto& slot = slots[(opt.frames + i) % opt.ring];
+		if (slot.inFlight)
+			retire(slot);
+	}
+	if (writer)
+		writer->Flush();
+	const double totalSeconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+	if (!writer)
+		cout << "Pixel[0, 0]: " << hex << (int)pix[0] << "," << (int)pix[1] << "," << (int)pix[2] << dec << endl;
+	if (nullDevice && nullDevice->GetStats().errors)
+	{
+		cout << "Null device detected " << nullDevice->GetStats().errors << " API errors." << endl;
+		return 1;
+	}
+
+	if (opt.bench)
+	{
+		// The writer converts on its own threads, hand-off is the time spent here
+		const auto writerStats = writer ? writer->GetStats() : ImageWriter::Stats();
+		const double convertSeconds = writer ? writerStats.convertSeconds : readbackSeconds;
+		// Machine-readable result
+		string json = "{"
+			"\"width\":" + to_string(opt.width) +
+			",\"height\":" + to_string(opt.height) +
+			",\"frames\":" + to_string(opt.frames) +
+			",\"ring\":" + to_string(opt.ring) +
+			",\"seconds\":" + to_string(totalSeconds) +
+			",\"fps\":" + to_string(opt.frames / totalSeconds) +
+			",\"latency_ms\":{\"p50\":" + to_string(Percentile(latencies, 0.50)) +
+			",\"p99\":" + to_string(Percentile(latencies, 0.99)) +
+			",\"max\":" + to_string(Percentile(latencies, 1.00)) + "}" +
+			",\"readback_bytes\":" + to_string(readbackBytes) +
+			",\"readback_mb_per_sec\":" + to_string(convertSeconds > 0.0 ? readbackBytes / convertSeconds / 1e6 : 0.0) +
+			",\"isa\":\"" + PixelConvert::IsaName(opt.isa == PixelConvert::Isa::Auto ? PixelConvert::BestIsa() : opt.isa) + "\"" +
+			",\"device\":\"" + (nullDevice ? "null" : "d3d12") + "\"" +
+			",\"record_us_per_frame\":" + to_string(recordSeconds * 1e6 / opt.frames) +
+			",\"submit_us_per_frame\":" + to_string(submitSeconds * 1e6 / opt.frames);
+		if (nullDevice)
+		{
+			// Command stream of one frame, so call sequences can be diffed between runs
+			const auto& stats = nullDevice->GetStats();
+			const auto& trace = nullDevice->GetTrace();
+			json += ",\"null_device\":{\"objects\":" + to_string(stats.objects) +
+				",\"live_objects\":" + to_string(stats.liveObjects) +
+				",\"allocations\":" + to_string(stats.allocations) +
+				",\"steady_allocations\":" + to_string(opt.frames > opt.ring ? stats.allocations - warmAllocations : 0) +
+				",\"allocated_bytes\":" + to_string(stats.allocatedBytes) +
+				",\"commands\":" + to_string(stats.commandsExecuted) +
+				",\"command_lists\":" + to_string(stats.commandListsExecuted) +
+				",\"signals\":" + to_string(stats.signals) +
+				",\"errors\":" + to_string(stats.errors) +
+				",\"frame_commands\":[";
+			for (size_t i = 0; i < trace.size(); ++i)
+				json += string(i ? "," : "") + "\"" + NullDevice::OpName(trace[i]) + "\"";
+			json += "]}";
+		}
+		if (writer)
+		{
+			const auto& stats = writerStats;
+			json += ",\"writer\":{\"threads\":" + to_string(opt.writers) +
+				",\"handoff_us_per_frame\":" + to_string(readbackSeconds * 1e6 / opt.frames) +
+				",\"frames\":" + to_string(stats.frames) +
+				",\"direct_frames\":" + to_string(stats.directFrames) +
+				",\"bytes\":" + to_string(stats.bytes) +
+				",\"format\":\"" + ImageEncoder::CodecName(opt.codec) + "\"" +
+				",\"convert_ms_per_frame\":" + to_string(stats.frames ? stats.convertSeconds * 1e3 / stats.frames : 0.0) +
+				",\"encode_ms_per_frame\":" + to_string(stats.frames ? stats.encodeSeconds * 1e3 / stats.frames : 0.0) +
+				",\"write_ms_per_frame\":" + to_string(stats.frames ? stats.writeSeconds * 1e3 / stats.frames : 0.0) +
+				",\"stall_seconds\":" + to_string(stats.stallSeconds) + "}";
+		}
+		json += "}";
+		if (!WriteJson(opt, json))
+			return 1;
+		cout << "End" << endl;
+		return 0;
+	}
+	// Every frame is already written as a numbered image
+	if (writer)
+	{
+		cout << "End" << endl;
+		return 0;
+	}
+
+	if (opt.codec != ImageEncoder::Codec::PPM)
+	{
+		vector<uint8_t> encoded;
+		ImageEncoder::Encode(opt.codec, pix.data(), opt.width, opt.height, encoded, opt.encodeThreads);
+		ofstream ofs(string("image") + ImageEncoder::Extension(opt.codec), ios::binary | ios::trunc);
+		if (!ofs)
 		{
-			dst[3 * x + 0] = src[4 * x + 0];
-			dst[3 * x + 1] = src[4 * x + 1];
-			dst[3 * x + 2] = src[4 * x + 2];
+			cout << "Cannot open image file." << endl;
+			return 1;
 		}
+		ofs.write(reinterpret_cast<char*>(encoded.data()), encoded.size());
+		cout << "End" << endl;
+		return 0;
 	}
-	readbackBuf->Unmap(0, nullptr);
-	// Write PPM
+
+	// Write PPM of the last frame
 	ofstream ofs("image.ppm", ios::binary | ios::trunc);
 	if (!ofs)
 	{
 		cout << "Cannot open image file." << endl;
 		return 1;
 	}
-	ofs << "P6" << endl << "# test" << endl << WIDTH << " " << HEIGHT << endl << "255" << endl;
+	ofs << "P6" << endl << "# test" << endl << opt.width << " " << opt.height << endl << "255" << endl;
 	ofs.write(reinterpret_cast<char*>(pix.data()), pix.size());
 	ofs << endl;
 	ofs.close();
 	cout << "End" << endl;
 	return 0;
 }
-
@@ -0,0 +1,133 @@
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <string>
+#define INITGUID
+#include <wsl/wrladapter.h>
+#include <directx/d3d12.h>
+#include <dxguids/dxguids.h>
+#include "Bench/Bench.h"
+
+using namespace std;
+
+// Checks and benchmarks of the shared modules, no GPU is needed
+struct Mode
+{
+	const char* name;
+	int (*run)(const Options&);
+	uint32_t frames; // Default of --frames
+	const char* description;
+};
+
+const Mode Modes[] = {
+	{ "convert", RunConvertBenchmark, 100, "checks the readback conversion kernels bit-exact against the scalar path" },
+	{ "encode", RunEncodeBenchmark, 10, "round-trips a synthetic frame through every image encoder" },
+	{ "mesh", RunMeshBenchmark, 10, "checks the procedural sphere against the per-vertex sinf/cosf loop" },
+	{ "stress-mesh", RunMeshStress, 1, "checks a 10M-triangle sphere with 32-bit and chunked 16-bit indices and its draws" },
+	{ "optimize-mesh", RunMeshOptimize, 1, "checks the mesh optimizer keeps every triangle and reports ACMR/ATVR" },
+	{ "pack", RunPackBenchmark, 10, "checks the 12-byte packed vertex encoders and their error bounds" },
+	{ "meshlet", RunMeshletBenchmark, 10, "validates the meshlet builder on several spheres" },
+	{ "simplify", RunSimplifyBenchmark, 1, "checks the LOD chains of several spheres and a flat grid" },
+	{ "cull", RunCullBenchmark, 100, "checks the SIMD frustum culling of a 100k-instance scene against scalar and double references" },
+	{ "trace-cpu", RunTraceCpu, 1, "writes the DXR sample modes traced by the CPU BVH as golden images" },
+	{ "trace", RunTraceBenchmark, 3, "checks the SIMD BVH traversal and refit against scalar and brute force tracing" },
+	{ "as-pool", RunAsPoolBenchmark, 50, "churns the acceleration structure pool allocator and checks its ranges" },
+	{ "blas-plan", RunBlasPlanBenchmark, 50, "packs 2000 BLAS builds into scratch batches under several budgets" },
+	{ "sbt", RunShaderTableBenchmark, 50, "checks the shader binding table layout and its incremental writes" },
+	{ "ray-budget", RunRayBudgetBenchmark, 1, "checks the adaptive ray budget settles under its target on a simulated GPU" },
+	{ "cb-ring", RunConstantRingBenchmark, 50, "allocates per-draw constants from the fence-retired ring and checks no live range is reused" },
+	{ "aliasing", RunAliasingBenchmark, 50, "places the transient textures of random frame graphs and checks placements and barriers" },
+	{ "heap-alloc", RunHeapAllocatorBenchmark, 50, "sub-allocates placed resources from pools of fake heaps through churn and defragmentation" },
+	{ "bindless", RunBindlessBenchmark, 50, "churns generational descriptor handles behind a lagging fence and checks no slot is reused early" },
+	{ "desc-ring", RunDescriptorRingBenchmark, 50, "pushes per-draw descriptor tables through the fence-retired ring and its per-frame cache" },
+	{ "file-stream", RunFileStreamBenchmark, 64, "streams a file through mapped windows and through upload copies and checks both deliver the same bytes" },
+	{ "upload", RunUploadBenchmark, 1, "uploads 10k small and three large textures through the staging uploader on a null device copy queue" },
+};
+
+void Usage(const char* name)
+{
+	cout << "Usage: " << name << " MODE [--frames N] [--width W] [--height H] [--encode-threads N] [--mesh-res N] [--instances N] [--threads N] [--rt-mode 0-3] [--output PREFIX] [--format ppm|qoi|png|png-store] [--json FILE]" << endl;
+	for (const auto& mode : Modes)
+		cout << "  " << mode.name << string(16 - strlen(mode.name), ' ') << mode.description << endl;
+}
+
+Options ParseOptions(const Mode& mode, int argc, char** argv)
+{
+	Options opt;
+	opt.frames = mode.frames;
+	for (int i = 2; i < argc; ++i)
+	{
+		auto hasValue = [&]() { return i + 1 < argc; };
+		if (!strcmp(argv[i], "--frames") && hasValue())
+			opt.frames = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "--width") && hasValue())
+			opt.width = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "--height") && hasValue())
+			opt.height = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "--encode-threads") && hasValue())
+			opt.encodeThreads = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "--mesh-res") && hasValue())
+			opt.meshRes = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "--instances") && hasValue())
+			opt.instances = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && hasValue())
+			opt.threads = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "--rt-mode") && hasValue())
+			opt.rtMode = stoi(argv[++i]);
+		else if (!strcmp(argv[i], "--output") && hasValue())
+			opt.outputPrefix = argv[++i];
+		else if (!strcmp(argv[i], "--format") && hasValue())
+		{
+			string format = argv[++i];
+			if (format == "ppm")
+				opt.codec = ImageEncoder::Codec::PPM;
+			else if (format == "qoi")
+				opt.codec = ImageEncoder::Codec::QOI;
+			else if (format == "png")
+				opt.codec = ImageEncoder::Codec::PNG;
+			else if (format == "png-store")
+				opt.codec = ImageEncoder::Codec::PNGStore;
+			else
+				throw runtime_error("Unknown image format.");
+		}
+		else if (!strcmp(argv[i], "--json") && hasValue())
+			opt.jsonPath = argv[++i];
+		else
+		{
+			Usage(argv[0]);
+			throw runtime_error("Invalid argument.");
+		}
+	}
+	if (opt.frames == 0 || opt.width == 0 || opt.height == 0)
+		throw runtime_error("Frames and size must be non-zero.");
+	return opt;
+}
+
+bool WriteJson(const Options& opt, const Json& json)
+{
+	if (opt.jsonPath.empty())
+	{
+		cout << json.Str() << endl;
+		return true;
+	}
+	ofstream ofs(opt.jsonPath, ios::trunc);
+	if (!ofs)
+	{
+		cout << "Cannot open json file." << endl;
+		return false;
+	}
+	ofs << json.Str() << endl;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	for (const auto& mode : Modes)
+	{
+		if (argc > 1 && !strcmp(argv[1], mode.name))
+			return mode.run(ParseOptions(mode, argc, argv));
+	}
+	Usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,795 @@
+#pragma once
+
+// Lossless encoders for packed RGB frames: PPM, QOI and a fast-profile PNG
+// QOI and PNG are encoded over row bands in parallel, each band is an independent
+// piece of the final stream so the bands are simply concatenated.
+// Small decoders for the same formats are included to verify round trips.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ImageEncoder
+{
+	enum class Codec
+	{
+		PPM,
+		QOI,
+		PNG,      // Sub filter, RLE matches with fixed Huffman codes
+		PNGStore, // No filter, stored deflate blocks
+	};
+
+	inline const char* CodecName(Codec codec)
+	{
+		switch (codec)
+		{
+		case Codec::QOI: return "qoi";
+		case Codec::PNG: return "png";
+		case Codec::PNGStore: return "png-store";
+		default: return "ppm";
+		}
+	}
+
+	inline const char* Extension(Codec codec)
+	{
+		switch (codec)
+		{
+		case Codec::QOI: return ".qoi";
+		case Codec::PNG:
+		case Codec::PNGStore: return ".png";
+		default: return ".ppm";
+		}
+	}
+
+	namespace Detail
+	{
+		inline void PutBE32(std::vector<uint8_t>& out, uint32_t v)
+		{
+			out.push_back(static_cast<uint8_t>(v >> 24));
+			out.push_back(static_cast<uint8_t>(v >> 16));
+			out.push_back(static_cast<uint8_t>(v >> 8));
+			out.push_back(static_cast<uint8_t>(v));
+		}
+
+		inline uint32_t GetBE32(const uint8_t* p)
+		{
+			return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+		}
+
+		// Split [0, rows) into at most threads bands and run func(band, rowBegin, rowEnd) in parallel
+		template<class Func>
+		void ForEachBand(uint32_t rows, uint32_t threads, Func&& func)
+		{
+			const uint32_t bandCount = std::clamp(threads, 1u, std::max(rows, 1u));
+			std::vector<std::thread> workers;
+			for (uint32_t band = 1; band < bandCount; ++band)
+			{
+				workers.emplace_back([&, band]() { func(band, rows * band / bandCount, rows * (band + 1) / bandCount); });
+			}
+			func(0, 0, rows / bandCount);
+			for (auto& t : workers)
+				t.join();
+		}
+
+		inline uint32_t BandCount(uint32_t rows, uint32_t threads)
+		{
+			return std::clamp(threads, 1u, std::max(rows, 1u));
+		}
+
+		// Slicing-by-8 tables, t[0] is the classic byte table
+		inline const std::array<std::array<uint32_t, 256>, 8>& CrcTables()
+		{
+			static const auto tables = []()
+			{
+				std::array<std::array<uint32_t, 256>, 8> t = {};
+				for (uint32_t n = 0; n < 256; ++n)
+				{
+					uint32_t c = n;
+					for (int k = 0; k < 8; ++k)
+						c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+					t[0][n] = c;
+				}
+				for (uint32_t n = 0; n < 256; ++n)
+				{
+					for (int k = 1; k < 8; ++k)
+						t[k][n] = t[0][t[k - 1][n] & 0xFF] ^ (t[k - 1][n] >> 8);
+				}
+				return t;
+			}();
+			return tables;
+		}
+
+		inline uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+		{
+			const auto& t = CrcTables();
+			crc = ~crc;
+			for (; size >= 8; size -= 8, data += 8)
+			{
+				uint32_t lo, hi;
+				memcpy(&lo, data, 4);
+				memcpy(&hi, data + 4, 4);
+				lo ^= crc; // Little endian
+				crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+					t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+			}
+			for (; size > 0; --size, ++data)
+				crc = t[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+			return ~crc;
+		}
+
+		constexpr uint32_t kAdlerBase = 65521;
+
+		inline uint32_t Adler32(const uint8_t* data, size_t size, uint32_t adler = 1)
+		{
+			uint32_t a = adler & 0xFFFF, b = adler >> 16;
+			while (size > 0)
+			{
+				// 5552 bytes is the largest block that cannot overflow before the modulo
+				const size_t n = std::min<size_t>(size, 5552);
+				for (size_t i = 0; i < n; ++i)
+				{
+					a += data[i];
+					b += a;
+				}
+				a %= kAdlerBase;
+				b %= kAdlerBase;
+				data += n;
+				size -= n;
+			}
+			return (b << 16) | a;
+		}
+
+		// Adler-32 of A||B from adler(A), adler(B) and length(B)
+		inline uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t len2)
+		{
+			const uint32_t rem = static_cast<uint32_t>(len2 % kAdlerBase);
+			uint32_t sum1 = adler1 & 0xFFFF;
+			uint32_t sum2 = static_cast<uint32_t>((uint64_t(rem) * sum1) % kAdlerBase);
+			sum1 += (adler2 & 0xFFFF) + kAdlerBase - 1;
+			sum2 += (adler1 >> 16) + (adler2 >> 16) + kAdlerBase - rem;
+			if (sum1 >= kAdlerBase) sum1 -= kAdlerBase;
+			if (sum1 >= kAdlerBase) sum1 -= kAdlerBase;
+			if (sum2 >= 2 * kAdlerBase) sum2 -= 2 * kAdlerBase;
+			if (sum2 >= kAdlerBase) sum2 -= kAdlerBase;
+			return sum1 | (sum2 << 16);
+		}
+
+		// LSB-first bit stream for deflate
+		// Writes into a buffer sized by the caller for the worst case, 32 bits at a time
+		class BitWriter
+		{
+			uint8_t* mPtr;
+			uint64_t mBits = 0;
+			uint32_t mCount = 0;
+		public:
+			explicit BitWriter(uint8_t* ptr) : mPtr(ptr) {}
+			void Put(uint32_t value, uint32_t count)
+			{
+				mBits |= uint64_t(value) << mCount;
+				mCount += count;
+				if (mCount >= 32)
+				{
+					const uint32_t word = static_cast<uint32_t>(mBits); // Little endian
+					memcpy(mPtr, &word, 4);
+					mPtr += 4;
+					mBits >>= 32;
+					mCount -= 32;
+				}
+			}
+			// Pad to a byte boundary and return the end of the written data
+			uint8_t* Finish()
+			{
+				while (mCount > 0)
+				{
+					*mPtr++ = static_cast<uint8_t>(mBits);
+					mBits >>= 8;
+					mCount = mCount > 8 ? mCount - 8 : 0;
+				}
+				return mPtr;
+			}
+		};
+
+		// Fixed Huffman literal/length codes, bit-reversed for the LSB-first stream
+		struct FixedCode
+		{
+			uint16_t code;
+			uint8_t length;
+		};
+
+		inline uint32_t ReverseBits(uint32_t v, uint32_t count)
+		{
+			uint32_t r = 0;
+			for (uint32_t i = 0; i < count; ++i)
+				r |= ((v >> i) & 1) << (count - 1 - i);
+			return r;
+		}
+
+		inline const std::array<FixedCode, 288>& FixedLiteralCodes()
+		{
+			static const auto table = []()
+			{
+				std::array<FixedCode, 288> t = {};
+				for (uint32_t s = 0; s < 288; ++s)
+				{
+					uint32_t code, len;
+					if (s < 144) { code = 0x30 + s; len = 8; }
+					else if (s < 256) { code = 0x190 + s - 144; len = 9; }
+					else if (s < 280) { code = s - 256; len = 7; }
+					else { code = 0xC0 + s - 280; len = 8; }
+					t[s] = { static_cast<uint16_t>(ReverseBits(code, len)), static_cast<uint8_t>(len) };
+				}
+				return t;
+			}();
+			return table;
+		}
+
+		constexpr uint16_t kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		constexpr uint8_t kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		constexpr uint16_t kDistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		constexpr uint8_t kDistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+		// Match length 3..258 -> length code index
+		inline const std::array<uint8_t, 259>& LengthCodeIndex()
+		{
+			static const auto table = []()
+			{
+				std::array<uint8_t, 259> t = {};
+				for (uint32_t i = 0; i < 29; ++i)
+				{
+					const uint32_t end = i == 28 ? 259 : kLengthBase[i + 1];
+					for (uint32_t len = kLengthBase[i]; len < end && len < 259; ++len)
+						t[len] = static_cast<uint8_t>(i);
+				}
+				return t;
+			}();
+			return table;
+		}
+
+		// One non-final fixed Huffman block with distance-1 runs, then an empty stored block
+		// so the band ends on a byte boundary and can be concatenated
+		inline void DeflateFastBand(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+		{
+			const auto& lit = FixedLiteralCodes();
+			const auto& lenIndex = LengthCodeIndex();
+			// Worst case is 9 bits per literal
+			const size_t start = out.size();
+			out.resize(start + size + size / 8 + 16);
+			BitWriter bw(out.data() + start);
+			bw.Put(0, 1); // BFINAL
+			bw.Put(1, 2); // BTYPE = fixed Huffman
+			size_t i = 0;
+			while (i < size)
+			{
+				size_t run = 0;
+				if (i > 0)
+				{
+					const uint8_t prev = data[i - 1];
+					const size_t maxRun = std::min<size_t>(258, size - i);
+					while (run < maxRun && data[i + run] == prev)
+						run++;
+				}
+				if (run >= 3)
+				{
+					const uint32_t li = lenIndex[run];
+					const auto& code = lit[257 + li];
+					bw.Put(code.code, code.length);
+					bw.Put(static_cast<uint32_t>(run) - kLengthBase[li], kLengthExtra[li]);
+					bw.Put(0, 5); // Distance code 0 = distance 1
+					i += run;
+				}
+				else
+				{
+					const auto& code = lit[data[i]];
+					bw.Put(code.code, code.length);
+					i++;
+				}
+			}
+			const auto& eob = lit[256];
+			bw.Put(eob.code, eob.length);
+			bw.Put(0, 1); // BFINAL
+			bw.Put(0, 2); // BTYPE = stored
+			out.resize(bw.Finish() - out.data());
+			const uint8_t sync[4] = { 0x00, 0x00, 0xFF, 0xFF };
+			out.insert(out.end(), sync, sync + 4);
+		}
+
+		inline void DeflateStoreBand(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+		{
+			do
+			{
+				const uint32_t n = static_cast<uint32_t>(std::min<size_t>(size, 65535));
+				out.push_back(0x00); // BFINAL = 0, BTYPE = stored
+				out.push_back(static_cast<uint8_t>(n));
+				out.push_back(static_cast<uint8_t>(n >> 8));
+				out.push_back(static_cast<uint8_t>(~n));
+				out.push_back(static_cast<uint8_t>(~n >> 8));
+				out.insert(out.end(), data, data + n);
+				data += n;
+				size -= n;
+			} while (size > 0);
+		}
+
+		inline void PutChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size)
+		{
+			PutBE32(out, static_cast<uint32_t>(size));
+			const size_t start = out.size();
+			out.insert(out.end(), type, type + 4);
+			if (size > 0)
+				out.insert(out.end(), data, data + size);
+			PutBE32(out, Crc32(out.data() + start, size + 4));
+		}
+
+		inline uint32_t QoiHash(uint8_t r, uint8_t g, uint8_t b)
+		{
+			return (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+		}
+
+		constexpr uint8_t QOI_OP_INDEX = 0x00;
+		constexpr uint8_t QOI_OP_DIFF = 0x40;
+		constexpr uint8_t QOI_OP_LUMA = 0x80;
+		constexpr uint8_t QOI_OP_RUN = 0xC0;
+		constexpr uint8_t QOI_OP_RGB = 0xFE;
+		constexpr uint8_t QOI_OP_RGBA = 0xFF;
+
+		// Encode pixels [begin, end) starting from the previous pixel of the whole image
+		// The band starts with an empty index: an opaque pixel never matches an empty slot,
+		// so the decoder's fuller index from earlier bands is never contradicted
+		inline void QoiEncodeBand(const uint8_t* rgb, size_t begin, size_t end, std::vector<uint8_t>& out)
+		{
+			uint8_t index[64][3] = {};
+			bool used[64] = {};
+			uint8_t pr = 0, pg = 0, pb = 0;
+			if (begin > 0)
+			{
+				pr = rgb[3 * (begin - 1) + 0];
+				pg = rgb[3 * (begin - 1) + 1];
+				pb = rgb[3 * (begin - 1) + 2];
+			}
+			uint32_t run = 0;
+			for (size_t i = begin; i < end; ++i)
+			{
+				const uint8_t r = rgb[3 * i + 0], g = rgb[3 * i + 1], b = rgb[3 * i + 2];
+				if (r == pr && g == pg && b == pb)
+				{
+					if (++run == 62)
+					{
+						out.push_back(QOI_OP_RUN | (run - 1));
+						run = 0;
+					}
+					continue;
+				}
+				if (run > 0)
+				{
+					out.push_back(QOI_OP_RUN | (run - 1));
+					run = 0;
+				}
+				const uint32_t h = QoiHash(r, g, b);
+				if (used[h] && index[h][0] == r && index[h][1] == g && index[h][2] == b)
+				{
+					out.push_back(QOI_OP_INDEX | h);
+				}
+				else
+				{
+					used[h] = true;
+					index[h][0] = r;
+					index[h][1] = g;
+					index[h][2] = b;
+					const int8_t vr = static_cast<int8_t>(r - pr);
+					const int8_t vg = static_cast<int8_t>(g - pg);
+					const int8_t vb = static_cast<int8_t>(b - pb);
+					const int8_t vgr = static_cast<int8_t>(vr - vg);
+					const int8_t vgb = static_cast<int8_t>(vb - vg);
+					if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+					{
+						out.push_back(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+					}
+					else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8)
+					{
+						out.push_back(QOI_OP_LUMA | (vg + 32));
+						out.push_back((vgr + 8) << 4 | (vgb + 8));
+					}
+					else
+					{
+						const uint8_t op[4] = { QOI_OP_RGB, r, g, b };
+						out.insert(out.end(), op, op + 4);
+					}
+				}
+				pr = r;
+				pg = g;
+				pb = b;
+			}
+			if (run > 0)
+				out.push_back(QOI_OP_RUN | (run - 1));
+		}
+	}
+
+	// Encode a packed RGB image, width * 3 bytes per row
+	// reserve(size) returns where the whole stream goes, e.g. an aligned write buffer, the stream size is returned
+	template<class Reserve>
+	inline size_t EncodeTo(Codec codec, const uint8_t* rgb, uint32_t width, uint32_t height, Reserve&& reserve, uint32_t threads = 1)
+	{
+		using namespace Detail;
+		const size_t rowBytes = 3ull * width;
+		// Stream pieces in order, copied once into the reserved destination
+		std::vector<uint8_t> head, tail;
+		std::vector<std::vector<uint8_t>> bands;
+		const uint8_t* body = nullptr;
+		size_t bodySize = 0;
+		if (codec == Codec::PPM)
+		{
+			const std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+			head.assign(header.begin(), header.end());
+			body = rgb;
+			bodySize = rowBytes * height;
+		}
+		else if (codec == Codec::QOI)
+		{
+			bands.resize(BandCount(height, threads));
+			ForEachBand(height, threads, [&](uint32_t band, uint32_t y0, uint32_t y1)
+			{
+				bands[band].reserve(rowBytes * (y1 - y0) / 2);
+				QoiEncodeBand(rgb, size_t(y0) * width, size_t(y1) * width, bands[band]);
+			});
+			head.insert(head.end(), { 'q', 'o', 'i', 'f' });
+			PutBE32(head, width);
+			PutBE32(head, height);
+			head.push_back(3); // RGB
+			head.push_back(0); // sRGB with linear alpha
+			tail.insert(tail.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+		}
+		else
+		{
+			// PNG: every band is one IDAT chunk, so filtering, deflate, Adler-32 and CRC all run per band
+			const uint32_t bandCount = BandCount(height, threads);
+			bands.resize(bandCount);
+			std::vector<uint32_t> adlers(bandCount);
+			std::vector<size_t> filteredSizes(bandCount);
+			ForEachBand(height, threads, [&](uint32_t band, uint32_t y0, uint32_t y1)
+			{
+				std::vector<uint8_t> filtered((rowBytes + 1) * (y1 - y0));
+				for (uint32_t y = y0; y < y1; ++y)
+				{
+					const uint8_t* src = rgb + rowBytes * y;
+					uint8_t* dst = filtered.data() + (rowBytes + 1) * (y - y0);
+					if (codec == Codec::PNGStore)
+					{
+						dst[0] = 0; // None
+						memcpy(dst + 1, src, rowBytes);
+					}
+					else
+					{
+						dst[0] = 1; // Sub
+						for (size_t x = 0; x < rowBytes; ++x)
+							dst[1 + x] = static_cast<uint8_t>(src[x] - (x >= 3 ? src[x - 3] : 0));
+					}
+				}
+				adlers[band] = Adler32(filtered.data(), filtered.size());
+				filteredSizes[band] = filtered.size();
+				std::vector<uint8_t> deflated;
+				deflated.reserve(filtered.size() / 2);
+				if (band == 0)
+					deflated.insert(deflated.end(), { 0x78, 0x01 }); // zlib header, fastest level
+				if (codec == Codec::PNGStore)
+					DeflateStoreBand(filtered.data(), filtered.size(), deflated);
+				else
+					DeflateFastBand(filtered.data(), filtered.size(), deflated);
+				bands[band].reserve(deflated.size() + 12);
+				PutChunk(bands[band], "IDAT", deflated.data(), deflated.size());
+			});
+			uint32_t adler = adlers[0];
+			for (uint32_t i = 1; i < bandCount; ++i)
+				adler = Adler32Combine(adler, adlers[i], filteredSizes[i]);
+
+			static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			head.insert(head.end(), signature, signature + 8);
+			std::vector<uint8_t> ihdr;
+			PutBE32(ihdr, width);
+			PutBE32(ihdr, height);
+			ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 }); // 8bit, truecolor, deflate, adaptive filter, no interlace
+			PutChunk(head, "IHDR", ihdr.data(), ihdr.size());
+			// Final empty fixed Huffman block and the stream checksum
+			std::vector<uint8_t> last = { 0x03, 0x00 };
+			PutBE32(last, adler);
+			PutChunk(tail, "IDAT", last.data(), last.size());
+			PutChunk(tail, "IEND", nullptr, 0);
+		}
+
+		size_t size = head.size() + bodySize + tail.size();
+		for (const auto& b : bands)
+			size += b.size();
+		uint8_t* dst = reserve(size);
+		auto put = [&](const uint8_t* data, size_t n)
+		{
+			if (n)
+				memcpy(dst, data, n);
+			dst += n;
+		};
+		put(head.data(), head.size());
+		put(body, bodySize);
+		for (const auto& b : bands)
+			put(b.data(), b.size());
+		put(tail.data(), tail.size());
+		return size;
+	}
+
+	inline void Encode(Codec codec, const uint8_t* rgb, uint32_t width, uint32_t height, std::vector<uint8_t>& out, uint32_t threads = 1)
+	{
+		EncodeTo(codec, rgb, width, height, [&](size_t size) { out.resize(size); return out.data(); }, threads);
+	}
+
+	// Decoders used to verify the encoders, RGB output only
+	// They accept the subset of each format that the encoders above produce
+
+	inline bool DecodeQOI(const uint8_t* data, size_t size, std::vector<uint8_t>& rgb, uint32_t& width, uint32_t& height)
+	{
+		using namespace Detail;
+		if (size < 14 + 8 || memcmp(data, "qoif", 4) != 0)
+			return false;
+		width = GetBE32(data + 4);
+		height = GetBE32(data + 8);
+		const uint32_t channels = data[12];
+		if (channels != 3 && channels != 4)
+			return false;
+		const size_t pixelCount = size_t(width) * height;
+		rgb.resize(3 * pixelCount);
+		uint8_t index[64][4] = {};
+		uint8_t px[4] = { 0, 0, 0, 255 };
+		size_t p = 14;
+		const size_t end = size - 8;
+		uint32_t run = 0;
+		for (size_t i = 0; i < pixelCount; ++i)
+		{
+			if (run > 0)
+			{
+				run--;
+			}
+			else
+			{
+				if (p >= end)
+					return false;
+				const uint8_t b1 = data[p++];
+				if (b1 == QOI_OP_RGB)
+				{
+					if (p + 3 > end) return false;
+					px[0] = data[p++]; px[1] = data[p++]; px[2] = data[p++];
+				}
+				else if (b1 == QOI_OP_RGBA)
+				{
+					if (p + 4 > end) return false;
+					px[0] = data[p++]; px[1] = data[p++]; px[2] = data[p++]; px[3] = data[p++];
+				}
+				else if ((b1 & 0xC0) == QOI_OP_INDEX)
+				{
+					memcpy(px, index[b1], 4);
+				}
+				else if ((b1 & 0xC0) == QOI_OP_DIFF)
+				{
+					px[0] += ((b1 >> 4) & 3) - 2;
+					px[1] += ((b1 >> 2) & 3) - 2;
+					px[2] += (b1 & 3) - 2;
+				}
+				else if ((b1 & 0xC0) == QOI_OP_LUMA)
+				{
+					if (p >= end) return false;
+					const uint8_t b2 = data[p++];
+					const int vg = (b1 & 0x3F) - 32;
+					px[0] += vg - 8 + ((b2 >> 4) & 0x0F);
+					px[1] += vg;
+					px[2] += vg - 8 + (b2 & 0x0F);
+				}
+				else
+				{
+					run = b1 & 0x3F;
+				}
+				memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px, 4);
+			}
+			memcpy(&rgb[3 * i], px, 3);
+		}
+		return true;
+	}
+
+	namespace Detail
+	{
+		class BitReader
+		{
+			const uint8_t* mData;
+			size_t mSize;
+			size_t mPos = 0;
+			uint32_t mBit = 0;
+		public:
+			BitReader(const uint8_t* data, size_t size) : mData(data), mSize(size) {}
+			bool Get(uint32_t count, uint32_t& value)
+			{
+				value = 0;
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					if (mPos >= mSize)
+						return false;
+					value |= ((mData[mPos] >> mBit) & 1u) << i;
+					if (++mBit == 8)
+					{
+						mBit = 0;
+						mPos++;
+					}
+				}
+				return true;
+			}
+			void AlignToByte()
+			{
+				if (mBit != 0)
+				{
+					mBit = 0;
+					mPos++;
+				}
+			}
+			const uint8_t* Bytes(size_t count)
+			{
+				if (mBit != 0 || mPos + count > mSize)
+					return nullptr;
+				const uint8_t* p = mData + mPos;
+				mPos += count;
+				return p;
+			}
+		};
+
+		// Fixed Huffman symbol, codes are read MSB-first
+		inline bool ReadFixedLiteral(BitReader& br, uint32_t& symbol)
+		{
+			uint32_t code = 0, bit;
+			for (uint32_t len = 1; len <= 9; ++len)
+			{
+				if (!br.Get(1, bit))
+					return false;
+				code = (code << 1) | bit;
+				if (len == 7 && code <= 0x17) { symbol = 256 + code; return true; }
+				if (len == 8 && code >= 0x30 && code <= 0xBF) { symbol = code - 0x30; return true; }
+				if (len == 8 && code >= 0xC0 && code <= 0xC7) { symbol = 280 + code - 0xC0; return true; }
+				if (len == 9 && code >= 0x190) { symbol = 144 + code - 0x190; return true; }
+			}
+			return false;
+		}
+
+		// Inflate stored and fixed Huffman blocks
+		inline bool Inflate(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+		{
+			BitReader br(data, size);
+			uint32_t final = 0, type = 0;
+			do
+			{
+				if (!br.Get(1, final) || !br.Get(2, type))
+					return false;
+				if (type == 0)
+				{
+					br.AlignToByte();
+					const uint8_t* hdr = br.Bytes(4);
+					if (!hdr)
+						return false;
+					const uint32_t len = hdr[0] | (hdr[1] << 8);
+					const uint32_t nlen = hdr[2] | (hdr[3] << 8);
+					if ((len ^ 0xFFFF) != nlen)
+						return false;
+					const uint8_t* bytes = br.Bytes(len);
+					if (!bytes && len > 0)
+						return false;
+					out.insert(out.end(), bytes, bytes + len);
+				}
+				else if (type == 1)
+				{
+					for (;;)
+					{
+						uint32_t sym, extra, dcode;
+						if (!ReadFixedLiteral(br, sym))
+							return false;
+						if (sym < 256)
+						{
+							out.push_back(static_cast<uint8_t>(sym));
+							continue;
+						}
+						if (sym == 256)
+							break;
+						if (sym > 285 || !br.Get(kLengthExtra[sym - 257], extra))
+							return false;
+						const uint32_t len = kLengthBase[sym - 257] + extra;
+						if (!br.Get(5, dcode))
+							return false;
+						dcode = ReverseBits(dcode, 5);
+						if (dcode >= 30 || !br.Get(kDistExtra[dcode], extra))
+							return false;
+						const size_t dist = kDistBase[dcode] + extra;
+						if (dist > out.size())
+							return false;
+						for (uint32_t i = 0; i < len; ++i)
+							out.push_back(out[out.size() - dist]);
+					}
+				}
+				else
+				{
+					return false; // Dynamic Huffman is not produced by the encoder
+				}
+			} while (!final);
+			return true;
+		}
+	}
+
+	inline bool DecodePNG(const uint8_t* data, size_t size, std::vector<uint8_t>& rgb, uint32_t& width, uint32_t& height)
+	{
+		using namespace Detail;
+		static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		if (size < 8 || memcmp(data, signature, 8) != 0)
+			return false;
+		std::vector<uint8_t> zlib;
+		bool hasHeader = false;
+		for (size_t p = 8; p + 12 <= size;)
+		{
+			const uint32_t len = GetBE32(data + p);
+			if (p + 12 + size_t(len) > size)
+				return false;
+			const uint8_t* type = data + p + 4;
+			const uint8_t* body = data + p + 8;
+			if (Crc32(type, size_t(len) + 4) != GetBE32(body + len))
+				return false;
+			if (!memcmp(type, "IHDR", 4))
+			{
+				if (len != 13 || body[8] != 8 || body[9] != 2 || body[12] != 0)
+					return false;
+				width = GetBE32(body);
+				height = GetBE32(body + 4);
+				hasHeader = true;
+			}
+			else if (!memcmp(type, "IDAT", 4))
+			{
+				zlib.insert(zlib.end(), body, body + len);
+			}
+			else if (!memcmp(type, "IEND", 4))
+			{
+				break;
+			}
+			p += 12 + size_t(len);
+		}
+		if (!hasHeader || zlib.size() < 6 || (zlib[0] & 0x0F) != 8 || ((zlib[0] << 8) | zlib[1]) % 31 != 0)
+			return false;
+		std::vector<uint8_t> filtered;
+		if (!Inflate(zlib.data() + 2, zlib.size() - 6, filtered))
+			return false;
+		if (Adler32(filtered.data(), filtered.size()) != GetBE32(zlib.data() + zlib.size() - 4))
+			return false;
+		const size_t rowBytes = 3ull * width;
+		if (filtered.size() != (rowBytes + 1) * height)
+			return false;
+		rgb.resize(rowBytes * height);
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			const uint8_t* src = filtered.data() + (rowBytes + 1) * y;
+			uint8_t* dst = rgb.data() + rowBytes * y;
+			const uint8_t* up = y > 0 ? dst - rowBytes : nullptr;
+			for (size_t x = 0; x < rowBytes; ++x)
+			{
+				const int a = x >= 3 ? dst[x - 3] : 0;
+				const int b = up ? up[x] : 0;
+				const int c = (up && x >= 3) ? up[x - 3] : 0;
+				int pred;
+				switch (src[0])
+				{
+				case 0: pred = 0; break;
+				case 1: pred = a; break;
+				case 2: pred = b; break;
+				case 3: pred = (a + b) / 2; break;
+				case 4:
+				{
+					const int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+					pred = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+					break;
+				}
+				default: return false;
+				}
+				dst[x] = static_cast<uint8_t>(src[1 + x] + pred);
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,265 @@
+#pragma once
+
+// Background writer for readback frames
+// The render thread hands off mapped readback memory through a bounded queue,
+// worker threads convert it into their own aligned buffers and write the files.
+// The readback memory is released as soon as the conversion is done, before encoding and disk I/O.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "PixelConvert.h"
+#include "ImageEncoder.h"
+
+class ImageWriter
+{
+public:
+	struct Job
+	{
+		std::string path;
+		const uint8_t* src = nullptr;
+		uint32_t srcPitch = 0;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		std::function<void()> onDone; // src is not referenced after this call
+	};
+
+	struct Stats
+	{
+		uint64_t frames = 0;
+		uint64_t bytes = 0;
+		uint64_t directFrames = 0;
+		double convertSeconds = 0.0;
+		double encodeSeconds = 0.0;
+		double writeSeconds = 0.0;
+		double stallSeconds = 0.0; // Producer blocked on a full queue
+	};
+
+	ImageWriter(uint32_t threadCount, uint32_t queueDepth, bool directIO = true,
+		ImageEncoder::Codec codec = ImageEncoder::Codec::PPM, uint32_t encodeThreads = 1, PixelConvert::Isa isa = PixelConvert::Isa::Auto)
+		: mQueueDepth(std::max(queueDepth, 1u)), mDirectIO(directIO), mCodec(codec), mEncodeThreads(encodeThreads), mIsa(isa)
+	{
+		threadCount = std::max(threadCount, 1u);
+		for (uint32_t i = 0; i < threadCount; ++i)
+			mThreads.emplace_back([this]() { Worker(); });
+	}
+
+	~ImageWriter()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mExit = true;
+		}
+		mCvJob.notify_all();
+		for (auto& t : mThreads)
+			t.join();
+	}
+
+	ImageWriter(const ImageWriter&) = delete;
+	ImageWriter& operator=(const ImageWriter&) = delete;
+
+	void Submit(Job&& job)
+	{
+		const auto t0 = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> lock(mMutex);
+		mCvSpace.wait(lock, [this]() { return mQueue.size() < mQueueDepth; });
+		mStats.stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		mQueue.push_back(std::move(job));
+		mPending++;
+		lock.unlock();
+		mCvJob.notify_one();
+	}
+
+	// Wait all submitted jobs, throws the first I/O error if any
+	void Flush()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mCvIdle.wait(lock, [this]() { return mPending == 0; });
+		if (!mError.empty())
+			throw std::runtime_error(mError);
+	}
+
+	Stats GetStats() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mStats;
+	}
+
+private:
+	static constexpr size_t kDirectAlign = 4096;
+
+	struct AlignedBuffer
+	{
+		uint8_t* ptr = nullptr;
+		size_t capacity = 0;
+		~AlignedBuffer() { free(ptr); }
+		void Reserve(size_t size)
+		{
+			if (size <= capacity)
+				return;
+			free(ptr);
+			capacity = (size + kDirectAlign - 1) & ~(kDirectAlign - 1);
+			if (posix_memalign(reinterpret_cast<void**>(&ptr), kDirectAlign, capacity) != 0)
+			{
+				ptr = nullptr;
+				capacity = 0;
+				throw std::bad_alloc();
+			}
+		}
+	};
+
+	void Worker()
+	{
+		AlignedBuffer buffer;
+		std::vector<uint8_t> rgb;
+		for (;;)
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCvJob.wait(lock, [this]() { return mExit || !mQueue.empty(); });
+			if (mQueue.empty())
+				return;
+			auto job = std::move(mQueue.front());
+			mQueue.pop_front();
+			lock.unlock();
+			mCvSpace.notify_one();
+
+			std::string error;
+			bool direct = false;
+			double convertSeconds = 0.0, encodeSeconds = 0.0, writeSeconds = 0.0;
+			size_t size = 0;
+			try
+			{
+				const auto t0 = std::chrono::steady_clock::now();
+				auto t1 = t0;
+				if (mCodec == ImageEncoder::Codec::PPM)
+				{
+					// PPM is converted straight into the aligned write buffer
+					const std::string header = "P6\n" + std::to_string(job.width) + " " + std::to_string(job.height) + "\n255\n";
+					size = header.size() + 3ull * job.width * job.height;
+					buffer.Reserve(size + kDirectAlign);
+					memcpy(buffer.ptr, header.data(), header.size());
+					PixelConvert::Convert(buffer.ptr + header.size(), job.src, job.srcPitch, job.width, job.height, PixelConvert::Format::RGB, mIsa);
+					if (job.onDone)
+						job.onDone();
+					job.onDone = nullptr;
+					t1 = std::chrono::steady_clock::now();
+				}
+				else
+				{
+					rgb.resize(3ull * job.width * job.height);
+					PixelConvert::Convert(rgb.data(), job.src, job.srcPitch, job.width, job.height, PixelConvert::Format::RGB, mIsa);
+					if (job.onDone)
+						job.onDone();
+					job.onDone = nullptr;
+					t1 = std::chrono::steady_clock::now();
+					// Encoded straight into the aligned write buffer
+					size = ImageEncoder::EncodeTo(mCodec, rgb.data(), job.width, job.height, [&](size_t bytes) {
+						buffer.Reserve(bytes + kDirectAlign);
+						return buffer.ptr;
+					}, mEncodeThreads);
+				}
+				const auto t2 = std::chrono::steady_clock::now();
+				direct = WriteFile(job.path, buffer, size);
+				const auto t3 = std::chrono::steady_clock::now();
+				convertSeconds = std::chrono::duration<double>(t1 - t0).count();
+				encodeSeconds = std::chrono::duration<double>(t2 - t1).count();
+				writeSeconds = std::chrono::duration<double>(t3 - t2).count();
+			}
+			catch (std::exception& e)
+			{
+				error = e.what();
+				if (job.onDone)
+					job.onDone();
+			}
+
+			lock.lock();
+			if (error.empty())
+			{
+				mStats.frames++;
+				mStats.bytes += size;
+				mStats.directFrames += direct ? 1 : 0;
+				mStats.convertSeconds += convertSeconds;
+				mStats.encodeSeconds += encodeSeconds;
+				mStats.writeSeconds += writeSeconds;
+			}
+			else if (mError.empty())
+			{
+				mError = error;
+			}
+			if (--mPending == 0)
+				mCvIdle.notify_all();
+		}
+	}
+
+	static bool WriteAll(int fd, const uint8_t* data, size_t size)
+	{
+		while (size > 0)
+		{
+			auto written = write(fd, data, size);
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written <= 0)
+				return false;
+			data += written;
+			size -= written;
+		}
+		return true;
+	}
+
+	// O_DIRECT needs block-aligned buffer and length, so write the padded buffer and truncate
+	// Falls back to a single large buffered write when the file system does not support it
+	// Returns whether O_DIRECT was used
+	bool WriteFile(const std::string& path, AlignedBuffer& buffer, size_t size)
+	{
+		if (mDirectIO)
+		{
+			int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+			if (fd >= 0)
+			{
+				const size_t padded = (size + kDirectAlign - 1) & ~(kDirectAlign - 1);
+				memset(buffer.ptr + size, 0, padded - size);
+				bool ok = WriteAll(fd, buffer.ptr, padded) && ftruncate(fd, size) == 0;
+				close(fd);
+				if (ok)
+					return true;
+			}
+		}
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			throw std::runtime_error("Cannot open image file: " + path);
+		bool ok = WriteAll(fd, buffer.ptr, size);
+		close(fd);
+		if (!ok)
+			throw std::runtime_error("Cannot write image file: " + path);
+		return false;
+	}
+
+	const uint32_t mQueueDepth;
+	const bool mDirectIO;
+	const ImageEncoder::Codec mCodec;
+	const uint32_t mEncodeThreads;
+	const PixelConvert::Isa mIsa;
+	std::vector<std::thread> mThreads;
+	mutable std::mutex mMutex;
+	std::condition_variable mCvJob;
+	std::condition_variable mCvSpace;
+	std::condition_variable mCvIdle;
+	std::deque<Job> mQueue;
+	uint32_t mPending = 0;
+	bool mExit = false;
+	std::string mError;
+	Stats mStats;
+};
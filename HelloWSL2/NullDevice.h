@@ -0,0 +1,1404 @@
+#pragma once
+
+// Recording null device for running D3D12 code without a GPU
+// Implements the base ID3D12Device, ID3D12GraphicsCommandList, ID3D12CommandQueue and ID3D12Fence
+// interfaces (plus the resources, allocators and descriptor heaps they need) on the CPU.
+// Every command is recorded into an inspectable stream, executed command lists are replayed
+// synchronously so fences complete immediately, and object/memory allocations are counted.
+// Clears and copies are emulated on CPU memory, so readback data matches what a GPU would produce
+// for simple flows such as HelloWSL2. Draws and dispatches are recorded only.
+// Not thread-safe, except Map/Unmap which do not touch shared state.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace NullDevice
+{
+	// Every ID3D12GraphicsCommandList method, in declaration order
+#define NULL_DEVICE_OPS(X) \
+	X(ClearState) X(DrawInstanced) X(DrawIndexedInstanced) X(Dispatch) \
+	X(CopyBufferRegion) X(CopyTextureRegion) X(CopyResource) X(CopyTiles) X(ResolveSubresource) \
+	X(IASetPrimitiveTopology) X(RSSetViewports) X(RSSetScissorRects) X(OMSetBlendFactor) X(OMSetStencilRef) \
+	X(SetPipelineState) X(ResourceBarrier) X(ExecuteBundle) X(SetDescriptorHeaps) \
+	X(SetComputeRootSignature) X(SetGraphicsRootSignature) \
+	X(SetComputeRootDescriptorTable) X(SetGraphicsRootDescriptorTable) \
+	X(SetComputeRoot32BitConstant) X(SetGraphicsRoot32BitConstant) \
+	X(SetComputeRoot32BitConstants) X(SetGraphicsRoot32BitConstants) \
+	X(SetComputeRootConstantBufferView) X(SetGraphicsRootConstantBufferView) \
+	X(SetComputeRootShaderResourceView) X(SetGraphicsRootShaderResourceView) \
+	X(SetComputeRootUnorderedAccessView) X(SetGraphicsRootUnorderedAccessView) \
+	X(IASetIndexBuffer) X(IASetVertexBuffers) X(SOSetTargets) X(OMSetRenderTargets) \
+	X(ClearDepthStencilView) X(ClearRenderTargetView) X(ClearUnorderedAccessViewUint) X(ClearUnorderedAccessViewFloat) \
+	X(DiscardResource) X(BeginQuery) X(EndQuery) X(ResolveQueryData) X(SetPredication) \
+	X(SetMarker) X(BeginEvent) X(EndEvent) X(ExecuteIndirect)
+
+	enum class Op : uint32_t
+	{
+#define NULL_DEVICE_ENUM(name) name,
+		NULL_DEVICE_OPS(NULL_DEVICE_ENUM)
+#undef NULL_DEVICE_ENUM
+		Count,
+	};
+
+	inline const char* OpName(Op op)
+	{
+		static const char* names[] = {
+#define NULL_DEVICE_NAME(name) #name,
+			NULL_DEVICE_OPS(NULL_DEVICE_NAME)
+#undef NULL_DEVICE_NAME
+		};
+		return op < Op::Count ? names[static_cast<uint32_t>(op)] : "Unknown";
+	}
+
+	// One recorded command
+	// Scalars are stored in declaration order, arrays and structs are copied into the list payload
+	struct Command
+	{
+		Op op = Op::ClearState;
+		uint32_t payloadOffset = 0;
+		uint32_t payloadSize = 0;
+		ID3D12Resource* resource = nullptr; // Destination or target resource
+		ID3D12Resource* source = nullptr;   // Source resource of copies, argument buffer of ExecuteIndirect
+		uint64_t args[6] = {};
+	};
+
+	struct Stats
+	{
+		uint64_t objects = 0;           // COM objects created
+		uint64_t liveObjects = 0;
+		uint64_t allocations = 0;       // CPU allocations made for objects, resource memory and command storage
+		uint64_t allocatedBytes = 0;
+		uint64_t commandsRecorded = 0;
+		uint64_t commandListsExecuted = 0;
+		uint64_t commandsExecuted = 0;
+		uint64_t signals = 0;
+		uint64_t errors = 0;            // API misuse, e.g. recording into a closed list
+		uint64_t ops[static_cast<size_t>(Op::Count)] = {}; // Executed commands per op
+	};
+
+	class Device;
+
+	namespace Detail
+	{
+		template<class T>
+		bool IsIID(REFIID riid)
+		{
+			T* p = nullptr;
+			const GUID iid = __uuidof(p);
+			return memcmp(&riid, &iid, sizeof(GUID)) == 0;
+		}
+
+		inline uint32_t BytesPerPixel(DXGI_FORMAT format)
+		{
+			switch (format)
+			{
+			case DXGI_FORMAT_R32G32B32A32_TYPELESS: case DXGI_FORMAT_R32G32B32A32_FLOAT:
+			case DXGI_FORMAT_R32G32B32A32_UINT: case DXGI_FORMAT_R32G32B32A32_SINT:
+				return 16;
+			case DXGI_FORMAT_R32G32B32_TYPELESS: case DXGI_FORMAT_R32G32B32_FLOAT:
+			case DXGI_FORMAT_R32G32B32_UINT: case DXGI_FORMAT_R32G32B32_SINT:
+				return 12;
+			case DXGI_FORMAT_R16G16B16A16_TYPELESS: case DXGI_FORMAT_R16G16B16A16_FLOAT:
+			case DXGI_FORMAT_R16G16B16A16_UNORM: case DXGI_FORMAT_R16G16B16A16_UINT:
+			case DXGI_FORMAT_R16G16B16A16_SNORM: case DXGI_FORMAT_R16G16B16A16_SINT:
+			case DXGI_FORMAT_R32G32_TYPELESS: case DXGI_FORMAT_R32G32_FLOAT:
+			case DXGI_FORMAT_R32G32_UINT: case DXGI_FORMAT_R32G32_SINT:
+				return 8;
+			case DXGI_FORMAT_R10G10B10A2_TYPELESS: case DXGI_FORMAT_R10G10B10A2_UNORM: case DXGI_FORMAT_R10G10B10A2_UINT:
+			case DXGI_FORMAT_R11G11B10_FLOAT:
+			case DXGI_FORMAT_R8G8B8A8_TYPELESS: case DXGI_FORMAT_R8G8B8A8_UNORM: case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+			case DXGI_FORMAT_R8G8B8A8_UINT: case DXGI_FORMAT_R8G8B8A8_SNORM: case DXGI_FORMAT_R8G8B8A8_SINT:
+			case DXGI_FORMAT_B8G8R8A8_TYPELESS: case DXGI_FORMAT_B8G8R8A8_UNORM: case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+			case DXGI_FORMAT_R16G16_TYPELESS: case DXGI_FORMAT_R16G16_FLOAT: case DXGI_FORMAT_R16G16_UNORM:
+			case DXGI_FORMAT_R16G16_UINT: case DXGI_FORMAT_R16G16_SNORM: case DXGI_FORMAT_R16G16_SINT:
+			case DXGI_FORMAT_R32_TYPELESS: case DXGI_FORMAT_D32_FLOAT: case DXGI_FORMAT_R32_FLOAT:
+			case DXGI_FORMAT_R32_UINT: case DXGI_FORMAT_R32_SINT: case DXGI_FORMAT_D24_UNORM_S8_UINT:
+			case DXGI_FORMAT_R24G8_TYPELESS: case DXGI_FORMAT_R24_UNORM_X8_TYPELESS:
+				return 4;
+			case DXGI_FORMAT_R16_TYPELESS: case DXGI_FORMAT_R16_FLOAT: case DXGI_FORMAT_D16_UNORM:
+			case DXGI_FORMAT_R16_UNORM: case DXGI_FORMAT_R16_UINT: case DXGI_FORMAT_R16_SNORM: case DXGI_FORMAT_R16_SINT:
+			case DXGI_FORMAT_R8G8_TYPELESS: case DXGI_FORMAT_R8G8_UNORM: case DXGI_FORMAT_R8G8_UINT:
+			case DXGI_FORMAT_R8G8_SNORM: case DXGI_FORMAT_R8G8_SINT:
+				return 2;
+			case DXGI_FORMAT_R8_TYPELESS: case DXGI_FORMAT_R8_UNORM: case DXGI_FORMAT_R8_UINT:
+			case DXGI_FORMAT_R8_SNORM: case DXGI_FORMAT_R8_SINT: case DXGI_FORMAT_A8_UNORM:
+				return 1;
+			default:
+				return 0; // Block compressed and video formats are not emulated
+			}
+		}
+
+		inline uint64_t AlignUp(uint64_t val, uint64_t align)
+		{
+			return (val + align - 1) & ~(align - 1);
+		}
+
+		inline uint32_t SubresourceCount(const D3D12_RESOURCE_DESC& desc)
+		{
+			if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+				return 1;
+			const uint32_t mips = std::max<uint32_t>(desc.MipLevels, 1);
+			const uint32_t slices = desc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE3D ? 1 : desc.DepthOrArraySize;
+			return mips * slices;
+		}
+
+		// Same layout rules as the runtime: 256 byte row pitch, 512 byte subresource placement
+		// Returns false when the format is not emulated
+		inline bool Footprints(const D3D12_RESOURCE_DESC& desc, uint32_t first, uint32_t count, uint64_t baseOffset,
+			D3D12_PLACED_SUBRESOURCE_FOOTPRINT* layouts, UINT* numRows, UINT64* rowSizes, UINT64* totalBytes)
+		{
+			if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+			{
+				if (layouts)
+					layouts[0] = { baseOffset, { DXGI_FORMAT_UNKNOWN, static_cast<UINT>(desc.Width), 1, 1, static_cast<UINT>(AlignUp(desc.Width, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT)) } };
+				if (numRows)
+					numRows[0] = 1;
+				if (rowSizes)
+					rowSizes[0] = desc.Width;
+				if (totalBytes)
+					*totalBytes = desc.Width;
+				return true;
+			}
+			const uint32_t bpp = BytesPerPixel(desc.Format);
+			if (bpp == 0 || first + count > SubresourceCount(desc))
+			{
+				if (totalBytes)
+					*totalBytes = UINT64_MAX;
+				return false;
+			}
+			const uint32_t mips = std::max<uint32_t>(desc.MipLevels, 1);
+			uint64_t offset = baseOffset;
+			uint64_t total = 0;
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				const uint32_t mip = (first + i) % mips;
+				const uint32_t w = std::max<uint32_t>(static_cast<uint32_t>(desc.Width >> mip), 1);
+				const uint32_t h = std::max<uint32_t>(desc.Height >> mip, 1);
+				const uint32_t d = desc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE3D ? std::max<uint32_t>(desc.DepthOrArraySize >> mip, 1) : 1;
+				const uint64_t rowSize = static_cast<uint64_t>(w) * bpp;
+				const uint64_t rowPitch = AlignUp(rowSize, D3D12_TEXTURE_DATA_PITCH_ALIGNMENT);
+				offset = AlignUp(offset, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+				if (layouts)
+					layouts[i] = { offset, { desc.Format, w, h, d, static_cast<UINT>(rowPitch) } };
+				if (numRows)
+					numRows[i] = h;
+				if (rowSizes)
+					rowSizes[i] = rowSize;
+				const uint64_t size = rowPitch * (static_cast<uint64_t>(h) * d - 1) + rowSize;
+				total = offset + size - baseOffset;
+				offset += size;
+			}
+			if (totalBytes)
+				*totalBytes = total;
+			return true;
+		}
+
+		inline uint8_t ToUnorm8(float v)
+		{
+			return static_cast<uint8_t>(std::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+
+		// Common IUnknown / ID3D12Object part, answers QueryInterface for Itf and all of its bases
+		template<class Itf>
+		class Object : public Itf
+		{
+		public:
+			Object(const Object&) = delete;
+			Object& operator=(const Object&) = delete;
+			virtual ~Object() = default;
+
+			HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override
+			{
+				if (!ppvObject)
+					return E_POINTER;
+				if (IsIID<IUnknown>(riid) || IsIID<ID3D12Object>(riid) || Is<ID3D12DeviceChild>(riid) ||
+					Is<ID3D12Pageable>(riid) || Is<ID3D12CommandList>(riid) || IsIID<Itf>(riid))
+				{
+					this->AddRef();
+					*ppvObject = static_cast<Itf*>(this);
+					return S_OK;
+				}
+				*ppvObject = nullptr;
+				return E_NOINTERFACE;
+			}
+			ULONG STDMETHODCALLTYPE AddRef() override
+			{
+				return ++mRefCount;
+			}
+			ULONG STDMETHODCALLTYPE Release() override
+			{
+				const auto count = --mRefCount;
+				if (count == 0)
+					delete this;
+				return count;
+			}
+			HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID, UINT*, void*) override { return E_NOTIMPL; }
+			HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID, UINT, const void*) override { return E_NOTIMPL; }
+			HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID, const IUnknown*) override { return E_NOTIMPL; }
+			HRESULT STDMETHODCALLTYPE SetName(LPCWSTR Name) override
+			{
+				mName = Name ? Name : L"";
+				return S_OK;
+			}
+
+			const std::wstring& GetName() const { return mName; }
+
+		protected:
+			Object() = default;
+
+		private:
+			template<class T>
+			static bool Is(REFIID riid)
+			{
+				if constexpr (std::is_base_of_v<T, Itf>)
+					return IsIID<T>(riid);
+				else
+					return false;
+			}
+
+			ULONG mRefCount = 1;
+			std::wstring mName;
+		};
+
+		// Device children keep their device alive and share its statistics
+		template<class Itf>
+		class Child : public Object<Itf>
+		{
+		public:
+			explicit Child(Device* device);
+			~Child() override;
+
+			HRESULT STDMETHODCALLTYPE GetDevice(REFIID riid, void** ppvDevice) override;
+
+		protected:
+			Device* mDevice;
+		};
+	}
+
+	class Resource : public Detail::Child<ID3D12Resource>
+	{
+	public:
+		Resource(Device* device, const D3D12_HEAP_PROPERTIES& heapProps, D3D12_HEAP_FLAGS heapFlags, const D3D12_RESOURCE_DESC& desc,
+			D3D12_RESOURCE_STATES initialState, D3D12_GPU_VIRTUAL_ADDRESS va);
+
+		HRESULT STDMETHODCALLTYPE Map(UINT Subresource, const D3D12_RANGE*, void** ppData) override
+		{
+			if (mDesc.Dimension != D3D12_RESOURCE_DIMENSION_BUFFER || mHeapProps.Type == D3D12_HEAP_TYPE_DEFAULT || Subresource != 0)
+				return E_INVALIDARG;
+			if (ppData)
+				*ppData = mMemory.data();
+			return S_OK;
+		}
+		void STDMETHODCALLTYPE Unmap(UINT, const D3D12_RANGE*) override
+		{
+		}
+		D3D12_RESOURCE_DESC STDMETHODCALLTYPE GetDesc() override
+		{
+			return mDesc;
+		}
+		D3D12_GPU_VIRTUAL_ADDRESS STDMETHODCALLTYPE GetGPUVirtualAddress() override
+		{
+			return mDesc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER ? mVA : 0;
+		}
+		HRESULT STDMETHODCALLTYPE WriteToSubresource(UINT DstSubresource, const D3D12_BOX* pDstBox, const void* pSrcData, UINT SrcRowPitch, UINT SrcDepthPitch) override
+		{
+			return CopyBox(DstSubresource, pDstBox, const_cast<void*>(pSrcData), SrcRowPitch, SrcDepthPitch, true);
+		}
+		HRESULT STDMETHODCALLTYPE ReadFromSubresource(void* pDstData, UINT DstRowPitch, UINT DstDepthPitch, UINT SrcSubresource, const D3D12_BOX* pSrcBox) override
+		{
+			return CopyBox(SrcSubresource, pSrcBox, pDstData, DstRowPitch, DstDepthPitch, false);
+		}
+		HRESULT STDMETHODCALLTYPE GetHeapProperties(D3D12_HEAP_PROPERTIES* pHeapProperties, D3D12_HEAP_FLAGS* pHeapFlags) override
+		{
+			if (pHeapProperties)
+				*pHeapProperties = mHeapProps;
+			if (pHeapFlags)
+				*pHeapFlags = mHeapFlags;
+			return S_OK;
+		}
+
+		// Emulation helpers
+		// Textures are stored in their copyable footprint layout, empty when the format is not emulated
+		uint8_t* Memory() { return mMemory.empty() ? nullptr : mMemory.data(); }
+		uint64_t MemorySize() const { return mMemory.size(); }
+		const D3D12_PLACED_SUBRESOURCE_FOOTPRINT* Layout(uint32_t subresource) const
+		{
+			return subresource < mLayouts.size() && !mMemory.empty() ? &mLayouts[subresource] : nullptr;
+		}
+		D3D12_RESOURCE_STATES State() const { return mState; }
+		void SetState(D3D12_RESOURCE_STATES state) { mState = state; }
+
+	private:
+		HRESULT CopyBox(uint32_t subresource, const D3D12_BOX* box, void* data, uint32_t rowPitch, uint32_t depthPitch, bool write)
+		{
+			const auto* layout = Layout(subresource);
+			if (!layout || !data || mDesc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+				return E_INVALIDARG;
+			const auto& fp = layout->Footprint;
+			const D3D12_BOX full = { 0, 0, 0, fp.Width, fp.Height, fp.Depth };
+			const auto& b = box ? *box : full;
+			if (b.right > fp.Width || b.bottom > fp.Height || b.back > fp.Depth || b.left >= b.right || b.top >= b.bottom || b.front >= b.back)
+				return E_INVALIDARG;
+			const uint32_t bpp = Detail::BytesPerPixel(fp.Format);
+			const size_t rowBytes = static_cast<size_t>(b.right - b.left) * bpp;
+			for (uint32_t z = b.front; z < b.back; ++z)
+			{
+				for (uint32_t y = b.top; y < b.bottom; ++y)
+				{
+					uint8_t* mem = mMemory.data() + layout->Offset + (static_cast<uint64_t>(z) * fp.Height + y) * fp.RowPitch + static_cast<uint64_t>(b.left) * bpp;
+					uint8_t* user = static_cast<uint8_t*>(data) + static_cast<size_t>(z - b.front) * depthPitch + static_cast<size_t>(y - b.top) * rowPitch;
+					if (write)
+						memcpy(mem, user, rowBytes);
+					else
+						memcpy(user, mem, rowBytes);
+				}
+			}
+			return S_OK;
+		}
+
+		D3D12_HEAP_PROPERTIES mHeapProps;
+		D3D12_HEAP_FLAGS mHeapFlags;
+		D3D12_RESOURCE_DESC mDesc;
+		D3D12_RESOURCE_STATES mState;
+		D3D12_GPU_VIRTUAL_ADDRESS mVA;
+		std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> mLayouts;
+		std::vector<uint8_t> mMemory;
+	};
+
+	class DescriptorHeap : public Detail::Child<ID3D12DescriptorHeap>
+	{
+	public:
+		// Descriptors only remember the resource they view
+		struct Descriptor
+		{
+			Resource* resource = nullptr;
+			D3D12_DESCRIPTOR_HEAP_TYPE type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+			uint32_t mipSlice = 0;
+			uint64_t reserved = 0;
+			D3D12_GPU_VIRTUAL_ADDRESS bufferLocation = 0; // Constant buffer views
+		};
+		static constexpr uint32_t kDescriptorSize = sizeof(Descriptor);
+
+		DescriptorHeap(Device* device, const D3D12_DESCRIPTOR_HEAP_DESC& desc, D3D12_GPU_VIRTUAL_ADDRESS gpuBase);
+
+		D3D12_DESCRIPTOR_HEAP_DESC STDMETHODCALLTYPE GetDesc() override
+		{
+			return mDesc;
+		}
+		D3D12_CPU_DESCRIPTOR_HANDLE STDMETHODCALLTYPE GetCPUDescriptorHandleForHeapStart() override
+		{
+			return { reinterpret_cast<SIZE_T>(mDescriptors.data()) };
+		}
+		D3D12_GPU_DESCRIPTOR_HANDLE STDMETHODCALLTYPE GetGPUDescriptorHandleForHeapStart() override
+		{
+			return { (mDesc.Flags & D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE) ? mGpuBase : 0 };
+		}
+
+		static Descriptor* FromHandle(D3D12_CPU_DESCRIPTOR_HANDLE handle)
+		{
+			return reinterpret_cast<Descriptor*>(handle.ptr);
+		}
+
+	private:
+		D3D12_DESCRIPTOR_HEAP_DESC mDesc;
+		D3D12_GPU_VIRTUAL_ADDRESS mGpuBase;
+		std::vector<Descriptor> mDescriptors;
+	};
+
+	class CommandAllocator : public Detail::Child<ID3D12CommandAllocator>
+	{
+	public:
+		CommandAllocator(Device* device, D3D12_COMMAND_LIST_TYPE type) : Child(device), mType(type) {}
+
+		HRESULT STDMETHODCALLTYPE Reset() override
+		{
+			return S_OK;
+		}
+
+		D3D12_COMMAND_LIST_TYPE Type() const { return mType; }
+
+	private:
+		D3D12_COMMAND_LIST_TYPE mType;
+	};
+
+	class RootSignature : public Detail::Child<ID3D12RootSignature>
+	{
+	public:
+		RootSignature(Device* device, const void* blob, size_t size)
+			: Child(device), mBlob(static_cast<const uint8_t*>(blob), static_cast<const uint8_t*>(blob) + size) {}
+
+	private:
+		std::vector<uint8_t> mBlob;
+	};
+
+	class PipelineState : public Detail::Child<ID3D12PipelineState>
+	{
+	public:
+		PipelineState(Device* device, ID3D12RootSignature* rootSignature) : Child(device), mRootSignature(rootSignature) {}
+
+		HRESULT STDMETHODCALLTYPE GetCachedBlob(ID3DBlob** ppBlob) override
+		{
+			if (ppBlob)
+				*ppBlob = nullptr;
+			return E_NOTIMPL;
+		}
+
+	private:
+		ID3D12RootSignature* mRootSignature;
+	};
+
+	class GraphicsCommandList : public Detail::Child<ID3D12GraphicsCommandList>
+	{
+	public:
+		GraphicsCommandList(Device* device, D3D12_COMMAND_LIST_TYPE type) : Child(device), mType(type) {}
+
+		// Recorded stream, valid until the next Reset
+		const std::vector<Command>& GetCommands() const { return mCommands; }
+		const uint8_t* GetPayload(const Command& cmd) const { return mPayload.data() + cmd.payloadOffset; }
+		template<class T>
+		const T* GetPayload(const Command& cmd) const { return reinterpret_cast<const T*>(GetPayload(cmd)); }
+		bool IsClosed() const { return mClosed; }
+
+		D3D12_COMMAND_LIST_TYPE STDMETHODCALLTYPE GetType() override
+		{
+			return mType;
+		}
+		HRESULT STDMETHODCALLTYPE Close() override;
+		HRESULT STDMETHODCALLTYPE Reset(ID3D12CommandAllocator* pAllocator, ID3D12PipelineState* pInitialState) override;
+		void STDMETHODCALLTYPE ClearState(ID3D12PipelineState* pPipelineState) override
+		{
+			Push(Op::ClearState, nullptr, nullptr, { Handle(pPipelineState) });
+		}
+		void STDMETHODCALLTYPE DrawInstanced(UINT VertexCountPerInstance, UINT InstanceCount, UINT StartVertexLocation, UINT StartInstanceLocation) override
+		{
+			Push(Op::DrawInstanced, nullptr, nullptr, { VertexCountPerInstance, InstanceCount, StartVertexLocation, StartInstanceLocation });
+		}
+		void STDMETHODCALLTYPE DrawIndexedInstanced(UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation, INT BaseVertexLocation, UINT StartInstanceLocation) override
+		{
+			Push(Op::DrawIndexedInstanced, nullptr, nullptr, { IndexCountPerInstance, InstanceCount, StartIndexLocation, static_cast<uint64_t>(static_cast<int64_t>(BaseVertexLocation)), StartInstanceLocation });
+		}
+		void STDMETHODCALLTYPE Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ) override
+		{
+			Push(Op::Dispatch, nullptr, nullptr, { ThreadGroupCountX, ThreadGroupCountY, ThreadGroupCountZ });
+		}
+		void STDMETHODCALLTYPE CopyBufferRegion(ID3D12Resource* pDstBuffer, UINT64 DstOffset, ID3D12Resource* pSrcBuffer, UINT64 SrcOffset, UINT64 NumBytes) override
+		{
+			Push(Op::CopyBufferRegion, pDstBuffer, pSrcBuffer, { DstOffset, SrcOffset, NumBytes });
+		}
+		// Payload: dst location, src location, optional box
+		void STDMETHODCALLTYPE CopyTextureRegion(const D3D12_TEXTURE_COPY_LOCATION* pDst, UINT DstX, UINT DstY, UINT DstZ, const D3D12_TEXTURE_COPY_LOCATION* pSrc, const D3D12_BOX* pSrcBox) override
+		{
+			if (!pDst || !pSrc)
+			{
+				mError = true;
+				return;
+			}
+			D3D12_TEXTURE_COPY_LOCATION locs[2] = { *pDst, *pSrc };
+			D3D12_BOX box = pSrcBox ? *pSrcBox : D3D12_BOX{};
+			auto& cmd = Push(Op::CopyTextureRegion, pDst->pResource, pSrc->pResource, { DstX, DstY, DstZ, pSrcBox ? 1u : 0u }, locs, sizeof(locs));
+			Append(cmd, &box, sizeof(box));
+		}
+		void STDMETHODCALLTYPE CopyResource(ID3D12Resource* pDstResource, ID3D12Resource* pSrcResource) override
+		{
+			Push(Op::CopyResource, pDstResource, pSrcResource);
+		}
+		void STDMETHODCALLTYPE CopyTiles(ID3D12Resource* pTiledResource, const D3D12_TILED_RESOURCE_COORDINATE*, const D3D12_TILE_REGION_SIZE*, ID3D12Resource* pBuffer, UINT64 BufferStartOffsetInBytes, D3D12_TILE_COPY_FLAGS Flags) override
+		{
+			Push(Op::CopyTiles, pTiledResource, pBuffer, { BufferStartOffsetInBytes, static_cast<uint64_t>(Flags) });
+		}
+		void STDMETHODCALLTYPE ResolveSubresource(ID3D12Resource* pDstResource, UINT DstSubresource, ID3D12Resource* pSrcResource, UINT SrcSubresource, DXGI_FORMAT Format) override
+		{
+			Push(Op::ResolveSubresource, pDstResource, pSrcResource, { DstSubresource, SrcSubresource, static_cast<uint64_t>(Format) });
+		}
+		void STDMETHODCALLTYPE IASetPrimitiveTopology(D3D12_PRIMITIVE_TOPOLOGY PrimitiveTopology) override
+		{
+			Push(Op::IASetPrimitiveTopology, nullptr, nullptr, { static_cast<uint64_t>(PrimitiveTopology) });
+		}
+		void STDMETHODCALLTYPE RSSetViewports(UINT NumViewports, const D3D12_VIEWPORT* pViewports) override
+		{
+			Push(Op::RSSetViewports, nullptr, nullptr, { NumViewports }, pViewports, sizeof(D3D12_VIEWPORT) * NumViewports);
+		}
+		void STDMETHODCALLTYPE RSSetScissorRects(UINT NumRects, const D3D12_RECT* pRects) override
+		{
+			Push(Op::RSSetScissorRects, nullptr, nullptr, { NumRects }, pRects, sizeof(D3D12_RECT) * NumRects);
+		}
+		void STDMETHODCALLTYPE OMSetBlendFactor(const FLOAT BlendFactor[4]) override
+		{
+			Push(Op::OMSetBlendFactor, nullptr, nullptr, {}, BlendFactor, BlendFactor ? sizeof(FLOAT) * 4 : 0);
+		}
+		void STDMETHODCALLTYPE OMSetStencilRef(UINT StencilRef) override
+		{
+			Push(Op::OMSetStencilRef, nullptr, nullptr, { StencilRef });
+		}
+		void STDMETHODCALLTYPE SetPipelineState(ID3D12PipelineState* pPipelineState) override
+		{
+			Push(Op::SetPipelineState, nullptr, nullptr, { Handle(pPipelineState) });
+		}
+		// One command per barrier, payload holds the barrier itself
+		void STDMETHODCALLTYPE ResourceBarrier(UINT NumBarriers, const D3D12_RESOURCE_BARRIER* pBarriers) override
+		{
+			for (UINT i = 0; i < NumBarriers; ++i)
+			{
+				const auto& b = pBarriers[i];
+				ID3D12Resource* res = b.Type == D3D12_RESOURCE_BARRIER_TYPE_TRANSITION ? b.Transition.pResource
+					: b.Type == D3D12_RESOURCE_BARRIER_TYPE_ALIASING ? b.Aliasing.pResourceAfter : b.UAV.pResource;
+				Push(Op::ResourceBarrier, res, nullptr, { static_cast<uint64_t>(b.Type), static_cast<uint64_t>(b.Flags) }, &b, sizeof(b));
+			}
+		}
+		void STDMETHODCALLTYPE ExecuteBundle(ID3D12GraphicsCommandList* pCommandList) override
+		{
+			Push(Op::ExecuteBundle, nullptr, nullptr, { Handle(pCommandList) });
+		}
+		void STDMETHODCALLTYPE SetDescriptorHeaps(UINT NumDescriptorHeaps, ID3D12DescriptorHeap* const* ppDescriptorHeaps) override
+		{
+			Push(Op::SetDescriptorHeaps, nullptr, nullptr, { NumDescriptorHeaps }, ppDescriptorHeaps, sizeof(void*) * NumDescriptorHeaps);
+		}
+		void STDMETHODCALLTYPE SetComputeRootSignature(ID3D12RootSignature* pRootSignature) override
+		{
+			Push(Op::SetComputeRootSignature, nullptr, nullptr, { Handle(pRootSignature) });
+		}
+		void STDMETHODCALLTYPE SetGraphicsRootSignature(ID3D12RootSignature* pRootSignature) override
+		{
+			Push(Op::SetGraphicsRootSignature, nullptr, nullptr, { Handle(pRootSignature) });
+		}
+		void STDMETHODCALLTYPE SetComputeRootDescriptorTable(UINT RootParameterIndex, D3D12_GPU_DESCRIPTOR_HANDLE BaseDescriptor) override
+		{
+			Push(Op::SetComputeRootDescriptorTable, nullptr, nullptr, { RootParameterIndex, BaseDescriptor.ptr });
+		}
+		void STDMETHODCALLTYPE SetGraphicsRootDescriptorTable(UINT RootParameterIndex, D3D12_GPU_DESCRIPTOR_HANDLE BaseDescriptor) override
+		{
+			Push(Op::SetGraphicsRootDescriptorTable, nullptr, nullptr, { RootParameterIndex, BaseDescriptor.ptr });
+		}
+		void STDMETHODCALLTYPE SetComputeRoot32BitConstant(UINT RootParameterIndex, UINT SrcData, UINT DestOffsetIn32BitValues) override
+		{
+			Push(Op::SetComputeRoot32BitConstant, nullptr, nullptr, { RootParameterIndex, SrcData, DestOffsetIn32BitValues });
+		}
+		void STDMETHODCALLTYPE SetGraphicsRoot32BitConstant(UINT RootParameterIndex, UINT SrcData, UINT DestOffsetIn32BitValues) override
+		{
+			Push(Op::SetGraphicsRoot32BitConstant, nullptr, nullptr, { RootParameterIndex, SrcData, DestOffsetIn32BitValues });
+		}
+		void STDMETHODCALLTYPE SetComputeRoot32BitConstants(UINT RootParameterIndex, UINT Num32BitValuesToSet, const void* pSrcData, UINT DestOffsetIn32BitValues) override
+		{
+			Push(Op::SetComputeRoot32BitConstants, nullptr, nullptr, { RootParameterIndex, Num32BitValuesToSet, DestOffsetIn32BitValues }, pSrcData, 4 * Num32BitValuesToSet);
+		}
+		void STDMETHODCALLTYPE SetGraphicsRoot32BitConstants(UINT RootParameterIndex, UINT Num32BitValuesToSet, const void* pSrcData, UINT DestOffsetIn32BitValues) override
+		{
+			Push(Op::SetGraphicsRoot32BitConstants, nullptr, nullptr, { RootParameterIndex, Num32BitValuesToSet, DestOffsetIn32BitValues }, pSrcData, 4 * Num32BitValuesToSet);
+		}
+		void STDMETHODCALLTYPE SetComputeRootConstantBufferView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override
+		{
+			Push(Op::SetComputeRootConstantBufferView, nullptr, nullptr, { RootParameterIndex, BufferLocation });
+		}
+		void STDMETHODCALLTYPE SetGraphicsRootConstantBufferView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override
+		{
+			Push(Op::SetGraphicsRootConstantBufferView, nullptr, nullptr, { RootParameterIndex, BufferLocation });
+		}
+		void STDMETHODCALLTYPE SetComputeRootShaderResourceView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override
+		{
+			Push(Op::SetComputeRootShaderResourceView, nullptr, nullptr, { RootParameterIndex, BufferLocation });
+		}
+		void STDMETHODCALLTYPE SetGraphicsRootShaderResourceView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override
+		{
+			Push(Op::SetGraphicsRootShaderResourceView, nullptr, nullptr, { RootParameterIndex, BufferLocation });
+		}
+		void STDMETHODCALLTYPE SetComputeRootUnorderedAccessView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override
+		{
+			Push(Op::SetComputeRootUnorderedAccessView, nullptr, nullptr, { RootParameterIndex, BufferLocation });
+		}
+		void STDMETHODCALLTYPE SetGraphicsRootUnorderedAccessView(UINT RootParameterIndex, D3D12_GPU_VIRTUAL_ADDRESS BufferLocation) override
+		{
+			Push(Op::SetGraphicsRootUnorderedAccessView, nullptr, nullptr, { RootParameterIndex, BufferLocation });
+		}
+		void STDMETHODCALLTYPE IASetIndexBuffer(const D3D12_INDEX_BUFFER_VIEW* pView) override
+		{
+			Push(Op::IASetIndexBuffer, nullptr, nullptr, {}, pView, pView ? sizeof(*pView) : 0);
+		}
+		void STDMETHODCALLTYPE IASetVertexBuffers(UINT StartSlot, UINT NumViews, const D3D12_VERTEX_BUFFER_VIEW* pViews) override
+		{
+			Push(Op::IASetVertexBuffers, nullptr, nullptr, { StartSlot, NumViews }, pViews, pViews ? sizeof(*pViews) * NumViews : 0);
+		}
+		void STDMETHODCALLTYPE SOSetTargets(UINT StartSlot, UINT NumViews, const D3D12_STREAM_OUTPUT_BUFFER_VIEW* pViews) override
+		{
+			Push(Op::SOSetTargets, nullptr, nullptr, { StartSlot, NumViews }, pViews, pViews ? sizeof(*pViews) * NumViews : 0);
+		}
+		// Payload: render target handles, then the depth stencil handle if any
+		void STDMETHODCALLTYPE OMSetRenderTargets(UINT NumRenderTargetDescriptors, const D3D12_CPU_DESCRIPTOR_HANDLE* pRenderTargetDescriptors, BOOL RTsSingleHandleToDescriptorRange, const D3D12_CPU_DESCRIPTOR_HANDLE* pDepthStencilDescriptor) override
+		{
+			const UINT numHandles = pRenderTargetDescriptors ? (RTsSingleHandleToDescriptorRange ? 1 : NumRenderTargetDescriptors) : 0;
+			auto& cmd = Push(Op::OMSetRenderTargets, nullptr, nullptr, { NumRenderTargetDescriptors, static_cast<uint64_t>(RTsSingleHandleToDescriptorRange), pDepthStencilDescriptor ? 1u : 0u },
+				pRenderTargetDescriptors, sizeof(D3D12_CPU_DESCRIPTOR_HANDLE) * numHandles);
+			if (pDepthStencilDescriptor)
+				Append(cmd, pDepthStencilDescriptor, sizeof(*pDepthStencilDescriptor));
+		}
+		void STDMETHODCALLTYPE ClearDepthStencilView(D3D12_CPU_DESCRIPTOR_HANDLE DepthStencilView, D3D12_CLEAR_FLAGS ClearFlags, FLOAT Depth, UINT8 Stencil, UINT NumRects, const D3D12_RECT* pRects) override
+		{
+			uint32_t depthBits;
+			memcpy(&depthBits, &Depth, sizeof(depthBits));
+			Push(Op::ClearDepthStencilView, ViewResource(DepthStencilView), nullptr, { DepthStencilView.ptr, static_cast<uint64_t>(ClearFlags), depthBits, Stencil, NumRects }, pRects, sizeof(D3D12_RECT) * NumRects);
+		}
+		// Payload: color, then rects
+		void STDMETHODCALLTYPE ClearRenderTargetView(D3D12_CPU_DESCRIPTOR_HANDLE RenderTargetView, const FLOAT ColorRGBA[4], UINT NumRects, const D3D12_RECT* pRects) override
+		{
+			auto& cmd = Push(Op::ClearRenderTargetView, ViewResource(RenderTargetView), nullptr, { RenderTargetView.ptr, NumRects }, ColorRGBA, sizeof(FLOAT) * 4);
+			Append(cmd, pRects, sizeof(D3D12_RECT) * NumRects);
+		}
+		void STDMETHODCALLTYPE ClearUnorderedAccessViewUint(D3D12_GPU_DESCRIPTOR_HANDLE ViewGPUHandleInCurrentHeap, D3D12_CPU_DESCRIPTOR_HANDLE ViewCPUHandle, ID3D12Resource* pResource, const UINT Values[4], UINT NumRects, const D3D12_RECT* pRects) override
+		{
+			auto& cmd = Push(Op::ClearUnorderedAccessViewUint, pResource, nullptr, { ViewGPUHandleInCurrentHeap.ptr, ViewCPUHandle.ptr, NumRects }, Values, sizeof(UINT) * 4);
+			Append(cmd, pRects, sizeof(D3D12_RECT) * NumRects);
+		}
+		void STDMETHODCALLTYPE ClearUnorderedAccessViewFloat(D3D12_GPU_DESCRIPTOR_HANDLE ViewGPUHandleInCurrentHeap, D3D12_CPU_DESCRIPTOR_HANDLE ViewCPUHandle, ID3D12Resource* pResource, const FLOAT Values[4], UINT NumRects, const D3D12_RECT* pRects) override
+		{
+			auto& cmd = Push(Op::ClearUnorderedAccessViewFloat, pResource, nullptr, { ViewGPUHandleInCurrentHeap.ptr, ViewCPUHandle.ptr, NumRects }, Values, sizeof(FLOAT) * 4);
+			Append(cmd, pRects, sizeof(D3D12_RECT) * NumRects);
+		}
+		void STDMETHODCALLTYPE DiscardResource(ID3D12Resource* pResource, const D3D12_DISCARD_REGION* pRegion) override
+		{
+			Push(Op::DiscardResource, pResource, nullptr, {}, pRegion, pRegion ? sizeof(*pRegion) : 0);
+		}
+		void STDMETHODCALLTYPE BeginQuery(ID3D12QueryHeap* pQueryHeap, D3D12_QUERY_TYPE Type, UINT Index) override
+		{
+			Push(Op::BeginQuery, nullptr, nullptr, { Handle(pQueryHeap), static_cast<uint64_t>(Type), Index });
+		}
+		void STDMETHODCALLTYPE EndQuery(ID3D12QueryHeap* pQueryHeap, D3D12_QUERY_TYPE Type, UINT Index) override
+		{
+			Push(Op::EndQuery, nullptr, nullptr, { Handle(pQueryHeap), static_cast<uint64_t>(Type), Index });
+		}
+		void STDMETHODCALLTYPE ResolveQueryData(ID3D12QueryHeap* pQueryHeap, D3D12_QUERY_TYPE Type, UINT StartIndex, UINT NumQueries, ID3D12Resource* pDestinationBuffer, UINT64 AlignedDestinationBufferOffset) override
+		{
+			Push(Op::ResolveQueryData, pDestinationBuffer, nullptr, { Handle(pQueryHeap), static_cast<uint64_t>(Type), StartIndex, NumQueries, AlignedDestinationBufferOffset });
+		}
+		void STDMETHODCALLTYPE SetPredication(ID3D12Resource* pBuffer, UINT64 AlignedBufferOffset, D3D12_PREDICATION_OP Operation) override
+		{
+			Push(Op::SetPredication, pBuffer, nullptr, { AlignedBufferOffset, static_cast<uint64_t>(Operation) });
+		}
+		void STDMETHODCALLTYPE SetMarker(UINT Metadata, const void* pData, UINT Size) override
+		{
+			Push(Op::SetMarker, nullptr, nullptr, { Metadata }, pData, pData ? Size : 0);
+		}
+		void STDMETHODCALLTYPE BeginEvent(UINT Metadata, const void* pData, UINT Size) override
+		{
+			Push(Op::BeginEvent, nullptr, nullptr, { Metadata }, pData, pData ? Size : 0);
+		}
+		void STDMETHODCALLTYPE EndEvent() override
+		{
+			Push(Op::EndEvent);
+		}
+		void STDMETHODCALLTYPE ExecuteIndirect(ID3D12CommandSignature* pCommandSignature, UINT MaxCommandCount, ID3D12Resource* pArgumentBuffer, UINT64 ArgumentBufferOffset, ID3D12Resource* pCountBuffer, UINT64 CountBufferOffset) override
+		{
+			Push(Op::ExecuteIndirect, pCountBuffer, pArgumentBuffer, { Handle(pCommandSignature), MaxCommandCount, ArgumentBufferOffset, CountBufferOffset });
+		}
+
+	private:
+		static uint64_t Handle(const void* p)
+		{
+			return reinterpret_cast<uintptr_t>(p);
+		}
+		static ID3D12Resource* ViewResource(D3D12_CPU_DESCRIPTOR_HANDLE handle)
+		{
+			return handle.ptr ? DescriptorHeap::FromHandle(handle)->resource : nullptr;
+		}
+
+		Command& Push(Op op, ID3D12Resource* resource = nullptr, ID3D12Resource* source = nullptr,
+			std::initializer_list<uint64_t> args = {}, const void* payload = nullptr, size_t payloadSize = 0);
+		void Append(Command& cmd, const void* payload, size_t size);
+
+		D3D12_COMMAND_LIST_TYPE mType;
+		std::vector<Command> mCommands;
+		std::vector<uint8_t> mPayload;
+		bool mClosed = true;
+		bool mError = false;
+	};
+
+	class Fence : public Detail::Child<ID3D12Fence>
+	{
+	public:
+		Fence(Device* device, uint64_t initialValue) : Child(device), mValue(initialValue) {}
+
+		UINT64 STDMETHODCALLTYPE GetCompletedValue() override
+		{
+			return mValue;
+		}
+		// Work is already done when the queue signals, so there is nothing to wait for
+		// A value that nobody signaled would block forever, report it instead
+		HRESULT STDMETHODCALLTYPE SetEventOnCompletion(UINT64 Value, HANDLE) override
+		{
+			return Value <= mValue ? S_OK : E_INVALIDARG;
+		}
+		HRESULT STDMETHODCALLTYPE Signal(UINT64 Value) override
+		{
+			mValue = Value;
+			return S_OK;
+		}
+
+	private:
+		uint64_t mValue;
+	};
+
+	class CommandQueue : public Detail::Child<ID3D12CommandQueue>
+	{
+	public:
+		CommandQueue(Device* device, const D3D12_COMMAND_QUEUE_DESC& desc) : Child(device), mDesc(desc) {}
+
+		void STDMETHODCALLTYPE UpdateTileMappings(ID3D12Resource*, UINT, const D3D12_TILED_RESOURCE_COORDINATE*, const D3D12_TILE_REGION_SIZE*, ID3D12Heap*,
+			UINT, const D3D12_TILE_RANGE_FLAGS*, const UINT*, const UINT*, D3D12_TILE_MAPPING_FLAGS) override
+		{
+		}
+		void STDMETHODCALLTYPE CopyTileMappings(ID3D12Resource*, const D3D12_TILED_RESOURCE_COORDINATE*, ID3D12Resource*, const D3D12_TILED_RESOURCE_COORDINATE*,
+			const D3D12_TILE_REGION_SIZE*, D3D12_TILE_MAPPING_FLAGS) override
+		{
+		}
+		void STDMETHODCALLTYPE ExecuteCommandLists(UINT NumCommandLists, ID3D12CommandList* const* ppCommandLists) override;
+		void STDMETHODCALLTYPE SetMarker(UINT, const void*, UINT) override
+		{
+		}
+		void STDMETHODCALLTYPE BeginEvent(UINT, const void*, UINT) override
+		{
+		}
+		void STDMETHODCALLTYPE EndEvent() override
+		{
+		}
+		HRESULT STDMETHODCALLTYPE Signal(ID3D12Fence* pFence, UINT64 Value) override;
+		HRESULT STDMETHODCALLTYPE Wait(ID3D12Fence* pFence, UINT64 Value) override
+		{
+			// Cross-queue waits are satisfied unless nobody ever signals the value
+			return pFence && pFence->GetCompletedValue() >= Value ? S_OK : E_INVALIDARG;
+		}
+		HRESULT STDMETHODCALLTYPE GetTimestampFrequency(UINT64* pFrequency) override
+		{
+			if (!pFrequency)
+				return E_POINTER;
+			*pFrequency = 1000000000;
+			return S_OK;
+		}
+		HRESULT STDMETHODCALLTYPE GetClockCalibration(UINT64* pGpuTimestamp, UINT64* pCpuTimestamp) override
+		{
+			if (pGpuTimestamp)
+				*pGpuTimestamp = 0;
+			if (pCpuTimestamp)
+				*pCpuTimestamp = 0;
+			return S_OK;
+		}
+		D3D12_COMMAND_QUEUE_DESC STDMETHODCALLTYPE GetDesc() override
+		{
+			return mDesc;
+		}
+
+	private:
+		void Replay(const GraphicsCommandList& list);
+		void ClearRenderTarget(Resource* res, uint32_t mip, const float color[4], const D3D12_RECT* rects, uint32_t numRects);
+		void CopyTextureRegion(const Command& cmd, const D3D12_TEXTURE_COPY_LOCATION* locs, const D3D12_BOX* box);
+
+		D3D12_COMMAND_QUEUE_DESC mDesc;
+	};
+
+	class Device : public Detail::Object<ID3D12Device>
+	{
+	public:
+		Device() = default;
+
+		// Counters for every object and command, reset with ResetStats
+		const Stats& GetStats() const { return mStats; }
+		Stats& MutableStats() { return mStats; }
+		void ResetStats()
+		{
+			const auto live = mStats.liveObjects;
+			mStats = {};
+			mStats.liveObjects = live;
+		}
+		// Executed op sequence over all queues, only kept while tracing is enabled
+		void SetTrace(bool enable) { mTracing = enable; }
+		const std::vector<Op>& GetTrace() const { return mTrace; }
+		void ClearTrace() { mTrace.clear(); }
+		void AppendTrace(Op op)
+		{
+			if (mTracing)
+				mTrace.push_back(op);
+		}
+
+		// Fake GPU addresses, 64KB apart like real allocations
+		D3D12_GPU_VIRTUAL_ADDRESS AllocateVA(uint64_t size)
+		{
+			const auto va = mNextVA;
+			mNextVA += Detail::AlignUp(std::max<uint64_t>(size, 1), D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
+			return va;
+		}
+		void OnCreate(size_t bytes)
+		{
+			mStats.objects++;
+			mStats.liveObjects++;
+			mStats.allocations++;
+			mStats.allocatedBytes += bytes;
+		}
+		void OnDestroy()
+		{
+			mStats.liveObjects--;
+		}
+
+		UINT STDMETHODCALLTYPE GetNodeCount() override
+		{
+			return 1;
+		}
+		HRESULT STDMETHODCALLTYPE CreateCommandQueue(const D3D12_COMMAND_QUEUE_DESC* pDesc, REFIID riid, void** ppCommandQueue) override
+		{
+			if (!pDesc)
+				return E_INVALIDARG;
+			return Output(new CommandQueue(this, *pDesc), riid, ppCommandQueue);
+		}
+		HRESULT STDMETHODCALLTYPE CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE type, REFIID riid, void** ppCommandAllocator) override
+		{
+			return Output(new CommandAllocator(this, type), riid, ppCommandAllocator);
+		}
+		HRESULT STDMETHODCALLTYPE CreateGraphicsPipelineState(const D3D12_GRAPHICS_PIPELINE_STATE_DESC* pDesc, REFIID riid, void** ppPipelineState) override
+		{
+			if (!pDesc)
+				return E_INVALIDARG;
+			return Output(new PipelineState(this, pDesc->pRootSignature), riid, ppPipelineState);
+		}
+		HRESULT STDMETHODCALLTYPE CreateComputePipelineState(const D3D12_COMPUTE_PIPELINE_STATE_DESC* pDesc, REFIID riid, void** ppPipelineState) override
+		{
+			if (!pDesc)
+				return E_INVALIDARG;
+			return Output(new PipelineState(this, pDesc->pRootSignature), riid, ppPipelineState);
+		}
+		HRESULT STDMETHODCALLTYPE CreateCommandList(UINT, D3D12_COMMAND_LIST_TYPE type, ID3D12CommandAllocator* pCommandAllocator, ID3D12PipelineState* pInitialState, REFIID riid, void** ppCommandList) override
+		{
+			if (!pCommandAllocator)
+				return E_INVALIDARG;
+			auto* list = new GraphicsCommandList(this, type);
+			list->Reset(pCommandAllocator, pInitialState);
+			return Output(list, riid, ppCommandList);
+		}
+		HRESULT STDMETHODCALLTYPE CheckFeatureSupport(D3D12_FEATURE, void*, UINT) override
+		{
+			return E_NOTIMPL;
+		}
+		HRESULT STDMETHODCALLTYPE CreateDescriptorHeap(const D3D12_DESCRIPTOR_HEAP_DESC* pDescriptorHeapDesc, REFIID riid, void** ppvHeap) override
+		{
+			if (!pDescriptorHeapDesc || pDescriptorHeapDesc->NumDescriptors == 0)
+				return E_INVALIDARG;
+			const auto gpuBase = AllocateVA(static_cast<uint64_t>(DescriptorHeap::kDescriptorSize) * pDescriptorHeapDesc->NumDescriptors);
+			return Output(new DescriptorHeap(this, *pDescriptorHeapDesc, gpuBase), riid, ppvHeap);
+		}
+		UINT STDMETHODCALLTYPE GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE) override
+		{
+			return DescriptorHeap::kDescriptorSize;
+		}
+		HRESULT STDMETHODCALLTYPE CreateRootSignature(UINT, const void* pBlobWithRootSignature, SIZE_T blobLengthInBytes, REFIID riid, void** ppvRootSignature) override
+		{
+			if (!pBlobWithRootSignature)
+				return E_INVALIDARG;
+			return Output(new RootSignature(this, pBlobWithRootSignature, blobLengthInBytes), riid, ppvRootSignature);
+		}
+		void STDMETHODCALLTYPE CreateConstantBufferView(const D3D12_CONSTANT_BUFFER_VIEW_DESC* pDesc, D3D12_CPU_DESCRIPTOR_HANDLE DestDescriptor) override
+		{
+			WriteDescriptor(DestDescriptor, nullptr, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, 0, pDesc ? pDesc->BufferLocation : 0);
+		}
+		void STDMETHODCALLTYPE CreateShaderResourceView(ID3D12Resource* pResource, const D3D12_SHADER_RESOURCE_VIEW_DESC*, D3D12_CPU_DESCRIPTOR_HANDLE DestDescriptor) override
+		{
+			WriteDescriptor(DestDescriptor, pResource, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, 0);
+		}
+		void STDMETHODCALLTYPE CreateUnorderedAccessView(ID3D12Resource* pResource, ID3D12Resource*, const D3D12_UNORDERED_ACCESS_VIEW_DESC*, D3D12_CPU_DESCRIPTOR_HANDLE DestDescriptor) override
+		{
+			WriteDescriptor(DestDescriptor, pResource, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, 0);
+		}
+		void STDMETHODCALLTYPE CreateRenderTargetView(ID3D12Resource* pResource, const D3D12_RENDER_TARGET_VIEW_DESC* pDesc, D3D12_CPU_DESCRIPTOR_HANDLE DestDescriptor) override
+		{
+			const uint32_t mip = pDesc && pDesc->ViewDimension == D3D12_RTV_DIMENSION_TEXTURE2D ? pDesc->Texture2D.MipSlice : 0;
+			WriteDescriptor(DestDescriptor, pResource, D3D12_DESCRIPTOR_HEAP_TYPE_RTV, mip);
+		}
+		void STDMETHODCALLTYPE CreateDepthStencilView(ID3D12Resource* pResource, const D3D12_DEPTH_STENCIL_VIEW_DESC* pDesc, D3D12_CPU_DESCRIPTOR_HANDLE DestDescriptor) override
+		{
+			const uint32_t mip = pDesc && pDesc->ViewDimension == D3D12_DSV_DIMENSION_TEXTURE2D ? pDesc->Texture2D.MipSlice : 0;
+			WriteDescriptor(DestDescriptor, pResource, D3D12_DESCRIPTOR_HEAP_TYPE_DSV, mip);
+		}
+		void STDMETHODCALLTYPE CreateSampler(const D3D12_SAMPLER_DESC*, D3D12_CPU_DESCRIPTOR_HANDLE DestDescriptor) override
+		{
+			WriteDescriptor(DestDescriptor, nullptr, D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER, 0);
+		}
+		void STDMETHODCALLTYPE CopyDescriptors(UINT NumDestDescriptorRanges, const D3D12_CPU_DESCRIPTOR_HANDLE* pDestDescriptorRangeStarts, const UINT* pDestDescriptorRangeSizes,
+			UINT NumSrcDescriptorRanges, const D3D12_CPU_DESCRIPTOR_HANDLE* pSrcDescriptorRangeStarts, const UINT* pSrcDescriptorRangeSizes, D3D12_DESCRIPTOR_HEAP_TYPE) override
+		{
+			// Walk both range lists in lockstep, one descriptor at a time
+			UINT dstRange = 0, dstIndex = 0;
+			for (UINT srcRange = 0; srcRange < NumSrcDescriptorRanges; ++srcRange)
+			{
+				const UINT srcSize = pSrcDescriptorRangeSizes ? pSrcDescriptorRangeSizes[srcRange] : 1;
+				for (UINT i = 0; i < srcSize; ++i)
+				{
+					while (dstRange < NumDestDescriptorRanges && dstIndex >= (pDestDescriptorRangeSizes ? pDestDescriptorRangeSizes[dstRange] : 1))
+						dstRange++, dstIndex = 0;
+					if (dstRange >= NumDestDescriptorRanges)
+						return;
+					auto* dst = DescriptorHeap::FromHandle(pDestDescriptorRangeStarts[dstRange]) + dstIndex++;
+					*dst = *(DescriptorHeap::FromHandle(pSrcDescriptorRangeStarts[srcRange]) + i);
+				}
+			}
+		}
+		void STDMETHODCALLTYPE CopyDescriptorsSimple(UINT NumDescriptors, D3D12_CPU_DESCRIPTOR_HANDLE DestDescriptorRangeStart, D3D12_CPU_DESCRIPTOR_HANDLE SrcDescriptorRangeStart, D3D12_DESCRIPTOR_HEAP_TYPE) override
+		{
+			memmove(DescriptorHeap::FromHandle(DestDescriptorRangeStart), DescriptorHeap::FromHandle(SrcDescriptorRangeStart), sizeof(DescriptorHeap::Descriptor) * NumDescriptors);
+		}
+		D3D12_RESOURCE_ALLOCATION_INFO STDMETHODCALLTYPE GetResourceAllocationInfo(UINT, UINT numResourceDescs, const D3D12_RESOURCE_DESC* pResourceDescs) override
+		{
+			D3D12_RESOURCE_ALLOCATION_INFO info = { 0, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT };
+			for (UINT i = 0; i < numResourceDescs; ++i)
+			{
+				UINT64 total = 0;
+				const auto& desc = pResourceDescs[i];
+				Detail::Footprints(desc, 0, Detail::SubresourceCount(desc), 0, nullptr, nullptr, nullptr, &total);
+				if (total == UINT64_MAX)
+					return { UINT64_MAX, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT };
+				info.SizeInBytes = Detail::AlignUp(info.SizeInBytes, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT) + Detail::AlignUp(total, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
+			}
+			return info;
+		}
+		D3D12_HEAP_PROPERTIES STDMETHODCALLTYPE GetCustomHeapProperties(UINT, D3D12_HEAP_TYPE heapType) override
+		{
+			D3D12_HEAP_PROPERTIES props = { D3D12_HEAP_TYPE_CUSTOM, D3D12_CPU_PAGE_PROPERTY_NOT_AVAILABLE, D3D12_MEMORY_POOL_L0, 1, 1 };
+			if (heapType == D3D12_HEAP_TYPE_UPLOAD)
+				props.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_WRITE_COMBINE;
+			else if (heapType == D3D12_HEAP_TYPE_READBACK)
+				props.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_WRITE_BACK;
+			return props;
+		}
+		HRESULT STDMETHODCALLTYPE CreateCommittedResource(const D3D12_HEAP_PROPERTIES* pHeapProperties, D3D12_HEAP_FLAGS HeapFlags, const D3D12_RESOURCE_DESC* pDesc,
+			D3D12_RESOURCE_STATES InitialResourceState, const D3D12_CLEAR_VALUE*, REFIID riidResource, void** ppvResource) override
+		{
+			if (!pHeapProperties || !pDesc)
+				return E_INVALIDARG;
+			const auto va = AllocateVA(pDesc->Dimension == D3D12_RESOURCE_DIMENSION_BUFFER ? pDesc->Width : 0);
+			auto* res = new Resource(this, *pHeapProperties, HeapFlags, *pDesc, InitialResourceState, va);
+			if (!ppvResource)
+			{
+				res->Release();
+				return S_FALSE;
+			}
+			return Output(res, riidResource, ppvResource);
+		}
+		HRESULT STDMETHODCALLTYPE CreateHeap(const D3D12_HEAP_DESC*, REFIID, void** ppvHeap) override
+		{
+			return NotImplemented(ppvHeap);
+		}
+		HRESULT STDMETHODCALLTYPE CreatePlacedResource(ID3D12Heap*, UINT64, const D3D12_RESOURCE_DESC*, D3D12_RESOURCE_STATES, const D3D12_CLEAR_VALUE*, REFIID, void** ppvResource) override
+		{
+			return NotImplemented(ppvResource);
+		}
+		HRESULT STDMETHODCALLTYPE CreateReservedResource(const D3D12_RESOURCE_DESC*, D3D12_RESOURCE_STATES, const D3D12_CLEAR_VALUE*, REFIID, void** ppvResource) override
+		{
+			return NotImplemented(ppvResource);
+		}
+		HRESULT STDMETHODCALLTYPE CreateSharedHandle(ID3D12DeviceChild*, const SECURITY_ATTRIBUTES*, DWORD, LPCWSTR, HANDLE*) override
+		{
+			return E_NOTIMPL;
+		}
+		HRESULT STDMETHODCALLTYPE OpenSharedHandle(HANDLE, REFIID, void** ppvObj) override
+		{
+			return NotImplemented(ppvObj);
+		}
+		HRESULT STDMETHODCALLTYPE OpenSharedHandleByName(LPCWSTR, DWORD, HANDLE*) override
+		{
+			return E_NOTIMPL;
+		}
+		HRESULT STDMETHODCALLTYPE MakeResident(UINT, ID3D12Pageable* const*) override
+		{
+			return S_OK;
+		}
+		HRESULT STDMETHODCALLTYPE Evict(UINT, ID3D12Pageable* const*) override
+		{
+			return S_OK;
+		}
+		HRESULT STDMETHODCALLTYPE CreateFence(UINT64 InitialValue, D3D12_FENCE_FLAGS, REFIID riid, void** ppFence) override
+		{
+			return Output(new Fence(this, InitialValue), riid, ppFence);
+		}
+		HRESULT STDMETHODCALLTYPE GetDeviceRemovedReason() override
+		{
+			return S_OK;
+		}
+		void STDMETHODCALLTYPE GetCopyableFootprints(const D3D12_RESOURCE_DESC* pResourceDesc, UINT FirstSubresource, UINT NumSubresources, UINT64 BaseOffset,
+			D3D12_PLACED_SUBRESOURCE_FOOTPRINT* pLayouts, UINT* pNumRows, UINT64* pRowSizeInBytes, UINT64* pTotalBytes) override
+		{
+			if (pResourceDesc)
+				Detail::Footprints(*pResourceDesc, FirstSubresource, NumSubresources, BaseOffset, pLayouts, pNumRows, pRowSizeInBytes, pTotalBytes);
+			else if (pTotalBytes)
+				*pTotalBytes = UINT64_MAX;
+		}
+		HRESULT STDMETHODCALLTYPE CreateQueryHeap(const D3D12_QUERY_HEAP_DESC*, REFIID, void** ppvHeap) override
+		{
+			return NotImplemented(ppvHeap);
+		}
+		HRESULT STDMETHODCALLTYPE SetStablePowerState(BOOL) override
+		{
+			return S_OK;
+		}
+		HRESULT STDMETHODCALLTYPE CreateCommandSignature(const D3D12_COMMAND_SIGNATURE_DESC*, ID3D12RootSignature*, REFIID, void** ppvCommandSignature) override
+		{
+			return NotImplemented(ppvCommandSignature);
+		}
+		void STDMETHODCALLTYPE GetResourceTiling(ID3D12Resource*, UINT* pNumTilesForEntireResource, D3D12_PACKED_MIP_INFO*, D3D12_TILE_SHAPE*, UINT* pNumSubresourceTilings, UINT, D3D12_SUBRESOURCE_TILING*) override
+		{
+			if (pNumTilesForEntireResource)
+				*pNumTilesForEntireResource = 0;
+			if (pNumSubresourceTilings)
+				*pNumSubresourceTilings = 0;
+		}
+		LUID STDMETHODCALLTYPE GetAdapterLuid() override
+		{
+			return {};
+		}
+
+	private:
+		template<class T>
+		static HRESULT Output(T* obj, REFIID riid, void** ppv)
+		{
+			const auto hr = obj->QueryInterface(riid, ppv);
+			obj->Release();
+			return hr;
+		}
+		static HRESULT NotImplemented(void** ppv)
+		{
+			if (ppv)
+				*ppv = nullptr;
+			return E_NOTIMPL;
+		}
+		static void WriteDescriptor(D3D12_CPU_DESCRIPTOR_HANDLE handle, ID3D12Resource* resource, D3D12_DESCRIPTOR_HEAP_TYPE type, uint32_t mip, D3D12_GPU_VIRTUAL_ADDRESS bufferLocation = 0)
+		{
+			if (!handle.ptr)
+				return;
+			auto* desc = DescriptorHeap::FromHandle(handle);
+			desc->resource = static_cast<Resource*>(resource);
+			desc->type = type;
+			desc->mipSlice = mip;
+			desc->bufferLocation = bufferLocation;
+		}
+
+		Stats mStats;
+		bool mTracing = false;
+		std::vector<Op> mTrace;
+		D3D12_GPU_VIRTUAL_ADDRESS mNextVA = 0x100000000ull;
+	};
+
+	// Same contract as D3D12CreateDevice, without an adapter
+	inline HRESULT CreateDevice(REFIID riid, void** ppDevice)
+	{
+		auto* device = new Device();
+		const auto hr = device->QueryInterface(riid, ppDevice);
+		device->Release();
+		return hr;
+	}
+
+	// Out-of-line members that need the complete Device
+
+	template<class Itf>
+	Detail::Child<Itf>::Child(Device* device) : mDevice(device)
+	{
+		mDevice->AddRef();
+		mDevice->OnCreate(sizeof(*this));
+	}
+
+	template<class Itf>
+	Detail::Child<Itf>::~Child()
+	{
+		mDevice->OnDestroy();
+		mDevice->Release();
+	}
+
+	template<class Itf>
+	HRESULT STDMETHODCALLTYPE Detail::Child<Itf>::GetDevice(REFIID riid, void** ppvDevice)
+	{
+		return mDevice->QueryInterface(riid, ppvDevice);
+	}
+
+	inline Resource::Resource(Device* device, const D3D12_HEAP_PROPERTIES& heapProps, D3D12_HEAP_FLAGS heapFlags, const D3D12_RESOURCE_DESC& desc,
+		D3D12_RESOURCE_STATES initialState, D3D12_GPU_VIRTUAL_ADDRESS va)
+		: Child(device), mHeapProps(heapProps), mHeapFlags(heapFlags), mDesc(desc), mState(initialState), mVA(va)
+	{
+		const uint32_t count = Detail::SubresourceCount(desc);
+		mLayouts.resize(count);
+		UINT64 total = 0;
+		if (Detail::Footprints(desc, 0, count, 0, mLayouts.data(), nullptr, nullptr, &total))
+		{
+			mMemory.resize(total);
+			device->MutableStats().allocations++;
+			device->MutableStats().allocatedBytes += total;
+		}
+	}
+
+	inline DescriptorHeap::DescriptorHeap(Device* device, const D3D12_DESCRIPTOR_HEAP_DESC& desc, D3D12_GPU_VIRTUAL_ADDRESS gpuBase)
+		: Child(device), mDesc(desc), mGpuBase(gpuBase), mDescriptors(desc.NumDescriptors)
+	{
+		device->MutableStats().allocations++;
+		device->MutableStats().allocatedBytes += sizeof(Descriptor) * desc.NumDescriptors;
+	}
+
+	inline HRESULT STDMETHODCALLTYPE GraphicsCommandList::Close()
+	{
+		if (mClosed)
+		{
+			mDevice->MutableStats().errors++;
+			return E_FAIL;
+		}
+		mClosed = true;
+		return mError ? E_INVALIDARG : S_OK;
+	}
+
+	// Storage is kept across resets, so steady state recording does not allocate
+	inline HRESULT STDMETHODCALLTYPE GraphicsCommandList::Reset(ID3D12CommandAllocator* pAllocator, ID3D12PipelineState* pInitialState)
+	{
+		if (!pAllocator)
+			return E_INVALIDARG;
+		if (!mClosed)
+		{
+			mDevice->MutableStats().errors++;
+			return E_FAIL;
+		}
+		mCommands.clear();
+		mPayload.clear();
+		mClosed = false;
+		mError = false;
+		if (pInitialState)
+			SetPipelineState(pInitialState);
+		return S_OK;
+	}
+
+	inline Command& GraphicsCommandList::Push(Op op, ID3D12Resource* resource, ID3D12Resource* source,
+		std::initializer_list<uint64_t> args, const void* payload, size_t payloadSize)
+	{
+		auto& stats = mDevice->MutableStats();
+		if (mClosed)
+		{
+			stats.errors++;
+			mError = true;
+		}
+		if (mCommands.size() == mCommands.capacity())
+			stats.allocations++;
+		auto& cmd = mCommands.emplace_back();
+		cmd.op = op;
+		cmd.resource = resource;
+		cmd.source = source;
+		std::copy_n(args.begin(), std::min<size_t>(args.size(), std::size(cmd.args)), cmd.args);
+		cmd.payloadOffset = static_cast<uint32_t>(mPayload.size());
+		Append(cmd, payload, payloadSize);
+		stats.commandsRecorded++;
+		return cmd;
+	}
+
+	// Payload entries are 8-byte aligned so they can be read back in place
+	inline void GraphicsCommandList::Append(Command& cmd, const void* payload, size_t size)
+	{
+		if (!payload || size == 0)
+			return;
+		const size_t offset = mPayload.size();
+		const size_t padded = Detail::AlignUp(size, 8);
+		if (offset + padded > mPayload.capacity())
+		{
+			mDevice->MutableStats().allocations++;
+			mPayload.reserve(std::max(offset + padded, 2 * mPayload.capacity()));
+		}
+		mPayload.resize(offset + padded);
+		memcpy(mPayload.data() + offset, payload, size);
+		cmd.payloadSize += static_cast<uint32_t>(padded);
+	}
+
+	inline void STDMETHODCALLTYPE CommandQueue::ExecuteCommandLists(UINT NumCommandLists, ID3D12CommandList* const* ppCommandLists)
+	{
+		auto& stats = mDevice->MutableStats();
+		for (UINT i = 0; i < NumCommandLists; ++i)
+		{
+			// Only lists created by this device can be replayed
+			auto* list = static_cast<GraphicsCommandList*>(static_cast<ID3D12GraphicsCommandList*>(ppCommandLists[i]));
+			if (!list || !list->IsClosed())
+			{
+				stats.errors++;
+				continue;
+			}
+			Replay(*list);
+			stats.commandListsExecuted++;
+		}
+	}
+
+	inline HRESULT STDMETHODCALLTYPE CommandQueue::Signal(ID3D12Fence* pFence, UINT64 Value)
+	{
+		if (!pFence)
+			return E_INVALIDARG;
+		mDevice->MutableStats().signals++;
+		return pFence->Signal(Value);
+	}
+
+	inline void CommandQueue::Replay(const GraphicsCommandList& list)
+	{
+		auto& stats = mDevice->MutableStats();
+		for (const auto& cmd : list.GetCommands())
+		{
+			stats.commandsExecuted++;
+			stats.ops[static_cast<size_t>(cmd.op)]++;
+			mDevice->AppendTrace(cmd.op);
+			switch (cmd.op)
+			{
+			case Op::ClearRenderTargetView:
+			{
+				const auto* desc = DescriptorHeap::FromHandle({ static_cast<SIZE_T>(cmd.args[0]) });
+				const auto* color = list.GetPayload<float>(cmd);
+				ClearRenderTarget(desc->resource, desc->mipSlice, color, reinterpret_cast<const D3D12_RECT*>(color + 4), static_cast<uint32_t>(cmd.args[1]));
+				break;
+			}
+			case Op::CopyTextureRegion:
+			{
+				const auto* locs = list.GetPayload<D3D12_TEXTURE_COPY_LOCATION>(cmd);
+				const auto* box = reinterpret_cast<const D3D12_BOX*>(list.GetPayload(cmd) + Detail::AlignUp(2 * sizeof(D3D12_TEXTURE_COPY_LOCATION), 8));
+				CopyTextureRegion(cmd, locs, cmd.args[3] ? box : nullptr);
+				break;
+			}
+			case Op::CopyBufferRegion:
+			{
+				auto* dst = static_cast<Resource*>(cmd.resource);
+				auto* src = static_cast<Resource*>(cmd.source);
+				if (!dst || !src || cmd.args[0] + cmd.args[2] > dst->MemorySize() || cmd.args[1] + cmd.args[2] > src->MemorySize())
+				{
+					stats.errors++;
+					break;
+				}
+				memmove(dst->Memory() + cmd.args[0], src->Memory() + cmd.args[1], cmd.args[2]);
+				break;
+			}
+			case Op::CopyResource:
+			{
+				auto* dst = static_cast<Resource*>(cmd.resource);
+				auto* src = static_cast<Resource*>(cmd.source);
+				if (!dst || !src || dst->MemorySize() != src->MemorySize())
+				{
+					stats.errors++;
+					break;
+				}
+				if (dst->MemorySize())
+					memcpy(dst->Memory(), src->Memory(), dst->MemorySize());
+				break;
+			}
+			case Op::ResourceBarrier:
+			{
+				const auto& b = *list.GetPayload<D3D12_RESOURCE_BARRIER>(cmd);
+				if (b.Type == D3D12_RESOURCE_BARRIER_TYPE_TRANSITION && b.Flags == D3D12_RESOURCE_BARRIER_FLAG_NONE && b.Transition.pResource)
+				{
+					auto* res = static_cast<Resource*>(b.Transition.pResource);
+					if (res->State() != b.Transition.StateBefore)
+						stats.errors++;
+					res->SetState(b.Transition.StateAfter);
+				}
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+
+	inline void CommandQueue::ClearRenderTarget(Resource* res, uint32_t mip, const float color[4], const D3D12_RECT* rects, uint32_t numRects)
+	{
+		const auto* layout = res ? res->Layout(mip) : nullptr;
+		if (!layout)
+			return;
+		const auto& fp = layout->Footprint;
+		uint8_t texel[16] = {};
+		uint32_t bpp = 0;
+		switch (fp.Format)
+		{
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+			for (int i = 0; i < 4; ++i)
+				texel[i] = Detail::ToUnorm8(color[i]);
+			bpp = 4;
+			break;
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+		case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+			texel[0] = Detail::ToUnorm8(color[2]);
+			texel[1] = Detail::ToUnorm8(color[1]);
+			texel[2] = Detail::ToUnorm8(color[0]);
+			texel[3] = Detail::ToUnorm8(color[3]);
+			bpp = 4;
+			break;
+		case DXGI_FORMAT_R32G32B32A32_FLOAT:
+			memcpy(texel, color, 16);
+			bpp = 16;
+			break;
+		default:
+			return; // Other formats are recorded only
+		}
+		const D3D12_RECT full = { 0, 0, static_cast<LONG>(fp.Width), static_cast<LONG>(fp.Height) };
+		if (numRects == 0)
+			rects = &full, numRects = 1;
+		for (uint32_t r = 0; r < numRects; ++r)
+		{
+			const auto left = std::clamp<LONG>(rects[r].left, 0, fp.Width), right = std::clamp<LONG>(rects[r].right, 0, fp.Width);
+			const auto top = std::clamp<LONG>(rects[r].top, 0, fp.Height), bottom = std::clamp<LONG>(rects[r].bottom, 0, fp.Height);
+			if (left >= right || top >= bottom)
+				continue;
+			// Fill the first row, then replicate it
+			uint8_t* first = res->Memory() + layout->Offset + static_cast<uint64_t>(top) * fp.RowPitch + static_cast<size_t>(left) * bpp;
+			for (LONG x = left; x < right; ++x)
+				memcpy(first + static_cast<size_t>(x - left) * bpp, texel, bpp);
+			for (LONG y = top + 1; y < bottom; ++y)
+				memcpy(first + static_cast<uint64_t>(y - top) * fp.RowPitch, first, static_cast<size_t>(right - left) * bpp);
+		}
+	}
+
+	// Either side is a texture subresource or a placed footprint in a buffer
+	inline void CommandQueue::CopyTextureRegion(const Command& cmd, const D3D12_TEXTURE_COPY_LOCATION* locs, const D3D12_BOX* box)
+	{
+		auto& stats = mDevice->MutableStats();
+		auto resolve = [](const D3D12_TEXTURE_COPY_LOCATION& loc, D3D12_PLACED_SUBRESOURCE_FOOTPRINT& out) -> uint8_t*
+		{
+			auto* res = static_cast<Resource*>(loc.pResource);
+			if (!res || !res->Memory())
+				return nullptr;
+			if (loc.Type == D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT)
+				out = loc.PlacedFootprint;
+			else if (const auto* layout = res->Layout(loc.SubresourceIndex))
+				out = *layout;
+			else
+				return nullptr;
+			const uint64_t bpp = Detail::BytesPerPixel(out.Footprint.Format);
+			const uint64_t end = out.Offset + static_cast<uint64_t>(out.Footprint.RowPitch) * (static_cast<uint64_t>(out.Footprint.Height) * out.Footprint.Depth - 1) + bpp * out.Footprint.Width;
+			return bpp && end <= res->MemorySize() ? res->Memory() : nullptr;
+		};
+		D3D12_PLACED_SUBRESOURCE_FOOTPRINT dstFp = {}, srcFp = {};
+		uint8_t* dst = resolve(locs[0], dstFp);
+		uint8_t* src = resolve(locs[1], srcFp);
+		if (!dst || !src)
+		{
+			// Formats without CPU memory are recorded only
+			if (locs[0].pResource && locs[1].pResource && static_cast<Resource*>(locs[0].pResource)->Memory() && static_cast<Resource*>(locs[1].pResource)->Memory())
+				stats.errors++;
+			return;
+		}
+		const auto& s = srcFp.Footprint;
+		const auto& d = dstFp.Footprint;
+		const D3D12_BOX full = { 0, 0, 0, s.Width, s.Height, s.Depth };
+		const auto& b = box ? *box : full;
+		const uint32_t bpp = Detail::BytesPerPixel(s.Format);
+		const uint32_t dx = static_cast<uint32_t>(cmd.args[0]), dy = static_cast<uint32_t>(cmd.args[1]), dz = static_cast<uint32_t>(cmd.args[2]);
+		if (bpp != Detail::BytesPerPixel(d.Format) || b.right > s.Width || b.bottom > s.Height || b.back > s.Depth || b.left > b.right || b.top > b.bottom || b.front > b.back ||
+			dx + (b.right - b.left) > d.Width || dy + (b.bottom - b.top) > d.Height || dz + (b.back - b.front) > d.Depth)
+		{
+			stats.errors++;
+			return;
+		}
+		const size_t rowBytes = static_cast<size_t>(b.right - b.left) * bpp;
+		for (uint32_t z = 0; z < b.back - b.front; ++z)
+		{
+			for (uint32_t y = 0; y < b.bottom - b.top; ++y)
+			{
+				const uint8_t* srcRow = src + srcFp.Offset + ((static_cast<uint64_t>(b.front) + z) * s.Height + b.top + y) * s.RowPitch + static_cast<uint64_t>(b.left) * bpp;
+				uint8_t* dstRow = dst + dstFp.Offset + ((static_cast<uint64_t>(dz) + z) * d.Height + dy + y) * d.RowPitch + static_cast<uint64_t>(dx) * bpp;
+				memmove(dstRow, srcRow, rowBytes);
+			}
+		}
+	}
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+// Pixel conversion kernels for readback data
+// R8G8B8A8 rows with D3D12_TEXTURE_DATA_PITCH_ALIGNMENT pitch -> packed rows
+// Scalar and SSSE3 versions are selected by CPUID at runtime
+// An AVX2 version was no faster, at 1080p the conversion runs at memcpy speed
+
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_CONVERT_X86 1
+#endif
+
+namespace PixelConvert
+{
+	enum class Format
+	{
+		RGB,  // Drop alpha
+		BGR,  // Drop alpha and swap red/blue
+		RGBA, // Pitch strip only
+	};
+
+	enum class Isa
+	{
+		Scalar,
+		SSSE3,
+		Auto,
+	};
+
+	inline const char* IsaName(Isa isa)
+	{
+		switch (isa)
+		{
+		case Isa::Scalar: return "scalar";
+		case Isa::SSSE3: return "ssse3";
+		default: return "auto";
+		}
+	}
+
+	inline uint32_t BytesPerPixel(Format format)
+	{
+		return format == Format::RGBA ? 4 : 3;
+	}
+
+	// Convert one row, width pixels
+	using RowKernel = void (*)(uint8_t* dst, const uint8_t* src, uint32_t width);
+
+	inline void RGBAtoRGBScalar(uint8_t* dst, const uint8_t* src, uint32_t width)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			dst[3 * x + 0] = src[4 * x + 0];
+			dst[3 * x + 1] = src[4 * x + 1];
+			dst[3 * x + 2] = src[4 * x + 2];
+		}
+	}
+
+	inline void RGBAtoBGRScalar(uint8_t* dst, const uint8_t* src, uint32_t width)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			dst[3 * x + 0] = src[4 * x + 2];
+			dst[3 * x + 1] = src[4 * x + 1];
+			dst[3 * x + 2] = src[4 * x + 0];
+		}
+	}
+
+	// libc memcpy is already vectorized, so the pitch strip has a single kernel
+	inline void CopyRow(uint8_t* dst, const uint8_t* src, uint32_t width)
+	{
+		memcpy(dst, src, 4 * static_cast<size_t>(width));
+	}
+
+#ifdef PIXEL_CONVERT_X86
+	// 16 pixels per iteration: 4 x pshufb packs 12 bytes each, then 3 stores of 16 bytes
+	template<bool SwapRB>
+	__attribute__((target("ssse3")))
+	inline void RGBAtoRGB_SSSE3(uint8_t* dst, const uint8_t* src, uint32_t width)
+	{
+		const __m128i mask = SwapRB
+			? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+			: _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		uint32_t x = 0;
+		for (; x + 16 <= width; x += 16)
+		{
+			auto a = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * x + 0)), mask);
+			auto b = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * x + 16)), mask);
+			auto c = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * x + 32)), mask);
+			auto d = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * x + 48)), mask);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * x + 0), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * x + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * x + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+		}
+		if (SwapRB)
+			RGBAtoBGRScalar(dst + 3 * x, src + 4 * x, width - x);
+		else
+			RGBAtoRGBScalar(dst + 3 * x, src + 4 * x, width - x);
+	}
+
+	inline bool IsSupported(Isa isa)
+	{
+		switch (isa)
+		{
+		case Isa::Scalar: return true;
+		case Isa::SSSE3: return __builtin_cpu_supports("ssse3");
+		default: return true;
+		}
+	}
+#else
+	inline bool IsSupported(Isa isa)
+	{
+		return isa == Isa::Scalar || isa == Isa::Auto;
+	}
+#endif
+
+	inline Isa BestIsa()
+	{
+		if (IsSupported(Isa::SSSE3))
+			return Isa::SSSE3;
+		return Isa::Scalar;
+	}
+
+	inline RowKernel GetRowKernel(Format format, Isa isa = Isa::Auto)
+	{
+		if (isa == Isa::Auto || !IsSupported(isa))
+			isa = BestIsa();
+		if (format == Format::RGBA)
+			return CopyRow;
+#ifdef PIXEL_CONVERT_X86
+		if (isa == Isa::SSSE3)
+			return format == Format::BGR ? RGBAtoRGB_SSSE3<true> : RGBAtoRGB_SSSE3<false>;
+#endif
+		return format == Format::BGR ? RGBAtoBGRScalar : RGBAtoRGBScalar;
+	}
+
+	// Convert rows [0, height) from pitched RGBA to a packed image
+	inline void Convert(uint8_t* dst, const uint8_t* src, uint32_t srcPitch, uint32_t width, uint32_t height, Format format, Isa isa = Isa::Auto)
+	{
+		const auto kernel = GetRowKernel(format, isa);
+		const size_t dstPitch = static_cast<size_t>(BytesPerPixel(format)) * width;
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			kernel(dst + y * dstPitch, src + static_cast<size_t>(y) * srcPitch, width);
+		}
+	}
+}
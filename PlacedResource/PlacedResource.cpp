@@ -5,6 +5,11 @@
 #include <dxgi1_4.h>
 #include <d3d12.h>
 #include "d3dx12.h"
+#include "ProceduralMesh.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "TransientAliasing.h"
+#include "StagingUploader.h"
 #include <DirectXMath.h>
 #include <vector>
 #include <iterator>
@@ -52,10 +57,9 @@ class D3D
 	ComPtr<ID3D12Resource> mSwapChainTex[BUFFER_COUNT];
 	ComPtr<ID3D12DescriptorHeap> mSwapChainRTVs;
 
-	ComPtr<ID3D12CommandAllocator> mCmdAllocCopy;
 	ComPtr<ID3D12CommandQueue> mCmdQueueCopy;
-	ComPtr<ID3D12GraphicsCommandList> mCmdListCopy;
-	ComPtr<ID3D12Resource> mCopyBuffer;
+	StagingUploader::Uploader mUploader;
+	const uint64_t kUploadRingSize = 64 * 1024; // The 1x1 textures take 512 bytes each
 
 	enum class Constants {
 		SceneMatrix,
@@ -101,11 +105,12 @@ class D3D
 	ComPtr<ID3D12Resource> mSceneTex;
 	//ComPtr<ID3D12Resource> mSceneZ;
 
-	ComPtr<ID3D12Heap> mPlacedHeap;
+	// Per view rt/ds alive only in the pass of their view, so the views share memory
+	vector<ComPtr<ID3D12Heap>> mPlacedHeaps;
 	ComPtr<ID3D12Resource> mPlacedTex[4];
 	ComPtr<ID3D12Resource> mPlacedZ[4];
-	UINT64 mPlacedTexSize;
-	UINT64 mPlacedZSize;
+	TransientAliasing::Plan mPlacedPlan;
+	ID3D12Resource* mPlacedResources[8]; // Transient resources in plan order, rt 0-3 then ds 0-3
 
 	ComPtr<ID3D12Resource> mBindlessResource[MAX_BINDLESS_RESOURCE];
 
@@ -121,6 +126,8 @@ class D3D
 	D3D12_INDEX_BUFFER_VIEW mIBView = {};
 	const int SphereSlices = 12;
 	const int SphereStacks = 12;
+	ProceduralMesh::IndexedMesh mSphereMesh;
+	MeshSimplifier::LodChain mSphereLods;
 
 	const float kDefaultDSClearColor[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
 	const float kDefaultRTClearColor[4] = { 0.1f, 0.2f, 0.4f, 0.0f };
@@ -170,13 +177,13 @@ public:
 		{
 			CHK(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&mCmdAlloc[i])));
 		}
-		CHK(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&mCmdAllocCopy)));
 
 		D3D12_COMMAND_QUEUE_DESC queueDesc = {};
 		queueDesc.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
 		CHK(mDevice->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&mCmdQueue)));
 		queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
 		CHK(mDevice->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&mCmdQueueCopy)));
+		mUploader.Create(mDevice.Get(), mCmdQueueCopy.Get(), kUploadRingSize);
 
 		DXGI_SWAP_CHAIN_DESC1 sc = {};
 		sc.Width = WINDOW_WIDTH;
@@ -196,8 +203,6 @@ public:
 
 		CHK(mDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence)));
 
-		CHK(mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, mCmdAllocCopy.Get(), nullptr, IID_PPV_ARGS(&mCmdListCopy)));
-
 		D3D12_DESCRIPTOR_HEAP_DESC descHeapDesc = {};
 		descHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
 		descHeapDesc.NumDescriptors = 10;
@@ -362,25 +367,29 @@ float4 main(Input input) : SV_Target {
 		auto resDescPlacedZ = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_D32_FLOAT, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2, 1, 1);
 		resDescPlacedTex.Flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
 		resDescPlacedZ.Flags = D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL;
-		auto allocInfoPlacedTex = mDevice->GetResourceAllocationInfo(0, 1, &resDescPlacedTex);
-		auto allocInfoPlacedZ = mDevice->GetResourceAllocationInfo(0, 1, &resDescPlacedZ);
-		mPlacedTexSize = allocInfoPlacedTex.SizeInBytes;
-		mPlacedZSize = allocInfoPlacedZ.SizeInBytes;
-
-		auto heapDesc = CD3DX12_HEAP_DESC(mPlacedTexSize + mPlacedZSize, D3D12_HEAP_TYPE_DEFAULT, 0,D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES);
-		CHK(mDevice->CreateHeap(&heapDesc, IID_PPV_ARGS(&mPlacedHeap)));
+		vector<TransientAliasing::Resource> transients;
+		for (uint32_t i = 0; i < 4; ++i)
+			transients.push_back(TransientAliasing::Describe(mDevice.Get(), resDescPlacedTex, 0, i, i, TransientAliasing::Init::Clear));
+		for (uint32_t i = 0; i < 4; ++i)
+			transients.push_back(TransientAliasing::Describe(mDevice.Get(), resDescPlacedZ, 0, i, i, TransientAliasing::Init::Clear));
+		mPlacedPlan = TransientAliasing::PlanHeaps(transients);
+		TransientAliasing::CreateHeaps(mDevice.Get(), mPlacedPlan, { D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES }, mPlacedHeaps);
 
 		for (int i = 0; i < 4; ++i) {
+			const auto& placement = mPlacedPlan.placements[i];
 			CHK(mDevice->CreatePlacedResource(
-				mPlacedHeap.Get(), 0, &resDescPlacedTex,
+				mPlacedHeaps[placement.heap].Get(), placement.offset, &resDescPlacedTex,
 				D3D12_RESOURCE_STATE_GENERIC_READ, &clearValue, IID_PPV_ARGS(&mPlacedTex[i])));
+			mPlacedResources[i] = mPlacedTex[i].Get();
 		}
 
 		clearValue = CD3DX12_CLEAR_VALUE(DXGI_FORMAT_D32_FLOAT, kDefaultDSClearColor);
 		for (int i = 0; i < 4; ++i) {
+			const auto& placement = mPlacedPlan.placements[4 + i];
 			CHK(mDevice->CreatePlacedResource(
-				mPlacedHeap.Get(), mPlacedTexSize, &resDescPlacedZ,
+				mPlacedHeaps[placement.heap].Get(), placement.offset, &resDescPlacedZ,
 				D3D12_RESOURCE_STATE_DEPTH_WRITE, &clearValue, IID_PPV_ARGS(&mPlacedZ[i])));
+			mPlacedResources[4 + i] = mPlacedZ[i].Get();
 		}
 
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
@@ -391,22 +400,15 @@ float4 main(Input input) : SV_Target {
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, &clearValue, IID_PPV_ARGS(&mSceneTex)));
 
-		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-		resDesc = CD3DX12_RESOURCE_DESC::Buffer(4 * 1024 * 1024);
-		resDesc.Flags = D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE;
-		CHK(mDevice->CreateCommittedResource(
-			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mCopyBuffer)));
-		vector<char> copyBuffer;
-		copyBuffer.reserve(resDesc.Width);
-
+		// Packed into one batch on the copy queue, which leaves the textures in COMMON
+		StagingUploader::Ticket uploaded = 0;
 		for (int i = 0; i < MAX_DEFINED_RESOURCE; ++i)
 		{
 			heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
 			resDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 1, 1, 1);
 			CHK(mDevice->CreateCommittedResource(
 				&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-				D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&mBindlessResource[i])));
+				D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&mBindlessResource[i])));
 
 			static const float colors[MAX_DEFINED_RESOURCE][4] = {
 				{1.0f, 0.0f, 0.0f, 1.0f},
@@ -419,18 +421,8 @@ float4 main(Input input) : SV_Target {
 				{1.0f, 1.0f, 1.0f, 1.0f},
 			};
 			D3D12_SUBRESOURCE_DATA sub = { colors[i], sizeof(colors[0]), sizeof(colors[0]) };
-			UpdateSubresources(
-				mCmdListCopy.Get(), mBindlessResource[i].Get(), mCopyBuffer.Get(),
-				D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT * i,
-				0, 1, &sub);
+			uploaded = mUploader.UploadTexture(mBindlessResource[i].Get(), 0, 1, &sub);
 		}
-		D3D12_RESOURCE_BARRIER transitions[MAX_DEFINED_RESOURCE];
-		for (int i = 0; i < MAX_DEFINED_RESOURCE; ++i)
-		{
-			transitions[i] = CD3DX12_RESOURCE_BARRIER::Transition(
-				mBindlessResource[i].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
-		}
-		mCmdListCopy->ResourceBarrier(MAX_DEFINED_RESOURCE, transitions);
 
 		descHeapDesc = {};
 		descHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
@@ -509,46 +501,10 @@ float4 main(Input input) : SV_Target {
 		CD3DX12_CPU_DESCRIPTOR_HANDLE samplerHandle(mSampler->GetCPUDescriptorHandleForHeapStart());
 		mDevice->CreateSampler(&samplerDesc, samplerHandle);
 
-		// Generate sphere triangles
-
-		struct IndexList
-		{
-			short a[6];
-		};
-		vector<VertexElement> vertices;
-		vector<IndexList> indices;
-		vertices.reserve((SphereStacks + 1) * (SphereSlices + 1));
-		for (int y = 0; y < SphereStacks + 1; ++y)
-		{
-			for (int x = 0; x < SphereSlices + 1; ++x)
-			{
-				// Generate a evenly tesselated plane
-				float v[3] = { (float)x / (float)(SphereSlices), (float)y / (float)(SphereStacks), 0.0f };
-				// Convert to spherical coordinate system
-				float theta = 2 * 3.14159265f * v[0];
-				float phi = 2 * 3.14159265f * v[1] / 2.0f;
-				VertexElement ve = { sinf(phi) * sinf(theta), cosf(phi), sinf(phi) * cosf(theta), 0, 0, 0 };
-				// Setup normal
-				float r = 1.0f;
-				ve.normal[0] = ve.position[0] / r;
-				ve.normal[1] = ve.position[1] / r;
-				ve.normal[2] = ve.position[2] / r;
-				vertices.push_back(ve);
-			}
-		}
-		indices.reserve(SphereStacks * SphereSlices);
-		for (int y = 0; y < SphereStacks; ++y)
-		{
-			for (int x = 0; x < SphereSlices; ++x)
-			{
-				short b = static_cast<short>(y * (SphereSlices + 1) + x);
-				short s = SphereSlices + 1;
-				IndexList il = { b, b + s, b + 1, b + s, b + s + 1, b + 1 };
-				indices.push_back(il);
-			}
-		}
+		// Generate sphere triangles, reordered in place for the vertex cache, overdraw and vertex fetch
+		mSphereMesh = ProceduralMesh::PlanSphere(SphereSlices, SphereStacks);
 
-		auto sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		auto sizeVB = static_cast<uint32_t>(sizeof(VertexElement) * mSphereMesh.vertexCount);
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
@@ -556,31 +512,30 @@ float4 main(Input input) : SV_Target {
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVB)));
 		void* gpuMem;
 		CHK(mVB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		ProceduralMesh::WriteSphereVertices(gpuMem, ProceduralMesh::LayoutOf<VertexElement>(), SphereSlices, SphereStacks);
+		vector<uint8_t> sphereIndices(mSphereMesh.IndexBufferSize());
+		ProceduralMesh::WriteSphereIndices(sphereIndices.data(), mSphereMesh);
+		MeshOptimizer::OptimizeInPlace(mSphereMesh, gpuMem, sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
+		mSphereLods = MeshSimplifier::BuildLodChain(mSphereMesh, gpuMem, sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
 
-		auto sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		auto sizeIB = static_cast<uint32_t>(mSphereLods.indices.size());
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeIB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIB)));
 		CHK(mIB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		memcpy(gpuMem, mSphereLods.indices.data(), mSphereLods.indices.size());
 
 		mVBView.BufferLocation = mVB->GetGPUVirtualAddress();
 		mVBView.StrideInBytes = sizeof(VertexElement);
 		mVBView.SizeInBytes = sizeVB;
 		mIBView.BufferLocation = mIB->GetGPUVirtualAddress();
-		mIBView.Format = DXGI_FORMAT_R16_UINT;
+		mIBView.Format = ProceduralMesh::IndexFormat(mSphereMesh);
 		mIBView.SizeInBytes = sizeIB;
 
-		// DMA
+		// DMA, the first frame waits for the uploads on the GPU
 
-		CHK(mCmdListCopy->Close());
-		ID3D12GraphicsCommandList* cmdLists[] = { mCmdListCopy.Get() };
-		mCmdQueueCopy->ExecuteCommandLists(1, CommandListCast(cmdLists));
-		CHK(mCmdQueueCopy->Signal(mFence.Get(), 10));
-		while (mFence->GetCompletedValue() < 10);
-		CHK(mCmdAllocCopy->Reset());
+		mUploader.QueueWait(mCmdQueue.Get(), uploaded);
 	}
 
 	void Draw()
@@ -622,6 +577,7 @@ float4 main(Input input) : SV_Target {
 		auto worldMat = DirectX::XMMatrixIdentity();
 		auto viewMat = DirectX::XMMatrixLookAtLH(mCameraPos, mCameraTarget, mCameraUp);
 		auto projMat = DirectX::XMMatrixPerspectiveFovLH(fov, aspect, nearClip, farClip);
+		const auto& sphereLod = mSphereLods.Select(DirectX::XMVectorGetX(DirectX::XMVector3Length(mCameraPos)) - 1.0f, MeshSimplifier::ProjectionScale(fov, (float)WINDOW_HEIGHT));
 
 		auto shadowDir = DirectX::XMVectorSet(0.0f, -1.0f, 0.0f, 0);
 		auto shadowPos = DirectX::XMVectorSet(0.0f, 5.0f, 0.0f, 0);
@@ -651,11 +607,10 @@ float4 main(Input input) : SV_Target {
 
 		// Draw 1st view then copy to scene
 
+		TransientAliasing::Activate(mCmdList.Get(), mPlacedPlan, 0, mPlacedResources);
 		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mPlacedTex[0].Get(),
 			D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_RENDER_TARGET);
-		transitions[1] = CD3DX12_RESOURCE_BARRIER::Aliasing(nullptr, mPlacedTex[0].Get());
-		transitions[2] = CD3DX12_RESOURCE_BARRIER::Aliasing(nullptr, mPlacedZ[0].Get());
-		mCmdList->ResourceBarrier(3, transitions);
+		mCmdList->ResourceBarrier(1, transitions);
 
 		// Need to clear or discard when activate the resource
 		mCmdList->ClearRenderTargetView(rtvPlacedScene0, kDefaultRTClearColor, 0, nullptr);
@@ -677,7 +632,7 @@ float4 main(Input input) : SV_Target {
 		auto scissor = CD3DX12_RECT(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 		mCmdList->RSSetScissorRects(1, &scissor);
 		mCmdList->OMSetRenderTargets(1, &rtvPlacedScene0, TRUE, &dsvPlacedScene0);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		ProceduralMesh::DrawIndexed(mCmdList.Get(), sphereLod);
 
 		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mPlacedTex[0].Get(),
 			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ);
@@ -690,11 +645,10 @@ float4 main(Input input) : SV_Target {
 
 		// Draw 2nd view then copy to scene
 
+		TransientAliasing::Activate(mCmdList.Get(), mPlacedPlan, 1, mPlacedResources);
 		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mPlacedTex[1].Get(),
 			D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_RENDER_TARGET);
-		transitions[1] = CD3DX12_RESOURCE_BARRIER::Aliasing(mPlacedTex[0].Get(), mPlacedTex[1].Get());
-		transitions[2] = CD3DX12_RESOURCE_BARRIER::Aliasing(mPlacedZ[0].Get(), mPlacedZ[1].Get());
-		mCmdList->ResourceBarrier(3, transitions);
+		mCmdList->ResourceBarrier(1, transitions);
 
 		viewIndex = 1;
 		
@@ -703,7 +657,7 @@ float4 main(Input input) : SV_Target {
 
 		mCmdList->SetGraphicsRoot32BitConstant(2, static_cast<UINT>(viewIndex), 0);
 		mCmdList->OMSetRenderTargets(1, &rtvPlacedScene1, TRUE, &dsvPlacedScene1);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		ProceduralMesh::DrawIndexed(mCmdList.Get(), sphereLod);
 
 		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mPlacedTex[1].Get(),
 			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ);
@@ -714,11 +668,10 @@ float4 main(Input input) : SV_Target {
 
 		// Draw 3rd view then copy to scene
 
+		TransientAliasing::Activate(mCmdList.Get(), mPlacedPlan, 2, mPlacedResources);
 		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mPlacedTex[2].Get(),
 			D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_RENDER_TARGET);
-		transitions[1] = CD3DX12_RESOURCE_BARRIER::Aliasing(mPlacedTex[1].Get(), mPlacedTex[2].Get());
-		transitions[2] = CD3DX12_RESOURCE_BARRIER::Aliasing(mPlacedZ[1].Get(), mPlacedZ[2].Get());
-		mCmdList->ResourceBarrier(3, transitions);
+		mCmdList->ResourceBarrier(1, transitions);
 
 		viewIndex = 2;
 
@@ -727,7 +680,7 @@ float4 main(Input input) : SV_Target {
 
 		mCmdList->SetGraphicsRoot32BitConstant(2, static_cast<UINT>(viewIndex), 0);
 		mCmdList->OMSetRenderTargets(1, &rtvPlacedScene2, TRUE, &dsvPlacedScene2);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		ProceduralMesh::DrawIndexed(mCmdList.Get(), sphereLod);
 
 		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mPlacedTex[2].Get(),
 			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ);
@@ -738,11 +691,10 @@ float4 main(Input input) : SV_Target {
 
 		// Draw 4th view then copy to scene
 
+		TransientAliasing::Activate(mCmdList.Get(), mPlacedPlan, 3, mPlacedResources);
 		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mPlacedTex[3].Get(),
 			D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_RENDER_TARGET);
-		transitions[1] = CD3DX12_RESOURCE_BARRIER::Aliasing(mPlacedTex[2].Get(), mPlacedTex[3].Get());
-		transitions[2] = CD3DX12_RESOURCE_BARRIER::Aliasing(mPlacedZ[2].Get(), mPlacedZ[3].Get());
-		mCmdList->ResourceBarrier(3, transitions);
+		mCmdList->ResourceBarrier(1, transitions);
 
 		viewIndex = 3;
 
@@ -751,7 +703,7 @@ float4 main(Input input) : SV_Target {
 
 		mCmdList->SetGraphicsRoot32BitConstant(2, static_cast<UINT>(viewIndex), 0);
 		mCmdList->OMSetRenderTargets(1, &rtvPlacedScene3, TRUE, &dsvPlacedScene3);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		ProceduralMesh::DrawIndexed(mCmdList.Get(), sphereLod);
 
 		transitions[0] = CD3DX12_RESOURCE_BARRIER::Transition(mPlacedTex[3].Get(),
 			D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_GENERIC_READ);
@@ -766,9 +718,7 @@ float4 main(Input input) : SV_Target {
 			D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_GENERIC_READ);
 		transitions[1] = CD3DX12_RESOURCE_BARRIER::Transition(mSwapChainTex[frameIndex].Get(),
 			D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_COPY_DEST);
-		transitions[2] = CD3DX12_RESOURCE_BARRIER::Aliasing(mPlacedTex[3].Get(), nullptr);
-		transitions[3] = CD3DX12_RESOURCE_BARRIER::Aliasing(mPlacedZ[3].Get(), nullptr);
-		mCmdList->ResourceBarrier(4, transitions);
+		mCmdList->ResourceBarrier(2, transitions);
 
 		mCmdList->CopyResource(mSwapChainTex[frameIndex].Get(), mSceneTex.Get());
 
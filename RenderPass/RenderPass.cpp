@@ -5,6 +5,10 @@
 #include <dxgi1_4.h>
 #include <d3d12.h>
 #include "d3dx12.h"
+#include "ProceduralMesh.h"
+#include "MeshOptimizer.h"
+#include "PackedVertex.h"
+#include "MeshSimplifier.h"
 #include <DirectXMath.h>
 #include <vector>
 #include <dxcapi.h>
@@ -107,6 +111,9 @@ class D3D
 	D3D12_INDEX_BUFFER_VIEW mIBView = {};
 	const int SphereSlices = 12;
 	const int SphereStacks = 12;
+	ProceduralMesh::IndexedMesh mSphereMesh;
+	MeshSimplifier::LodChain mSphereLods;
+	const bool UsePackedVertex = true; // 12-byte PackedVertex::Vertex in the vertex buffers
 
 	ComPtr<ID3D12Resource> mVBPlane;
 	ComPtr<ID3D12Resource> mIBPlane;
@@ -244,7 +251,16 @@ Output main(float3 position : Position, float3 normal : Normal) {
 	Output output;
 	output.position = mul(float4(position, 1), ViewProj);
 	output.world = position;
+#if PACKED_VERTEX
+	// Octahedral normal in xy
+	float3 n = float3(normal.xy, 1 - abs(normal.x) - abs(normal.y));
+	float t = saturate(-n.z);
+	n.x += n.x >= 0 ? -t : t;
+	n.y += n.y >= 0 ? -t : t;
+	output.normal = normalize(n);
+#else
 	output.normal = normalize(normal);
+#endif
 	return output;
 }
 )#";
@@ -295,6 +311,7 @@ float4 main(Input input) : SV_Target {
 		ComPtr<IDxcBlobEncoding> dxcError;
 		ComPtr<IDxcOperationResult> dxcRes;
 		const wchar_t* shaderArgs[] = { L"-Zi", L"-all_resources_bound", L"-Qembed_debug" };
+		const DxcDefine packedVertexDefines[] = { { L"PACKED_VERTEX", L"1" } };
 
 		dxc->Compile(dxcTxtShadowVS.Get(), nullptr, L"main", L"vs_6_0", shaderArgs, _countof(shaderArgs), nullptr, 0, nullptr, &dxcRes);
 		dxcRes->GetErrorBuffer(&dxcError);
@@ -303,7 +320,7 @@ float4 main(Input input) : SV_Target {
 			throw runtime_error("Shader compile error.");
 		}
 		dxcRes->GetResult(&dxcBlobShadowVS);
-		dxc->Compile(dxcTxtSceneVS.Get(), nullptr, L"main", L"vs_6_0", shaderArgs, _countof(shaderArgs), nullptr, 0, nullptr, &dxcRes);
+		dxc->Compile(dxcTxtSceneVS.Get(), nullptr, L"main", L"vs_6_0", shaderArgs, _countof(shaderArgs), packedVertexDefines, UsePackedVertex ? 1 : 0, nullptr, &dxcRes);
 		dxcRes->GetErrorBuffer(&dxcError);
 		if (dxcError->GetBufferSize()) {
 			OutputDebugStringA(reinterpret_cast<char*>(dxcError->GetBufferPointer()));
@@ -332,7 +349,7 @@ float4 main(Input input) : SV_Target {
 		psoDesc.pRootSignature = mShadowRootSig.Get();
 		psoDesc.VS = CD3DX12_SHADER_BYTECODE(dxcBlobShadowVS->GetBufferPointer(), dxcBlobShadowVS->GetBufferSize());
 		psoDesc.PS = CD3DX12_SHADER_BYTECODE(nullptr, 0);
-		psoDesc.InputLayout = { ieDesc, _countof(ieDesc) };
+		psoDesc.InputLayout = UsePackedVertex ? PackedVertex::InputLayout() : D3D12_INPUT_LAYOUT_DESC{ ieDesc, _countof(ieDesc) };
 		psoDesc.IBStripCutValue = D3D12_INDEX_BUFFER_STRIP_CUT_VALUE_DISABLED;
 		psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
 		psoDesc.RasterizerState = rsDesc;
@@ -347,7 +364,7 @@ float4 main(Input input) : SV_Target {
 		psoDesc.pRootSignature = mSceneRootSig.Get();
 		psoDesc.VS = CD3DX12_SHADER_BYTECODE(dxcBlobSceneVS->GetBufferPointer(), dxcBlobSceneVS->GetBufferSize());
 		psoDesc.PS = CD3DX12_SHADER_BYTECODE(dxcBlobScenePS->GetBufferPointer(), dxcBlobScenePS->GetBufferSize());
-		psoDesc.InputLayout = { ieDesc, _countof(ieDesc) };
+		psoDesc.InputLayout = UsePackedVertex ? PackedVertex::InputLayout() : D3D12_INPUT_LAYOUT_DESC{ ieDesc, _countof(ieDesc) };
 		psoDesc.IBStripCutValue = D3D12_INDEX_BUFFER_STRIP_CUT_VALUE_DISABLED;
 		psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
 		psoDesc.RasterizerState = rsDesc;
@@ -460,46 +477,25 @@ float4 main(Input input) : SV_Target {
 		CD3DX12_CPU_DESCRIPTOR_HANDLE samplerHandle(mSampler->GetCPUDescriptorHandleForHeapStart());
 		mDevice->CreateSampler(&samplerDesc, samplerHandle);
 
-		// Generate sphere triangles
-
-		struct IndexList
-		{
-			short a[6];
+		// Generate sphere triangles, reordered in place for the vertex cache, overdraw and vertex fetch
+		// The packed vertex buffer is encoded from these
+		mSphereMesh = ProceduralMesh::PlanSphere(SphereSlices, SphereStacks);
+		vector<VertexElement> sphereVertices(mSphereMesh.vertexCount);
+		vector<uint8_t> sphereIndices(mSphereMesh.IndexBufferSize());
+		ProceduralMesh::WriteSphereVertices(sphereVertices.data(), ProceduralMesh::LayoutOf<VertexElement>(), SphereSlices, SphereStacks);
+		ProceduralMesh::WriteSphereIndices(sphereIndices.data(), mSphereMesh);
+		MeshOptimizer::OptimizeInPlace(mSphereMesh, sphereVertices.data(), sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
+		mSphereLods = MeshSimplifier::BuildLodChain(mSphereMesh, sphereVertices.data(), sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
+
+		const UINT vertexStride = UsePackedVertex ? sizeof(PackedVertex::Vertex) : sizeof(VertexElement);
+		auto uploadVertices = [&](void* dst, const void* src, uint32_t count) {
+			if (UsePackedVertex)
+				PackedVertex::Encode(static_cast<PackedVertex::Vertex*>(dst), src, ProceduralMesh::LayoutOf<VertexElement>(), count);
+			else
+				memcpy(dst, src, sizeof(VertexElement) * count);
 		};
-		vector<VertexElement> vertices;
-		vector<IndexList> indices;
-		vertices.reserve((SphereStacks + 1) * (SphereSlices + 1));
-		for (int y = 0; y < SphereStacks + 1; ++y)
-		{
-			for (int x = 0; x < SphereSlices + 1; ++x)
-			{
-				// Generate a evenly tesselated plane
-				float v[3] = { (float)x / (float)(SphereSlices), (float)y / (float)(SphereStacks), 0.0f };
-				// Convert to spherical coordinate system
-				float theta = 2 * 3.14159265f * v[0];
-				float phi = 2 * 3.14159265f * v[1] / 2.0f;
-				VertexElement ve = { sinf(phi) * sinf(theta), cosf(phi), sinf(phi) * cosf(theta), 0, 0, 0 };
-				// Setup normal
-				float r = 1.0f;
-				ve.normal[0] = ve.position[0] / r;
-				ve.normal[1] = ve.position[1] / r;
-				ve.normal[2] = ve.position[2] / r;
-				vertices.push_back(ve);
-			}
-		}
-		indices.reserve(SphereStacks * SphereSlices);
-		for (int y = 0; y < SphereStacks; ++y)
-		{
-			for (int x = 0; x < SphereSlices; ++x)
-			{
-				short b = static_cast<short>(y * (SphereSlices + 1) + x);
-				short s = SphereSlices + 1;
-				IndexList il = { b, b + s, b + 1, b + s, b + s + 1, b + 1 };
-				indices.push_back(il);
-			}
-		}
 
-		auto sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		auto sizeVB = static_cast<uint32_t>(vertexStride * mSphereMesh.vertexCount);
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
@@ -507,51 +503,46 @@ float4 main(Input input) : SV_Target {
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVB)));
 		void* gpuMem;
 		CHK(mVB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		uploadVertices(gpuMem, sphereVertices.data(), mSphereMesh.vertexCount);
 
-		auto sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		auto sizeIB = static_cast<uint32_t>(mSphereLods.indices.size());
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeIB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIB)));
 		CHK(mIB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		memcpy(gpuMem, mSphereLods.indices.data(), mSphereLods.indices.size());
 
 		mVBView.BufferLocation = mVB->GetGPUVirtualAddress();
-		mVBView.StrideInBytes = sizeof(VertexElement);
+		mVBView.StrideInBytes = vertexStride;
 		mVBView.SizeInBytes = sizeVB;
 		mIBView.BufferLocation = mIB->GetGPUVirtualAddress();
-		mIBView.Format = DXGI_FORMAT_R16_UINT;
+		mIBView.Format = ProceduralMesh::IndexFormat(mSphereMesh);
 		mIBView.SizeInBytes = sizeIB;
 
 		// Generate plane triangles
-		vertices.clear();
-		indices.clear();
-		vertices.push_back({ -1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ -1, -1, -1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, -1,  0, +1,  0 });
-		for (auto& v : vertices) { v.position[0] *= 3; v.position[1] *= 3; v.position[2] *= 3; }
-		indices.push_back({ 0, 1, 2, 2, 1, 3 });
-
-		sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		const auto planeSize = ProceduralMesh::PlaneSize();
+
+		sizeVB = static_cast<uint32_t>(vertexStride * planeSize.vertexCount);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVBPlane)));
 		CHK(mVBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		VertexElement planeVertices[4];
+		ProceduralMesh::WritePlaneVertices(planeVertices, ProceduralMesh::LayoutOf<VertexElement>(), 3.0f, -3.0f);
+		uploadVertices(gpuMem, planeVertices, planeSize.vertexCount);
 
-		sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		sizeIB = static_cast<uint32_t>(sizeof(uint16_t) * planeSize.indexCount);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeIB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIBPlane)));
 		CHK(mIBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		ProceduralMesh::WritePlaneIndices(static_cast<uint16_t*>(gpuMem));
 
 		mVBPlaneView.BufferLocation = mVBPlane->GetGPUVirtualAddress();
-		mVBPlaneView.StrideInBytes = sizeof(VertexElement);
+		mVBPlaneView.StrideInBytes = vertexStride;
 		mVBPlaneView.SizeInBytes = sizeVB;
 		mIBPlaneView.BufferLocation = mIBPlane->GetGPUVirtualAddress();
 		mIBPlaneView.Format = DXGI_FORMAT_R16_UINT;
@@ -592,6 +583,7 @@ float4 main(Input input) : SV_Target {
 		auto worldMat = DirectX::XMMatrixIdentity();
 		auto viewMat = DirectX::XMMatrixLookAtLH(mCameraPos, mCameraTarget, mCameraUp);
 		auto projMat = DirectX::XMMatrixPerspectiveFovLH(fov, aspect, nearClip, farClip);
+		const auto& sphereLod = mSphereLods.Select(DirectX::XMVectorGetX(DirectX::XMVector3Length(mCameraPos)) - 1.0f, MeshSimplifier::ProjectionScale(fov, (float)WINDOW_HEIGHT));
 
 		auto shadowDir = DirectX::XMVectorSet(0.0f, -1.0f, 0.0f, 0);
 		auto shadowPos = DirectX::XMVectorSet(0.0f, 5.0f, 0.0f, 0);
@@ -641,7 +633,7 @@ float4 main(Input input) : SV_Target {
 		auto scissor = CD3DX12_RECT(0, 0, kShadowMapSize, kShadowMapSize);
 		mCmdList->RSSetScissorRects(1, &scissor);
 		//mCmdList->OMSetRenderTargets(0, nullptr, TRUE, &dsvShadow);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		ProceduralMesh::DrawIndexed(mCmdList.Get(), sphereLod);
 
 		mCmdList->EndRenderPass();
 
@@ -681,7 +673,7 @@ float4 main(Input input) : SV_Target {
 		scissor = CD3DX12_RECT(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 		mCmdList->RSSetScissorRects(1, &scissor);
 		//mCmdList->OMSetRenderTargets(1, &rtvScene, TRUE, &dsvScene);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		ProceduralMesh::DrawIndexed(mCmdList.Get(), sphereLod);
 
 		mCmdList->IASetVertexBuffers(0, 1, &mVBPlaneView);
 		mCmdList->IASetIndexBuffer(&mIBPlaneView);
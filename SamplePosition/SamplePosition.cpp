@@ -5,6 +5,8 @@
 #include <dxgi1_4.h>
 #include <d3d12.h>
 #include "d3dx12.h"
+#include "ProceduralMesh.h"
+#include "MeshOptimizer.h"
 #include <d3dcompiler.h>
 #include <vector>
 
@@ -59,6 +61,7 @@ class D3D
 	uint32_t mIBSize;
 	const int SphereSlices = 8;
 	const int SphereStacks = 8;
+	ProceduralMesh::IndexedMesh mSphereMesh;
 	struct VertexElement
 	{
 		float position[3];
@@ -282,62 +285,28 @@ void main(uint2 id : SV_DispatchThreadID) {
 		CD3DX12_CPU_DESCRIPTOR_HANDLE offscreenRTVHandle(mOffscreenRTV->GetCPUDescriptorHandleForHeapStart());
 		mDevice->CreateRenderTargetView(mOffscreenTex.Get(), nullptr, offscreenRTVHandle);
 
-		// Generate sphere triangles
+		// Generate sphere triangles, reordered in place for the vertex cache, overdraw and vertex fetch
+		mSphereMesh = ProceduralMesh::PlanSphere(SphereSlices, SphereStacks);
 
-		struct IndexList
-		{
-			short a[6];
-		};
-		vector<VertexElement> vertices;
-		vector<IndexList> indices;
-		vertices.reserve((SphereStacks + 1) * (SphereSlices + 1));
-		for (int y = 0; y < SphereStacks + 1; ++y)
-		{
-			for (int x = 0; x < SphereSlices + 1; ++x)
-			{
-				// Generate a evenly tesselated plane
-				float v[3] = { (float)x / (float)(SphereSlices), (float)y / (float)(SphereStacks), 0.0f };
-				// Convert to spherical coordinate system
-				float theta = 2 * 3.14159265f * v[0];
-				float phi = 2 * 3.14159265f * v[1] / 2.0f;
-				VertexElement ve = { sinf(phi) * sinf(theta), cosf(phi), sinf(phi) * cosf(theta), 0, 0, 0 };
-				// Setup normal
-				float r = 1.0f;
-				ve.normal[0] = ve.position[0] / r;
-				ve.normal[1] = ve.position[1] / r;
-				ve.normal[2] = ve.position[2] / r;
-				vertices.push_back(ve);
-			}
-		}
-		indices.reserve(SphereStacks * SphereSlices);
-		for (int y = 0; y < SphereStacks; ++y)
-		{
-			for (int x = 0; x < SphereSlices; ++x)
-			{
-				short b = static_cast<short>(y * (SphereSlices + 1) + x);
-				short s = SphereSlices + 1;
-				IndexList il = { b, b + 1, b + s, b + s, b + 1, b + s + 1 };
-				indices.push_back(il);
-			}
-		}
-
-		mVBSize = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		mVBSize = static_cast<uint32_t>(sizeof(VertexElement) * mSphereMesh.vertexCount);
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(mVBSize, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVB)));
-		void* gpuMem;
-		CHK(mVB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), mVBSize);
+		void* vbMem;
+		CHK(mVB->Map(0, nullptr, &vbMem));
+		ProceduralMesh::WriteSphereVertices(vbMem, ProceduralMesh::LayoutOf<VertexElement>(), SphereSlices, SphereStacks);
 
-		mIBSize = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		mIBSize = static_cast<uint32_t>(mSphereMesh.IndexBufferSize());
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(mIBSize, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIB)));
-		CHK(mIB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), mIBSize);
+		void* ibMem;
+		CHK(mIB->Map(0, nullptr, &ibMem));
+		ProceduralMesh::WriteSphereIndices(ibMem, mSphereMesh);
+		MeshOptimizer::OptimizeInPlace(mSphereMesh, vbMem, ibMem, ProceduralMesh::LayoutOf<VertexElement>());
 
 		// Resolved resource
 
@@ -398,7 +367,7 @@ void main(uint2 id : SV_DispatchThreadID) {
 		mCmdList->IASetVertexBuffers(0, 1, vb);
 		D3D12_INDEX_BUFFER_VIEW ib = {};
 		ib.BufferLocation = mIB->GetGPUVirtualAddress();
-		ib.Format = DXGI_FORMAT_R16_UINT;
+		ib.Format = ProceduralMesh::IndexFormat(mSphereMesh);
 		ib.SizeInBytes = mIBSize;
 		mCmdList->IASetIndexBuffer(&ib);
 		auto viewport = CD3DX12_VIEWPORT(0.0f, 0.0f, WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2);
@@ -407,7 +376,7 @@ void main(uint2 id : SV_DispatchThreadID) {
 		mCmdList->RSSetScissorRects(1, &scissor);
 		auto descRTVCpuHandle = mOffscreenRTV->GetCPUDescriptorHandleForHeapStart();
 		mCmdList->OMSetRenderTargets(1, &descRTVCpuHandle, TRUE, nullptr);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		ProceduralMesh::DrawIndexed(mCmdList.Get(), mSphereMesh);
 
 		mCmdList1->SetSamplePositions(0, 0, nullptr);
 
@@ -5,6 +5,12 @@
 #include <dxgi1_4.h>
 #include <d3d12.h>
 #include "d3dx12.h"
+#include "ProceduralMesh.h"
+#include "MeshOptimizer.h"
+#include "PackedVertex.h"
+#include "MeshSimplifier.h"
+#include "ConstantRing.h"
+#include "DescriptorRing.h"
 #include <DirectXMath.h>
 #include <vector>
 #include <dxcapi.h>
@@ -49,12 +55,9 @@ class D3D
 	ComPtr<ID3D12Resource> mSwapChainTex[BUFFER_COUNT];
 	ComPtr<ID3D12DescriptorHeap> mSwapChainRTVs;
 
-	enum class Constants {
-		ShadowMatrix,
-		SceneMatrix,
-		Max,
-	};
-	ComPtr<ID3D12Resource> mConstantBuffer[BUFFER_COUNT];
+	// Constants of every draw, bound as root CBVs and retired by mFence
+	ConstantRing::Allocator mConstants;
+	const uint64_t kConstantRingSize = 1024 * 1024;
 
 	enum class RTVs {
 		Scene,
@@ -69,16 +72,15 @@ class D3D
 	};
 	ComPtr<ID3D12DescriptorHeap> mDSV;
 
+	// Views live in a non-visible heap, each draw copies its table into the ring
 	enum class ShaderViews {
-		// Shadow pass
-		ShadowCBVMatrix,
 		// Base pass
 		ShadowSRV,
-		SceneCBVMatrix,
-		ScenePSCBVMatrix,
 		Max,
 	};
-	ComPtr<ID3D12DescriptorHeap> mShaderView[BUFFER_COUNT];
+	ComPtr<ID3D12DescriptorHeap> mShaderView;
+	DescriptorRing::Allocator mViewRing;
+	const uint32_t kViewRingSize = 4096;
 
 	enum class Samplers {
 		Shadow,
@@ -108,6 +110,9 @@ class D3D
 	D3D12_INDEX_BUFFER_VIEW mIBView = {};
 	const int SphereSlices = 12;
 	const int SphereStacks = 12;
+	ProceduralMesh::IndexedMesh mSphereMesh;
+	MeshSimplifier::LodChain mSphereLods;
+	const bool UsePackedVertex = true; // 12-byte PackedVertex::Vertex in the vertex buffers
 
 	ComPtr<ID3D12Resource> mVBPlane;
 	ComPtr<ID3D12Resource> mIBPlane;
@@ -202,9 +207,8 @@ public:
 		// Shader
 
 		CD3DX12_DESCRIPTOR_RANGE descRange[10];
-		descRange[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0);
 		CD3DX12_ROOT_PARAMETER rootParam[10];
-		rootParam[0].InitAsDescriptorTable(1, descRange); // CBV_SRV_UAV
+		rootParam[0].InitAsConstantBufferView(0, 0, D3D12_SHADER_VISIBILITY_VERTEX); // b0
 		CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc;
 		rootSigDesc.Init(1, rootParam, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
@@ -212,14 +216,13 @@ public:
 		CHK(D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1, &rootSigBlob, &rootSigError));
 		CHK(mDevice->CreateRootSignature(0, rootSigBlob->GetBufferPointer(), rootSigBlob->GetBufferSize(), IID_PPV_ARGS(&mShadowRootSig)));
 
-		descRange[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0); // VS
-		descRange[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0); // PS
-		descRange[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 2, 0); // PS
-		descRange[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER, 1, 0); // PS
-		rootParam[0].InitAsDescriptorTable(1, descRange + 0, D3D12_SHADER_VISIBILITY_VERTEX); // CBV_SRV_UAV
-		rootParam[1].InitAsDescriptorTable(2, descRange + 1, D3D12_SHADER_VISIBILITY_PIXEL); // CBV_SRV_UAV
-		rootParam[2].InitAsDescriptorTable(1, descRange + 3, D3D12_SHADER_VISIBILITY_PIXEL); // Sampler
-		rootSigDesc.Init(3, rootParam, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+		descRange[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0); // PS
+		descRange[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SAMPLER, 1, 0); // PS
+		rootParam[0].InitAsConstantBufferView(0, 0, D3D12_SHADER_VISIBILITY_VERTEX); // b0
+		rootParam[1].InitAsDescriptorTable(1, descRange + 0, D3D12_SHADER_VISIBILITY_PIXEL); // CBV_SRV_UAV
+		rootParam[2].InitAsDescriptorTable(1, descRange + 1, D3D12_SHADER_VISIBILITY_PIXEL); // Sampler
+		rootParam[3].InitAsConstantBufferView(1, 0, D3D12_SHADER_VISIBILITY_PIXEL); // b1
+		rootSigDesc.Init(4, rootParam, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
 		CHK(D3D12SerializeRootSignature(&rootSigDesc, D3D_ROOT_SIGNATURE_VERSION_1, &rootSigBlob, &rootSigError));
 		CHK(mDevice->CreateRootSignature(0, rootSigBlob->GetBufferPointer(), rootSigBlob->GetBufferSize(), IID_PPV_ARGS(&mSceneRootSig)));
@@ -246,16 +249,22 @@ Output main(float3 position : Position, float3 normal : Normal) {
 	Output output;
 	output.position = mul(float4(position, 1), ViewProj);
 	output.world = position;
+#if PACKED_VERTEX
+	// Octahedral normal in xy
+	float3 n = float3(normal.xy, 1 - abs(normal.x) - abs(normal.y));
+	float t = saturate(-n.z);
+	n.x += n.x >= 0 ? -t : t;
+	n.y += n.y >= 0 ? -t : t;
+	output.normal = normalize(n);
+#else
 	output.normal = normalize(normal);
+#endif
 	return output;
 }
 )#";
 
 		static const char shaderCodeScenePS[] = R"#(
 Texture2D<float> ShadowMap;
-cbuffer CScene : register(b0) {
-	float4x4 ViewProj;
-};
 cbuffer CShadow : register(b1) {
 	float4x4 ShadowViewProj;
 };
@@ -297,6 +306,7 @@ float4 main(Input input) : SV_Target {
 		ComPtr<IDxcBlobEncoding> dxcError;
 		ComPtr<IDxcOperationResult> dxcRes;
 		const wchar_t* shaderArgs[] = { L"-Zi", L"-all_resources_bound", L"-Qembed_debug" };
+		const DxcDefine packedVertexDefines[] = { { L"PACKED_VERTEX", L"1" } };
 
 		dxc->Compile(dxcTxtShadowVS.Get(), nullptr, L"main", L"vs_6_0", shaderArgs, _countof(shaderArgs), nullptr, 0, nullptr, &dxcRes);
 		dxcRes->GetErrorBuffer(&dxcError);
@@ -305,7 +315,7 @@ float4 main(Input input) : SV_Target {
 			throw runtime_error("Shader compile error.");
 		}
 		dxcRes->GetResult(&dxcBlobShadowVS);
-		dxc->Compile(dxcTxtSceneVS.Get(), nullptr, L"main", L"vs_6_0", shaderArgs, _countof(shaderArgs), nullptr, 0, nullptr, &dxcRes);
+		dxc->Compile(dxcTxtSceneVS.Get(), nullptr, L"main", L"vs_6_0", shaderArgs, _countof(shaderArgs), packedVertexDefines, UsePackedVertex ? 1 : 0, nullptr, &dxcRes);
 		dxcRes->GetErrorBuffer(&dxcError);
 		if (dxcError->GetBufferSize()) {
 			OutputDebugStringA(reinterpret_cast<char*>(dxcError->GetBufferPointer()));
@@ -334,7 +344,7 @@ float4 main(Input input) : SV_Target {
 		psoDesc.pRootSignature = mShadowRootSig.Get();
 		psoDesc.VS = CD3DX12_SHADER_BYTECODE(dxcBlobShadowVS->GetBufferPointer(), dxcBlobShadowVS->GetBufferSize());
 		psoDesc.PS = CD3DX12_SHADER_BYTECODE(nullptr, 0);
-		psoDesc.InputLayout = { ieDesc, _countof(ieDesc) };
+		psoDesc.InputLayout = UsePackedVertex ? PackedVertex::InputLayout() : D3D12_INPUT_LAYOUT_DESC{ ieDesc, _countof(ieDesc) };
 		psoDesc.IBStripCutValue = D3D12_INDEX_BUFFER_STRIP_CUT_VALUE_DISABLED;
 		psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
 		psoDesc.RasterizerState = rsDesc;
@@ -349,7 +359,7 @@ float4 main(Input input) : SV_Target {
 		psoDesc.pRootSignature = mSceneRootSig.Get();
 		psoDesc.VS = CD3DX12_SHADER_BYTECODE(dxcBlobSceneVS->GetBufferPointer(), dxcBlobSceneVS->GetBufferSize());
 		psoDesc.PS = CD3DX12_SHADER_BYTECODE(dxcBlobScenePS->GetBufferPointer(), dxcBlobScenePS->GetBufferSize());
-		psoDesc.InputLayout = { ieDesc, _countof(ieDesc) };
+		psoDesc.InputLayout = UsePackedVertex ? PackedVertex::InputLayout() : D3D12_INPUT_LAYOUT_DESC{ ieDesc, _countof(ieDesc) };
 		psoDesc.IBStripCutValue = D3D12_INDEX_BUFFER_STRIP_CUT_VALUE_DISABLED;
 		psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
 		psoDesc.RasterizerState = rsDesc;
@@ -364,14 +374,7 @@ float4 main(Input input) : SV_Target {
 
 		// Resources
 
-		for (auto& cb : mConstantBuffer)
-		{
-			auto heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-			auto resDesc = CD3DX12_RESOURCE_DESC::Buffer(256 * (int)Constants::Max);
-			CHK(mDevice->CreateCommittedResource(
-				&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
-				D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&cb)));
-		}
+		mConstants.Create(mDevice.Get(), kConstantRingSize);
 
 		auto heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
 		auto resDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, WINDOW_WIDTH, WINDOW_HEIGHT, 1, 1);
@@ -413,39 +416,23 @@ float4 main(Input input) : SV_Target {
 		dsvHandle.Offset(mDSVStride);
 		mDevice->CreateDepthStencilView(mShadowZ.Get(), nullptr, dsvHandle);
 
-		for (int i = 0; i < BUFFER_COUNT; i++)
-		{
-			descHeapDesc = {};
-			descHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-			descHeapDesc.NumDescriptors = (int)ShaderViews::Max;
-			descHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-			CHK(mDevice->CreateDescriptorHeap(&descHeapDesc, IID_PPV_ARGS(&mShaderView[i])));
-
-			CD3DX12_CPU_DESCRIPTOR_HANDLE shaderViewHandle(mShaderView[i]->GetCPUDescriptorHandleForHeapStart());
-			auto addrCB = mConstantBuffer[i]->GetGPUVirtualAddress();
-
-			D3D12_SHADER_RESOURCE_VIEW_DESC srv = {};
-			srv.Format = DXGI_FORMAT_R32_FLOAT;
-			srv.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-			srv.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-			srv.Texture2D.MipLevels = 1;
-			srv.Texture2D.PlaneSlice = 0; // Depth
-			auto sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)ShaderViews::ShadowSRV, mResourceStride);
-			mDevice->CreateShaderResourceView(mShadowZ.Get(), &srv, sv);
-
-			D3D12_CONSTANT_BUFFER_VIEW_DESC cbv = {};
-			cbv.BufferLocation = addrCB + 256 * (int)Constants::ShadowMatrix;
-			cbv.SizeInBytes = 256;
-			sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)ShaderViews::ShadowCBVMatrix, mResourceStride);
-			mDevice->CreateConstantBufferView(&cbv, sv);
-			sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)ShaderViews::ScenePSCBVMatrix, mResourceStride);
-			mDevice->CreateConstantBufferView(&cbv, sv);
-
-			cbv.BufferLocation = addrCB + 256 * (int)Constants::SceneMatrix;
-			cbv.SizeInBytes = 256;
-			sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)ShaderViews::SceneCBVMatrix, mResourceStride);
-			mDevice->CreateConstantBufferView(&cbv, sv);
-		}
+		descHeapDesc = {};
+		descHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+		descHeapDesc.NumDescriptors = (int)ShaderViews::Max;
+		CHK(mDevice->CreateDescriptorHeap(&descHeapDesc, IID_PPV_ARGS(&mShaderView)));
+
+		CD3DX12_CPU_DESCRIPTOR_HANDLE shaderViewHandle(mShaderView->GetCPUDescriptorHandleForHeapStart());
+
+		D3D12_SHADER_RESOURCE_VIEW_DESC srv = {};
+		srv.Format = DXGI_FORMAT_R32_FLOAT;
+		srv.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		srv.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srv.Texture2D.MipLevels = 1;
+		srv.Texture2D.PlaneSlice = 0; // Depth
+		auto sv = CD3DX12_CPU_DESCRIPTOR_HANDLE(shaderViewHandle, (int)ShaderViews::ShadowSRV, mResourceStride);
+		mDevice->CreateShaderResourceView(mShadowZ.Get(), &srv, sv);
+
+		mViewRing.Create(mDevice.Get(), kViewRingSize);
 
 		descHeapDesc = {};
 		descHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER;
@@ -462,98 +449,72 @@ float4 main(Input input) : SV_Target {
 		CD3DX12_CPU_DESCRIPTOR_HANDLE samplerHandle(mSampler->GetCPUDescriptorHandleForHeapStart());
 		mDevice->CreateSampler(&samplerDesc, samplerHandle);
 
-		// Generate sphere triangles
-
-		struct IndexList
-		{
-			short a[6];
+		// Generate sphere triangles, reordered in place for the vertex cache, overdraw and vertex fetch
+		// The packed vertex buffer is encoded from these
+		mSphereMesh = ProceduralMesh::PlanSphere(SphereSlices, SphereStacks);
+		vector<VertexElement> sphereVertices(mSphereMesh.vertexCount);
+		vector<uint8_t> sphereIndices(mSphereMesh.IndexBufferSize());
+		ProceduralMesh::WriteSphereVertices(sphereVertices.data(), ProceduralMesh::LayoutOf<VertexElement>(), SphereSlices, SphereStacks);
+		ProceduralMesh::WriteSphereIndices(sphereIndices.data(), mSphereMesh);
+		MeshOptimizer::OptimizeInPlace(mSphereMesh, sphereVertices.data(), sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
+		mSphereLods = MeshSimplifier::BuildLodChain(mSphereMesh, sphereVertices.data(), sphereIndices.data(), ProceduralMesh::LayoutOf<VertexElement>());
+
+		const UINT vertexStride = UsePackedVertex ? sizeof(PackedVertex::Vertex) : sizeof(VertexElement);
+		auto uploadVertices = [&](void* dst, const void* src, uint32_t count) {
+			if (UsePackedVertex)
+				PackedVertex::Encode(static_cast<PackedVertex::Vertex*>(dst), src, ProceduralMesh::LayoutOf<VertexElement>(), count);
+			else
+				memcpy(dst, src, sizeof(VertexElement) * count);
 		};
-		vector<VertexElement> vertices;
-		vector<IndexList> indices;
-		vertices.reserve((SphereStacks + 1) * (SphereSlices + 1));
-		for (int y = 0; y < SphereStacks + 1; ++y)
-		{
-			for (int x = 0; x < SphereSlices + 1; ++x)
-			{
-				// Generate a evenly tesselated plane
-				float v[3] = { (float)x / (float)(SphereSlices), (float)y / (float)(SphereStacks), 0.0f };
-				// Convert to spherical coordinate system
-				float theta = 2 * 3.14159265f * v[0];
-				float phi = 2 * 3.14159265f * v[1] / 2.0f;
-				VertexElement ve = { sinf(phi) * sinf(theta), cosf(phi), sinf(phi) * cosf(theta), 0, 0, 0 };
-				// Setup normal
-				float r = 1.0f;
-				ve.normal[0] = ve.position[0] / r;
-				ve.normal[1] = ve.position[1] / r;
-				ve.normal[2] = ve.position[2] / r;
-				vertices.push_back(ve);
-			}
-		}
-		indices.reserve(SphereStacks * SphereSlices);
-		for (int y = 0; y < SphereStacks; ++y)
-		{
-			for (int x = 0; x < SphereSlices; ++x)
-			{
-				short b = static_cast<short>(y * (SphereSlices + 1) + x);
-				short s = SphereSlices + 1;
-				IndexList il = { b, b + s, b + 1, b + s, b + s + 1, b + 1 };
-				indices.push_back(il);
-			}
-		}
 
 		heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-		auto sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		auto sizeVB = static_cast<uint32_t>(vertexStride * mSphereMesh.vertexCount);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVB)));
 		void* gpuMem;
 		CHK(mVB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		uploadVertices(gpuMem, sphereVertices.data(), mSphereMesh.vertexCount);
 
-		auto sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		auto sizeIB = static_cast<uint32_t>(mSphereLods.indices.size());
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeIB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIB)));
 		CHK(mIB->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		memcpy(gpuMem, mSphereLods.indices.data(), mSphereLods.indices.size());
 
 		mVBView.BufferLocation = mVB->GetGPUVirtualAddress();
-		mVBView.StrideInBytes = sizeof(VertexElement);
+		mVBView.StrideInBytes = vertexStride;
 		mVBView.SizeInBytes = sizeVB;
 		mIBView.BufferLocation = mIB->GetGPUVirtualAddress();
-		mIBView.Format = DXGI_FORMAT_R16_UINT;
+		mIBView.Format = ProceduralMesh::IndexFormat(mSphereMesh);
 		mIBView.SizeInBytes = sizeIB;
 
 		// Generate plane triangles
-		vertices.clear();
-		indices.clear();
-		vertices.push_back({ -1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, +1,  0, +1,  0 });
-		vertices.push_back({ -1, -1, -1,  0, +1,  0 });
-		vertices.push_back({ +1, -1, -1,  0, +1,  0 });
-		for (auto& v : vertices) { v.position[0] *= 3; v.position[1] *= 3; v.position[2] *= 3; }
-		indices.push_back({ 0, 1, 2, 2, 1, 3 });
-
-		sizeVB = static_cast<uint32_t>(sizeof(vertices[0]) * vertices.size());
+		const auto planeSize = ProceduralMesh::PlaneSize();
+
+		sizeVB = static_cast<uint32_t>(vertexStride * planeSize.vertexCount);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeVB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mVBPlane)));
 		CHK(mVBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, vertices.data(), sizeVB);
+		VertexElement planeVertices[4];
+		ProceduralMesh::WritePlaneVertices(planeVertices, ProceduralMesh::LayoutOf<VertexElement>(), 3.0f, -3.0f);
+		uploadVertices(gpuMem, planeVertices, planeSize.vertexCount);
 
-		sizeIB = static_cast<uint32_t>(sizeof(indices[0]) * indices.size());
+		sizeIB = static_cast<uint32_t>(sizeof(uint16_t) * planeSize.indexCount);
 		resDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeIB, D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE);
 		CHK(mDevice->CreateCommittedResource(
 			&heapProp, D3D12_HEAP_FLAG_NONE, &resDesc,
 			D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&mIBPlane)));
 		CHK(mIBPlane->Map(0, nullptr, &gpuMem));
-		memcpy(gpuMem, indices.data(), sizeIB);
+		ProceduralMesh::WritePlaneIndices(static_cast<uint16_t*>(gpuMem));
 
 		mVBPlaneView.BufferLocation = mVBPlane->GetGPUVirtualAddress();
-		mVBPlaneView.StrideInBytes = sizeof(VertexElement);
+		mVBPlaneView.StrideInBytes = vertexStride;
 		mVBPlaneView.SizeInBytes = sizeVB;
 		mIBPlaneView.BufferLocation = mIBPlane->GetGPUVirtualAddress();
 		mIBPlaneView.Format = DXGI_FORMAT_R16_UINT;
@@ -567,20 +528,15 @@ float4 main(Input input) : SV_Target {
 
 		//-------------------------------
 
-		float* pCB;
-		CHK(mConstantBuffer[mFrameCount % BUFFER_COUNT]->Map(0, nullptr, reinterpret_cast<void**>(&pCB)));
-		float* pCBShadowMatrix = pCB + 256 * (int)Constants::ShadowMatrix / sizeof(*pCB);
-		float* pCBSceneMatrix = pCB + 256 * (int)Constants::SceneMatrix / sizeof(*pCB);
+		mConstants.Retire(mFence->GetCompletedValue());
+		mViewRing.Retire(mFence->GetCompletedValue());
 
 		auto rtvScene = CD3DX12_CPU_DESCRIPTOR_HANDLE(mRTV->GetCPUDescriptorHandleForHeapStart());
 
 		auto dsvScene = CD3DX12_CPU_DESCRIPTOR_HANDLE(mDSV->GetCPUDescriptorHandleForHeapStart());
 		auto dsvShadow = CD3DX12_CPU_DESCRIPTOR_HANDLE(dsvScene, mDSVStride);
 
-		CD3DX12_GPU_DESCRIPTOR_HANDLE svBase(mShaderView[mFrameCount % BUFFER_COUNT]->GetGPUDescriptorHandleForHeapStart());
-		auto svShadow = svBase;
-		auto svSceneVS = CD3DX12_GPU_DESCRIPTOR_HANDLE(svBase, (int)ShaderViews::SceneCBVMatrix, mResourceStride);
-		auto svScenePS = CD3DX12_GPU_DESCRIPTOR_HANDLE(svBase, (int)ShaderViews::ShadowSRV, mResourceStride);
+		auto svShadowSRV = CD3DX12_CPU_DESCRIPTOR_HANDLE(mShaderView->GetCPUDescriptorHandleForHeapStart(), (int)ShaderViews::ShadowSRV, mResourceStride);
 
 		auto samplerShadow = CD3DX12_GPU_DESCRIPTOR_HANDLE(mSampler->GetGPUDescriptorHandleForHeapStart());
 
@@ -594,6 +550,7 @@ float4 main(Input input) : SV_Target {
 		auto worldMat = DirectX::XMMatrixIdentity();
 		auto viewMat = DirectX::XMMatrixLookAtLH(mCameraPos, mCameraTarget, mCameraUp);
 		auto projMat = DirectX::XMMatrixPerspectiveFovLH(fov, aspect, nearClip, farClip);
+		const auto& sphereLod = mSphereLods.Select(DirectX::XMVectorGetX(DirectX::XMVector3Length(mCameraPos)) - 1.0f, MeshSimplifier::ProjectionScale(fov, (float)WINDOW_HEIGHT));
 
 		auto shadowDir = DirectX::XMVectorSet(0.0f, -1.0f, 0.0f, 0);
 		auto shadowPos = DirectX::XMVectorSet(0.0f, 5.0f, 0.0f, 0);
@@ -604,8 +561,8 @@ float4 main(Input input) : SV_Target {
 		auto shadowViewMat = DirectX::XMMatrixLookAtLH(shadowPos, DirectX::XMVectorAdd(shadowPos, shadowDir), shadowUp);
 		auto shadowProjMat = DirectX::XMMatrixOrthographicLH(shadowRange * 2, shadowRange * 2, 0, shadowDistance);
 
-		*reinterpret_cast<DirectX::XMMATRIX*>(pCBSceneMatrix) = DirectX::XMMatrixTranspose(worldMat * viewMat * projMat);
-		*reinterpret_cast<DirectX::XMMATRIX*>(pCBShadowMatrix) = DirectX::XMMatrixTranspose(shadowViewMat * shadowProjMat);
+		auto cbSceneMatrix = mConstants.Push(DirectX::XMMatrixTranspose(worldMat * viewMat * projMat));
+		auto cbShadowMatrix = mConstants.Push(DirectX::XMMatrixTranspose(shadowViewMat * shadowProjMat));
 
 		// Start recording commands
 
@@ -614,7 +571,7 @@ float4 main(Input input) : SV_Target {
 
 		// Draw shadow
 		
-		ID3D12DescriptorHeap* descHeap[] = { mShaderView[mFrameCount % BUFFER_COUNT].Get(), mSampler.Get() };
+		ID3D12DescriptorHeap* descHeap[] = { mViewRing.Heap(), mSampler.Get() };
 		mCmdList->SetDescriptorHeaps(_countof(descHeap), descHeap);
 
 		CD3DX12_RESOURCE_BARRIER transitions[10];
@@ -626,7 +583,7 @@ float4 main(Input input) : SV_Target {
 
 		mCmdList->SetGraphicsRootSignature(mShadowRootSig.Get());
 		mCmdList->SetPipelineState(mShadowPSO.Get());
-		mCmdList->SetGraphicsRootDescriptorTable(0, svShadow); // VS, CBV_SRV_UAV
+		mCmdList->SetGraphicsRootConstantBufferView(0, cbShadowMatrix); // VS, CBV
 		mCmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 		mCmdList->IASetVertexBuffers(0, 1, &mVBView);
 		mCmdList->IASetIndexBuffer(&mIBView);
@@ -635,7 +592,7 @@ float4 main(Input input) : SV_Target {
 		auto scissor = CD3DX12_RECT(0, 0, kShadowMapSize, kShadowMapSize);
 		mCmdList->RSSetScissorRects(1, &scissor);
 		mCmdList->OMSetRenderTargets(0, nullptr, TRUE, &dsvShadow);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		ProceduralMesh::DrawIndexed(mCmdList.Get(), sphereLod);
 
 		// Draw scene
 
@@ -650,9 +607,10 @@ float4 main(Input input) : SV_Target {
 
 		mCmdList->SetGraphicsRootSignature(mSceneRootSig.Get());
 		mCmdList->SetPipelineState(mScenePSO.Get());
-		mCmdList->SetGraphicsRootDescriptorTable(0, svSceneVS); // VS, CBV_SRV_UAV
-		mCmdList->SetGraphicsRootDescriptorTable(1, svScenePS); // PS, CBV_SRV_UAV
+		mCmdList->SetGraphicsRootConstantBufferView(0, cbSceneMatrix); // VS, CBV
+		mCmdList->SetGraphicsRootDescriptorTable(1, mViewRing.Push(&svShadowSRV, 1)); // PS, CBV_SRV_UAV
 		mCmdList->SetGraphicsRootDescriptorTable(2, samplerShadow); // PS, Sampler
+		mCmdList->SetGraphicsRootConstantBufferView(3, cbShadowMatrix); // PS, CBV
 		mCmdList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 		mCmdList->IASetVertexBuffers(0, 1, &mVBView);
 		mCmdList->IASetIndexBuffer(&mIBView);
@@ -661,7 +619,7 @@ float4 main(Input input) : SV_Target {
 		scissor = CD3DX12_RECT(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 		mCmdList->RSSetScissorRects(1, &scissor);
 		mCmdList->OMSetRenderTargets(1, &rtvScene, TRUE, &dsvScene);
-		mCmdList->DrawIndexedInstanced(6 * SphereStacks * SphereSlices, 1, 0, 0, 0);
+		ProceduralMesh::DrawIndexed(mCmdList.Get(), sphereLod);
 
 		mCmdList->IASetVertexBuffers(0, 1, &mVBPlaneView);
 		mCmdList->IASetIndexBuffer(&mIBPlaneView);
@@ -689,6 +647,8 @@ float4 main(Input input) : SV_Target {
 		// Execute recorded commands
 		mCmdQueue->ExecuteCommandLists(1, CommandListCast(mCmdList.GetAddressOf()));
 		CHK(mCmdQueue->Signal(mFence.Get(), mFrameCount));
+		mConstants.Close(mFrameCount);
+		mViewRing.Close(mFrameCount);
 	}
 
 	void Present()